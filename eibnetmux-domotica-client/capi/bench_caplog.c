@@ -0,0 +1,167 @@
+/*
+ * bench_caplog - append latency of the capture file writer
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+/*
+ * Appends the same synthetic telegram stream to capture files in a
+ * scratch directory, once with write() and once with io_uring, and
+ * reports the distribution of the time a single append takes.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <libgen.h>
+#include <getopt.h>
+#include <time.h>
+#include <arpa/inet.h>
+#include <sys/time.h>
+
+#include "caplog.h"
+
+
+static void Usage( char *progname )
+{
+    fprintf( stderr, "Usage: %s [options] directory\n"
+                     "where:\n"
+                     "  directory                            scratch directory for the capture files\n"
+                     "\n"
+                     "options:\n"
+                     "  -n telegrams                         telegrams per run                      default: 1000000\n"
+                     "  -r rate                              telegrams per second, 0 = unlimited    default: 0\n"
+                     "  -s mb                                segment size                           default: 64\n"
+                     "\n", basename( progname ));
+}
+
+
+static int compare_ns( const void *a, const void *b )
+{
+    uint32_t        x = *(const uint32_t *)a;
+    uint32_t        y = *(const uint32_t *)b;
+
+    return( (x > y) - (x < y) );
+}
+
+
+static uint64_t now_ns( void )
+{
+    struct timespec ts;
+
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return( ts.tv_sec * 1000000000ull + ts.tv_nsec );
+}
+
+
+int main( int argc, char **argv )
+{
+    CAPLOG          *log;
+    KNXTELEGRAM     telegram;
+    struct timespec due;
+    uint32_t        *latency;
+    uint64_t        start;
+    uint64_t        took;
+    uint64_t        total;
+    int             methods[] = { CAPLOG_WRITE, CAPLOG_URING };
+    int             count = 1000000;
+    int             rate = 0;
+    int             segment_mb = CAPLOG_DEFAULT_SEGMENT_MB;
+    int             dropped;
+    int             run;
+    int             idx;
+    int             c;
+
+    while( ( c = getopt( argc, argv, "n:r:s:" )) != -1 ) {
+        switch( c ) {
+            case 'n':
+                count = atoi( optarg );
+                break;
+            case 'r':
+                rate = atoi( optarg );
+                break;
+            case 's':
+                segment_mb = atoi( optarg );
+                break;
+            default:
+                Usage( argv[0] );
+                exit( -1 );
+        }
+    }
+    if( optind + 1 != argc || count < 1 || rate < 0 || segment_mb < 1 ) {
+        Usage( argv[0] );
+        exit( -1 );
+    }
+    latency = malloc( count * sizeof( uint32_t ));
+    if( latency == NULL ) {
+        fprintf( stderr, "Out of memory\n" );
+        exit( -5 );
+    }
+
+    memset( &telegram, 0, sizeof( telegram ));
+    telegram.frame.code = 0x29;
+    telegram.frame.ntwrk = EIB_DAF_GROUP | 0x60;
+    telegram.frame.saddr = htons( 0x1101 );
+    telegram.frame.length = 3;
+    telegram.frame.apci = A_WRITE_VALUE_REQ;
+    telegram.frame.data[0] = 0x0c;
+    telegram.frame.data[1] = 0x1a;
+
+    printf( "method      telegrams    p50 ns    p99 ns  p99.9 ns    max ns    dropped  telegrams/s\n" );
+    for( run = 0; run < sizeof( methods ) / sizeof( methods[0] ); run++ ) {
+        log = caplog_open( argv[optind], (uint64_t)segment_mb << 20, CAPLOG_DEFAULT_SEGMENT_MINUTES * 60, methods[run] );
+        if( log == NULL ) {
+            exit( 2 );
+        }
+        if( caplog_method( log ) != methods[run] ) {
+            caplog_close( log );
+            continue;
+        }
+        clock_gettime( CLOCK_MONOTONIC, &due );
+        dropped = 0;
+        total = now_ns();
+        for( idx = 0; idx < count; idx++ ) {
+            if( rate > 0 ) {
+                due.tv_nsec += 1000000000 / rate;
+                if( due.tv_nsec >= 1000000000 ) {
+                    due.tv_sec++;
+                    due.tv_nsec -= 1000000000;
+                }
+                clock_nanosleep( CLOCK_MONOTONIC, TIMER_ABSTIME, &due, NULL );
+            }
+            gettimeofday( &telegram.tv, NULL );
+            telegram.frame.daddr = htons( 0x0800 + idx % 2000 );
+            start = now_ns();
+            if( caplog_append( log, &telegram ) != 0 ) {
+                dropped++;
+            }
+            took = now_ns() - start;
+            latency[idx] = (took > UINT32_MAX) ? UINT32_MAX : took;
+        }
+        total = now_ns() - total;
+        caplog_close( log );
+
+        qsort( latency, count, sizeof( uint32_t ), compare_ns );
+        printf( "%-8s  %11d  %8u  %8u  %8u  %8u  %9d  %11.0f\n",
+                (methods[run] == CAPLOG_URING) ? "io_uring" : "write", count,
+                latency[count / 2], latency[(int)(count * 0.99)], latency[(int)(count * 0.999)],
+                latency[count - 1], dropped, count / (total / 1e9) );
+    }
+    free( latency );
+    return( 0 );
+}
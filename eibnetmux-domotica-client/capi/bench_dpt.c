@@ -0,0 +1,252 @@
+/*
+ * bench_dpt - throughput of the batch datapoint decoders
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+/*
+ * First checks every batch decoder against its single value function
+ * for all 65536 16 bit payloads, with random bits above them, and
+ * counts the DPT 9 values that differ from enmx_frame2value().
+ *
+ * Then decodes a column of random payloads repeatedly with
+ * enmx_frame2value() per telegram, with the single value function in a
+ * loop and with the batch decoder, and reports values per second.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <libgen.h>
+#include <getopt.h>
+#include <time.h>
+
+#include <eibnetmux/enmx_lib.h>
+
+#include "knxframe.h"
+#include "dptdecode.h"
+
+
+typedef struct {
+        const char      *name;
+        void            (*batch)( const uint32_t *, double *, size_t );
+        double          (*single)( uint32_t );
+        int             eis;                    // for enmx_frame2value, 0 = not compared
+        int             length;                 // frame length for eis
+} DPT_KERNEL;
+
+
+/*
+ * local function declarations
+ */
+static void     Usage( char *progname );
+static uint64_t now_ns( void );
+static double   frame2value( int eis, int length, uint32_t raw );
+static void     single_loop( DPT_KERNEL *k, const uint32_t *data, double *value, size_t n );
+static void     dpt9_float_check( const uint32_t *data, size_t n, int *mismatch );
+
+
+static double dpt9_single( uint32_t raw ) { return( dpt9_value( raw )); }
+static double dpt5_single( uint32_t raw ) { return( dpt5_value( raw )); }
+static double dpt6_single( uint32_t raw ) { return( dpt6_value( raw )); }
+static double dpt7_single( uint32_t raw ) { return( dpt7_value( raw )); }
+static double dpt8_single( uint32_t raw ) { return( dpt8_value( raw )); }
+
+static DPT_KERNEL kernels[] = {
+    { "dpt9",   dpt9_to_double, dpt9_single, 5, 3 },
+    { "dpt5",   dpt5_to_double, dpt5_single, 0, 0 },
+    { "dpt6",   dpt6_to_double, dpt6_single, 0, 0 },
+    { "dpt7",   dpt7_to_double, dpt7_single, 0, 0 },
+    { "dpt8",   dpt8_to_double, dpt8_single, 0, 0 },
+};
+
+
+static void Usage( char *progname )
+{
+    fprintf( stderr, "Usage: %s [options]\n"
+                     "\n"
+                     "options:\n"
+                     "  -n values                            values per column                      default: 1048576\n"
+                     "  -r rounds                            decodes of the column per kernel       default: 20\n"
+                     "\n", basename( progname ));
+}
+
+
+static uint64_t now_ns( void )
+{
+    struct timespec ts;
+
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return( ts.tv_sec * 1000000000ull + ts.tv_nsec );
+}
+
+
+/*
+ * value as the capture path decodes it today, one frame at a time
+ */
+static double frame2value( int eis, int length, uint32_t raw )
+{
+    CEMIFRAME       frame;
+    unsigned char   buf[20];
+
+    memset( &frame, 0, sizeof( frame ));
+    frame.length = length;
+    frame.apci = A_WRITE_VALUE_REQ;
+    frame.data[0] = raw >> 8;
+    frame.data[1] = raw;
+    memset( buf, 0, sizeof( buf ));
+    enmx_frame2value( eis, &frame, buf );
+    return( (eis == 5 || eis == 9) ? *(double *)buf : *(uint32_t *)buf );
+}
+
+
+static void single_loop( DPT_KERNEL *k, const uint32_t *data, double *value, size_t n )
+{
+    size_t          idx;
+
+    for( idx = 0; idx < n; idx++ ) {
+        value[idx] = k->single( data[idx] );
+    }
+}
+
+
+static void dpt9_float_check( const uint32_t *data, size_t n, int *mismatch )
+{
+    float           *f;
+    float           expect;
+    size_t          idx;
+
+    f = malloc( n * sizeof( float ));
+    if( f == NULL ) {
+        fprintf( stderr, "Out of memory\n" );
+        exit( -5 );
+    }
+    dpt9_to_float( data, f, n );
+    for( idx = 0; idx < n; idx++ ) {
+        expect = (float)dpt9_value( data[idx] );
+        if( memcmp( &expect, &f[idx], sizeof( float )) != 0 ) {
+            (*mismatch)++;
+        }
+    }
+    free( f );
+}
+
+
+int main( int argc, char **argv )
+{
+    DPT_KERNEL      *k;
+    uint32_t        *data;
+    double          *value;
+    double          expect;
+    uint64_t        took[3];
+    size_t          count = 1048576;
+    size_t          idx;
+    int             rounds = 20;
+    int             mismatch;
+    int             differ;
+    int             round;
+    int             kern;
+    int             c;
+
+    while( ( c = getopt( argc, argv, "n:r:" )) != -1 ) {
+        switch( c ) {
+            case 'n':
+                count = strtoul( optarg, NULL, 0 );
+                break;
+            case 'r':
+                rounds = atoi( optarg );
+                break;
+            default:
+                Usage( argv[0] );
+                exit( -1 );
+        }
+    }
+    if( optind != argc || count < 65536 || rounds < 1 ) {
+        Usage( argv[0] );
+        exit( -1 );
+    }
+    data = malloc( count * sizeof( uint32_t ));
+    value = malloc( count * sizeof( double ));
+    if( data == NULL || value == NULL ) {
+        fprintf( stderr, "Out of memory\n" );
+        exit( -5 );
+    }
+
+    // every payload once, then random ones
+    srandom( 1 );
+    for( idx = 0; idx < count; idx++ ) {
+        data[idx] = ((uint32_t)random() << 16) | ((idx < 65536) ? idx : random() & 0xffff);
+    }
+
+    printf( "kernel: %s\n\n", dpt_kernel());
+    printf( "dpt    mismatch  enmx differs\n" );
+    for( kern = 0; kern < sizeof( kernels ) / sizeof( kernels[0] ); kern++ ) {
+        k = &kernels[kern];
+        // short call for the tail, the rest unaligned
+        k->batch( data, value, 3 );
+        k->batch( data + 3, value + 3, 65533 );
+        mismatch = 0;
+        differ = 0;
+        for( idx = 0; idx < 65536; idx++ ) {
+            expect = k->single( data[idx] );
+            if( memcmp( &expect, &value[idx], sizeof( double )) != 0 ) {
+                mismatch++;
+            }
+            if( k->eis != 0 && frame2value( k->eis, k->length, data[idx] & 0xffff ) != expect ) {
+                differ++;
+            }
+        }
+        if( k->eis != 0 ) {
+            printf( "%-5s  %8d  %12d\n", k->name, mismatch, differ );
+        } else {
+            printf( "%-5s  %8d  %12s\n", k->name, mismatch, "-" );
+        }
+    }
+    mismatch = 0;
+    dpt9_float_check( data, 65536, &mismatch );
+    printf( "%-5s  %8d  %12s\n\n", "dpt9f", mismatch, "-" );
+
+    printf( "dpt      frame2value/s     single/s      batch/s\n" );
+    for( kern = 0; kern < sizeof( kernels ) / sizeof( kernels[0] ); kern++ ) {
+        k = &kernels[kern];
+        memset( took, 0, sizeof( took ));
+        for( round = 0; round < rounds; round++ ) {
+            if( k->eis != 0 ) {
+                took[0] -= now_ns();
+                for( idx = 0; idx < count; idx++ ) {
+                    value[idx] = frame2value( k->eis, k->length, data[idx] & 0xffff );
+                }
+                took[0] += now_ns();
+            }
+            took[1] -= now_ns();
+            single_loop( k, data, value, count );
+            took[1] += now_ns();
+            took[2] -= now_ns();
+            k->batch( data, value, count );
+            took[2] += now_ns();
+        }
+        if( k->eis != 0 ) {
+            printf( "%-4s  %16.0f", k->name, (double)count * rounds / (took[0] / 1e9) );
+        } else {
+            printf( "%-4s  %16s", k->name, "-" );
+        }
+        printf( "  %11.0f  %11.0f\n", (double)count * rounds / (took[1] / 1e9), (double)count * rounds / (took[2] / 1e9) );
+    }
+    free( value );
+    free( data );
+    return( 0 );
+}
@@ -0,0 +1,325 @@
+/*
+ * bench_monitor - enmx_monitor() against blocking and batched receive from eibbroker
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+/*
+ * Stands in for eibbroker on a scratch socket and streams the same
+ * synthetic telegrams to two subscribers in turn: one calling
+ * broker_next() for each telegram, and one polling a non-blocking
+ * connection and taking every read as zero-copy views. Reports telegrams
+ * per second and, for the batched client, telegrams per read().
+ *
+ * As a baseline, a third client takes telegrams from eibnetmux itself
+ * with one enmx_monitor() call each, the way eibtrace and eibbroker do.
+ * eibnetmux only passes on what the bus carries, so this client gets its
+ * own, smaller count; on a quiet bus it measures the wait, not the call.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <libgen.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <signal.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/time.h>
+#include <arpa/inet.h>
+
+#include <eibnetmux/enmx_lib.h>
+
+#include "broker.h"
+
+typedef struct {
+        int             listener;
+        int             telegrams;
+        int             addresses;
+} STANDIN;
+
+static volatile uint32_t bench_sum;         // keeps the frame reads from being optimised away
+
+
+/*
+ * local function declarations
+ */
+static void     Usage( char *progname );
+static void     *standin_thread( void *arg );
+static int      bench_enmx( char *target, int telegrams );
+static int      bench_next( BROKER_CLIENT *client, int telegrams );
+static int      bench_views( BROKER_CLIENT *client, int telegrams, uint64_t *reads );
+
+
+static void Usage( char *progname )
+{
+    fprintf( stderr, "Usage: %s [options]\n"
+                     "\n"
+                     "options:\n"
+                     "  -s socket                            stand-in broker socket                 default: /tmp/bench_monitor.sock\n"
+                     "  -n count                             telegrams per run                      default: 2000000\n"
+                     "  -a addresses                         distinct group addresses               default: 2000\n"
+                     "  -e server                            eibnetmux for the enmx_monitor() run   default: search\n"
+                     "  -m count                             telegrams from eibnetmux, 0 to skip    default: 10000\n"
+                     "\n", basename( progname ));
+}
+
+
+/*
+ * accept one subscriber per run and send it all telegrams
+ */
+static void *standin_thread( void *arg )
+{
+    STANDIN         *standin = arg;
+    KNXTELEGRAM     telegram;
+    unsigned char   request[8];
+    unsigned char   out[65536];
+    unsigned int    outlen;
+    int             fd;
+    int             idx;
+
+    memset( &telegram, 0, sizeof( telegram ));
+    telegram.frame.code = 0x29;
+    telegram.frame.ctrl = 0xbc;
+    telegram.frame.ntwrk = EIB_DAF_GROUP | 0x60;
+    telegram.frame.saddr = htons( 0x1101 );
+    telegram.frame.length = 3;
+    telegram.frame.apci = A_WRITE_VALUE_REQ;
+
+    while( (fd = accept( standin->listener, NULL, NULL )) >= 0 ) {
+        if( read( fd, request, sizeof( request )) != sizeof( request )) {
+            close( fd );
+            continue;
+        }
+        gettimeofday( &telegram.tv, NULL );
+        outlen = 0;
+        for( idx = 0; idx < standin->telegrams; idx++ ) {
+            telegram.frame.daddr = htons( 0x0800 + idx % standin->addresses );
+            telegram.frame.data[0] = (idx >> 8) & 0x07;
+            telegram.frame.data[1] = idx;
+            outlen += broker_encode( out + outlen, &telegram, 0 );
+            if( outlen > sizeof( out ) - BROKER_RECORD_MAX ) {
+                if( write( fd, out, outlen ) != outlen ) {
+                    break;
+                }
+                outlen = 0;
+            }
+        }
+        if( outlen > 0 && write( fd, out, outlen ) != outlen ) {
+            fprintf( stderr, "Stand-in broker write failed: %s\n", strerror( errno ));
+        }
+        close( fd );
+    }
+    return( NULL );
+}
+
+
+/*
+ * one enmx_monitor() per telegram, returns telegrams received or -1
+ */
+static int bench_enmx( char *target, int telegrams )
+{
+    ENMX_HANDLE     sock_con;
+    KNXTELEGRAM     telegram;
+    unsigned char   *buf;
+    uint16_t        buflen;
+    uint16_t        value_size;
+    int             count = 0;
+
+    sock_con = enmx_open( target, "bench_monitor" );
+    if( sock_con < 0 ) {
+        fprintf( stderr, "Connect to eibnetmux failed (%d): %s\n", sock_con, enmx_errormessage( sock_con ));
+        return( -1 );
+    }
+    buf = malloc( 10 );
+    buflen = 10;
+    while( count < telegrams ) {
+        buf = enmx_monitor( sock_con, 0xffff, buf, &buflen, &value_size );
+        if( buf == NULL ) {
+            if( enmx_geterror( sock_con ) == ENMX_E_TIMEOUT ) {
+                continue;
+            }
+            fprintf( stderr, "Error on read: %s\n", enmx_errormessage( sock_con ));
+            break;
+        }
+        memset( &telegram.frame, 0, sizeof( CEMIFRAME ));
+        memcpy( &telegram.frame, buf, (value_size < sizeof( CEMIFRAME )) ? value_size : sizeof( CEMIFRAME ));
+        bench_sum += telegram.frame.daddr + telegram.frame.data[1];
+        count++;
+    }
+    free( buf );
+    enmx_close( sock_con );
+    return( count );
+}
+
+
+/*
+ * one broker_next() per telegram, returns telegrams received
+ */
+static int bench_next( BROKER_CLIENT *client, int telegrams )
+{
+    KNXTELEGRAM     telegram;
+    int             count = 0;
+
+    while( count < telegrams && broker_next( client, &telegram, NULL ) == 0 ) {
+        bench_sum += telegram.frame.daddr + telegram.frame.data[1];
+        count++;
+    }
+    return( count );
+}
+
+
+/*
+ * poll, one read() and all complete records as views, returns telegrams received
+ */
+static int bench_views( BROKER_CLIENT *client, int telegrams, uint64_t *reads )
+{
+    static BROKER_VIEW  views[BROKER_VIEWS];
+    struct pollfd       pfd;
+    int                 count = 0;
+    int                 nviews;
+    int                 idx;
+
+    pfd.fd = broker_fd( client );
+    pfd.events = POLLIN;
+    while( count < telegrams ) {
+        if( poll( &pfd, 1, 1000 ) <= 0 ) {
+            break;
+        }
+        if( broker_fill( client ) < 0 ) {
+            break;
+        }
+        (*reads)++;
+        if( (nviews = broker_views( client, views, BROKER_VIEWS )) < 0 ) {
+            break;
+        }
+        for( idx = 0; idx < nviews; idx++ ) {
+            bench_sum += views[idx].frame->daddr + views[idx].frame->data[1];
+        }
+        count += nviews;
+    }
+    return( count );
+}
+
+
+int main( int argc, char **argv )
+{
+    STANDIN             standin;
+    pthread_t           thread;
+    struct sockaddr_un  addr;
+    BROKER_CLIENT       *client;
+    struct timeval      start;
+    struct timeval      end;
+    double              elapsed;
+    uint64_t            reads = 0;
+    char                *path = "/tmp/bench_monitor.sock";
+    char                *target = NULL;
+    int                 direct = 10000;
+    int                 received;
+    int                 batched;
+    int                 c;
+
+    standin.telegrams = 2000000;
+    standin.addresses = 2000;
+    while( ( c = getopt( argc, argv, "s:n:a:e:m:" )) != -1 ) {
+        switch( c ) {
+            case 's':
+                path = optarg;
+                break;
+            case 'n':
+                standin.telegrams = atoi( optarg );
+                break;
+            case 'a':
+                standin.addresses = atoi( optarg );
+                break;
+            case 'e':
+                target = optarg;
+                break;
+            case 'm':
+                direct = atoi( optarg );
+                break;
+            default:
+                Usage( argv[0] );
+                exit( -1 );
+        }
+    }
+    if( optind != argc || standin.telegrams < 1 || standin.addresses < 1 || standin.addresses > 32768 || direct < 0 ) {
+        Usage( argv[0] );
+        exit( -1 );
+    }
+    signal( SIGPIPE, SIG_IGN );
+
+    memset( &addr, 0, sizeof( addr ));
+    addr.sun_family = AF_UNIX;
+    strncpy( addr.sun_path, path, sizeof( addr.sun_path ) -1 );
+    unlink( path );
+    standin.listener = socket( AF_UNIX, SOCK_STREAM, 0 );
+    if( standin.listener < 0 ||
+        bind( standin.listener, (struct sockaddr *)&addr, sizeof( addr )) != 0 ||
+        listen( standin.listener, 1 ) != 0 ) {
+        fprintf( stderr, "Unable to listen on %s: %s\n", path, strerror( errno ));
+        exit( -2 );
+    }
+    if( pthread_create( &thread, NULL, standin_thread, &standin ) != 0 ) {
+        fprintf( stderr, "Unable to start stand-in broker\n" );
+        exit( -2 );
+    }
+
+    printf( "client          telegrams    seconds telegrams/s  per read\n" );
+    if( direct > 0 ) {
+        enmx_init();
+        gettimeofday( &start, NULL );
+        received = bench_enmx( target, direct );
+        gettimeofday( &end, NULL );
+        if( received < 0 ) {
+            exit( -2 );
+        }
+        elapsed = (end.tv_sec - start.tv_sec) + (end.tv_usec - start.tv_usec) / 1e6;
+        printf( "%-12s %12d %10.2f %11.0f\n", "enmx_monitor", received, elapsed, received / elapsed );
+    }
+    for( batched = 0; batched <= 1; batched++ ) {
+        if( (client = broker_connect( path, BROKER_F_PHYSICAL, NULL, 0 )) == NULL ) {
+            exit( -2 );
+        }
+        gettimeofday( &start, NULL );
+        if( batched == 0 ) {
+            received = bench_next( client, standin.telegrams );
+        } else {
+            if( broker_nonblock( client ) != 0 ) {
+                exit( -2 );
+            }
+            received = bench_views( client, standin.telegrams, &reads );
+        }
+        gettimeofday( &end, NULL );
+        broker_close( client );
+        elapsed = (end.tv_sec - start.tv_sec) + (end.tv_usec - start.tv_usec) / 1e6;
+        if( batched == 0 ) {
+            printf( "%-12s %12d %10.2f %11.0f\n", "broker_next", received, elapsed, received / elapsed );
+        } else {
+            printf( "%-12s %12d %10.2f %11.0f %9.1f\n", "views", received, elapsed, received / elapsed,
+                    (reads > 0) ? (double)received / reads : 0.0 );
+        }
+    }
+
+    close( standin.listener );
+    unlink( path );
+    return( 0 );
+}
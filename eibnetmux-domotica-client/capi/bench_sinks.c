@@ -0,0 +1,220 @@
+/*
+ * bench_sinks - throughput of the storage sinks
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+/*
+ * Submits the same synthetic telegram stream to each sink on its own,
+ * then to all of them at once, and reports rows per second until the
+ * sinks are closed. The text sink writes to /dev/null, the SQLite and
+ * capture file sinks to fresh files in the scratch directory. MySQL is
+ * included when a database is given; rows are appended to its
+ * knx_telegram table.
+ *
+ * Submitting waits for room in the queues, so nothing is dropped and
+ * the slowest sink sets the pace of the combined run.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <libgen.h>
+#include <getopt.h>
+#include <arpa/inet.h>
+#include <sys/time.h>
+
+#include <mysql.h>
+
+#include "sink.h"
+#include "sinkdb.h"
+
+enum { BENCH_TEXT, BENCH_CAPFILE, BENCH_SQLITE, BENCH_MYSQL, BENCH_SINKS };
+
+static const char *bench_names[BENCH_SINKS] = { "text", "capfile", "sqlite", "mysql" };
+
+
+/*
+ * local function declarations
+ */
+static void     Usage( char *progname );
+static SINK     *bench_open( int which, const char *dir, DBPARAMS *db, unsigned int batch );
+static double   bench_run( SINK **sinks, int count, int rows, int addresses );
+
+
+static void Usage( char *progname )
+{
+    fprintf( stderr, "Usage: %s [options] dir\n"
+                     "where:\n"
+                     "  dir                                  scratch directory for the SQLite and capture files\n"
+                     "\n"
+                     "options:\n"
+                     "  -m database                          also MySQL, rows are appended to knx_telegram\n"
+                     "  -h host                              MySQL server                           default: localhost\n"
+                     "  -u user                              MySQL user                             default: login name\n"
+                     "  -p password                          MySQL password                         default: none\n"
+                     "  -n rows                              telegrams per run                      default: 200000\n"
+                     "  -a addresses                         distinct group addresses               default: 2000\n"
+                     "  -b batch                             telegrams per append                   default: %d\n"
+                     "\n", basename( progname ), SINK_DEFAULT_BATCH );
+}
+
+
+static SINK *bench_open( int which, const char *dir, DBPARAMS *db, unsigned int batch )
+{
+    char            path[1024];
+    char            wal[1040];
+
+    switch( which ) {
+        case BENCH_TEXT:
+            return( sink_open( &sink_text_ops, sink_text_open( fopen( "/dev/null", "w" )),
+                               batch, SINK_DEFAULT_FLUSH_MS, SINK_DEFAULT_QUEUE ));
+        case BENCH_CAPFILE:
+            snprintf( path, sizeof( path ), "%s/bench_sinks.cap", dir );
+            return( sink_open( &sink_capfile_ops, sink_capfile_open( path ),
+                               batch, SINK_DEFAULT_FLUSH_MS, SINK_DEFAULT_QUEUE ));
+        case BENCH_SQLITE:
+            snprintf( path, sizeof( path ), "%s/bench_sinks.db", dir );
+            snprintf( wal, sizeof( wal ), "%s-wal", path );
+            unlink( path );
+            unlink( wal );
+            return( sink_open( &sink_sqlite_ops, sink_sqlite_open( path ),
+                               batch, SINK_DEFAULT_FLUSH_MS, SINK_DEFAULT_QUEUE ));
+        case BENCH_MYSQL:
+            return( sink_open( &sink_mysql_ops, writer_pool_open( db, WRITER_DEFAULT_WRITERS, batch,
+                                                                  WRITER_DEFAULT_FLUSH_MS, WRITER_DEFAULT_QUEUE ),
+                               batch, SINK_DEFAULT_FLUSH_MS, 0 ));
+    }
+    return( NULL );
+}
+
+
+/*
+ * submit rows telegrams to all sinks and close them, returns seconds
+ */
+static double bench_run( SINK **sinks, int count, int rows, int addresses )
+{
+    KNXTELEGRAM     telegram;
+    struct timeval  start;
+    struct timeval  end;
+    int             idx;
+    int             k;
+
+    memset( &telegram, 0, sizeof( telegram ));
+    telegram.frame.code = 0x29;
+    telegram.frame.ntwrk = EIB_DAF_GROUP | 0x60;
+    telegram.frame.saddr = htons( 0x1101 );
+    telegram.frame.length = 3;
+    telegram.frame.apci = A_WRITE_VALUE_REQ;
+    telegram.frame.data[0] = 0x0c;
+    telegram.frame.data[1] = 0x1a;
+
+    gettimeofday( &start, NULL );
+    for( idx = 0; idx < rows; idx++ ) {
+        gettimeofday( &telegram.tv, NULL );
+        telegram.frame.daddr = htons( 0x0800 + idx % addresses );
+        for( k = 0; k < count; k++ ) {
+            sink_submit( sinks[k], &telegram, 1 );
+        }
+    }
+    for( k = 0; k < count; k++ ) {
+        sink_stats( sinks[k], stderr );
+        sink_close( sinks[k] );
+    }
+    gettimeofday( &end, NULL );
+    return( (end.tv_sec - start.tv_sec) + (end.tv_usec - start.tv_usec) / 1e6 );
+}
+
+
+int main( int argc, char **argv )
+{
+    DBPARAMS        db;
+    SINK            *sinks[BENCH_SINKS];
+    double          elapsed;
+    char            *dir;
+    int             rows = 200000;
+    int             addresses = 2000;
+    int             batch = SINK_DEFAULT_BATCH;
+    int             nsinks;
+    int             count;
+    int             which;
+    int             c;
+
+    memset( &db, 0, sizeof( db ));
+    while( ( c = getopt( argc, argv, "m:h:u:p:n:a:b:" )) != -1 ) {
+        switch( c ) {
+            case 'm':
+                db.db = optarg;
+                break;
+            case 'h':
+                db.host = optarg;
+                break;
+            case 'u':
+                db.user = optarg;
+                break;
+            case 'p':
+                db.password = optarg;
+                break;
+            case 'n':
+                rows = atoi( optarg );
+                break;
+            case 'a':
+                addresses = atoi( optarg );
+                break;
+            case 'b':
+                batch = atoi( optarg );
+                break;
+            default:
+                Usage( argv[0] );
+                exit( -1 );
+        }
+    }
+    if( optind + 1 != argc || rows < 1 || addresses < 1 || batch < 1 || batch > SINK_DEFAULT_QUEUE ) {
+        Usage( argv[0] );
+        exit( -1 );
+    }
+    dir = argv[optind];
+    nsinks = (db.db != NULL) ? BENCH_SINKS : BENCH_MYSQL;
+
+    if( db.db != NULL && mysql_library_init( 0, NULL, NULL )) {
+        fprintf( stderr, "mysql_library_init() failed\n" );
+        exit( 1 );
+    }
+
+    printf( "sink            rows    seconds     rows/s\n" );
+    for( which = 0; which < nsinks; which++ ) {
+        if( (sinks[0] = bench_open( which, dir, &db, batch )) == NULL ) {
+            exit( 2 );
+        }
+        elapsed = bench_run( sinks, 1, rows, addresses );
+        printf( "%-8s %11d %10.2f %10.0f\n", bench_names[which], rows, elapsed, rows / elapsed );
+    }
+
+    for( count = 0; count < nsinks; count++ ) {
+        if( (sinks[count] = bench_open( count, dir, &db, batch )) == NULL ) {
+            exit( 2 );
+        }
+    }
+    elapsed = bench_run( sinks, count, rows, addresses );
+    printf( "%-8s %11d %10.2f %10.0f\n", "all", rows, elapsed, rows / elapsed );
+
+    if( db.db != NULL ) {
+        mysql_library_end();
+    }
+    return( 0 );
+}
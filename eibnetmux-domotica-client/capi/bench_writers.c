@@ -0,0 +1,159 @@
+/*
+ * bench_writers - scaling benchmark for the parallel MySQL writer
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+/*
+ * Inserts the same synthetic telegram stream with 1, 2, 4 and 8 writers
+ * into knx_telegram of a scratch database and reports rows per second.
+ * The table is emptied before every run.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <libgen.h>
+#include <getopt.h>
+#include <arpa/inet.h>
+#include <sys/time.h>
+
+#include <mysql.h>
+
+#include "writer.h"
+
+
+static void Usage( char *progname )
+{
+    fprintf( stderr, "Usage: %s [options] database\n"
+                     "where:\n"
+                     "  database                             scratch database, knx_telegram is emptied\n"
+                     "\n"
+                     "options:\n"
+                     "  -h host                              MySQL server                           default: localhost\n"
+                     "  -u user                              MySQL user                             default: login name\n"
+                     "  -p password                          MySQL password                         default: none\n"
+                     "  -n rows                              telegrams per run                      default: 200000\n"
+                     "  -a addresses                         distinct group addresses               default: 2000\n"
+                     "\n", basename( progname ));
+}
+
+
+/*
+ * empty the telegram table between runs
+ */
+static int truncate_table( DBPARAMS *db )
+{
+    MYSQL           *conn;
+    int             rc = 0;
+
+    conn = mysql_init( NULL );
+    if( conn == NULL ) {
+        return( -1 );
+    }
+    if( mysql_real_connect( conn, db->host, db->user, db->password, db->db,
+                            db->port, db->socket, db->flags ) == NULL ||
+        mysql_query( conn, "DELETE FROM knx_telegram" ) != 0 ) {
+        fprintf( stderr, "Could not empty knx_telegram: %s\n", mysql_error( conn ));
+        rc = -1;
+    }
+    mysql_close( conn );
+    return( rc );
+}
+
+
+int main( int argc, char **argv )
+{
+    DBPARAMS        db;
+    WRITER_POOL     *pool;
+    KNXTELEGRAM     telegram;
+    struct timeval  start;
+    struct timeval  end;
+    double          elapsed;
+    int             writers[] = { 1, 2, 4, 8 };
+    int             rows = 200000;
+    int             addresses = 2000;
+    int             run;
+    int             idx;
+    int             c;
+
+    memset( &db, 0, sizeof( db ));
+    while( ( c = getopt( argc, argv, "h:u:p:n:a:" )) != -1 ) {
+        switch( c ) {
+            case 'h':
+                db.host = optarg;
+                break;
+            case 'u':
+                db.user = optarg;
+                break;
+            case 'p':
+                db.password = optarg;
+                break;
+            case 'n':
+                rows = atoi( optarg );
+                break;
+            case 'a':
+                addresses = atoi( optarg );
+                break;
+            default:
+                Usage( argv[0] );
+                exit( -1 );
+        }
+    }
+    if( optind + 1 != argc || rows < 1 || addresses < 1 ) {
+        Usage( argv[0] );
+        exit( -1 );
+    }
+    db.db = argv[optind];
+
+    if( mysql_library_init( 0, NULL, NULL )) {
+        fprintf( stderr, "mysql_library_init() failed\n" );
+        exit( 1 );
+    }
+
+    memset( &telegram, 0, sizeof( telegram ));
+    telegram.frame.code = 0x29;
+    telegram.frame.ntwrk = EIB_DAF_GROUP | 0x60;
+    telegram.frame.saddr = htons( 0x1101 );
+    telegram.frame.length = 3;
+    telegram.frame.apci = A_WRITE_VALUE_REQ;
+    telegram.frame.data[0] = 0x0c;
+    telegram.frame.data[1] = 0x1a;
+
+    printf( "writers      rows    seconds     rows/s\n" );
+    for( run = 0; run < sizeof( writers ) / sizeof( writers[0] ); run++ ) {
+        pool = writer_pool_open( &db, writers[run], WRITER_DEFAULT_BATCH,
+                                 WRITER_DEFAULT_FLUSH_MS, WRITER_DEFAULT_QUEUE );
+        if( pool == NULL || truncate_table( &db ) != 0 ) {
+            exit( 2 );
+        }
+        gettimeofday( &start, NULL );
+        for( idx = 0; idx < rows; idx++ ) {
+            gettimeofday( &telegram.tv, NULL );
+            telegram.frame.daddr = htons( 0x0800 + idx % addresses );
+            writer_pool_submit( pool, &telegram );
+        }
+        writer_pool_close( pool );
+        gettimeofday( &end, NULL );
+        elapsed = (end.tv_sec - start.tv_sec) + (end.tv_usec - start.tv_usec) / 1e6;
+        printf( "%7d %9d %10.2f %10.0f\n", writers[run], rows, elapsed, rows / elapsed );
+    }
+
+    mysql_library_end();
+    return( 0 );
+}
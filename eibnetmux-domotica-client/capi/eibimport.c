@@ -0,0 +1,699 @@
+/*
+ * eibimport - convert eibtrace logs to capture files, archives or MySQL rows
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+/*
+ * Reads lines as printed by eibtrace:
+ *
+ *   2009/05/17 10:15:02:123 -   1.1.12  W    1/2/3 : 21.50 | 2150 (0c 33  - eis types: 5, 10)
+ *
+ * numbered when eibtrace ran with -c and possibly followed by the answer
+ * time of -l; other lines are skipped. The raw payload is taken from the
+ * hex dump, the decoded values are not used.
+ *
+ * Every log is mapped and cut into chunks at line ends; worker threads
+ * parse the chunks and the main thread writes their telegrams in file
+ * order. At most IMPORT_AHEAD chunks per thread are parsed ahead of the
+ * writer, so memory does not grow with the size of the log.
+ *
+ * Times are local times of this machine, set TZ for logs written in
+ * another time zone. The log does not show control field or hop count:
+ * frames are imported as standard frames, priority low, hop count 6.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <libgen.h>
+#include <getopt.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <pthread.h>
+#include <arpa/inet.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#if defined( __SSE2__ ) || defined( __AVX2__ )
+#include <immintrin.h>
+#endif
+
+#include <mysql.h>
+
+#include "writer.h"
+#include "capfile.h"
+#include "archive.h"
+
+#define IMPORT_CHUNK_SIZE   (4 << 20)           // bytes parsed by a thread at a time
+#define IMPORT_AHEAD        2                   // chunks per thread parsed ahead of the writer
+#define IMPORT_MAX_THREADS  64
+
+#define IMPORT_CAPFILE      0                   // output formats
+#define IMPORT_ARCHIVE      1
+#define IMPORT_MYSQL        2
+
+typedef struct {
+        char            key[13];                // "YYYY/MM/DD HH" of base
+        time_t          base;
+} IMPORT_CLOCK;
+
+typedef struct {
+        KNXTELEGRAM     *telegram;
+        uint32_t        count;
+        uint32_t        size;
+        uint64_t        lines;
+        uint64_t        skipped;                // not a telegram
+        uint64_t        bad;                    // a telegram, but not understood
+        int             done;
+} IMPORT_CHUNK;
+
+typedef struct {
+        const char      *map;
+        size_t          size;
+        uint64_t        chunks;
+        uint64_t        next;                   // chunk to parse next
+        uint64_t        written;                // chunks written
+        IMPORT_CHUNK    *chunk;                 // ring of slots chunks
+        unsigned int    slots;
+        pthread_mutex_t lock;
+        pthread_cond_t  parsed;
+        pthread_cond_t  free;
+} IMPORT_FILE;
+
+typedef struct {
+        int             format;
+        CAPFILE         *capture;
+        ARCHIVE         *archive;
+        WRITER_POOL     *pool;
+        uint64_t        bytes;
+        uint64_t        lines;
+        uint64_t        telegrams;
+        uint64_t        skipped;
+        uint64_t        bad;
+        int             errors;
+} IMPORT_OUTPUT;
+
+
+/*
+ * local function declarations
+ */
+static void         Usage( char *progname );
+static const char   *import_eol( const char *p, const char *end );
+static size_t       import_line_start( IMPORT_FILE *file, size_t pos );
+static int          import_number( const char **p, const char *end, unsigned int *value );
+static int          import_address( const char **p, const char *end, uint16_t *addr, int *group );
+static int          import_hex( char c );
+static int          import_line( const char *p, const char *end, IMPORT_CLOCK *clock, KNXTELEGRAM *telegram );
+static void         import_chunk( IMPORT_FILE *file, uint64_t idx, IMPORT_CLOCK *clock );
+static void         *import_worker( void *arg );
+static int          import_file( const char *path, int threads, IMPORT_OUTPUT *out );
+
+
+static void Usage( char *progname )
+{
+    fprintf( stderr, "Usage: %s [options] logfile ...\n"
+                     "where:\n"
+                     "  logfile                              eibtrace output, '-' is not supported\n"
+                     "\n"
+                     "options:\n"
+                     "  -f format                            cap, archive or mysql                  default: cap\n"
+                     "  -o file                              output file, '-' for stdout            default: -\n"
+                     "  -t threads                           parser threads                         default: cpu cores\n"
+                     "  -r rows                              telegrams per archive segment          default: %d\n"
+                     "  -h host                              MySQL server                           default: localhost\n"
+                     "  -u user                              MySQL user                             default: login name\n"
+                     "  -p password                          MySQL password                         default: none\n"
+                     "  -d database                          MySQL database, knx_telegram is filled\n"
+                     "  -w writers                           MySQL connections                      default: 4\n"
+                     "  -q                                   no statistics\n"
+                     "\n"
+                     "Times are read as local time, set TZ for logs of another time zone.\n"
+                     "\n", basename( progname ), ARCHIVE_DEFAULT_ROWS );
+}
+
+
+/*
+ * first newline at or after p, end if there is none
+ */
+static const char *import_eol( const char *p, const char *end )
+{
+#if defined( __AVX2__ )
+    const __m256i   nl32 = _mm256_set1_epi8( '\n' );
+    unsigned int    mask32;
+
+    while( end - p >= 32 ) {
+        mask32 = _mm256_movemask_epi8( _mm256_cmpeq_epi8( _mm256_loadu_si256( (const __m256i *)p ), nl32 ));
+        if( mask32 != 0 ) {
+            return( p + __builtin_ctz( mask32 ));
+        }
+        p += 32;
+    }
+#endif
+#if defined( __SSE2__ )
+    const __m128i   nl16 = _mm_set1_epi8( '\n' );
+    unsigned int    mask;
+
+    while( end - p >= 16 ) {
+        mask = _mm_movemask_epi8( _mm_cmpeq_epi8( _mm_loadu_si128( (const __m128i *)p ), nl16 ));
+        if( mask != 0 ) {
+            return( p + __builtin_ctz( mask ));
+        }
+        p += 16;
+    }
+#endif
+    while( p < end && *p != '\n' ) {
+        p++;
+    }
+    return( p );
+}
+
+
+/*
+ * start of the first line beginning at or after pos
+ */
+static size_t import_line_start( IMPORT_FILE *file, size_t pos )
+{
+    if( pos == 0 || pos >= file->size ) {
+        return( (pos == 0) ? 0 : file->size );
+    }
+    pos = import_eol( file->map + pos - 1, file->map + file->size ) - file->map;
+    return( (pos < file->size) ? pos + 1 : file->size );
+}
+
+
+static int import_number( const char **p, const char *end, unsigned int *value )
+{
+    const char      *s = *p;
+
+    *value = 0;
+    while( s < end && *s >= '0' && *s <= '9' && *value < 100000 ) {
+        *value = *value * 10 + (*s++ - '0');
+    }
+    if( s == *p ) {
+        return( -1 );
+    }
+    *p = s;
+    return( 0 );
+}
+
+
+/*
+ * physical (a.l.d) or group (m/s/g) address
+ */
+static int import_address( const char **p, const char *end, uint16_t *addr, int *group )
+{
+    unsigned int    a, b, c;
+    char            sep;
+
+    if( import_number( p, end, &a ) != 0 || *p >= end ) {
+        return( -1 );
+    }
+    sep = **p;
+    if( (sep != '.' && sep != '/') || (++*p, import_number( p, end, &b )) != 0 ||
+        *p >= end || **p != sep || (++*p, import_number( p, end, &c )) != 0 || c > 255 ) {
+        return( -1 );
+    }
+    *group = (sep == '/');
+    if( *group ) {
+        if( a > 31 || b > 7 ) {
+            return( -1 );
+        }
+        *addr = (a << 11) | (b << 8) | c;
+    } else {
+        if( a > 15 || b > 15 ) {
+            return( -1 );
+        }
+        *addr = (a << 12) | (b << 8) | c;
+    }
+    return( 0 );
+}
+
+
+static int import_hex( char c )
+{
+    if( c >= '0' && c <= '9' ) {
+        return( c - '0' );
+    } else if( c >= 'a' && c <= 'f' ) {
+        return( c - 'a' + 10 );
+    } else if( c >= 'A' && c <= 'F' ) {
+        return( c - 'A' + 10 );
+    }
+    return( -1 );
+}
+
+
+#define DIGITS2(s)  (((s)[0] - '0') * 10 + ((s)[1] - '0'))
+
+/*
+ * parse one line without its newline
+ *
+ * returns 1 for a telegram, 0 for other lines, -1 if a telegram line is not understood
+ */
+static int import_line( const char *p, const char *end, IMPORT_CLOCK *clock, KNXTELEGRAM *telegram )
+{
+    CEMIFRAME       *frame = &telegram->frame;
+    struct tm       tm;
+    const char      *s;
+    const char      *hex;
+    unsigned int    number;
+    uint16_t        saddr;
+    uint16_t        daddr;
+    int             group;
+    int             hi, lo;
+    int             bytes = 0;
+    uint8_t         raw[sizeof( frame->data ) + 1];
+    char            service;
+    int             idx;
+
+    if( end > p && end[-1] == '\r' ) {
+        end--;
+    }
+    while( p < end && *p == ' ' ) {
+        p++;
+    }
+    // counter printed with -c
+    s = p;
+    if( import_number( &s, end, &number ) == 0 && s + 1 < end && s[0] == ':' && s[1] == ' ' ) {
+        p = s + 2;
+    }
+    // "YYYY/MM/DD HH:MM:SS:mmm - "
+    if( end - p < 26 || p[4] != '/' || p[7] != '/' || p[10] != ' ' || p[13] != ':' || p[16] != ':' ||
+        p[19] != ':' || p[23] != ' ' || p[24] != '-' || p[25] != ' ' ) {
+        return( 0 );
+    }
+    for( idx = 0; idx < 23; idx++ ) {
+        if( (p[idx] < '0' || p[idx] > '9') && idx != 4 && idx != 7 && idx != 10 && idx != 13 &&
+            idx != 16 && idx != 19 ) {
+            return( 0 );
+        }
+    }
+    if( memcmp( clock->key, p, sizeof( clock->key )) != 0 ) {
+        memset( &tm, 0, sizeof( tm ));
+        tm.tm_year = DIGITS2( p ) * 100 + DIGITS2( p + 2 ) - 1900;
+        tm.tm_mon = DIGITS2( p + 5 ) - 1;
+        tm.tm_mday = DIGITS2( p + 8 );
+        tm.tm_hour = DIGITS2( p + 11 );
+        tm.tm_isdst = -1;
+        clock->base = mktime( &tm );
+        memcpy( clock->key, p, sizeof( clock->key ));
+    }
+    memset( telegram, 0, sizeof( KNXTELEGRAM ));
+    telegram->tv.tv_sec = clock->base + DIGITS2( p + 14 ) * 60 + DIGITS2( p + 17 );
+    telegram->tv.tv_usec = (DIGITS2( p + 20 ) * 10 + (p[22] - '0')) * 1000;
+    p += 26;
+
+    // "  1.1.12  W    1/2/3"
+    while( p < end && *p == ' ' ) {
+        p++;
+    }
+    if( import_address( &p, end, &saddr, &group ) != 0 || group || end - p < 4 || p[0] != ' ' ||
+        p[1] != ' ' || p[3] != ' ' ) {
+        return( -1 );
+    }
+    service = p[2];
+    p += 4;
+    while( p < end && *p == ' ' ) {
+        p++;
+    }
+    if( (service != 'W' && service != 'A' && service != 'R') ||
+        import_address( &p, end, &daddr, &group ) != 0 ) {
+        return( -1 );
+    }
+
+    frame->code = 0x29;
+    frame->ctrl = 0xbc;
+    frame->ntwrk = (group ? EIB_DAF_GROUP : 0) | 0x60;
+    frame->saddr = htons( saddr );
+    frame->daddr = htons( daddr );
+    frame->length = 1;
+    if( service == 'R' ) {
+        return( 1 );
+    }
+
+    // " : value | value (0c 33 - eis types: 5, 10)", values may contain '('
+    if( end - p < 3 || memcmp( p, " : ", 3 ) != 0 ) {
+        return( -1 );
+    }
+    for( hex = end - 1; hex > p && *hex != '('; hex-- );           // end may be one past the mapping
+    if( hex == p ) {
+        return( -1 );
+    }
+    // every byte is followed by a space
+    for( s = hex + 1; s + 2 < end && s[0] != ' '; s += 3 ) {
+        hi = import_hex( s[0] );
+        lo = import_hex( s[1] );
+        if( hi < 0 || lo < 0 || s[2] != ' ' || bytes == sizeof( raw )) {
+            return( -1 );
+        }
+        raw[bytes++] = (hi << 4) | lo;
+    }
+    if( bytes == 0 || end - s < 15 || memcmp( s, " - eis types: ", 14 ) != 0 ) {
+        return( -1 );
+    }
+    s += 14;
+    if( s[0] == '1' && s[1] == ',' ) {
+        // 6 bit value, the byte shown is apci
+        frame->apci = raw[0];
+        if( bytes != 1 || knx_service( frame ) != service ) {
+            return( -1 );
+        }
+    } else {
+        frame->apci = (service == 'W') ? A_WRITE_VALUE_REQ : A_RESPONSE_VALUE_REQ;
+        frame->length = bytes + 1;
+        memcpy( frame->data, raw, (bytes < sizeof( frame->data )) ? bytes : sizeof( frame->data ));
+    }
+    return( 1 );
+}
+
+
+/*
+ * parse chunk idx into its slot
+ */
+static void import_chunk( IMPORT_FILE *file, uint64_t idx, IMPORT_CLOCK *clock )
+{
+    IMPORT_CHUNK    *chunk = &file->chunk[idx % file->slots];
+    const char      *p = file->map + import_line_start( file, idx * IMPORT_CHUNK_SIZE );
+    const char      *end = file->map + import_line_start( file, (idx + 1) * IMPORT_CHUNK_SIZE );
+    const char      *eol;
+    int             rc;
+
+    chunk->count = chunk->lines = chunk->skipped = chunk->bad = 0;
+    while( p < end ) {
+        eol = import_eol( p, end );
+        if( chunk->count == chunk->size ) {
+            chunk->size = (chunk->size == 0) ? 65536 : chunk->size * 2;
+            chunk->telegram = realloc( chunk->telegram, chunk->size * sizeof( KNXTELEGRAM ));
+            if( chunk->telegram == NULL ) {
+                fprintf( stderr, "Out of memory: %s\n", strerror( errno ));
+                exit( -9 );
+            }
+        }
+        rc = import_line( p, eol, clock, &chunk->telegram[chunk->count] );
+        if( rc > 0 ) {
+            chunk->count++;
+        } else if( rc == 0 ) {
+            chunk->skipped++;
+        } else {
+            chunk->bad++;
+        }
+        chunk->lines++;
+        p = eol + 1;
+    }
+}
+
+
+static void *import_worker( void *arg )
+{
+    IMPORT_FILE     *file = arg;
+    IMPORT_CLOCK    clock;
+    uint64_t        idx;
+
+    memset( &clock, 0, sizeof( clock ));
+    for( ;; ) {
+        pthread_mutex_lock( &file->lock );
+        while( file->next < file->chunks && file->next >= file->written + file->slots ) {
+            pthread_cond_wait( &file->free, &file->lock );
+        }
+        if( file->next == file->chunks ) {
+            pthread_mutex_unlock( &file->lock );
+            break;
+        }
+        idx = file->next++;
+        pthread_mutex_unlock( &file->lock );
+
+        import_chunk( file, idx, &clock );
+
+        pthread_mutex_lock( &file->lock );
+        file->chunk[idx % file->slots].done = 1;
+        pthread_cond_broadcast( &file->parsed );
+        pthread_mutex_unlock( &file->lock );
+    }
+    return( NULL );
+}
+
+
+/*
+ * import one log, returns -1 if it cannot be read
+ */
+static int import_file( const char *path, int threads, IMPORT_OUTPUT *out )
+{
+    IMPORT_FILE     file;
+    IMPORT_CHUNK    *chunk;
+    pthread_t       worker[IMPORT_MAX_THREADS];
+    struct stat     st;
+    uint64_t        idx;
+    uint32_t        n;
+    int             fd;
+    int             rc;
+    int             err;
+
+    fd = open( path, O_RDONLY );
+    if( fd < 0 || fstat( fd, &st ) != 0 ) {
+        fprintf( stderr, "Unable to open %s: %s\n", path, strerror( errno ));
+        if( fd >= 0 ) {
+            close( fd );
+        }
+        return( -1 );
+    }
+    if( st.st_size == 0 ) {
+        close( fd );
+        return( 0 );
+    }
+    memset( &file, 0, sizeof( file ));
+    file.size = st.st_size;
+    file.map = mmap( NULL, file.size, PROT_READ, MAP_PRIVATE, fd, 0 );
+    close( fd );
+    if( file.map == MAP_FAILED ) {
+        fprintf( stderr, "Unable to map %s: %s\n", path, strerror( errno ));
+        return( -1 );
+    }
+    madvise( (void *)file.map, file.size, MADV_SEQUENTIAL | MADV_WILLNEED );
+
+    file.chunks = (file.size + IMPORT_CHUNK_SIZE - 1) / IMPORT_CHUNK_SIZE;
+    if( threads > file.chunks ) {
+        threads = file.chunks;
+    }
+    file.slots = threads * IMPORT_AHEAD;
+    file.chunk = calloc( file.slots, sizeof( IMPORT_CHUNK ));
+    if( file.chunk == NULL ) {
+        fprintf( stderr, "Out of memory: %s\n", strerror( errno ));
+        exit( -9 );
+    }
+    pthread_mutex_init( &file.lock, NULL );
+    pthread_cond_init( &file.parsed, NULL );
+    pthread_cond_init( &file.free, NULL );
+    for( n = 0; n < threads; n++ ) {
+        if( (err = pthread_create( &worker[n], NULL, import_worker, &file )) != 0 ) {
+            fprintf( stderr, "Unable to start parser thread: %s\n", strerror( err ));
+            exit( -5 );
+        }
+    }
+
+    for( idx = 0; idx < file.chunks; idx++ ) {
+        chunk = &file.chunk[idx % file.slots];
+        pthread_mutex_lock( &file.lock );
+        while( !chunk->done ) {
+            pthread_cond_wait( &file.parsed, &file.lock );
+        }
+        pthread_mutex_unlock( &file.lock );
+
+        for( n = 0; n < chunk->count && out->errors == 0; n++ ) {
+            switch( out->format ) {
+                case IMPORT_CAPFILE:
+                    rc = capfile_write( out->capture, &chunk->telegram[n] );
+                    break;
+                case IMPORT_ARCHIVE:
+                    rc = archive_append( out->archive, &chunk->telegram[n] );
+                    break;
+                default:
+                    rc = (writer_pool_submit( out->pool, &chunk->telegram[n] ) < 0) ? -1 : 0;
+                    break;
+            }
+            if( rc != 0 ) {
+                fprintf( stderr, "Unable to write output: %s\n", strerror( errno ));
+                out->errors++;
+            }
+        }
+        out->telegrams += chunk->count;
+        out->lines += chunk->lines;
+        out->skipped += chunk->skipped;
+        out->bad += chunk->bad;
+
+        pthread_mutex_lock( &file.lock );
+        chunk->done = 0;
+        file.written++;
+        pthread_cond_broadcast( &file.free );
+        pthread_mutex_unlock( &file.lock );
+    }
+
+    for( n = 0; n < threads; n++ ) {
+        pthread_join( worker[n], NULL );
+    }
+    for( n = 0; n < file.slots; n++ ) {
+        free( file.chunk[n].telegram );
+    }
+    free( file.chunk );
+    pthread_mutex_destroy( &file.lock );
+    pthread_cond_destroy( &file.parsed );
+    pthread_cond_destroy( &file.free );
+    munmap( (void *)file.map, file.size );
+    out->bytes += file.size;
+    return( 0 );
+}
+
+
+int main( int argc, char **argv )
+{
+    IMPORT_OUTPUT   out;
+    DBPARAMS        db;
+    struct timeval  start;
+    struct timeval  end;
+    double          elapsed;
+    char            *output = "-";
+    uint32_t        rows = ARCHIVE_DEFAULT_ROWS;
+    int             threads;
+    int             writers = 4;
+    int             quiet = 0;
+    int             failed = 0;
+    int             c;
+
+    memset( &out, 0, sizeof( out ));
+    memset( &db, 0, sizeof( db ));
+    threads = sysconf( _SC_NPROCESSORS_ONLN );
+    while( ( c = getopt( argc, argv, "f:o:t:r:h:u:p:d:w:q" )) != -1 ) {
+        switch( c ) {
+            case 'f':
+                if( strcmp( optarg, "cap" ) == 0 ) {
+                    out.format = IMPORT_CAPFILE;
+                } else if( strcmp( optarg, "archive" ) == 0 ) {
+                    out.format = IMPORT_ARCHIVE;
+                } else if( strcmp( optarg, "mysql" ) == 0 ) {
+                    out.format = IMPORT_MYSQL;
+                } else {
+                    Usage( argv[0] );
+                    exit( -1 );
+                }
+                break;
+            case 'o':
+                output = optarg;
+                break;
+            case 't':
+                threads = atoi( optarg );
+                break;
+            case 'r':
+                rows = atoi( optarg );
+                break;
+            case 'h':
+                db.host = optarg;
+                break;
+            case 'u':
+                db.user = optarg;
+                break;
+            case 'p':
+                db.password = optarg;
+                break;
+            case 'd':
+                db.db = optarg;
+                break;
+            case 'w':
+                writers = atoi( optarg );
+                break;
+            case 'q':
+                quiet = 1;
+                break;
+            default:
+                Usage( argv[0] );
+                exit( -1 );
+        }
+    }
+    if( optind == argc || threads < 1 || writers < 1 || writers > WRITER_MAX_WRITERS ||
+        (out.format == IMPORT_MYSQL && db.db == NULL) ) {
+        Usage( argv[0] );
+        exit( -1 );
+    }
+    if( threads > IMPORT_MAX_THREADS ) {
+        threads = IMPORT_MAX_THREADS;
+    }
+
+    switch( out.format ) {
+        case IMPORT_CAPFILE:
+            out.capture = capfile_create( output );
+            if( out.capture == NULL ) {
+                exit( -2 );
+            }
+            break;
+        case IMPORT_ARCHIVE:
+            out.archive = archive_create( output, rows, telegram_value );
+            if( out.archive == NULL ) {
+                exit( -2 );
+            }
+            break;
+        default:
+            if( mysql_library_init( 0, NULL, NULL )) {
+                fprintf( stderr, "mysql_library_init() failed\n" );
+                exit( -2 );
+            }
+            out.pool = writer_pool_open( &db, writers, WRITER_DEFAULT_BATCH * 4,
+                                         WRITER_DEFAULT_FLUSH_MS, WRITER_DEFAULT_QUEUE * 4 );
+            if( out.pool == NULL ) {
+                exit( -2 );
+            }
+            break;
+    }
+
+    gettimeofday( &start, NULL );
+    for( ; optind < argc && out.errors == 0; optind++ ) {
+        if( import_file( argv[optind], threads, &out ) != 0 ) {
+            failed++;
+        }
+    }
+    switch( out.format ) {
+        case IMPORT_CAPFILE:
+            if( capfile_close( out.capture ) != 0 ) {
+                fprintf( stderr, "Unable to write %s: %s\n", output, strerror( errno ));
+                out.errors++;
+            }
+            break;
+        case IMPORT_ARCHIVE:
+            if( archive_close( out.archive ) != 0 ) {
+                fprintf( stderr, "Unable to write %s: %s\n", output, strerror( errno ));
+                out.errors++;
+            }
+            break;
+        default:
+            if( !quiet ) {
+                writer_pool_stats( out.pool, stderr );
+            }
+            writer_pool_close( out.pool );
+            mysql_library_end();
+            break;
+    }
+    gettimeofday( &end, NULL );
+    elapsed = (end.tv_sec - start.tv_sec) + (end.tv_usec - start.tv_usec) / 1e6;
+
+    if( !quiet ) {
+        fprintf( stderr, "%llu telegrams from %llu lines, %llu other lines, %llu not understood\n",
+                 (unsigned long long)out.telegrams, (unsigned long long)out.lines,
+                 (unsigned long long)out.skipped, (unsigned long long)out.bad );
+        fprintf( stderr, "%.1f MB in %.2f s, %.1f MB/s with %d threads\n", out.bytes / 1e6, elapsed,
+                 (elapsed > 0) ? out.bytes / 1e6 / elapsed : 0.0, threads );
+    }
+    return( (out.errors > 0) ? -4 : (failed > 0) ? -2 : 0 );
+}
@@ -0,0 +1,622 @@
+/*
+ * eibredecode - decode the values of an archive again with corrected EIS types
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+/*
+ * The map file has a group address or range and an EIS type per line,
+ * 0 for addresses without a value:
+ *
+ *   1/2/3        5     # temperature
+ *   1/3/0-1/3/9  1
+ *
+ * Rows sent to a mapped address get value and eis decoded again from
+ * their payload, in place in the archive; only rows whose result differs
+ * are written. Segments whose statistics show none of the addresses are
+ * skipped.
+ *
+ * Segments are dealt out to the threads in ranges; a thread that runs
+ * out takes half of what is left of the fullest other range. Done
+ * segments are recorded in a checkpoint file every few seconds, after
+ * the archive was synced, and on SIGINT or SIGTERM; started again with
+ * the same map the job goes on where it stopped. The checkpoint is
+ * removed when all segments are done.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <libgen.h>
+#include <getopt.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <math.h>
+#include <time.h>
+#include <pthread.h>
+#include <arpa/inet.h>
+#include <sys/time.h>
+
+#include <mysql.h>
+
+#include "writer.h"
+#include "archive.h"
+
+#define REDECODE_MAX_THREADS    64
+#define REDECODE_CHECKPOINT_SEC 5
+#define REDECODE_MAGIC          0x4b4e5844      // "KNXD"
+#define REDECODE_UNMAPPED       0xff
+#define REDECODE_MAX_EIS        15
+
+/*
+ * checkpoint file, followed by a bit per segment
+ */
+typedef struct {
+        uint32_t        magic;
+        uint32_t        segments;
+        uint64_t        size;                   // of the archive
+        uint32_t        map_hash;
+        uint32_t        done;                   // segments
+} REDECODE_CHECKPOINT;
+
+/*
+ * segments todo[next] up to todo[end] of a thread
+ */
+typedef struct {
+        pthread_mutex_t lock;
+        uint32_t        next;
+        uint32_t        end;
+        pthread_t       thread;
+        struct redecode *job;
+        uint64_t        segments;
+        uint64_t        skipped;
+        uint64_t        rows;
+        uint64_t        changed;
+        uint64_t        stolen;
+} REDECODE_QUEUE;
+
+typedef struct redecode {
+        ARCHIVE         *ar;
+        uint8_t         eis[65536];             // REDECODE_UNMAPPED if not in the map
+        uint16_t        *groups;                // mapped addresses
+        uint32_t        ngroups;
+        uint32_t        *todo;
+        REDECODE_QUEUE  queue[REDECODE_MAX_THREADS];
+        int             threads;
+        uint8_t         *done;                  // per segment
+        uint32_t        finished;
+        pthread_mutex_t lock;
+        pthread_cond_t  progress;
+} REDECODE;
+
+static volatile sig_atomic_t stop_redecode = 0;
+
+
+/*
+ * local function declarations
+ */
+static void         Usage( char *progname );
+static void         redecode_shutdown( int arg );
+static int          redecode_load( REDECODE *job, const char *file );
+static uint32_t     redecode_hash( REDECODE *job );
+static uint32_t     redecode_resume( REDECODE *job, const char *path, uint32_t hash );
+static int          redecode_checkpoint( REDECODE *job, const char *path, uint32_t hash );
+static int          redecode_take( REDECODE *job, REDECODE_QUEUE *own, uint32_t *segment );
+static void         redecode_segment( REDECODE *job, REDECODE_QUEUE *own, uint32_t segment );
+static void         *redecode_worker( void *arg );
+
+
+static void Usage( char *progname )
+{
+    fprintf( stderr, "Usage: %s [options] mapfile archive\n"
+                     "where:\n"
+                     "  mapfile                              group address or range and EIS type per line\n"
+                     "  archive                              archive written by eibimport, changed in place\n"
+                     "\n"
+                     "options:\n"
+                     "  -t threads                           decoder threads                        default: cpu cores\n"
+                     "  -c file                              checkpoint file                        default: archive.redecode\n"
+                     "  -q                                   no progress and statistics\n"
+                     "\n", basename( progname ));
+}
+
+
+static void redecode_shutdown( int arg )
+{
+    stop_redecode = 1;
+}
+
+
+/*
+ * read address to EIS type map
+ */
+static int redecode_load( REDECODE *job, const char *file )
+{
+    FILE            *fp;
+    char            line[128];
+    char            range[64];
+    char            *sep;
+    unsigned int    eis;
+    uint16_t        first;
+    uint16_t        last;
+    uint32_t        addr;
+    int             lineno = 0;
+    int             fields;
+
+    fp = fopen( file, "r" );
+    if( fp == NULL ) {
+        fprintf( stderr, "Unable to open map file %s: %s\n", file, strerror( errno ));
+        return( -1 );
+    }
+    memset( job->eis, REDECODE_UNMAPPED, sizeof( job->eis ));
+    while( fgets( line, sizeof( line ), fp ) != NULL ) {
+        lineno++;
+        if( (sep = strchr( line, '#' )) != NULL ) {
+            *sep = '\0';
+        }
+        fields = sscanf( line, "%63s %u", range, &eis );
+        if( fields <= 0 ) {
+            continue;
+        }
+        if( (sep = strchr( range, '-' )) != NULL ) {
+            *sep++ = '\0';
+        }
+        if( fields != 2 || eis > REDECODE_MAX_EIS ||
+            knx_parse_group( range, &first ) != 0 ||
+            knx_parse_group( (sep != NULL) ? sep : range, &last ) != 0 || last < first ) {
+            fprintf( stderr, "Map file line %d: expected group address or range and EIS type\n", lineno );
+            fclose( fp );
+            return( -1 );
+        }
+        for( addr = first; addr <= last; addr++ ) {
+            job->eis[addr] = eis;
+        }
+    }
+    fclose( fp );
+
+    job->groups = malloc( 65536 * sizeof( uint16_t ));
+    if( job->groups == NULL ) {
+        fprintf( stderr, "Out of memory\n" );
+        exit( -5 );
+    }
+    for( addr = 0; addr < 65536; addr++ ) {
+        if( job->eis[addr] != REDECODE_UNMAPPED ) {
+            job->groups[job->ngroups++] = addr;
+        }
+    }
+    return( 0 );
+}
+
+
+/*
+ * FNV-1a of the map, a checkpoint is only used with the same map
+ */
+static uint32_t redecode_hash( REDECODE *job )
+{
+    uint32_t        hash = 2166136261u;
+    uint32_t        addr;
+
+    for( addr = 0; addr < 65536; addr++ ) {
+        hash = (hash ^ job->eis[addr]) * 16777619u;
+    }
+    return( hash );
+}
+
+
+/*
+ * mark segments done by an earlier run, returns their number
+ */
+static uint32_t redecode_resume( REDECODE *job, const char *path, uint32_t hash )
+{
+    REDECODE_CHECKPOINT cp;
+    FILE            *fp;
+    uint8_t         *bits;
+    uint32_t        segment;
+    uint32_t        bytes = (job->ar->segments + 7) / 8;
+    uint32_t        resumed = 0;
+
+    fp = fopen( path, "r" );
+    if( fp == NULL ) {
+        return( 0 );
+    }
+    bits = malloc( bytes + 1 );
+    if( bits == NULL ) {
+        fprintf( stderr, "Out of memory\n" );
+        exit( -5 );
+    }
+    if( fread( &cp, sizeof( cp ), 1, fp ) != 1 || cp.magic != REDECODE_MAGIC ||
+        cp.segments != job->ar->segments || cp.size != job->ar->size || fread( bits, 1, bytes, fp ) != bytes ) {
+        fprintf( stderr, "Checkpoint %s is not for this archive, starting over\n", path );
+    } else if( cp.map_hash != hash ) {
+        fprintf( stderr, "Checkpoint %s is for another map, starting over\n", path );
+    } else {
+        for( segment = 0; segment < job->ar->segments; segment++ ) {
+            if( bits[segment >> 3] & (1 << (segment & 7)) ) {
+                job->done[segment] = 1;
+                resumed++;
+            }
+        }
+    }
+    fclose( fp );
+    free( bits );
+    return( resumed );
+}
+
+
+/*
+ * sync the archive and record the segments done so far
+ */
+static int redecode_checkpoint( REDECODE *job, const char *path, uint32_t hash )
+{
+    REDECODE_CHECKPOINT cp;
+    FILE            *fp;
+    uint8_t         *bits;
+    uint32_t        segment;
+    uint32_t        bytes = (job->ar->segments + 7) / 8;
+    char            tmp[1024];
+    int             rc = 0;
+
+    bits = calloc( 1, bytes + 1 );
+    if( bits == NULL ) {
+        fprintf( stderr, "Out of memory\n" );
+        exit( -5 );
+    }
+    memset( &cp, 0, sizeof( cp ));
+    cp.magic = REDECODE_MAGIC;
+    cp.segments = job->ar->segments;
+    cp.size = job->ar->size;
+    cp.map_hash = hash;
+    pthread_mutex_lock( &job->lock );
+    for( segment = 0; segment < job->ar->segments; segment++ ) {
+        if( job->done[segment] ) {
+            bits[segment >> 3] |= 1 << (segment & 7);
+            cp.done++;
+        }
+    }
+    pthread_mutex_unlock( &job->lock );
+
+    // what the checkpoint claims must be on disk before it
+    if( archive_sync( job->ar ) != 0 ) {
+        fprintf( stderr, "Unable to sync archive: %s\n", strerror( errno ));
+        free( bits );
+        return( -1 );
+    }
+    snprintf( tmp, sizeof( tmp ), "%s.tmp", path );
+    fp = fopen( tmp, "w" );
+    if( fp == NULL || fwrite( &cp, sizeof( cp ), 1, fp ) != 1 || fwrite( bits, 1, bytes, fp ) != bytes ||
+        fflush( fp ) != 0 || fsync( fileno( fp )) != 0 ) {
+        rc = -1;
+    }
+    if( fp != NULL && fclose( fp ) != 0 ) {
+        rc = -1;
+    }
+    if( rc == 0 && rename( tmp, path ) != 0 ) {
+        rc = -1;
+    }
+    if( rc != 0 ) {
+        fprintf( stderr, "Unable to write checkpoint %s: %s\n", path, strerror( errno ));
+        unlink( tmp );
+    }
+    free( bits );
+    return( rc );
+}
+
+
+/*
+ * next segment of the own range, or stolen from the fullest other one
+ *
+ * returns -1 when there is nothing left
+ */
+static int redecode_take( REDECODE *job, REDECODE_QUEUE *own, uint32_t *segment )
+{
+    REDECODE_QUEUE  *victim;
+    uint32_t        left;
+    uint32_t        most;
+    uint32_t        half;
+    uint32_t        from;
+    int             idx;
+
+    for( ;; ) {
+        if( stop_redecode ) {
+            return( -1 );
+        }
+        pthread_mutex_lock( &own->lock );
+        if( own->next < own->end ) {
+            *segment = job->todo[own->next++];
+            pthread_mutex_unlock( &own->lock );
+            return( 0 );
+        }
+        pthread_mutex_unlock( &own->lock );
+
+        // unlocked look for a victim, checked again under its lock
+        victim = NULL;
+        most = 0;
+        for( idx = 0; idx < job->threads; idx++ ) {
+            left = job->queue[idx].end - job->queue[idx].next;
+            if( &job->queue[idx] != own && job->queue[idx].end > job->queue[idx].next && left > most ) {
+                most = left;
+                victim = &job->queue[idx];
+            }
+        }
+        if( victim == NULL ) {
+            return( -1 );
+        }
+        pthread_mutex_lock( &victim->lock );
+        if( victim->next >= victim->end ) {
+            pthread_mutex_unlock( &victim->lock );
+            continue;
+        }
+        half = (victim->end - victim->next + 1) / 2;
+        victim->end -= half;
+        from = victim->end;
+        pthread_mutex_unlock( &victim->lock );
+
+        pthread_mutex_lock( &own->lock );
+        own->next = from;
+        own->end = from + half;
+        own->stolen += half;
+        pthread_mutex_unlock( &own->lock );
+    }
+}
+
+
+/*
+ * decode the mapped rows of a segment again
+ */
+static void redecode_segment( REDECODE *job, REDECODE_QUEUE *own, uint32_t segment )
+{
+    ARCHIVE_COLUMNS cols;
+    KNXTELEGRAM     telegram;
+    uint32_t        blob_pos = 0;
+    uint32_t        row;
+    uint32_t        idx;
+    uint8_t         eis;
+    double          value;
+
+    archive_columns( job->ar, segment, &cols );
+    for( idx = 0; idx < job->ngroups; idx++ ) {
+        if( archive_may_contain( cols.segment, job->groups[idx] )) {
+            break;
+        }
+    }
+    if( idx == job->ngroups ) {
+        own->skipped++;
+        return;
+    }
+
+    for( row = 0; row < cols.segment->rows; row++ ) {
+        eis = job->eis[cols.daddr[row]];
+        if( !(cols.ntwrk[row] & EIB_DAF_GROUP) || eis == REDECODE_UNMAPPED ) {
+            if( cols.length[row] - 1 > ARCHIVE_DATA_BYTES ) {
+                blob_pos += cols.length[row] - 1 - ARCHIVE_DATA_BYTES;
+            }
+            continue;
+        }
+        archive_telegram( &cols, row, &blob_pos, &telegram );
+        own->rows++;
+        if( eis == 0 || telegram_value_eis( &telegram.frame, eis, &value ) != 0 ) {
+            eis = 0;
+            value = NAN;
+        }
+        // compare bits, NaN included
+        if( cols.eis[row] != eis || memcmp( &cols.value[row], &value, sizeof( double )) != 0 ) {
+            cols.value[row] = value;
+            cols.eis[row] = eis;
+            own->changed++;
+        }
+    }
+    own->segments++;
+}
+
+
+static void *redecode_worker( void *arg )
+{
+    REDECODE_QUEUE  *own = arg;
+    REDECODE        *job = own->job;
+    uint32_t        segment;
+
+    while( redecode_take( job, own, &segment ) == 0 ) {
+        redecode_segment( job, own, segment );
+        pthread_mutex_lock( &job->lock );
+        job->done[segment] = 1;
+        job->finished++;
+        pthread_cond_signal( &job->progress );
+        pthread_mutex_unlock( &job->lock );
+    }
+    return( NULL );
+}
+
+
+int main( int argc, char **argv )
+{
+    REDECODE        *job;
+    REDECODE_QUEUE  *q;
+    struct sigaction sa;
+    struct timeval  start;
+    struct timeval  end;
+    struct timespec deadline;
+    double          elapsed;
+    char            *checkpoint = NULL;
+    char            *archive;
+    uint32_t        hash;
+    uint32_t        pending = 0;
+    uint32_t        segment;
+    uint64_t        segments = 0;
+    uint64_t        skipped = 0;
+    uint64_t        rows = 0;
+    uint64_t        changed = 0;
+    uint64_t        stolen = 0;
+    int             threads;
+    int             quiet = 0;
+    uint32_t        resumed;
+    int             all_done;
+    int             rc = 0;
+    int             idx;
+    int             c;
+    int             err;
+
+    threads = sysconf( _SC_NPROCESSORS_ONLN );
+    while( ( c = getopt( argc, argv, "t:c:q" )) != -1 ) {
+        switch( c ) {
+            case 't':
+                threads = atoi( optarg );
+                break;
+            case 'c':
+                checkpoint = optarg;
+                break;
+            case 'q':
+                quiet = 1;
+                break;
+            default:
+                Usage( argv[0] );
+                exit( -1 );
+        }
+    }
+    if( optind + 2 != argc || threads < 1 ) {
+        Usage( argv[0] );
+        exit( -1 );
+    }
+    if( threads > REDECODE_MAX_THREADS ) {
+        threads = REDECODE_MAX_THREADS;
+    }
+    archive = argv[optind + 1];
+    if( checkpoint == NULL ) {
+        checkpoint = malloc( strlen( archive ) + 10 );
+        if( checkpoint == NULL ) {
+            fprintf( stderr, "Out of memory\n" );
+            exit( -5 );
+        }
+        sprintf( checkpoint, "%s.redecode", archive );
+    }
+
+    job = calloc( 1, sizeof( REDECODE ));
+    if( job == NULL ) {
+        fprintf( stderr, "Out of memory\n" );
+        exit( -5 );
+    }
+    if( redecode_load( job, argv[optind] ) != 0 ) {
+        exit( 2 );
+    }
+    job->ar = archive_update( archive );
+    if( job->ar == NULL ) {
+        exit( 2 );
+    }
+    if( job->ar->version < 2 ) {
+        fprintf( stderr, "Archive %s has no value columns, import it again with eibimport\n", archive );
+        exit( 2 );
+    }
+    job->done = calloc( job->ar->segments + 1, 1 );
+    job->todo = malloc( (job->ar->segments + 1) * sizeof( uint32_t ));
+    if( job->done == NULL || job->todo == NULL ) {
+        fprintf( stderr, "Out of memory\n" );
+        exit( -5 );
+    }
+    hash = redecode_hash( job );
+    resumed = redecode_resume( job, checkpoint, hash );
+    if( resumed > 0 && !quiet ) {
+        fprintf( stderr, "Resuming, %u of %u segments done before\n", resumed, job->ar->segments );
+    }
+    for( segment = 0; segment < job->ar->segments; segment++ ) {
+        if( !job->done[segment] ) {
+            job->todo[pending++] = segment;
+        }
+    }
+
+    // shut down after the next checkpoint
+    memset( &sa, 0, sizeof( sa ));
+    sa.sa_handler = redecode_shutdown;
+    sigemptyset( &sa.sa_mask );
+    sigaction( SIGINT, &sa, NULL );
+    sigaction( SIGTERM, &sa, NULL );
+
+    gettimeofday( &start, NULL );
+    pthread_mutex_init( &job->lock, NULL );
+    pthread_cond_init( &job->progress, NULL );
+    job->threads = threads;
+    for( idx = 0; idx < threads; idx++ ) {
+        q = &job->queue[idx];
+        pthread_mutex_init( &q->lock, NULL );
+        q->job = job;
+        q->next = (uint64_t)pending * idx / threads;
+        q->end = (uint64_t)pending * (idx + 1) / threads;
+    }
+    for( idx = 0; idx < threads; idx++ ) {
+        if( (err = pthread_create( &job->queue[idx].thread, NULL, redecode_worker, &job->queue[idx] )) != 0 ) {
+            fprintf( stderr, "Unable to start decoder thread: %s\n", strerror( err ));
+            exit( -5 );
+        }
+    }
+
+    do {
+        clock_gettime( CLOCK_REALTIME, &deadline );
+        deadline.tv_sec += REDECODE_CHECKPOINT_SEC;
+        pthread_mutex_lock( &job->lock );
+        while( job->finished < pending && !stop_redecode &&
+               pthread_cond_timedwait( &job->progress, &job->lock, &deadline ) == 0 ) {
+            ;
+        }
+        all_done = (job->finished == pending);
+        if( !quiet ) {
+            fprintf( stderr, "%u of %u segments\n", resumed + job->finished, job->ar->segments );
+        }
+        pthread_mutex_unlock( &job->lock );
+        if( !all_done && !stop_redecode && redecode_checkpoint( job, checkpoint, hash ) != 0 ) {
+            stop_redecode = 1;
+            rc = 2;
+        }
+    } while( !all_done && !stop_redecode );
+
+    for( idx = 0; idx < threads; idx++ ) {
+        q = &job->queue[idx];
+        pthread_join( q->thread, NULL );
+        segments += q->segments;
+        skipped += q->skipped;
+        rows += q->rows;
+        changed += q->changed;
+        stolen += q->stolen;
+    }
+    if( job->finished == pending ) {
+        if( archive_sync( job->ar ) != 0 ) {
+            fprintf( stderr, "Unable to sync archive: %s\n", strerror( errno ));
+            rc = 2;
+        } else {
+            unlink( checkpoint );
+        }
+    } else if( rc == 0 ) {
+        if( redecode_checkpoint( job, checkpoint, hash ) != 0 ) {
+            rc = 2;
+        } else {
+            fprintf( stderr, "Stopped, run again with the same map to continue\n" );
+            rc = 1;
+        }
+    }
+    gettimeofday( &end, NULL );
+    elapsed = (end.tv_sec - start.tv_sec) + (end.tv_usec - start.tv_usec) / 1e6;
+
+    if( !quiet ) {
+        fprintf( stderr, "%llu segments decoded, %llu skipped by their statistics, %llu taken over by idle threads\n",
+                 (unsigned long long)segments, (unsigned long long)skipped, (unsigned long long)stolen );
+        fprintf( stderr, "%llu rows of mapped addresses, %llu changed\n",
+                 (unsigned long long)rows, (unsigned long long)changed );
+        fprintf( stderr, "%.2f s, %.0f rows/s with %d threads\n", elapsed,
+                 (elapsed > 0) ? rows / elapsed : 0.0, threads );
+    }
+    archive_close( job->ar );
+    return( rc );
+}
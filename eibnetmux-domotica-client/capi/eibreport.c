@@ -0,0 +1,334 @@
+/*
+ * eibreport - min/max/mean/count per group address and day from an archive
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+/*
+ * Prints a line per period and group address with values:
+ *
+ *   2026-03-01  1/2/3      1440  18.2  21.7  20.054
+ *
+ * Periods are hours, days, weeks starting on monday or months of local
+ * time. From and until default to the first and last telegram of the
+ * archive.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <libgen.h>
+#include <getopt.h>
+#include <time.h>
+#include <sys/time.h>
+
+#include "archive.h"
+#include "aggregate.h"
+
+#define REPORT_MAX_BUCKETS      1048576
+
+enum { PERIOD_HOUR, PERIOD_DAY, PERIOD_WEEK, PERIOD_MONTH };
+
+
+/*
+ * local function declarations
+ */
+static void     Usage( char *progname );
+static int      report_time( const char *text, int64_t *sec );
+static int      report_groups( const char *text, uint8_t *groups );
+static int64_t  *report_bounds( int64_t from, int64_t until, int period, uint32_t *buckets );
+static void     report_label( int64_t sec, int period, char *label, size_t size );
+
+
+static void Usage( char *progname )
+{
+    fprintf( stderr, "Usage: %s [options] archive\n"
+                     "where:\n"
+                     "  archive                              archive written by eibimport\n"
+                     "\n"
+                     "options:\n"
+                     "  -g group[-group]                     only these group addresses, may be repeated\n"
+                     "  -f yyyy-mm-dd[ hh:mm[:ss]]           from, local time                       default: first telegram\n"
+                     "  -u yyyy-mm-dd[ hh:mm[:ss]]           until, local time, excluded            default: after last telegram\n"
+                     "  -p hour|day|week|month               period                                 default: day\n"
+                     "  -d dpt                               decode payload as DPT 5, 6, 7, 8 or 9  default: archived values\n"
+                     "  -t threads                           aggregation threads                    default: cpu cores\n"
+                     "  -q                                   no statistics\n"
+                     "\n", basename( progname ));
+}
+
+
+static int report_time( const char *text, int64_t *sec )
+{
+    struct tm       tm;
+    int             fields;
+
+    memset( &tm, 0, sizeof( tm ));
+    fields = sscanf( text, "%d-%d-%d %d:%d:%d", &tm.tm_year, &tm.tm_mon, &tm.tm_mday,
+                     &tm.tm_hour, &tm.tm_min, &tm.tm_sec );
+    if( fields != 3 && fields != 5 && fields != 6 ) {
+        return( -1 );
+    }
+    tm.tm_year -= 1900;
+    tm.tm_mon--;
+    tm.tm_isdst = -1;
+    *sec = mktime( &tm );
+    return( 0 );
+}
+
+
+static int report_groups( const char *text, uint8_t *groups )
+{
+    char            range[64];
+    char            *sep;
+    uint16_t        first;
+    uint16_t        last;
+    uint32_t        addr;
+
+    snprintf( range, sizeof( range ), "%s", text );
+    if( (sep = strchr( range, '-' )) != NULL ) {
+        *sep++ = '\0';
+    }
+    if( knx_parse_group( range, &first ) != 0 ||
+        knx_parse_group( (sep != NULL) ? sep : range, &last ) != 0 || last < first ) {
+        return( -1 );
+    }
+    for( addr = first; addr <= last; addr++ ) {
+        groups[addr] = 1;
+    }
+    return( 0 );
+}
+
+
+/*
+ * period starts from the one holding from up to until, local time
+ */
+static int64_t *report_bounds( int64_t from, int64_t until, int period, uint32_t *buckets )
+{
+    struct tm       tm;
+    time_t          t = from;
+    int64_t         *bounds;
+    uint32_t        n = 0;
+
+    bounds = malloc( (REPORT_MAX_BUCKETS + 1) * sizeof( int64_t ));
+    if( bounds == NULL ) {
+        fprintf( stderr, "Out of memory\n" );
+        exit( -5 );
+    }
+    localtime_r( &t, &tm );
+    tm.tm_min = tm.tm_sec = 0;
+    if( period != PERIOD_HOUR ) {
+        tm.tm_hour = 0;
+    }
+    if( period == PERIOD_WEEK ) {
+        tm.tm_mday -= (tm.tm_wday + 6) % 7;
+    } else if( period == PERIOD_MONTH ) {
+        tm.tm_mday = 1;
+    }
+    for( ;; ) {
+        tm.tm_isdst = -1;
+        t = mktime( &tm );
+        if( n > 0 && t <= bounds[n - 1] ) {
+            tm.tm_hour++;                       // hour repeated when clocks go back
+            continue;
+        }
+        bounds[n] = t;
+        if( t >= until ) {
+            break;
+        }
+        if( ++n == REPORT_MAX_BUCKETS ) {
+            fprintf( stderr, "More than %d periods\n", REPORT_MAX_BUCKETS );
+            exit( -1 );
+        }
+        switch( period ) {
+            case PERIOD_HOUR:   tm.tm_hour++;       break;
+            case PERIOD_DAY:    tm.tm_mday++;       break;
+            case PERIOD_WEEK:   tm.tm_mday += 7;    break;
+            case PERIOD_MONTH:  tm.tm_mon++;        break;
+        }
+    }
+    *buckets = n;
+    return( bounds );
+}
+
+
+static void report_label( int64_t sec, int period, char *label, size_t size )
+{
+    struct tm       tm;
+    time_t          t = sec;
+
+    localtime_r( &t, &tm );
+    strftime( label, size, (period == PERIOD_HOUR) ? "%Y-%m-%d %H:00" : (period == PERIOD_MONTH) ? "%Y-%m" : "%Y-%m-%d", &tm );
+}
+
+
+int main( int argc, char **argv )
+{
+    ARCHIVE         *ar;
+    ARCHIVE_COLUMNS cols;
+    AGG_QUERY       query;
+    AGG_RESULT      *result;
+    AGG_BUCKET      *bucket;
+    AGG_CELL        *cell;
+    uint8_t         *groups = NULL;
+    int64_t         *bounds;
+    int64_t         from = INT64_MAX;
+    int64_t         until = INT64_MIN;
+    int             have_from = 0;
+    int             have_until = 0;
+    struct timeval  start;
+    struct timeval  end;
+    double          elapsed;
+    char            label[32];
+    uint32_t        segment;
+    uint32_t        idx;
+    uint32_t        k;
+    int             period = PERIOD_DAY;
+    int             quiet = 0;
+    int             c;
+
+    memset( &query, 0, sizeof( query ));
+    query.threads = sysconf( _SC_NPROCESSORS_ONLN );
+    while( ( c = getopt( argc, argv, "g:f:u:p:d:t:q" )) != -1 ) {
+        switch( c ) {
+            case 'g':
+                if( groups == NULL && (groups = calloc( 65536, 1 )) == NULL ) {
+                    fprintf( stderr, "Out of memory\n" );
+                    exit( -5 );
+                }
+                if( report_groups( optarg, groups ) != 0 ) {
+                    fprintf( stderr, "Invalid group address or range %s\n", optarg );
+                    exit( -1 );
+                }
+                break;
+            case 'f':
+                if( report_time( optarg, &from ) != 0 ) {
+                    Usage( argv[0] );
+                    exit( -1 );
+                }
+                have_from = 1;
+                break;
+            case 'u':
+                if( report_time( optarg, &until ) != 0 ) {
+                    Usage( argv[0] );
+                    exit( -1 );
+                }
+                have_until = 1;
+                break;
+            case 'p':
+                if( strcmp( optarg, "hour" ) == 0 ) {
+                    period = PERIOD_HOUR;
+                } else if( strcmp( optarg, "day" ) == 0 ) {
+                    period = PERIOD_DAY;
+                } else if( strcmp( optarg, "week" ) == 0 ) {
+                    period = PERIOD_WEEK;
+                } else if( strcmp( optarg, "month" ) == 0 ) {
+                    period = PERIOD_MONTH;
+                } else {
+                    Usage( argv[0] );
+                    exit( -1 );
+                }
+                break;
+            case 'd':
+                query.dpt = atoi( optarg );
+                break;
+            case 't':
+                query.threads = atoi( optarg );
+                break;
+            case 'q':
+                quiet = 1;
+                break;
+            default:
+                Usage( argv[0] );
+                exit( -1 );
+        }
+    }
+    if( optind + 1 != argc || query.threads < 1 ) {
+        Usage( argv[0] );
+        exit( -1 );
+    }
+
+    ar = archive_open( argv[optind] );
+    if( ar == NULL ) {
+        exit( -2 );
+    }
+    if( !have_from || !have_until ) {
+        for( segment = 0; segment < ar->segments; segment++ ) {
+            if( archive_columns( ar, segment, &cols ) != 0 || cols.segment->rows == 0 ) {
+                continue;
+            }
+            if( !have_from && cols.segment->first_sec < from ) {
+                from = cols.segment->first_sec;
+            }
+            if( !have_until && cols.segment->last_sec + 1 > until ) {
+                until = cols.segment->last_sec + 1;
+            }
+        }
+    }
+    if( from >= until ) {
+        archive_close( ar );
+        return( 0 );
+    }
+
+    bounds = report_bounds( from, until, period, &query.buckets );
+    // partial first and last period when from or until were given
+    if( have_from ) {
+        bounds[0] = from;
+    }
+    if( have_until ) {
+        bounds[query.buckets] = until;
+    }
+    query.bounds = bounds;
+    query.groups = groups;
+
+    gettimeofday( &start, NULL );
+    result = agg_run( ar, &query );
+    if( result == NULL ) {
+        exit( -2 );
+    }
+    gettimeofday( &end, NULL );
+    elapsed = (end.tv_sec - start.tv_sec) + (end.tv_usec - start.tv_usec) / 1e6;
+
+    for( idx = 0; idx < result->buckets; idx++ ) {
+        bucket = &result->bucket[idx];
+        if( bucket->cells == 0 ) {
+            continue;
+        }
+        report_label( bounds[idx], period, label, sizeof( label ));
+        for( k = 0; k < bucket->cells; k++ ) {
+            cell = &bucket->cell[k];
+            printf( "%s  %2d/%d/%-3d  %8u  %g  %g  %g\n", label,
+                    cell->group >> 11, (cell->group >> 8) & 0x07, cell->group & 0xff,
+                    cell->count, cell->min, cell->max, cell->sum / cell->count );
+        }
+    }
+
+    if( !quiet ) {
+        fprintf( stderr, "%llu of %u segments read, %llu skipped by their statistics\n",
+                 (unsigned long long)result->segments, ar->segments, (unsigned long long)result->skipped );
+        fprintf( stderr, "%llu rows, %llu values in %u periods\n",
+                 (unsigned long long)result->rows, (unsigned long long)result->values, result->buckets );
+        fprintf( stderr, "%.2f s, %.0f rows/s with %d threads\n", elapsed,
+                 (elapsed > 0) ? result->rows / elapsed : 0.0, query.threads );
+    }
+    agg_free( result );
+    free( bounds );
+    free( groups );
+    archive_close( ar );
+    return( 0 );
+}
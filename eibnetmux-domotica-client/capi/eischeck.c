@@ -0,0 +1,274 @@
+/*
+ * eischeck - EIS codec against enmx_frame2value() and against itself
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+/*
+ * For every EIS type with a numeric codec, decodes every payload of its
+ * frame length with eis_decode() and with enmx_frame2value() and counts
+ * the values that differ. Each value is then encoded with eis_encode()
+ * and decoded again, and the values that do not come back are counted.
+ * Times and dates with fields out of range (25:00:00, 31 April) decode
+ * to something, but no encoding gives them back; they are counted apart
+ * and left out of the round trip.
+ *
+ * Payloads of 4 bytes (EIS 9, 11) are too many to try all: every value
+ * of the upper 16 bits is tried once, then random payloads.
+ *
+ * The first mismatches of each type are listed with their payload. The
+ * exit code is 1 if any value differs.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <libgen.h>
+#include <getopt.h>
+#include <time.h>
+
+#include <eibnetmux/enmx_lib.h>
+
+#include "knxframe.h"
+#include "eiscodec.h"
+
+
+typedef struct {
+        int             eis;
+        int             length;                 // frame length, counting the apci byte
+} EIS_TYPE;
+
+
+/*
+ * local function declarations
+ */
+static void     Usage( char *progname );
+static void     frame_build( CEMIFRAME *frame, int length, uint32_t payload );
+static double   frame2value( int eis, CEMIFRAME *frame );
+static int      in_range( int eis, CEMIFRAME *frame, double value );
+static int      roundtrip( int eis, double value, double *again );
+static int      same( double a, double b );
+
+
+static EIS_TYPE types[] = {
+    { 1,    EIS1_LENGTH },
+    { 2,    EIS2_LENGTH },
+    { 7,    EIS7_LENGTH },
+    { 8,    EIS8_LENGTH },
+    { 6,    EIS6_LENGTH },
+    { 13,   EIS13_LENGTH },
+    { 14,   EIS14_LENGTH },
+    { 5,    EIS5_LENGTH },
+    { 10,   EIS10_LENGTH },
+    { 3,    EIS3_LENGTH },
+    { 4,    EIS4_LENGTH },
+    { 9,    EIS9_LENGTH },
+    { 11,   EIS11_LENGTH },
+};
+
+
+static void Usage( char *progname )
+{
+    fprintf( stderr, "Usage: %s [options]\n"
+                     "\n"
+                     "options:\n"
+                     "  -n payloads                          random 4 byte payloads tried           default: 16777216\n"
+                     "  -e count                             mismatches listed per type             default: 3\n"
+                     "\n", basename( progname ));
+}
+
+
+/*
+ * write frame with payload, the 6 bit value of short frames in the apci byte
+ */
+static void frame_build( CEMIFRAME *frame, int length, uint32_t payload )
+{
+    int             idx;
+
+    memset( frame, 0, sizeof( CEMIFRAME ));
+    frame->length = length;
+    frame->apci = A_WRITE_VALUE_REQ;
+    if( length == 1 ) {
+        frame->apci |= payload & 0x3f;
+    }
+    for( idx = 0; idx < length - 1; idx++ ) {
+        frame->data[idx] = payload >> (8 * (length - 2 - idx));
+    }
+}
+
+
+/*
+ * value as enmx_frame2value() decodes it
+ */
+static double frame2value( int eis, CEMIFRAME *frame )
+{
+    unsigned char   buf[20];
+
+    memset( buf, 0, sizeof( buf ));
+    enmx_frame2value( eis, frame, buf );
+    switch( eis ) {
+        case 4:     return( *(time_t *)buf );
+        case 5:
+        case 9:     return( *(double *)buf );
+    }
+    return( *(uint32_t *)buf );
+}
+
+
+/*
+ * are the time or date fields of the payload valid
+ */
+static int in_range( int eis, CEMIFRAME *frame, double value )
+{
+    time_t          date;
+    struct tm       tm;
+
+    switch( eis ) {
+        case 3:
+            return( value < 86400 && (frame->data[1] & 0x3f) < 60 && (frame->data[2] & 0x3f) < 60 );
+        case 4:
+            // mktime() moves a day past the end of the month into the next one
+            date = value;
+            localtime_r( &date, &tm );
+            return( (frame->data[2] & 0x7f) < 100 && tm.tm_mday == (frame->data[0] & 0x1f) &&
+                    tm.tm_mon + 1 == (frame->data[1] & 0x0f) );
+    }
+    return( 1 );
+}
+
+
+/*
+ * encode value and decode it again, -1 if it cannot be encoded
+ */
+static int roundtrip( int eis, double value, double *again )
+{
+    CEMIFRAME       frame;
+    uint8_t         data[EIS_MAX_LENGTH];
+    int             length;
+
+    *again = 0;
+    if( (length = eis_encode( eis, value, data )) < 0 ) {
+        return( -1 );
+    }
+    memset( &frame, 0, sizeof( frame ));
+    frame.length = length;
+    frame.apci = A_WRITE_VALUE_REQ;
+    if( length == 1 ) {
+        frame.apci |= data[0] & 0x3f;
+    } else {
+        memcpy( frame.data, data + 1, length - 1 );
+    }
+    return( eis_decode( eis, &frame, again ));
+}
+
+
+/*
+ * equal values, NaN equal to NaN
+ */
+static int same( double a, double b )
+{
+    return( a == b || (a != a && b != b) );
+}
+
+
+int main( int argc, char **argv )
+{
+    EIS_TYPE        *t;
+    CEMIFRAME       frame;
+    double          value;
+    double          enmx;
+    double          again;
+    uint64_t        payloads;
+    uint64_t        idx;
+    uint64_t        random_payloads = 16777216;
+    uint64_t        range;
+    uint64_t        differ;
+    uint64_t        lost;
+    uint32_t        payload;
+    int             examples = 3;
+    int             listed;
+    int             failed = 0;
+    int             type;
+    int             c;
+
+    while( ( c = getopt( argc, argv, "n:e:" )) != -1 ) {
+        switch( c ) {
+            case 'n':
+                random_payloads = strtoull( optarg, NULL, 0 );
+                break;
+            case 'e':
+                examples = atoi( optarg );
+                break;
+            default:
+                Usage( argv[0] );
+                exit( -1 );
+        }
+    }
+    if( optind != argc || examples < 0 ) {
+        Usage( argv[0] );
+        exit( -1 );
+    }
+
+    srandom( 1 );
+    printf( "eis  length      payloads  out of range  enmx differs  round trip differs\n" );
+    for( type = 0; type < sizeof( types ) / sizeof( types[0] ); type++ ) {
+        t = &types[type];
+        if( t->length == 1 ) {
+            payloads = 64;
+        } else if( t->length < 5 ) {
+            payloads = 1ull << (8 * (t->length - 1));
+        } else {
+            payloads = 65536 + random_payloads;
+        }
+        range = 0;
+        differ = 0;
+        lost = 0;
+        listed = 0;
+        for( idx = 0; idx < payloads; idx++ ) {
+            if( t->length < 5 ) {
+                payload = idx;
+            } else if( idx < 65536 ) {
+                payload = (idx << 16) | (random() & 0xffff);
+            } else {
+                payload = ((uint32_t)random() << 16) ^ random();
+            }
+            frame_build( &frame, t->length, payload );
+            eis_decode( t->eis, &frame, &value );
+            enmx = frame2value( t->eis, &frame );
+            if( !same( value, enmx )) {
+                differ++;
+                if( listed++ < examples ) {
+                    printf( "     eis %d payload %0*x: %.17g, enmx_frame2value %.17g\n", t->eis,
+                            (t->length == 1) ? 2 : 2 * (t->length - 1), payload, value, enmx );
+                }
+            }
+            if( !in_range( t->eis, &frame, value )) {
+                range++;
+            } else if( roundtrip( t->eis, value, &again ) != 0 || !same( value, again )) {
+                lost++;
+                if( listed++ < examples ) {
+                    printf( "     eis %d payload %0*x: %.17g, encoded and decoded %.17g\n", t->eis,
+                            (t->length == 1) ? 2 : 2 * (t->length - 1), payload, value, again );
+                }
+            }
+        }
+        printf( "%3d  %6d  %12llu  %12llu  %12llu  %18llu\n", t->eis, t->length, (unsigned long long)payloads,
+                (unsigned long long)range, (unsigned long long)differ, (unsigned long long)lost );
+        failed |= (differ > 0 || lost > 0);
+    }
+    return( failed );
+}
@@ -0,0 +1,205 @@
+/*
+ * knxipsend - send telegrams as KNXnet/IP routing indications
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+/*
+ * Stands in for a KNXnet/IP router when testing the routing receiver:
+ * sends the telegrams of capture files, or synthetic writes to a range
+ * of group addresses, to the routing group. With -i 127.0.0.1 the
+ * packets stay on loopback, where a receiver joined on the same
+ * interface gets them:
+ *
+ *   eibtrace -k -i 127.0.0.1 &
+ *   knxipsend -i 127.0.0.1 -n 10000
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <libgen.h>
+#include <getopt.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "knxip.h"
+#include "capfile.h"
+
+
+/*
+ * local function declarations
+ */
+static void     Usage( char *progname );
+static void     send_pace( double rate, uint64_t sent, struct timeval *start );
+
+
+static void Usage( char *progname )
+{
+    fprintf( stderr, "Usage: %s [options] [file ...]\n"
+                     "where:\n"
+                     "  file                                 capture files to send, synthetic writes if none\n"
+                     "\n"
+                     "options:\n"
+                     "  -g group[:port]                      routing group                          default: %s:%d\n"
+                     "  -i address                           address of the interface to send on    default: routing table\n"
+                     "  -n count                             synthetic telegrams                    default: 1000\n"
+                     "  -a addresses                         distinct group addresses               default: 100\n"
+                     "  -r rate                              telegrams per second, 0 = no limit     default: 0\n"
+                     "\n", basename( progname ), KNXIP_DEFAULT_GROUP, KNXIP_DEFAULT_PORT );
+}
+
+
+/*
+ * sleep until sent telegrams are due at rate
+ */
+static void send_pace( double rate, uint64_t sent, struct timeval *start )
+{
+    struct timeval  now;
+    double          ahead;
+
+    if( rate <= 0 ) {
+        return;
+    }
+    gettimeofday( &now, NULL );
+    ahead = sent / rate - ((now.tv_sec - start->tv_sec) + (now.tv_usec - start->tv_usec) / 1e6);
+    if( ahead > 0 ) {
+        usleep( ahead * 1e6 );
+    }
+}
+
+
+int main( int argc, char **argv )
+{
+    struct sockaddr_in  group;
+    struct in_addr      ifaddr;
+    struct timeval      start;
+    struct timeval      end;
+    KNXTELEGRAM         telegram;
+    CAPFILE             *cf;
+    unsigned char       packet[KNXIP_PACKET_MAX];
+    char                *group_text = NULL;
+    char                *if_text = NULL;
+    double              rate = 0;
+    double              elapsed;
+    uint64_t            sent = 0;
+    uint64_t            failed = 0;
+    int                 count = 1000;
+    int                 addresses = 100;
+    int                 len;
+    int                 fd;
+    int                 idx;
+    int                 c;
+    unsigned char       loop = 1;
+    unsigned char       ttl = 16;
+
+    while( ( c = getopt( argc, argv, "g:i:n:a:r:" )) != -1 ) {
+        switch( c ) {
+            case 'g':
+                group_text = optarg;
+                break;
+            case 'i':
+                if_text = optarg;
+                break;
+            case 'n':
+                count = atoi( optarg );
+                break;
+            case 'a':
+                addresses = atoi( optarg );
+                break;
+            case 'r':
+                rate = atof( optarg );
+                break;
+            default:
+                Usage( argv[0] );
+                exit( -1 );
+        }
+    }
+    if( count < 0 || addresses < 1 || addresses > 32768 || rate < 0 ) {
+        Usage( argv[0] );
+        exit( -1 );
+    }
+    if( knxip_address( group_text, &group ) != 0 ) {
+        fprintf( stderr, "Invalid routing group %s\n", group_text );
+        exit( -1 );
+    }
+
+    fd = socket( AF_INET, SOCK_DGRAM, 0 );
+    if( fd < 0 ||
+        setsockopt( fd, IPPROTO_IP, IP_MULTICAST_LOOP, &loop, sizeof( loop )) != 0 ||
+        setsockopt( fd, IPPROTO_IP, IP_MULTICAST_TTL, &ttl, sizeof( ttl )) != 0 ) {
+        fprintf( stderr, "Unable to open socket: %s\n", strerror( errno ));
+        exit( -2 );
+    }
+    if( if_text != NULL ) {
+        if( inet_pton( AF_INET, if_text, &ifaddr ) != 1 ) {
+            fprintf( stderr, "Invalid interface address %s\n", if_text );
+            exit( -1 );
+        }
+        if( setsockopt( fd, IPPROTO_IP, IP_MULTICAST_IF, &ifaddr, sizeof( ifaddr )) != 0 ) {
+            fprintf( stderr, "Unable to send on %s: %s\n", if_text, strerror( errno ));
+            exit( -2 );
+        }
+    }
+
+    gettimeofday( &start, NULL );
+    if( optind < argc ) {
+        for( idx = optind; idx < argc; idx++ ) {
+            if( (cf = capfile_open( argv[idx] )) == NULL ) {
+                exit( -2 );
+            }
+            while( capfile_read( cf, &telegram ) == 1 ) {
+                len = knxip_encode( packet, &telegram.frame );
+                if( sendto( fd, packet, len, 0, (struct sockaddr *)&group, sizeof( group )) != len ) {
+                    failed++;
+                }
+                send_pace( rate, ++sent, &start );
+            }
+            capfile_close( cf );
+        }
+    } else {
+        memset( &telegram, 0, sizeof( telegram ));
+        telegram.frame.code = CEMI_L_DATA_IND;
+        telegram.frame.ctrl = 0xbc;
+        telegram.frame.ntwrk = EIB_DAF_GROUP | 0x60;
+        telegram.frame.saddr = htons( 0x1101 );
+        telegram.frame.length = 3;
+        telegram.frame.apci = A_WRITE_VALUE_REQ;
+        for( idx = 0; idx < count; idx++ ) {
+            telegram.frame.daddr = htons( 0x0800 + idx % addresses );
+            telegram.frame.data[0] = (idx >> 8) & 0x07;
+            telegram.frame.data[1] = idx;
+            len = knxip_encode( packet, &telegram.frame );
+            if( sendto( fd, packet, len, 0, (struct sockaddr *)&group, sizeof( group )) != len ) {
+                failed++;
+            }
+            send_pace( rate, ++sent, &start );
+        }
+    }
+    gettimeofday( &end, NULL );
+    elapsed = (end.tv_sec - start.tv_sec) + (end.tv_usec - start.tv_usec) / 1e6;
+
+    fprintf( stderr, "%llu telegrams sent to %s:%d in %.2f s, %llu failed\n", (unsigned long long)sent,
+             inet_ntoa( group.sin_addr ), ntohs( group.sin_port ), elapsed, (unsigned long long)failed );
+    close( fd );
+    return( (failed != 0) ? 1 : 0 );
+}
@@ -58,18 +58,30 @@
 #include <errno.h>
 #include <time.h>
 #include <math.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <poll.h>
 #include <arpa/inet.h>
 #include <sys/time.h>
 
 #include <eibnetmux/enmx_lib.h>
 //#include "../mylib/mylib.h"
 #include "mylib.h"
-/*
- * EIB constants
- */
-#define EIB_DAF_GROUP                   0x80
-#define A_RESPONSE_VALUE_REQ            0x0040
-#define A_WRITE_VALUE_REQ               0x0080
+#include "knxframe.h"
+#include "eiscodec.h"
+#include "writer.h"
+#include "state.h"
+#include "sensors.h"
+#include "lastvalue.h"
+#include "broker.h"
+#include "rules.h"
+#include "fastlane.h"
+#include "dedupe.h"
+#include "recorder.h"
+#include "caplog.h"
+#include "knxip.h"
+#include "sink.h"
+#include "sinkdb.h"
 
 
 /*
@@ -77,159 +89,379 @@
  */
 ENMX_HANDLE     sock_con = 0;
 unsigned char   conn_state = 0;
+static volatile sig_atomic_t stop_capture = 0;
+static RECORDER *flight_recorder = NULL;
+static int      monitor_pipe[2];
+
+/*
+ * capture source and consumers
+ */
+typedef struct {
+        char            *target;                // eibnetmux server
+        char            *user;
+        char            *broker;                // eibbroker socket, instead of eibnetmux
+        char            *knxip;                 // KNXnet/IP routing group, instead of eibnetmux
+        char            *knxip_if;              // interface address to join it on, NULL = any
+        int             total;
+        int             quiet;
+        SINK            *sink[SINK_MAX];        // MySQL first unless disabled
+        int             sinks;
+        STATE_TABLE     *state;
+        LV_TABLE        *lastvalue;
+        RULESET         *rules;
+        DEDUPE          *dedupe;                // NULL = store every copy
+        SENSOR_MONITOR  *sensors;
+        RECORDER        *recorder;              // NULL = no flight recorder
+        CAPLOG          *caplog;                // NULL = no capture files
+        char            *snapshot;              // last value snapshot file, NULL = none
+        unsigned int    snapshot_interval;      // s
+} CAPTURE;
 
 /*
  * local function declarations
  */
-static void     Usage( char *progname );
 static char     *knx_physical( uint16_t phy_addr );
 static char     *knx_group( uint16_t grp_addr );
+static void     capture_shutdown( int arg );
+static void     capture_store( void *arg, KNXTELEGRAM *telegram );
+static int      capture_add_sink( CAPTURE *cap, SINK *sink );
+static void     capture_close_sinks( CAPTURE *cap );
+static void     capture_dump( int arg );
+static void     capture_stale( void *arg, uint16_t daddr );
+static void     *capture_snapshot( void *arg );
+static void     *capture_monitor( void *arg );
+
+
+/*
+ * capture_shutdown
+ *
+ * catches SIGINT and SIGTERM and stops the capture loop, so that queued
+ * telegrams are still written before exiting
+ */
+static void capture_shutdown( int arg )
+{
+    stop_capture = 1;
+}
+
+
+/*
+ * capture_dump
+ *
+ * catches SIGUSR2 and has the flight recorder write its telegrams
+ */
+static void capture_dump( int arg )
+{
+    if( flight_recorder != NULL ) {
+        recorder_trigger( flight_recorder, RECORDER_SIGNAL );
+    }
+}
 
 
 /*
- * EIB request frame
+ * a sensor went silent, keep the traffic that led up to it
  */
-typedef struct __attribute__((packed)) {
-        uint8_t  code;
-        uint8_t  zero;
-        uint8_t  ctrl;
-        uint8_t  ntwrk;
-        uint16_t saddr;
-        uint16_t daddr;
-        uint8_t  length;
-        uint8_t  tpci;
-        uint8_t  apci;
-        uint8_t  data[16];
-} CEMIFRAME;
-
-
-static void Usage( char *progname )
+static void capture_stale( void *arg, uint16_t daddr )
 {
-    fprintf( stderr, "Usage: %s [options] [hostname[:port]]\n"
-                     "where:\n"
-                     "  hostname[:port]                      defines eibnetmux server with default port of 4390\n"
-                     "\n"
-                     "options:\n"
-                     "  -u user                              name of user                           default: -\n"
-                     "  -c count                             stop after count number of requests    default: endless\n"
-                     "  -q                                   no verbose output (default: no)\n"
-                     "\n", basename( progname ));
+    recorder_trigger( arg, RECORDER_WATCHDOG );
 }
 
 
-int trace( int argc, char **argv )
+/*
+ * monitor thread
+ *
+ * enmx_monitor() blocks until the next telegram, so it runs here and
+ * passes telegrams through a pipe the capture loop can wait on with a
+ * timeout; closes the pipe on a fatal error
+ */
+static void *capture_monitor( void *arg )
 {
     uint16_t                value_size;
-    struct timeval          tv;
-    struct tm               *ltime;
     uint16_t                buflen;
     unsigned char           *buf;
+    KNXTELEGRAM             telegram;
+    sigset_t                sigs;
+
+    // signals are for the capture loop
+    sigemptyset( &sigs );
+    sigaddset( &sigs, SIGINT );
+    sigaddset( &sigs, SIGTERM );
+    sigaddset( &sigs, SIGUSR2 );
+    pthread_sigmask( SIG_BLOCK, &sigs, NULL );
+
+    buf = malloc( 10 );
+    buflen = 10;
+    for( ;; ) {
+        buf = enmx_monitor( sock_con, 0xffff, buf, &buflen, &value_size );
+        if( buf == NULL ) {
+            switch( enmx_geterror( sock_con )) {
+                case ENMX_E_COMMUNICATION:
+                case ENMX_E_NO_CONNECTION:
+                case ENMX_E_WRONG_USAGE:
+                case ENMX_E_NO_MEMORY:
+                    fprintf( stderr, "Error on write: %s\n", enmx_errormessage( sock_con ));
+                    close( monitor_pipe[1] );
+                    return( NULL );
+                case ENMX_E_INTERNAL:
+                    fprintf( stderr, "Bad status returned\n" );
+                    break;
+                case ENMX_E_SERVER_ABORTED:
+                    fprintf( stderr, "EOF reached: %s\n", enmx_errormessage( sock_con ));
+                    close( monitor_pipe[1] );
+                    return( NULL );
+                case ENMX_E_TIMEOUT:
+                    fprintf( stderr, "No value received\n" );
+                    break;
+            }
+            continue;
+        }
+        gettimeofday( &telegram.tv, NULL );
+        memset( &telegram.frame, 0, sizeof( CEMIFRAME ));
+        memcpy( &telegram.frame, buf, (value_size < sizeof( CEMIFRAME )) ? value_size : sizeof( CEMIFRAME ));
+        telegram.seen = 0;
+        if( write( monitor_pipe[1], &telegram, sizeof( telegram )) != sizeof( telegram )) {
+            return( NULL );
+        }
+    }
+}
+
+
+/*
+ * save last values every snapshot_interval seconds until capture stops
+ */
+static void *capture_snapshot( void *arg )
+{
+    CAPTURE         *cap = arg;
+    unsigned int    elapsed = 0;
+
+    while( stop_capture == 0 ) {
+        sleep( 1 );
+        if( ++elapsed >= cap->snapshot_interval && stop_capture == 0 ) {
+            lv_save( cap->lastvalue, cap->snapshot );
+            elapsed = 0;
+        }
+    }
+    return( NULL );
+}
+
+
+/*
+ * dedupe stage output
+ *
+ * a sink whose queue is full drops the telegram rather than holding up
+ * capture and the other sinks
+ */
+static void capture_store( void *arg, KNXTELEGRAM *telegram )
+{
+    CAPTURE         *cap = arg;
+    int             idx;
+
+    for( idx = 0; idx < cap->sinks; idx++ ) {
+        sink_submit( cap->sink[idx], telegram, 0 );
+    }
+}
+
+
+/*
+ * keep an opened sink, or close the others if it could not be opened
+ */
+static int capture_add_sink( CAPTURE *cap, SINK *sink )
+{
+    if( sink == NULL ) {
+        capture_close_sinks( cap );
+        return( -1 );
+    }
+    cap->sink[cap->sinks++] = sink;
+    return( 0 );
+}
+
+
+/*
+ * write what is still queued and close all sinks
+ */
+static void capture_close_sinks( CAPTURE *cap )
+{
+    while( cap->sinks > 0 ) {
+        sink_close( cap->sink[--cap->sinks] );
+    }
+}
+
+
+static int trace( CAPTURE *cap )
+{
+    struct timeval          tv;
+    struct tm               *ltime;
+    struct pollfd           pfd;
+    pthread_t               monitor;
     CEMIFRAME               *cemiframe;
-    int                     enmx_version;
-    int                     c;
-    int                     quiet = 0;
-    int                     total = -1;
+    KNXTELEGRAM             telegram;
+    BROKER_CLIENT           *broker = NULL;
+    static BROKER_VIEW      views[BROKER_VIEWS];
+    int                     view_next = 0;
+    int                     view_count = 0;
+    KNXIP_ROUTER            *knxip = NULL;
+    int                     result;
+    uint8_t                 eis;
+    double                  telegram_val;
+    struct sigaction        sa;
     int                     count = 0;
     int                     spaces = 1;
-    char                    *user = NULL;
     char                    pwd[255];
-    char                    *target;
     char                    *eis_types;
-    int                     type;
     int                     seconds;
-    unsigned char           value[20];
-    uint32_t                *p_int = 0;
-    double                  *p_real;
-
-    opterr = 0;
-    while( ( c = getopt( argc, argv, "c:u:q" )) != -1 ) {
-        switch( c ) {
-            case 'c':
-                total = atoi( optarg );
-                break;
-            case 'u':
-                user = strdup( optarg );
-                break;
-            case 'q':
-                quiet = 1;
-                break;
-            default:
-                fprintf( stderr, "Invalid option: %c\n", c );
-                Usage( argv[0] );
-                exit( -1 );
-        }
-    }
-    if( optind == argc ) {
-        target = NULL;
-    } else if( optind + 1 == argc ) {
-        target = argv[optind];
-    } else {
-        Usage( argv[0] );
-        exit( -1 );
-    }
+    time_t                  date;
+    uint8_t                 character;
 
     // catch signals for shutdown
-    signal( SIGINT, Shutdown );
-    signal( SIGTERM, Shutdown );
-
-    // request monitoring connection
-    enmx_version = enmx_init();
-    sock_con = enmx_open( target, "eibtrace" );
-    if( sock_con < 0 ) {
-        fprintf( stderr, "Connect to eibnetmux failed (%d): %s\n", sock_con, enmx_errormessage( sock_con ));
-        exit( -2 );
+    // no SA_RESTART, a pending poll() must return
+    memset( &sa, 0, sizeof( sa ));
+    sa.sa_handler = capture_shutdown;
+    sigemptyset( &sa.sa_mask );
+    sigaction( SIGINT, &sa, NULL );
+    sigaction( SIGTERM, &sa, NULL );
+    if( cap->recorder != NULL ) {
+        flight_recorder = cap->recorder;
+        sa.sa_handler = capture_dump;
+        sa.sa_flags = SA_RESTART;
+        sigaction( SIGUSR2, &sa, NULL );
     }
 
-    // authenticate
-    if( user != NULL ) {
-        if( getpassword( pwd ) != 0 ) {
-            fprintf( stderr, "Error reading password - cannot continue\n" );
-            exit( -6 );
+    // request monitoring connection, or share the one of eibbroker
+    enmx_init();
+    if( cap->user != NULL && getpassword( pwd ) != 0 ) {
+        fprintf( stderr, "Error reading password - cannot continue\n" );
+        exit( -6 );
+    }
+    if( cap->broker != NULL ) {
+        broker = broker_connect( cap->broker, BROKER_F_PHYSICAL, NULL, 0 );
+        if( broker == NULL || broker_nonblock( broker ) != 0 ) {
+            exit( -2 );
         }
-        if( enmx_auth( sock_con, user, pwd ) != 0 ) {
+        if( cap->quiet == 0 ) {
+            printf( "Connection to eibbroker '%s' established\n", cap->broker );
+        }
+    } else if( cap->knxip != NULL ) {
+        knxip = knxip_open( cap->knxip, cap->knxip_if );
+        if( knxip == NULL ) {
+            exit( -2 );
+        }
+        if( cap->quiet == 0 ) {
+            printf( "Joined KNXnet/IP routing group %s\n", cap->knxip );
+        }
+    } else {
+        sock_con = enmx_open( cap->target, "eibtrace" );
+        if( sock_con < 0 ) {
+            fprintf( stderr, "Connect to eibnetmux failed (%d): %s\n", sock_con, enmx_errormessage( sock_con ));
+            exit( -2 );
+        }
+
+        // authenticate
+        if( cap->user != NULL && enmx_auth( sock_con, cap->user, pwd ) != 0 ) {
             fprintf( stderr, "Authentication failure\n" );
             exit( -3 );
         }
+        if( cap->quiet == 0 ) {
+            printf( "Connection to eibnetmux '%s' established\n", enmx_gethost( sock_con ));
+        }
+        result = (pipe( monitor_pipe ) != 0) ? errno : pthread_create( &monitor, NULL, capture_monitor, NULL );
+        if( result != 0 ) {
+            fprintf( stderr, "Unable to start monitor: %s\n", strerror( result ));
+            exit( -5 );
+        }
     }
-    if( quiet == 0 ) {
-        printf( "Connection to eibnetmux '%s' established\n", enmx_gethost( sock_con ));
+
+    // rules write on a connection of their own
+    if( cap->rules != NULL && rules_connect( cap->rules, cap->target, cap->user, pwd ) != 0 ) {
+        exit( -2 );
     }
 
-    buf = malloc( 10 );
-    buflen = 10;
-    if( total != -1 ) {
-        spaces = floor( log10( total )) +1;
+    if( cap->total != -1 ) {
+        spaces = floor( log10( cap->total )) +1;
     }
-    while( total == -1 || count < total ) {
-        buf = enmx_monitor( sock_con, 0xffff, buf, &buflen, &value_size );
-        if( buf == NULL ) {
-            switch( enmx_geterror( sock_con )) {
-                case ENMX_E_COMMUNICATION:
-                case ENMX_E_NO_CONNECTION:
-                case ENMX_E_WRONG_USAGE:
-                case ENMX_E_NO_MEMORY:
-                    fprintf( stderr, "Error on write: %s\n", enmx_errormessage( sock_con ));
-                    enmx_close( sock_con );
-                    exit( -4 );
-                    break;
-                case ENMX_E_INTERNAL:
-                    fprintf( stderr, "Bad status returned\n" );
+    while( stop_capture == 0 && (cap->total == -1 || count < cap->total) ) {
+        if( broker != NULL ) {
+            // take all records of a read at once, waking up now and then for the idle work below
+            if( view_next == view_count ) {
+                view_next = view_count = 0;
+                result = broker_poll( broker, 1000 );
+                if( result >= 0 ) {
+                    result = view_count = broker_views( broker, views, BROKER_VIEWS );
+                }
+                if( result < 0 ) {
+                    if( stop_capture == 0 ) {
+                        fprintf( stderr, "Connection to eibbroker lost\n" );
+                    }
                     break;
-                case ENMX_E_SERVER_ABORTED:
-                    fprintf( stderr, "EOF reached: %s\n", enmx_errormessage( sock_con ));
+                }
+            }
+            cemiframe = NULL;
+            if( view_next < view_count ) {
+                broker_view_telegram( &views[view_next++], &telegram );
+                cemiframe = &telegram.frame;
+            }
+        } else if( knxip != NULL ) {
+            // wake up now and then for the idle work below
+            result = knxip_next( knxip, &telegram, 1000 );
+            if( result < 0 ) {
+                fprintf( stderr, "Receive from KNXnet/IP routing group failed: %s\n", strerror( errno ));
+                break;
+            }
+            cemiframe = (result > 0) ? &telegram.frame : NULL;
+        } else {
+            // from the monitor thread, waking up now and then for the idle work below
+            pfd.fd = monitor_pipe[0];
+            pfd.events = POLLIN;
+            cemiframe = NULL;
+            if( poll( &pfd, 1, 1000 ) > 0 ) {
+                if( read( monitor_pipe[0], &telegram, sizeof( telegram )) != sizeof( telegram )) {
+                    // the monitor thread reported why
                     enmx_close( sock_con );
                     exit( -4 );
-                    break;
-                case ENMX_E_TIMEOUT:
-                    fprintf( stderr, "No value received\n" );
-                    break;
+                }
+                cemiframe = &telegram.frame;
+            }
+        }
+        if( cemiframe == NULL ) {
+            if( stop_capture != 0 ) {
+                break;
+            }
+            if( cap->dedupe != NULL || cap->caplog != NULL ) {
+                gettimeofday( &tv, NULL );
+            }
+            if( cap->dedupe != NULL ) {
+                dedupe_expire( cap->dedupe, &tv );
+            }
+            if( cap->caplog != NULL ) {
+                caplog_tick( cap->caplog, &tv );
             }
         } else {
             count++;
-            cemiframe = (CEMIFRAME *) buf;
-            gettimeofday( &tv, NULL );
+            tv = telegram.tv;
+            if( cap->recorder != NULL ) {
+                recorder_record( cap->recorder, &telegram );
+            }
+            if( cap->caplog != NULL ) {
+                caplog_append( cap->caplog, &telegram );
+            }
+            // rules first, their reaction time must not include storage
+            if( cap->rules != NULL && rules_process( cap->rules, &telegram ) > 0 && cap->recorder != NULL ) {
+                recorder_trigger( cap->recorder, RECORDER_RULE );
+            }
+            if( cap->dedupe != NULL ) {
+                dedupe_telegram( cap->dedupe, &telegram );
+            } else {
+                capture_store( cap, &telegram );
+            }
+            if( cap->state != NULL ) {
+                state_update( cap->state, &telegram );
+            }
+            if( cap->sensors != NULL ) {
+                sensors_update( cap->sensors, &telegram );
+            }
+            if( cap->lastvalue != NULL && telegram_value( &telegram.frame, &eis, &telegram_val ) == 0 ) {
+                lv_publish( cap->lastvalue, &telegram, eis, telegram_val );
+            }
             ltime = localtime( &tv.tv_sec );
-            if( total != -1 ) {
+            if( cap->total != -1 ) {
                 printf( "%*d: ", spaces, count );
             }
             printf( "%04d/%02d/%02d %02d:%02d:%02d:%03d - ",
@@ -246,59 +478,45 @@ int trace( int argc, char **argv )
             printf( "%8s", (cemiframe->ntwrk & EIB_DAF_GROUP) ? knx_group( cemiframe->daddr ) : knx_physical( cemiframe->daddr ));
             if( cemiframe->apci & (A_WRITE_VALUE_REQ | A_RESPONSE_VALUE_REQ) ) {
                 printf( " : " );
-                p_int = (uint32_t *)value;
-                p_real = (double *)value;
                 switch( cemiframe->length ) {
                     case 1:     // EIS 1, 2, 7, 8
-                        type = enmx_frame2value( 1, cemiframe, value );
-                        printf( "%s | ", (*p_int == 0) ? "off" : "on" );
-                        type = enmx_frame2value( 2, cemiframe, value );
-                        printf( "%d | ", *p_int );
-                        type = enmx_frame2value( 7, cemiframe, value );
-                        printf( "%d | ", *p_int );
-                        type = enmx_frame2value( 8, cemiframe, value );
-                        printf( "%d", *p_int );
+                        printf( "%s | ", eis1_decode( cemiframe ) ? "on" : "off" );
+                        printf( "%d | ", eis2_decode( cemiframe ));
+                        printf( "%d | ", eis7_decode( cemiframe ));
+                        printf( "%d", eis8_decode( cemiframe ));
                         eis_types = "1, 2, 7, 8";
                         break;
                     case 2:     // 6, 13, 14
-                        type = enmx_frame2value( 6, cemiframe, value );
-                        printf( "%d%% | %d", *p_int * 100 / 255, *p_int );
-                        type = enmx_frame2value( 13, cemiframe, value );
-                        if( *p_int >=  0x20 && *p_int < 0x7f ) {
-                            printf( " | %c", *p_int );
+                        printf( "%d%% | %d", eis6_decode( cemiframe ) * 100 / 255, eis6_decode( cemiframe ));
+                        character = eis13_decode( cemiframe );
+                        if( character >=  0x20 && character < 0x7f ) {
+                            printf( " | %c", character );
                             eis_types = "6, 14, 13";
                         } else {
                             eis_types = "6, 14";
                         }
                         break;
                     case 3:     // 5, 10
-                        type = enmx_frame2value( 5, cemiframe, value );
-                        printf( "%.2f | ", *p_real );
-                        type = enmx_frame2value( 10, cemiframe, value );
-                        printf( "%d", *p_int );
+                        printf( "%.2f | ", eis5_decode( cemiframe ));
+                        printf( "%d", eis10_decode( cemiframe ));
                         eis_types = "5, 10";
                         break;
                     case 4:     // 3, 4
-                        type = enmx_frame2value( 3, cemiframe, value );
-                        seconds = *p_int;
+                        seconds = eis3_decode( cemiframe );
                         ltime->tm_hour = seconds / 3600;
                         seconds %= 3600;
                         ltime->tm_min = seconds / 60;
                         seconds %= 60;
                         ltime->tm_sec = seconds;
                         printf( "%02d:%02d:%02d | ", ltime->tm_hour, ltime->tm_min, ltime->tm_sec );
-                        type = enmx_frame2value( 4, cemiframe, value );
-                        ltime = localtime( (time_t *)p_int );
+                        date = eis4_decode( cemiframe );
+                        ltime = localtime( &date );
                         printf( "%04d/%02d/%02d", ltime->tm_year + 1900, ltime->tm_mon +1, ltime->tm_mday );
                         eis_types = "3, 4";
                         break;
                     case 5:     // 9, 11, 12
-                        type = enmx_frame2value( 11, cemiframe, value );
-                        printf( "%d | ", *p_int );
-                        type = enmx_frame2value( 9, cemiframe, value );
-                        printf( "%.2f", *p_real );
-                        type = enmx_frame2value( 12, cemiframe, value );
-                        // printf( "12: <->" );
+                        printf( "%u | ", eis11_decode( cemiframe ));
+                        printf( "%.2f", eis9_decode( cemiframe ));
                         eis_types = "9, 11, 12";
                         break;
                     default:    // 15
@@ -316,7 +534,24 @@ int trace( int argc, char **argv )
             printf( "\n" );
         }
     }
-    return( 0 );
+    if( cap->dedupe != NULL ) {
+        dedupe_flush( cap->dedupe );
+    }
+    if( broker != NULL ) {
+        broker_close( broker );
+    } else if( knxip != NULL ) {
+        if( cap->quiet == 0 ) {
+            knxip_stats( knxip, stderr );
+        }
+        knxip_close( knxip );
+    } else {
+        // enmx_monitor() may be waiting, stop the thread before closing its connection
+        pthread_cancel( monitor );
+        pthread_join( monitor, NULL );
+        enmx_close( sock_con );
+        close( monitor_pipe[0] );
+    }
+    return( count );
 }
 
 
@@ -376,6 +611,39 @@ enum options_client
 #endif
 /* @# _OPTION_ENUM_ */
 
+enum options_capture
+{
+  OPT_EIB_USER=512,
+  OPT_BATCH_SIZE,
+  OPT_FLUSH_INTERVAL,
+  OPT_QUEUE_SIZE,
+  OPT_STATE_INTERVAL,
+  OPT_SHM_NAME,
+  OPT_SNAPSHOT,
+  OPT_SNAPSHOT_INTERVAL,
+  OPT_BROKER,
+  OPT_RULES,
+  OPT_SHED_WATERMARK,
+  OPT_SOURCE_RATE,
+  OPT_SOURCE_BURST,
+  OPT_FAST_LANE,
+  OPT_DEDUPE_WINDOW,
+  OPT_SENSORS,
+  OPT_SENSORS_LEARN,
+  OPT_RECORDER,
+  OPT_RECORDER_DIR,
+  OPT_CAPTURE_DIR,
+  OPT_CAPTURE_SEGMENT_MB,
+  OPT_CAPTURE_SEGMENT_MINUTES,
+  OPT_CAPTURE_WRITE,
+  OPT_NO_MYSQL,
+  OPT_SINK_SQLITE,
+  OPT_SINK_CAPFILE,
+  OPT_SINK_TEXT,
+  OPT_KNXIP,
+  OPT_KNXIP_INTERFACE
+};
+
 static char *opt_host_name = NULL;    /* server host (default=localhost) */
 static char *opt_user_name = NULL;    /* username (default=login name) */
 static char *opt_password = NULL;     /* password (default=none) */
@@ -388,7 +656,39 @@ static unsigned int opt_flags = 0;    /* connection flags (none) */
 
 static int ask_password = 0;          /* whether to solicit password */
 
-static MYSQL *conn;                   /* pointer to connection handler */
+static char *opt_eib_target = NULL;   /* eibnetmux server (default=search) */
+static char *opt_eib_user = NULL;     /* eibnetmux user (default=none) */
+static char *opt_broker = NULL;       /* eibbroker socket (default=none) */
+static char *opt_knxip = NULL;        /* KNXnet/IP routing group (default=none) */
+static char *opt_knxip_interface = NULL; /* interface address to join it on */
+static char *opt_rules = NULL;        /* rule file (default=none) */
+static char *opt_fast_lane = NULL;    /* fast lane file (default=none) */
+static char *opt_sensors = NULL;      /* expected sensor intervals (default=none) */
+static my_bool opt_sensors_learn = 0; /* learn sensor intervals */
+static unsigned int opt_recorder = 0; /* flight recorder telegrams (default=off) */
+static char *opt_recorder_dir = "/tmp"; /* flight recorder dumps */
+static char *opt_capture_dir = NULL;  /* capture files (default=none) */
+static unsigned int opt_capture_segment_mb = CAPLOG_DEFAULT_SEGMENT_MB;
+static unsigned int opt_capture_segment_minutes = CAPLOG_DEFAULT_SEGMENT_MINUTES;
+static my_bool opt_capture_write = 0; /* write() instead of io_uring */
+static my_bool opt_no_mysql = 0;      /* store in other sinks only */
+static char *opt_sink_sqlite = NULL;  /* SQLite database file (default=none) */
+static char *opt_sink_capfile = NULL; /* single capture file (default=none) */
+static char *opt_sink_text = NULL;    /* text lines, - is stdout (default=none) */
+static int opt_count = -1;            /* stop after count telegrams */
+static my_bool opt_quiet = 0;         /* no verbose output */
+static unsigned int opt_writers = WRITER_DEFAULT_WRITERS;
+static unsigned int opt_batch_size = WRITER_DEFAULT_BATCH;
+static unsigned int opt_flush_interval = WRITER_DEFAULT_FLUSH_MS;
+static unsigned int opt_queue_size = WRITER_DEFAULT_QUEUE;
+static unsigned int opt_shed_watermark = WRITER_DEFAULT_WATERMARK;
+static unsigned int opt_source_rate = WRITER_DEFAULT_SOURCE_RATE;
+static unsigned int opt_source_burst = WRITER_DEFAULT_SOURCE_BURST;
+static unsigned int opt_state_interval = STATE_DEFAULT_FLUSH_MS;
+static unsigned int opt_dedupe_window = 0;
+static char *opt_shm_name = LV_DEFAULT_NAME;
+static char *opt_snapshot = NULL; /* last value snapshot file (default=none) */
+static unsigned int opt_snapshot_interval = 60; /* s between snapshots */
 
 static const char *client_groups[] = { "client", NULL };
 
@@ -413,6 +713,105 @@ static struct my_option my_opts[] =   /* option information structures */
   {"user", 'u', "User name",
   (uchar **) &opt_user_name, NULL, NULL,
   GET_STR, REQUIRED_ARG, 0, 0, 0, 0, 0, 0},
+  {"eibnetmux", 'e', "eibnetmux server as hostname[:port]",
+  (uchar **) &opt_eib_target, NULL, NULL,
+  GET_STR, REQUIRED_ARG, 0, 0, 0, 0, 0, 0},
+  {"eib-user", OPT_EIB_USER, "eibnetmux user name",
+  (uchar **) &opt_eib_user, NULL, NULL,
+  GET_STR, REQUIRED_ARG, 0, 0, 0, 0, 0, 0},
+  {"broker", OPT_BROKER, "Receive from eibbroker socket instead of eibnetmux",
+  (uchar **) &opt_broker, NULL, NULL,
+  GET_STR, REQUIRED_ARG, 0, 0, 0, 0, 0, 0},
+  {"knxip", OPT_KNXIP, "Receive from KNXnet/IP routing group[:port] instead of eibnetmux, e.g. " KNXIP_DEFAULT_GROUP,
+  (uchar **) &opt_knxip, NULL, NULL,
+  GET_STR, REQUIRED_ARG, 0, 0, 0, 0, 0, 0},
+  {"knxip-interface", OPT_KNXIP_INTERFACE, "Address of the interface to join the routing group on",
+  (uchar **) &opt_knxip_interface, NULL, NULL,
+  GET_STR, REQUIRED_ARG, 0, 0, 0, 0, 0, 0},
+  {"rules", OPT_RULES, "Rule file, matching telegrams trigger group writes",
+  (uchar **) &opt_rules, NULL, NULL,
+  GET_STR, REQUIRED_ARG, 0, 0, 0, 0, 0, 0},
+  {"fast-lane", OPT_FAST_LANE, "Addresses and priorities written without batching",
+  (uchar **) &opt_fast_lane, NULL, NULL,
+  GET_STR, REQUIRED_ARG, 0, 0, 0, 0, 0, 0},
+  {"sensors", OPT_SENSORS, "Expected update intervals, silent addresses are reported stale",
+  (uchar **) &opt_sensors, NULL, NULL,
+  GET_STR, REQUIRED_ARG, 0, 0, 0, 0, 0, 0},
+  {"sensors-learn", OPT_SENSORS_LEARN, "Learn update intervals of steady senders",
+  (uchar **) &opt_sensors_learn, NULL, NULL,
+  GET_BOOL, NO_ARG, 0, 0, 0, 0, 0, 0},
+  {"recorder", OPT_RECORDER, "Keep the last telegrams in memory, dumped on SIGUSR2, rule or stale sensor; 0 disables",
+  (uchar **) &opt_recorder, NULL, NULL,
+  GET_UINT, REQUIRED_ARG, 0, 0, 16777216, 0, 0, 0},
+  {"recorder-dir", OPT_RECORDER_DIR, "Directory of flight recorder dumps",
+  (uchar **) &opt_recorder_dir, NULL, NULL,
+  GET_STR, REQUIRED_ARG, 0, 0, 0, 0, 0, 0},
+  {"capture-dir", OPT_CAPTURE_DIR, "Also write every telegram to rotating capture files in directory",
+  (uchar **) &opt_capture_dir, NULL, NULL,
+  GET_STR, REQUIRED_ARG, 0, 0, 0, 0, 0, 0},
+  {"capture-segment-mb", OPT_CAPTURE_SEGMENT_MB, "Start a new capture file after MB",
+  (uchar **) &opt_capture_segment_mb, NULL, NULL,
+  GET_UINT, REQUIRED_ARG, CAPLOG_DEFAULT_SEGMENT_MB, 1, 4096, 0, 0, 0},
+  {"capture-segment-minutes", OPT_CAPTURE_SEGMENT_MINUTES, "Start a new capture file after minutes",
+  (uchar **) &opt_capture_segment_minutes, NULL, NULL,
+  GET_UINT, REQUIRED_ARG, CAPLOG_DEFAULT_SEGMENT_MINUTES, 1, 10080, 0, 0, 0},
+  {"capture-write", OPT_CAPTURE_WRITE, "Write capture files with write() instead of io_uring",
+  (uchar **) &opt_capture_write, NULL, NULL,
+  GET_BOOL, NO_ARG, 0, 0, 0, 0, 0, 0},
+  {"no-mysql", OPT_NO_MYSQL, "Store in the other sinks only; no state table or sensor monitor",
+  (uchar **) &opt_no_mysql, NULL, NULL,
+  GET_BOOL, NO_ARG, 0, 0, 0, 0, 0, 0},
+  {"sink-sqlite", OPT_SINK_SQLITE, "Also store telegrams in SQLite database file",
+  (uchar **) &opt_sink_sqlite, NULL, NULL,
+  GET_STR, REQUIRED_ARG, 0, 0, 0, 0, 0, 0},
+  {"sink-capfile", OPT_SINK_CAPFILE, "Also store telegrams in a single capture file",
+  (uchar **) &opt_sink_capfile, NULL, NULL,
+  GET_STR, REQUIRED_ARG, 0, 0, 0, 0, 0, 0},
+  {"sink-text", OPT_SINK_TEXT, "Also append telegrams as text lines to file, - is stdout",
+  (uchar **) &opt_sink_text, NULL, NULL,
+  GET_STR, REQUIRED_ARG, 0, 0, 0, 0, 0, 0},
+  {"count", 'c', "Stop after count number of telegrams",
+  (uchar **) &opt_count, NULL, NULL,
+  GET_INT, REQUIRED_ARG, -1, -1, INT_MAX, 0, 0, 0},
+  {"quiet", 'q', "No verbose output",
+  (uchar **) &opt_quiet, NULL, NULL,
+  GET_BOOL, NO_ARG, 0, 0, 0, 0, 0, 0},
+  {"writers", 'w', "Number of parallel database writers",
+  (uchar **) &opt_writers, NULL, NULL,
+  GET_UINT, REQUIRED_ARG, WRITER_DEFAULT_WRITERS, 1, WRITER_MAX_WRITERS, 0, 0, 0},
+  {"batch-size", OPT_BATCH_SIZE, "Rows per insert transaction",
+  (uchar **) &opt_batch_size, NULL, NULL,
+  GET_UINT, REQUIRED_ARG, WRITER_DEFAULT_BATCH, 1, 65536, 0, 0, 0},
+  {"flush-interval", OPT_FLUSH_INTERVAL, "Write incomplete batches after ms",
+  (uchar **) &opt_flush_interval, NULL, NULL,
+  GET_UINT, REQUIRED_ARG, WRITER_DEFAULT_FLUSH_MS, 1, 3600000, 0, 0, 0},
+  {"queue-size", OPT_QUEUE_SIZE, "Telegrams queued per writer and sink",
+  (uchar **) &opt_queue_size, NULL, NULL,
+  GET_UINT, REQUIRED_ARG, WRITER_DEFAULT_QUEUE, 1, 16777216, 0, 0, 0},
+  {"shed-watermark", OPT_SHED_WATERMARK, "Shed telegrams above percent of writer queue, 0 disables",
+  (uchar **) &opt_shed_watermark, NULL, NULL,
+  GET_UINT, REQUIRED_ARG, WRITER_DEFAULT_WATERMARK, 0, 100, 0, 0, 0},
+  {"source-rate", OPT_SOURCE_RATE, "Telegrams per second and sender while shedding",
+  (uchar **) &opt_source_rate, NULL, NULL,
+  GET_UINT, REQUIRED_ARG, WRITER_DEFAULT_SOURCE_RATE, 1, 65536, 0, 0, 0},
+  {"source-burst", OPT_SOURCE_BURST, "Burst per sender while shedding",
+  (uchar **) &opt_source_burst, NULL, NULL,
+  GET_UINT, REQUIRED_ARG, WRITER_DEFAULT_SOURCE_BURST, 1, 65536, 0, 0, 0},
+  {"dedupe-window", OPT_DEDUPE_WINDOW, "Store copies forwarded by couplers within ms once, 0 disables",
+  (uchar **) &opt_dedupe_window, NULL, NULL,
+  GET_UINT, REQUIRED_ARG, 0, 0, 60000, 0, 0, 0},
+  {"state-interval", OPT_STATE_INTERVAL, "Update knx_state every ms, 0 disables",
+  (uchar **) &opt_state_interval, NULL, NULL,
+  GET_UINT, REQUIRED_ARG, STATE_DEFAULT_FLUSH_MS, 0, 3600000, 0, 0, 0},
+  {"shm-name", OPT_SHM_NAME, "Shared memory last value table, empty disables",
+  (uchar **) &opt_shm_name, NULL, NULL,
+  GET_STR, REQUIRED_ARG, 0, 0, 0, 0, 0, 0},
+  {"snapshot", OPT_SNAPSHOT, "Restore last values from file at start, save them periodically and at exit",
+  (uchar **) &opt_snapshot, NULL, NULL,
+  GET_STR, REQUIRED_ARG, 0, 0, 0, 0, 0, 0},
+  {"snapshot-interval", OPT_SNAPSHOT_INTERVAL, "Seconds between last value snapshots",
+  (uchar **) &opt_snapshot_interval, NULL, NULL,
+  GET_UINT, REQUIRED_ARG, 60, 1, 86400, 0, 0, 0},
 
 #include <sslopt-longopts.h>
 
@@ -431,21 +830,6 @@ print_error (MYSQL *conn, char *message)
   }
 }
 
-/* #@ _PRINT_STMT_ERROR_ */
-static void
-print_stmt_error (MYSQL_STMT *stmt, char *message)
-{
-  fprintf (stderr, "%s\n", message);
-  if (stmt != NULL)
-  {
-    fprintf (stderr, "Error %u (%s): %s\n",
-             mysql_stmt_errno (stmt),
-             mysql_stmt_sqlstate (stmt),
-             mysql_stmt_error (stmt));
-  }
-}
-/* #@ _PRINT_STMT_ERROR_ */
-
 /* #@ _GET_ONE_OPTION_ */
 static my_bool
 get_one_option (int optid, const struct my_option *opt, char *argument)
@@ -477,8 +861,6 @@ get_one_option (int optid, const struct my_option *opt, char *argument)
 }
 /* #@ _GET_ONE_OPTION_ */
 
-#include "process_prepared_statement.c"
-
 struct EibtraceParameter
 {
     char saddr[9];
@@ -552,14 +934,37 @@ EibtraceParameter processEibtraceParameter(int argc, char * argv[])
 
 }*/
 
-int main (int argc, char *argv[])
+/*
+ * per connection setup, called by the writer pool for each connection
+ */
+static void
+connect_options (MYSQL *conn)
 {
+#ifdef HAVE_OPENSSL
+  /* pass SSL information to client library */
+  if (opt_use_ssl)
+    mysql_ssl_set (conn, opt_ssl_key, opt_ssl_cert, opt_ssl_ca,
+                   opt_ssl_capath, opt_ssl_cipher);
+#if (MYSQL_VERSION_ID >= 50023 && MYSQL_VERSION_ID < 50100) \
+    || MYSQL_VERSION_ID >= 50111
+  mysql_options (conn,MYSQL_OPT_SSL_VERIFY_SERVER_CERT,
+                 (char*)&opt_ssl_verify_server_cert);
+#endif
+#endif
+}
 
-  
-  trace(argc, argv);
-
+int main (int argc, char *argv[])
+{
   int opt_err;
-  
+  DBPARAMS db;
+  CAPTURE cap;
+  FASTLANE *lane = NULL;
+  int count;
+  int n;
+  int err;
+  pthread_t snapshot_thread;
+  FILE *text_fp = NULL;
+
   MY_INIT (argv[0]);
   load_defaults ("my", client_groups, &argc, &argv);
 
@@ -577,6 +982,21 @@ int main (int argc, char *argv[])
     --argc; ++argv;
   }
 
+  /* compile rules before anything is connected */
+  memset (&cap, 0, sizeof (cap));
+  if (opt_rules != NULL)
+  {
+    cap.rules = rules_load (opt_rules);
+    if (cap.rules == NULL)
+      exit (1);
+  }
+  if (opt_fast_lane != NULL)
+  {
+    lane = fastlane_load (opt_fast_lane);
+    if (lane == NULL)
+      exit (1);
+  }
+
   /* initialize client library */
   if (mysql_library_init (0, NULL, NULL))
   {
@@ -584,39 +1004,219 @@ int main (int argc, char *argv[])
     exit (1);
   }
 
-  /* initialize connection handler */
-  conn = mysql_init (NULL);
-  if (conn == NULL)
+  /* connect writers to server */
+  db.host = opt_host_name;
+  db.user = opt_user_name;
+  db.password = opt_password;
+  db.db = opt_db_name;
+  db.port = opt_port_num;
+  db.socket = opt_socket_name;
+  db.flags = opt_flags;
+  db.init_conn = connect_options;
+  cap.target = opt_eib_target;
+  cap.user = opt_eib_user;
+  cap.broker = opt_broker;
+  cap.knxip = opt_knxip;
+  cap.knxip_if = opt_knxip_interface;
+  cap.total = opt_count;
+  cap.quiet = opt_quiet;
+  if (opt_no_mysql && opt_sink_sqlite == NULL && opt_sink_capfile == NULL
+      && opt_sink_text == NULL)
   {
-    print_error (NULL, "mysql_init() failed (probably out of memory)");
+    print_error (NULL, "No sink to store telegrams in");
     exit (1);
   }
+  if (opt_no_mysql && (opt_sensors != NULL || opt_sensors_learn))
+  {
+    print_error (NULL, "The sensor monitor needs MySQL");
+    exit (1);
+  }
+  if (!opt_no_mysql)
+  {
+    WRITER_POOL *pool;
 
-#ifdef HAVE_OPENSSL
-  /* pass SSL information to client library */
-  if (opt_use_ssl)
-    mysql_ssl_set (conn, opt_ssl_key, opt_ssl_cert, opt_ssl_ca,
-                   opt_ssl_capath, opt_ssl_cipher);
-#if (MYSQL_VERSION_ID >= 50023 && MYSQL_VERSION_ID < 50100) \
-    || MYSQL_VERSION_ID >= 50111
-  mysql_options (conn,MYSQL_OPT_SSL_VERIFY_SERVER_CERT,
-                 (char*)&opt_ssl_verify_server_cert);
-#endif
-#endif
-
-  /* connect to server */
-  if (mysql_real_connect (conn, opt_host_name, opt_user_name, opt_password,
-      opt_db_name, opt_port_num, opt_socket_name, opt_flags) == NULL)
+    pool = writer_pool_open (&db, opt_writers, opt_batch_size,
+                             opt_flush_interval, opt_queue_size);
+    if (pool == NULL)
+    {
+      print_error (NULL, "Could not start database writers");
+      mysql_library_end ();
+      exit (1);
+    }
+    if (writer_pool_shedding (pool, opt_shed_watermark,
+                              opt_source_rate, opt_source_burst) != 0
+        || (lane != NULL && writer_pool_fastlane (pool, lane) != 0))
+    {
+      writer_pool_close (pool);
+      mysql_library_end ();
+      exit (1);
+    }
+    /* the pool queues and batches itself */
+    if (capture_add_sink (&cap, sink_open (&sink_mysql_ops, pool, opt_batch_size,
+                                           opt_flush_interval, 0)) != 0)
+    {
+      mysql_library_end ();
+      exit (1);
+    }
+  }
+  /* the text sink does not close its file */
+  if (opt_sink_text != NULL)
+  {
+    text_fp = (strcmp (opt_sink_text, "-") == 0) ? stdout : fopen (opt_sink_text, "a");
+    if (text_fp == NULL)
+    {
+      fprintf (stderr, "Unable to open text sink %s: %s\n", opt_sink_text, strerror (errno));
+      capture_close_sinks (&cap);
+      mysql_library_end ();
+      exit (1);
+    }
+  }
+  if ((opt_sink_sqlite != NULL
+       && capture_add_sink (&cap, sink_open (&sink_sqlite_ops, sink_sqlite_open (opt_sink_sqlite),
+                                             opt_batch_size, opt_flush_interval, opt_queue_size)) != 0)
+      || (opt_sink_capfile != NULL
+          && capture_add_sink (&cap, sink_open (&sink_capfile_ops, sink_capfile_open (opt_sink_capfile),
+                                                opt_batch_size, opt_flush_interval, opt_queue_size)) != 0)
+      || (opt_sink_text != NULL
+          && capture_add_sink (&cap, sink_open (&sink_text_ops, sink_text_open (text_fp),
+                                                opt_batch_size, opt_flush_interval, opt_queue_size)) != 0))
   {
-    print_error (conn, "mysql_real_connect() failed");
-    mysql_close (conn);
+    mysql_library_end ();
     exit (1);
   }
 
-  process_prepared_statements (conn);
+  if (opt_state_interval > 0 && !opt_no_mysql)
+  {
+    cap.state = state_open (&db, opt_state_interval);
+    if (cap.state == NULL)
+    {
+      print_error (NULL, "Could not start current state table");
+      capture_close_sinks (&cap);
+      mysql_library_end ();
+      exit (1);
+    }
+  }
+
+  if (opt_recorder > 0)
+  {
+    cap.recorder = recorder_open (opt_recorder, opt_recorder_dir);
+    if (cap.recorder == NULL)
+      exit (1);
+  }
+
+  if (opt_capture_dir != NULL)
+  {
+    cap.caplog = caplog_open (opt_capture_dir, (uint64_t) opt_capture_segment_mb << 20,
+                              opt_capture_segment_minutes * 60,
+                              opt_capture_write ? CAPLOG_WRITE : CAPLOG_URING);
+    if (cap.caplog == NULL)
+      exit (1);
+  }
 
-  /* disconnect from server, terminate client library */
-  mysql_close (conn);
+  if (opt_sensors != NULL || opt_sensors_learn)
+  {
+    cap.sensors = sensors_open (&db, opt_sensors, opt_sensors_learn);
+    if (cap.sensors == NULL)
+    {
+      print_error (NULL, "Could not start sensor monitor");
+      capture_close_sinks (&cap);
+      if (cap.state != NULL)
+        state_close (cap.state);
+      mysql_library_end ();
+      exit (1);
+    }
+    if (cap.recorder != NULL)
+      sensors_notify (cap.sensors, capture_stale, cap.recorder);
+  }
+
+  if (opt_dedupe_window > 0)
+  {
+    cap.dedupe = dedupe_open (opt_dedupe_window, capture_store, &cap);
+    if (cap.dedupe == NULL)
+    {
+      capture_close_sinks (&cap);
+      mysql_library_end ();
+      exit (1);
+    }
+  }
+
+  if (opt_shm_name != NULL && *opt_shm_name != '\0')
+  {
+    cap.lastvalue = lv_create (opt_shm_name);
+    if (cap.lastvalue == NULL)
+      fprintf (stderr, "Continuing without shared memory last value table\n");
+  }
+
+  if (opt_snapshot != NULL && cap.lastvalue == NULL)
+    fprintf (stderr, "Snapshot needs the last value table, not used\n");
+  else if (opt_snapshot != NULL)
+  {
+    struct timeval start, end;
+
+    gettimeofday (&start, NULL);
+    n = lv_restore (cap.lastvalue, opt_snapshot);
+    gettimeofday (&end, NULL);
+    if (n >= 0 && !opt_quiet)
+      fprintf (stderr, "%d last values restored from %s in %.1f ms\n", n, opt_snapshot,
+               (end.tv_sec - start.tv_sec) * 1000.0 + (end.tv_usec - start.tv_usec) / 1000.0);
+    cap.snapshot = opt_snapshot;
+    cap.snapshot_interval = opt_snapshot_interval;
+    if ((err = pthread_create (&snapshot_thread, NULL, capture_snapshot, &cap)) != 0)
+    {
+      fprintf (stderr, "Unable to start snapshot thread: %s\n", strerror (err));
+      exit (1);
+    }
+  }
+
+  count = trace (&cap);
+
+  if (cap.snapshot != NULL)
+  {
+    stop_capture = 1;
+    pthread_join (snapshot_thread, NULL);
+    n = lv_save (cap.lastvalue, cap.snapshot);
+    if (n >= 0 && !opt_quiet)
+      fprintf (stderr, "%d last values saved to %s\n", n, cap.snapshot);
+  }
+
+  /* write what is still queued, disconnect, terminate client library */
+  if (!opt_quiet)
+  {
+    fprintf (stderr, "%d telegrams captured\n", count);
+    for (n = 0; n < cap.sinks; n++)
+      sink_stats (cap.sink[n], stderr);
+    if (cap.state != NULL)
+      state_stats (cap.state, stderr);
+    if (cap.rules != NULL)
+      rules_stats (cap.rules, stderr);
+    if (cap.dedupe != NULL)
+      dedupe_stats (cap.dedupe, stderr);
+    if (cap.sensors != NULL)
+      sensors_stats (cap.sensors, stderr);
+    if (cap.recorder != NULL)
+      recorder_stats (cap.recorder, stderr);
+    if (cap.caplog != NULL)
+      caplog_stats (cap.caplog, stderr);
+  }
+  capture_close_sinks (&cap);
+  if (text_fp != NULL && text_fp != stdout)
+    fclose (text_fp);
+  if (cap.state != NULL)
+    state_close (cap.state);
+  if (cap.lastvalue != NULL)
+    lv_close (cap.lastvalue);
+  if (cap.rules != NULL)
+    rules_close (cap.rules);
+  if (lane != NULL)
+    fastlane_close (lane);
+  if (cap.dedupe != NULL)
+    dedupe_close (cap.dedupe);
+  if (cap.sensors != NULL)
+    sensors_close (cap.sensors);
+  if (cap.recorder != NULL)
+    recorder_close (cap.recorder);
+  if (cap.caplog != NULL)
+    caplog_close (cap.caplog);
   mysql_library_end ();
   exit (0);
 }
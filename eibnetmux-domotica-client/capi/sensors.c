@@ -0,0 +1,524 @@
+/*
+ * sensors - detect cyclic senders that went silent
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+/*
+ * Every watched group address has a timer in a hierarchical timing wheel
+ * with one second ticks. Each write or answer re-arms it to
+ * SENSOR_STALE_FACTOR times the expected interval; a timer running out
+ * marks the address stale, the next telegram marks it recovered.
+ *
+ * Expected intervals come from a file:
+ *
+ *   # address or range     seconds
+ *   3/0/1                  300
+ *   3/1/0-3/1/31           60
+ *
+ * or are learned: an address whose interval average stays steady over
+ * SENSOR_LEARN_SAMPLES telegrams is watched with that average.
+ *
+ * A thread with its own connection advances the wheel once a second and
+ * logs the events to stderr and table knx_stale.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <arpa/inet.h>
+#include <sys/time.h>
+
+#include <mysql.h>
+
+#include "sensors.h"
+#include "timerwheel.h"
+
+#define SENSOR_ADDRESSES    65536
+#define SENSOR_STALE_SHOWN  10
+
+#define SENSOR_F_CONFIGURED 0x01
+#define SENSOR_F_LEARNED    0x02
+#define SENSOR_F_STALE      0x04
+#define SENSOR_F_SEEN       0x08
+
+/*
+ * upper bound of one VALUES tuple:
+ * (65535,'YYYY-MM-DD HH:MM:SS','S',4294967295,4294967295),
+ */
+#define SENSOR_ROW_TEXT     64
+
+typedef struct {
+        float           mean;                   // interval, s
+        float           deviation;              // mean absolute deviation
+        uint16_t        samples;
+} SENSOR_LEARN;
+
+typedef struct {
+        time_t          when;
+        uint32_t        silent;                 // s since last telegram
+        uint32_t        expected;
+        uint16_t        daddr;
+        char            event;                  // 'S'tale or 'R'ecovered
+} SENSOR_EVENT;
+
+struct sensor_monitor {
+        DBPARAMS        db;
+        MYSQL           *conn;
+        pthread_t       thread;
+        pthread_mutex_t lock;
+        pthread_cond_t  wakeup;
+        int             stop;
+        time_t          base;                   // time of tick 0
+        TIMER_WHEEL     *wheel;                 // timer per group address
+        uint32_t        *expected;              // s, 0 = not watched
+        uint32_t        *last_seen;             // tick
+        uint8_t         *flags;
+        SENSOR_LEARN    *learn;                 // NULL = not learning
+        SENSOR_NOTIFY   notify;                 // called for stale events, from the monitor thread
+        void            *notify_arg;
+        SENSOR_EVENT    event[SENSOR_EVENTS];
+        unsigned int    nevents;
+        SENSOR_EVENT    *flushbuf;
+        char            *query;
+        uint32_t        watched;
+        uint32_t        learned;
+        uint32_t        stale;
+        uint64_t        stale_events;
+        uint64_t        recovered;
+        uint64_t        dropped;
+        uint64_t        errors;
+};
+
+static const char *create_stmt =
+    "CREATE TABLE IF NOT EXISTS knx_stale ("
+    " id       BIGINT UNSIGNED NOT NULL AUTO_INCREMENT PRIMARY KEY,"
+    " daddr    SMALLINT UNSIGNED NOT NULL,"
+    " dt       DATETIME NOT NULL,"
+    " event    CHAR(1) NOT NULL,"
+    " silent   INT UNSIGNED NOT NULL,"
+    " expected INT UNSIGNED NOT NULL,"
+    " KEY daddr_dt (daddr, dt)"
+    ")";
+
+static const char *insert_head =
+    "INSERT INTO knx_stale (daddr,dt,event,silent,expected) VALUES ";
+
+
+/*
+ * local function declarations
+ */
+static int      sensors_load( SENSOR_MONITOR *mon, const char *file );
+static void     sensors_event( SENSOR_MONITOR *mon, uint16_t daddr, char event, uint32_t silent );
+static void     sensors_learn( SENSOR_MONITOR *mon, uint16_t daddr, uint32_t interval );
+static void     sensors_expired( void *arg, uint32_t daddr );
+static void     sensors_flush( SENSOR_MONITOR *mon, SENSOR_EVENT *events, unsigned int count );
+static void     *sensors_thread( void *arg );
+
+
+/*
+ * read expected intervals
+ */
+static int sensors_load( SENSOR_MONITOR *mon, const char *file )
+{
+    FILE            *fp;
+    char            line[128];
+    char            range[64];
+    char            *sep;
+    unsigned int    seconds;
+    uint16_t        first;
+    uint16_t        last;
+    uint32_t        addr;
+    int             lineno = 0;
+    int             fields;
+
+    fp = fopen( file, "r" );
+    if( fp == NULL ) {
+        fprintf( stderr, "Unable to open sensor file %s: %s\n", file, strerror( errno ));
+        return( -1 );
+    }
+    while( fgets( line, sizeof( line ), fp ) != NULL ) {
+        lineno++;
+        if( (sep = strchr( line, '#' )) != NULL ) {
+            *sep = '\0';
+        }
+        fields = sscanf( line, "%63s %u", range, &seconds );
+        if( fields <= 0 ) {
+            continue;
+        }
+        if( (sep = strchr( range, '-' )) != NULL ) {
+            *sep++ = '\0';
+        }
+        if( fields != 2 || seconds == 0 || seconds > WHEEL_RANGE / SENSOR_STALE_FACTOR ||
+            knx_parse_group( range, &first ) != 0 ||
+            knx_parse_group( (sep != NULL) ? sep : range, &last ) != 0 || last < first ) {
+            fprintf( stderr, "Sensor file line %d: expected group address or range and seconds\n", lineno );
+            fclose( fp );
+            return( -1 );
+        }
+        for( addr = first; addr <= last; addr++ ) {
+            mon->expected[addr] = seconds;
+            mon->flags[addr] |= SENSOR_F_CONFIGURED;
+        }
+    }
+    fclose( fp );
+    return( 0 );
+}
+
+
+/*
+ * queue event for the thread, lock held
+ */
+static void sensors_event( SENSOR_MONITOR *mon, uint16_t daddr, char event, uint32_t silent )
+{
+    SENSOR_EVENT    *ev;
+
+    if( mon->nevents == SENSOR_EVENTS ) {
+        mon->dropped++;
+        return;
+    }
+    ev = &mon->event[mon->nevents++];
+    ev->when = mon->base + mon->wheel->now;
+    ev->silent = silent;
+    ev->expected = mon->expected[daddr];
+    ev->daddr = daddr;
+    ev->event = event;
+}
+
+
+/*
+ * follow the cadence of an address not configured, lock held
+ *
+ * an average over irregular intervals (senders on change only) is not used
+ */
+static void sensors_learn( SENSOR_MONITOR *mon, uint16_t daddr, uint32_t interval )
+{
+    SENSOR_LEARN    *learn = &mon->learn[daddr];
+    int             steady;
+
+    if( interval == 0 ) {
+        return;
+    }
+    if( learn->samples == 0 ) {
+        learn->mean = interval;
+    } else {
+        learn->deviation += (fabsf( interval - learn->mean ) - learn->deviation) / 8;
+        learn->mean += (interval - learn->mean) / 8;
+    }
+    if( learn->samples < SENSOR_LEARN_SAMPLES ) {
+        learn->samples++;
+        return;
+    }
+
+    steady = (learn->deviation <= learn->mean / 4);
+    if( steady && !(mon->flags[daddr] & SENSOR_F_LEARNED) ) {
+        mon->flags[daddr] |= SENSOR_F_LEARNED;
+        mon->learned++;
+        mon->watched++;
+    } else if( !steady && (mon->flags[daddr] & SENSOR_F_LEARNED) ) {
+        mon->flags[daddr] &= ~SENSOR_F_LEARNED;
+        mon->learned--;
+        mon->watched--;
+        mon->expected[daddr] = 0;
+        wheel_cancel( mon->wheel, daddr );
+    }
+    if( steady ) {
+        mon->expected[daddr] = lrintf( learn->mean );
+    }
+}
+
+
+/*
+ * timer of an address ran out, lock held
+ */
+static void sensors_expired( void *arg, uint32_t daddr )
+{
+    SENSOR_MONITOR  *mon = arg;
+
+    mon->flags[daddr] |= SENSOR_F_STALE;
+    mon->stale++;
+    mon->stale_events++;
+    sensors_event( mon, daddr, 'S', mon->wheel->now - mon->last_seen[daddr] );
+}
+
+
+SENSOR_MONITOR *sensors_open( DBPARAMS *db, const char *file, int learn )
+{
+    SENSOR_MONITOR  *mon;
+    DBPARAMS        *p;
+    struct timeval  now;
+    uint32_t        addr;
+    int             err;
+
+    mon = calloc( 1, sizeof( SENSOR_MONITOR ));
+    if( mon == NULL ) {
+        fprintf( stderr, "Out of memory: %s\n", strerror( errno ));
+        return( NULL );
+    }
+    mon->db = *db;
+    gettimeofday( &now, NULL );
+    mon->base = now.tv_sec;
+    mon->wheel = wheel_open( SENSOR_ADDRESSES, 0 );
+    mon->expected = calloc( SENSOR_ADDRESSES, sizeof( uint32_t ));
+    mon->last_seen = calloc( SENSOR_ADDRESSES, sizeof( uint32_t ));
+    mon->flags = calloc( SENSOR_ADDRESSES, sizeof( uint8_t ));
+    mon->flushbuf = malloc( SENSOR_EVENTS * sizeof( SENSOR_EVENT ));
+    mon->query = malloc( strlen( insert_head ) + SENSOR_EVENTS * SENSOR_ROW_TEXT + 1 );
+    if( learn ) {
+        mon->learn = calloc( SENSOR_ADDRESSES, sizeof( SENSOR_LEARN ));
+    }
+    if( mon->wheel == NULL || mon->expected == NULL || mon->last_seen == NULL || mon->flags == NULL ||
+        mon->flushbuf == NULL || mon->query == NULL || (learn && mon->learn == NULL) ) {
+        fprintf( stderr, "Out of memory: %s\n", strerror( errno ));
+        goto failed;
+    }
+    if( file != NULL && sensors_load( mon, file ) != 0 ) {
+        goto failed;
+    }
+
+    // configured addresses are expected from the start
+    for( addr = 0; addr < SENSOR_ADDRESSES; addr++ ) {
+        if( mon->expected[addr] != 0 ) {
+            wheel_arm( mon->wheel, addr, mon->expected[addr] * SENSOR_STALE_FACTOR );
+            mon->watched++;
+        }
+    }
+
+    p = &mon->db;
+    mon->conn = mysql_init( NULL );
+    if( mon->conn == NULL ) {
+        fprintf( stderr, "Sensors: mysql_init() failed (probably out of memory)\n" );
+        goto failed;
+    }
+    if( p->init_conn != NULL ) {
+        p->init_conn( mon->conn );
+    }
+    if( mysql_real_connect( mon->conn, p->host, p->user, p->password, p->db,
+                            p->port, p->socket, p->flags ) == NULL ||
+        mysql_query( mon->conn, create_stmt ) != 0 ) {
+        fprintf( stderr, "Sensors: could not set up knx_stale: Error %u (%s): %s\n",
+                 mysql_errno( mon->conn ), mysql_sqlstate( mon->conn ), mysql_error( mon->conn ));
+        goto failed;
+    }
+
+    pthread_mutex_init( &mon->lock, NULL );
+    pthread_cond_init( &mon->wakeup, NULL );
+    if( (err = pthread_create( &mon->thread, NULL, sensors_thread, mon )) != 0 ) {
+        fprintf( stderr, "Unable to start sensor monitor: %s\n", strerror( err ));
+        pthread_cond_destroy( &mon->wakeup );
+        pthread_mutex_destroy( &mon->lock );
+        goto failed;
+    }
+    return( mon );
+
+failed:
+    if( mon->conn != NULL ) {
+        mysql_close( mon->conn );
+    }
+    wheel_close( mon->wheel );
+    free( mon->expected );
+    free( mon->last_seen );
+    free( mon->flags );
+    free( mon->learn );
+    free( mon->flushbuf );
+    free( mon->query );
+    free( mon );
+    return( NULL );
+}
+
+
+/*
+ * re-arm the timer of the telegram's group address
+ *
+ * only group writes and answers count as sign of life
+ */
+void sensors_update( SENSOR_MONITOR *mon, KNXTELEGRAM *telegram )
+{
+    uint16_t        daddr;
+    uint32_t        now;
+
+    if( !(telegram->frame.ntwrk & EIB_DAF_GROUP) || knx_service( &telegram->frame ) == 'R' ) {
+        return;
+    }
+    daddr = ntohs( telegram->frame.daddr );
+
+    pthread_mutex_lock( &mon->lock );
+    now = telegram->tv.tv_sec - mon->base;
+    if( mon->learn != NULL && !(mon->flags[daddr] & SENSOR_F_CONFIGURED) && (mon->flags[daddr] & SENSOR_F_SEEN) ) {
+        sensors_learn( mon, daddr, now - mon->last_seen[daddr] );
+    }
+    if( mon->flags[daddr] & SENSOR_F_STALE ) {
+        mon->flags[daddr] &= ~SENSOR_F_STALE;
+        mon->stale--;
+        mon->recovered++;
+        sensors_event( mon, daddr, 'R', now - mon->last_seen[daddr] );
+    }
+    mon->last_seen[daddr] = now;
+    mon->flags[daddr] |= SENSOR_F_SEEN;
+    if( mon->expected[daddr] != 0 ) {
+        wheel_arm( mon->wheel, daddr, now + mon->expected[daddr] * SENSOR_STALE_FACTOR );
+    }
+    pthread_mutex_unlock( &mon->lock );
+}
+
+
+/*
+ * have stale called for every stale event, before any telegram is captured
+ */
+void sensors_notify( SENSOR_MONITOR *mon, SENSOR_NOTIFY stale, void *arg )
+{
+    pthread_mutex_lock( &mon->lock );
+    mon->notify = stale;
+    mon->notify_arg = arg;
+    pthread_mutex_unlock( &mon->lock );
+}
+
+
+/*
+ * print counters and the addresses stale right now
+ */
+void sensors_stats( SENSOR_MONITOR *mon, FILE *fp )
+{
+    uint32_t        addr;
+    int             shown = 0;
+
+    pthread_mutex_lock( &mon->lock );
+    fprintf( fp, "sensors: %u watched (%u learned), %u stale, %llu stale events, %llu recovered, "
+                 "%llu events dropped, %llu errors\n",
+             mon->watched, mon->learned, mon->stale, (unsigned long long)mon->stale_events,
+             (unsigned long long)mon->recovered, (unsigned long long)mon->dropped,
+             (unsigned long long)mon->errors );
+    for( addr = 0; addr < SENSOR_ADDRESSES && shown < SENSOR_STALE_SHOWN && shown < mon->stale; addr++ ) {
+        if( mon->flags[addr] & SENSOR_F_STALE ) {
+            fprintf( fp, "  %d/%d/%d silent for %u s, expected every %u s\n",
+                     addr >> 11, (addr >> 8) & 0x07, addr & 0xff,
+                     mon->wheel->now - mon->last_seen[addr], mon->expected[addr] );
+            shown++;
+        }
+    }
+    pthread_mutex_unlock( &mon->lock );
+}
+
+
+/*
+ * stop monitor thread, write remaining events and free tables
+ */
+void sensors_close( SENSOR_MONITOR *mon )
+{
+    pthread_mutex_lock( &mon->lock );
+    mon->stop = 1;
+    pthread_cond_signal( &mon->wakeup );
+    pthread_mutex_unlock( &mon->lock );
+    pthread_join( mon->thread, NULL );
+
+    mysql_close( mon->conn );
+    pthread_mutex_destroy( &mon->lock );
+    pthread_cond_destroy( &mon->wakeup );
+    wheel_close( mon->wheel );
+    free( mon->expected );
+    free( mon->last_seen );
+    free( mon->flags );
+    free( mon->learn );
+    free( mon->flushbuf );
+    free( mon->query );
+    free( mon );
+}
+
+
+/*
+ * log events and store them in one statement
+ */
+static void sensors_flush( SENSOR_MONITOR *mon, SENSOR_EVENT *events, unsigned int count )
+{
+    SENSOR_EVENT    *ev;
+    struct tm       tm;
+    unsigned int    idx;
+    size_t          len;
+
+    if( count == 0 ) {
+        return;
+    }
+    len = strlen( strcpy( mon->query, insert_head ));
+    for( idx = 0; idx < count; idx++ ) {
+        ev = &events[idx];
+        if( ev->event == 'S' ) {
+            fprintf( stderr, "Sensor %d/%d/%d stale: silent for %u s, expected every %u s\n",
+                     ev->daddr >> 11, (ev->daddr >> 8) & 0x07, ev->daddr & 0xff, ev->silent, ev->expected );
+            if( mon->notify != NULL ) {
+                mon->notify( mon->notify_arg, ev->daddr );
+            }
+        } else {
+            fprintf( stderr, "Sensor %d/%d/%d recovered after %u s\n",
+                     ev->daddr >> 11, (ev->daddr >> 8) & 0x07, ev->daddr & 0xff, ev->silent );
+        }
+        localtime_r( &ev->when, &tm );
+        len += sprintf( mon->query + len, "%s(%u,'%04d-%02d-%02d %02d:%02d:%02d','%c',%u,%u)",
+                        (idx > 0) ? "," : "", ev->daddr,
+                        tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday, tm.tm_hour, tm.tm_min, tm.tm_sec,
+                        ev->event, ev->silent, ev->expected );
+    }
+    if( mysql_real_query( mon->conn, mon->query, len ) != 0 ) {
+        fprintf( stderr, "Sensors: insert failed: Error %u (%s): %s\n",
+                 mysql_errno( mon->conn ), mysql_sqlstate( mon->conn ), mysql_error( mon->conn ));
+        pthread_mutex_lock( &mon->lock );
+        mon->errors++;
+        pthread_mutex_unlock( &mon->lock );
+    }
+}
+
+
+/*
+ * advance the wheel every second
+ */
+static void *sensors_thread( void *arg )
+{
+    SENSOR_MONITOR  *mon = arg;
+    struct timeval  now;
+    struct timespec deadline;
+    unsigned int    count;
+    int             stop;
+
+    mysql_thread_init();
+
+    do {
+        gettimeofday( &now, NULL );
+        deadline.tv_sec = now.tv_sec + 1;
+        deadline.tv_nsec = 0;
+        pthread_mutex_lock( &mon->lock );
+        while( mon->stop == 0 ) {
+            if( pthread_cond_timedwait( &mon->wakeup, &mon->lock, &deadline ) == ETIMEDOUT ) {
+                break;
+            }
+        }
+        stop = mon->stop;
+        gettimeofday( &now, NULL );
+        wheel_advance( mon->wheel, now.tv_sec - mon->base, sensors_expired, mon );
+        count = mon->nevents;
+        memcpy( mon->flushbuf, mon->event, count * sizeof( SENSOR_EVENT ));
+        mon->nevents = 0;
+        pthread_mutex_unlock( &mon->lock );
+
+        sensors_flush( mon, mon->flushbuf, count );
+    } while( stop == 0 );
+
+    mysql_thread_end();
+    return( NULL );
+}
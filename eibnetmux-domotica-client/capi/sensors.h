@@ -0,0 +1,47 @@
+/*
+ * sensors - detect cyclic senders that went silent
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#ifndef SENSORS_H_
+#define SENSORS_H_
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include "knxframe.h"
+#include "writer.h"
+
+#define SENSOR_STALE_FACTOR     3               // stale after this many missed intervals
+#define SENSOR_LEARN_SAMPLES    8               // intervals seen before a cadence is trusted
+#define SENSOR_EVENTS           1024            // waiting to be logged and stored
+
+typedef struct sensor_monitor SENSOR_MONITOR;
+
+typedef void (*SENSOR_NOTIFY)( void *arg, uint16_t daddr );
+
+
+/*
+ * function declarations
+ */
+extern SENSOR_MONITOR   *sensors_open( DBPARAMS *db, const char *file, int learn );
+extern void             sensors_update( SENSOR_MONITOR *mon, KNXTELEGRAM *telegram );
+extern void             sensors_notify( SENSOR_MONITOR *mon, SENSOR_NOTIFY stale, void *arg );
+extern void             sensors_stats( SENSOR_MONITOR *mon, FILE *fp );
+extern void             sensors_close( SENSOR_MONITOR *mon );
+
+#endif /*SENSORS_H_*/
@@ -0,0 +1,262 @@
+/*
+ * sinkdb - MySQL and SQLite sinks
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <time.h>
+#include <arpa/inet.h>
+
+#include <sqlite3.h>
+
+#include "sinkdb.h"
+
+#define SQLITE_RAW_MAX      (sizeof( CEMIFRAME ) - offsetof( CEMIFRAME, tpci ))
+#define SQLITE_BUSY_MS      5000
+
+typedef struct {
+        sqlite3         *db;
+        sqlite3_stmt    *insert;
+        sqlite3_stmt    *begin;
+        sqlite3_stmt    *commit;
+        sqlite3_stmt    *rollback;
+        time_t          sec;                    // of dt
+        char            dt[20];
+        char            *path;
+} SQLITE_SINK;
+
+static const char *sqlite_create =
+    "CREATE TABLE IF NOT EXISTS knx_telegram ("
+    " id     INTEGER PRIMARY KEY,"
+    " dt     TEXT NOT NULL,"
+    " msec   INTEGER NOT NULL,"
+    " saddr  INTEGER NOT NULL,"
+    " daddr  INTEGER NOT NULL,"
+    " ctrl   INTEGER NOT NULL,"
+    " ntwrk  INTEGER NOT NULL,"
+    " apci   TEXT NOT NULL,"
+    " length INTEGER NOT NULL,"
+    " eis    INTEGER NOT NULL,"
+    " value  REAL NULL,"
+    " raw    BLOB NOT NULL,"
+    " seen   INTEGER NOT NULL DEFAULT 0"
+    ");"
+    "CREATE INDEX IF NOT EXISTS daddr_dt ON knx_telegram (daddr, dt)";
+
+static const char *sqlite_insert =
+    "INSERT INTO knx_telegram (dt,msec,saddr,daddr,ctrl,ntwrk,apci,length,eis,value,raw,seen)"
+    " VALUES(?,?,?,?,?,?,?,?,?,?,?,?)";
+
+
+/*
+ * local function declarations
+ */
+static int      mysql_sink_append( void *handle, KNXTELEGRAM *batch, unsigned int count );
+static void     mysql_sink_stats( void *handle, FILE *fp );
+static void     mysql_sink_close( void *handle );
+static int      sqlite_sink_prepare( SQLITE_SINK *s, const char *sql, sqlite3_stmt **stmt );
+static int      sqlite_sink_step( SQLITE_SINK *s, sqlite3_stmt *stmt );
+static void     sqlite_sink_bind( SQLITE_SINK *s, KNXTELEGRAM *telegram );
+static int      sqlite_sink_append( void *handle, KNXTELEGRAM *batch, unsigned int count );
+static void     sqlite_sink_close( void *handle );
+
+const SINK_OPS sink_mysql_ops = {
+    "mysql", mysql_sink_append, NULL, mysql_sink_stats, mysql_sink_close
+};
+
+const SINK_OPS sink_sqlite_ops = {
+    "sqlite", sqlite_sink_append, NULL, NULL, sqlite_sink_close
+};
+
+
+/*
+ * the handle is the writer pool
+ */
+static int mysql_sink_append( void *handle, KNXTELEGRAM *batch, unsigned int count )
+{
+    unsigned int    idx;
+
+    for( idx = 0; idx < count; idx++ ) {
+        if( writer_pool_submit( handle, &batch[idx] ) < 0 ) {
+            return( -1 );
+        }
+    }
+    return( 0 );
+}
+
+
+static void mysql_sink_stats( void *handle, FILE *fp )
+{
+    writer_pool_stats( handle, fp );
+}
+
+
+static void mysql_sink_close( void *handle )
+{
+    writer_pool_close( handle );
+}
+
+
+/*
+ * open or create database file with the telegram table
+ */
+void *sink_sqlite_open( const char *path )
+{
+    SQLITE_SINK     *s;
+    char            *errmsg = NULL;
+
+    s = calloc( 1, sizeof( SQLITE_SINK ));
+    if( s == NULL || (s->path = strdup( path )) == NULL ) {
+        fprintf( stderr, "Out of memory\n" );
+        exit( -5 );
+    }
+    s->sec = -1;
+    if( sqlite3_open_v2( path, &s->db, SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE | SQLITE_OPEN_NOMUTEX,
+                         NULL ) != SQLITE_OK ) {
+        fprintf( stderr, "Unable to open SQLite database %s: %s\n", path,
+                 (s->db != NULL) ? sqlite3_errmsg( s->db ) : "out of memory" );
+        sqlite_sink_close( s );
+        return( NULL );
+    }
+    sqlite3_busy_timeout( s->db, SQLITE_BUSY_MS );
+    if( sqlite3_exec( s->db, "PRAGMA journal_mode=WAL; PRAGMA synchronous=NORMAL", NULL, NULL, &errmsg ) != SQLITE_OK ||
+        sqlite3_exec( s->db, sqlite_create, NULL, NULL, &errmsg ) != SQLITE_OK ) {
+        fprintf( stderr, "SQLite %s: could not set up database: %s\n", path, errmsg );
+        sqlite3_free( errmsg );
+        sqlite_sink_close( s );
+        return( NULL );
+    }
+    if( sqlite_sink_prepare( s, sqlite_insert, &s->insert ) != 0 ||
+        sqlite_sink_prepare( s, "BEGIN", &s->begin ) != 0 ||
+        sqlite_sink_prepare( s, "COMMIT", &s->commit ) != 0 ||
+        sqlite_sink_prepare( s, "ROLLBACK", &s->rollback ) != 0 ) {
+        sqlite_sink_close( s );
+        return( NULL );
+    }
+    return( s );
+}
+
+
+static int sqlite_sink_prepare( SQLITE_SINK *s, const char *sql, sqlite3_stmt **stmt )
+{
+    if( sqlite3_prepare_v2( s->db, sql, -1, stmt, NULL ) != SQLITE_OK ) {
+        fprintf( stderr, "SQLite %s: could not prepare %s: %s\n", s->path, sql, sqlite3_errmsg( s->db ));
+        return( -1 );
+    }
+    return( 0 );
+}
+
+
+static int sqlite_sink_step( SQLITE_SINK *s, sqlite3_stmt *stmt )
+{
+    int             rc;
+
+    rc = sqlite3_step( stmt );
+    sqlite3_reset( stmt );
+    if( rc != SQLITE_DONE ) {
+        fprintf( stderr, "SQLite %s: %s\n", s->path, sqlite3_errmsg( s->db ));
+        return( -1 );
+    }
+    return( 0 );
+}
+
+
+/*
+ * bind telegram to the INSERT parameters, the same columns as the MySQL writer
+ */
+static void sqlite_sink_bind( SQLITE_SINK *s, KNXTELEGRAM *telegram )
+{
+    CEMIFRAME       *frame = &telegram->frame;
+    sqlite3_stmt    *stmt = s->insert;
+    struct tm       tm;
+    char            apci[1];
+    uint8_t         eis;
+    double          value;
+    int             raw_length;
+
+    if( telegram->tv.tv_sec != s->sec ) {
+        s->sec = telegram->tv.tv_sec;
+        localtime_r( &s->sec, &tm );
+        strftime( s->dt, sizeof( s->dt ), "%Y-%m-%d %H:%M:%S", &tm );
+    }
+    raw_length = frame->length + 1;
+    if( raw_length > SQLITE_RAW_MAX ) {
+        raw_length = SQLITE_RAW_MAX;
+    }
+    apci[0] = knx_service( frame );
+
+    sqlite3_bind_text( stmt, 1, s->dt, -1, SQLITE_STATIC );
+    sqlite3_bind_int( stmt, 2, telegram->tv.tv_usec / 1000 );
+    sqlite3_bind_int( stmt, 3, ntohs( frame->saddr ));
+    sqlite3_bind_int( stmt, 4, ntohs( frame->daddr ));
+    sqlite3_bind_int( stmt, 5, frame->ctrl );
+    sqlite3_bind_int( stmt, 6, frame->ntwrk );
+    sqlite3_bind_text( stmt, 7, apci, 1, SQLITE_TRANSIENT );
+    sqlite3_bind_int( stmt, 8, frame->length );
+    if( telegram_value( frame, &eis, &value ) == 0 ) {
+        sqlite3_bind_double( stmt, 10, value );
+    } else {
+        sqlite3_bind_null( stmt, 10 );
+    }
+    sqlite3_bind_int( stmt, 9, eis );
+    sqlite3_bind_blob( stmt, 11, &frame->tpci, raw_length, SQLITE_TRANSIENT );
+    sqlite3_bind_int( stmt, 12, telegram->seen );
+}
+
+
+/*
+ * insert a batch of telegrams in one transaction
+ */
+static int sqlite_sink_append( void *handle, KNXTELEGRAM *batch, unsigned int count )
+{
+    SQLITE_SINK     *s = handle;
+    unsigned int    idx;
+
+    if( sqlite_sink_step( s, s->begin ) != 0 ) {
+        return( -1 );
+    }
+    for( idx = 0; idx < count; idx++ ) {
+        sqlite_sink_bind( s, &batch[idx] );
+        if( sqlite_sink_step( s, s->insert ) != 0 ) {
+            sqlite_sink_step( s, s->rollback );
+            return( -1 );
+        }
+    }
+    if( sqlite_sink_step( s, s->commit ) != 0 ) {
+        sqlite_sink_step( s, s->rollback );
+        return( -1 );
+    }
+    return( 0 );
+}
+
+
+static void sqlite_sink_close( void *handle )
+{
+    SQLITE_SINK     *s = handle;
+
+    sqlite3_finalize( s->insert );
+    sqlite3_finalize( s->begin );
+    sqlite3_finalize( s->commit );
+    sqlite3_finalize( s->rollback );
+    sqlite3_close( s->db );
+    free( s->path );
+    free( s );
+}
@@ -0,0 +1,44 @@
+/*
+ * sinkdb - MySQL and SQLite sinks
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#ifndef SINKDB_H_
+#define SINKDB_H_
+
+#include "sink.h"
+#include "writer.h"
+
+/*
+ * The MySQL sink hands telegrams to an opened writer pool, which has
+ * queues, batching, shedding and the fast lane of its own; open it with
+ * queue size 0. Closing the sink closes the pool.
+ *
+ * The SQLite sink writes the same knx_telegram table into a database
+ * file in WAL mode with synchronous=NORMAL, a batch per transaction
+ * through one prepared INSERT.
+ */
+extern const SINK_OPS   sink_mysql_ops;
+extern const SINK_OPS   sink_sqlite_ops;
+
+
+/*
+ * function declarations
+ */
+extern void         *sink_sqlite_open( const char *path );
+
+#endif /*SINKDB_H_*/
@@ -0,0 +1,435 @@
+/*
+ * state - current value per group address, kept in table knx_state
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+/*
+ * knx_state holds one row per group address with the last value written
+ * or answered on the bus, so the current value of 2/1/5 is a primary key
+ * lookup instead of a scan of knx_telegram:
+ *
+ *   SELECT value, dt FROM knx_state WHERE daddr = (2<<11 | 1<<8 | 5)
+ *
+ * Updates are coalesced in a 65536 slot table in memory. A flusher thread
+ * with its own connection writes the addresses changed since the last
+ * flush with multi-row INSERT ... ON DUPLICATE KEY UPDATE, so each address
+ * is written at most once per flush interval however often it changes.
+ *
+ * A statement that fails is retried STATE_RETRIES times on a new
+ * connection. If it still fails, its addresses and those not yet written
+ * are marked changed again and go out with the next flush.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <math.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <arpa/inet.h>
+#include <sys/time.h>
+
+#include <mysql.h>
+
+#include "state.h"
+
+#define STATE_SLOTS         65536
+#define STATE_RETRIES       3
+#define STATE_RETRY_MS      500                 // doubled with each retry
+
+/*
+ * upper bound of one VALUES tuple:
+ * (65535,'YYYY-MM-DD HH:MM:SS',999,65535,'W',255,255,<double>,X'<34 hex digits>'),
+ */
+#define STATE_ROW_TEXT      128
+
+struct state_table {
+        DBPARAMS        db;
+        unsigned int    flush_ms;
+        MYSQL           *conn;
+        pthread_t       thread;
+        pthread_mutex_t lock;
+        pthread_cond_t  wakeup;
+        int             stop;
+        KNXTELEGRAM     *slots;                 // last telegram per address
+        uint8_t         *dirty;                 // address changed since last flush
+        uint16_t        *dirtylist;             // changed addresses in order of first change
+        unsigned int    ndirty;
+        KNXTELEGRAM     *flushbuf;
+        char            *query;
+        uint64_t        updates;
+        uint64_t        rows;
+        uint64_t        statements;
+        uint64_t        errors;
+};
+
+static const char *create_stmt =
+    "CREATE TABLE IF NOT EXISTS knx_state ("
+    " daddr  SMALLINT UNSIGNED NOT NULL PRIMARY KEY,"
+    " dt     DATETIME NOT NULL,"
+    " msec   SMALLINT UNSIGNED NOT NULL,"
+    " saddr  SMALLINT UNSIGNED NOT NULL,"
+    " apci   CHAR(1) NOT NULL,"
+    " length TINYINT UNSIGNED NOT NULL,"
+    " eis    TINYINT UNSIGNED NOT NULL,"
+    " value  DOUBLE NULL,"
+    " raw    VARBINARY(17) NOT NULL"
+    ")";
+
+static const char *upsert_head =
+    "INSERT INTO knx_state (daddr,dt,msec,saddr,apci,length,eis,value,raw) VALUES ";
+
+static const char *upsert_tail =
+    " ON DUPLICATE KEY UPDATE dt=VALUES(dt),msec=VALUES(msec),saddr=VALUES(saddr),"
+    "apci=VALUES(apci),length=VALUES(length),eis=VALUES(eis),value=VALUES(value),raw=VALUES(raw)";
+
+
+/*
+ * local function declarations
+ */
+static void     *state_thread( void *arg );
+static int      state_connect( STATE_TABLE *state );
+static void     state_disconnect( STATE_TABLE *state );
+static int      state_upsert( STATE_TABLE *state, unsigned int len );
+static void     state_flush( STATE_TABLE *state );
+static int      state_row( char *buf, KNXTELEGRAM *telegram );
+
+
+/*
+ * open state table and start flusher
+ */
+STATE_TABLE *state_open( DBPARAMS *db, unsigned int flush_ms )
+{
+    STATE_TABLE     *state;
+    int             err;
+
+    state = calloc( 1, sizeof( STATE_TABLE ));
+    if( state == NULL ) {
+        fprintf( stderr, "Out of memory: %s\n", strerror( errno ));
+        return( NULL );
+    }
+    state->db = *db;
+    state->flush_ms = flush_ms;
+    state->slots = malloc( STATE_SLOTS * sizeof( KNXTELEGRAM ));
+    state->dirty = calloc( STATE_SLOTS, sizeof( uint8_t ));
+    state->dirtylist = malloc( STATE_SLOTS * sizeof( uint16_t ));
+    state->flushbuf = malloc( STATE_SLOTS * sizeof( KNXTELEGRAM ));
+    state->query = malloc( strlen( upsert_head ) + STATE_ROWS_PER_STATEMENT * STATE_ROW_TEXT + strlen( upsert_tail ) + 1 );
+    if( state->slots == NULL || state->dirty == NULL || state->dirtylist == NULL ||
+        state->flushbuf == NULL || state->query == NULL ) {
+        fprintf( stderr, "Out of memory: %s\n", strerror( errno ));
+        goto failed;
+    }
+
+    if( state_connect( state ) != 0 ) {
+        goto failed;
+    }
+    if( mysql_query( state->conn, create_stmt ) != 0 ) {
+        fprintf( stderr, "State: could not set up knx_state: Error %u (%s): %s\n",
+                 mysql_errno( state->conn ), mysql_sqlstate( state->conn ), mysql_error( state->conn ));
+        goto failed;
+    }
+
+    pthread_mutex_init( &state->lock, NULL );
+    pthread_cond_init( &state->wakeup, NULL );
+    if( (err = pthread_create( &state->thread, NULL, state_thread, state )) != 0 ) {
+        fprintf( stderr, "Unable to start state flusher: %s\n", strerror( err ));
+        pthread_cond_destroy( &state->wakeup );
+        pthread_mutex_destroy( &state->lock );
+        goto failed;
+    }
+    return( state );
+
+failed:
+    state_disconnect( state );
+    free( state->slots );
+    free( state->dirty );
+    free( state->dirtylist );
+    free( state->flushbuf );
+    free( state->query );
+    free( state );
+    return( NULL );
+}
+
+
+/*
+ * record telegram as current state of its group address
+ *
+ * only group writes and answers carry a value
+ */
+void state_update( STATE_TABLE *state, KNXTELEGRAM *telegram )
+{
+    uint16_t        daddr;
+
+    if( !(telegram->frame.ntwrk & EIB_DAF_GROUP) || knx_service( &telegram->frame ) == 'R' ) {
+        return;
+    }
+    daddr = ntohs( telegram->frame.daddr );
+
+    pthread_mutex_lock( &state->lock );
+    state->slots[daddr] = *telegram;
+    if( state->dirty[daddr] == 0 ) {
+        state->dirty[daddr] = 1;
+        state->dirtylist[state->ndirty++] = daddr;
+    }
+    state->updates++;
+    pthread_mutex_unlock( &state->lock );
+}
+
+
+/*
+ * print statistics
+ */
+void state_stats( STATE_TABLE *state, FILE *fp )
+{
+    pthread_mutex_lock( &state->lock );
+    fprintf( fp, "state: %llu updates coalesced into %llu rows in %llu statements, %llu errors\n",
+             (unsigned long long)state->updates, (unsigned long long)state->rows,
+             (unsigned long long)state->statements, (unsigned long long)state->errors );
+    pthread_mutex_unlock( &state->lock );
+}
+
+
+/*
+ * write pending updates, stop flusher and free table
+ */
+void state_close( STATE_TABLE *state )
+{
+    pthread_mutex_lock( &state->lock );
+    state->stop = 1;
+    pthread_cond_signal( &state->wakeup );
+    pthread_mutex_unlock( &state->lock );
+    pthread_join( state->thread, NULL );
+    if( state->ndirty > 0 ) {
+        fprintf( stderr, "State: %u addresses not written\n", state->ndirty );
+    }
+
+    state_disconnect( state );
+    pthread_mutex_destroy( &state->lock );
+    pthread_cond_destroy( &state->wakeup );
+    free( state->slots );
+    free( state->dirty );
+    free( state->dirtylist );
+    free( state->flushbuf );
+    free( state->query );
+    free( state );
+}
+
+
+/*
+ * open the flusher's connection
+ */
+static int state_connect( STATE_TABLE *state )
+{
+    DBPARAMS        *p = &state->db;
+
+    state->conn = mysql_init( NULL );
+    if( state->conn == NULL ) {
+        fprintf( stderr, "State: mysql_init() failed (probably out of memory)\n" );
+        return( -1 );
+    }
+    if( p->init_conn != NULL ) {
+        p->init_conn( state->conn );
+    }
+    if( mysql_real_connect( state->conn, p->host, p->user, p->password, p->db,
+                            p->port, p->socket, p->flags ) == NULL ) {
+        fprintf( stderr, "State: connect failed: Error %u (%s): %s\n",
+                 mysql_errno( state->conn ), mysql_sqlstate( state->conn ), mysql_error( state->conn ));
+        state_disconnect( state );
+        return( -1 );
+    }
+    return( 0 );
+}
+
+
+/*
+ * close the flusher's connection, if open
+ */
+static void state_disconnect( STATE_TABLE *state )
+{
+    if( state->conn != NULL ) {
+        mysql_close( state->conn );
+        state->conn = NULL;
+    }
+}
+
+
+/*
+ * send the statement in query, reconnecting and retrying if it fails
+ *
+ * returns -1 if it failed STATE_RETRIES + 1 times
+ */
+static int state_upsert( STATE_TABLE *state, unsigned int len )
+{
+    int             attempt;
+
+    for( attempt = 0; ; attempt++ ) {
+        if( state->conn != NULL ) {
+            if( mysql_real_query( state->conn, state->query, len ) == 0 ) {
+                return( 0 );
+            }
+            fprintf( stderr, "State: upsert failed: Error %u (%s): %s\n",
+                     mysql_errno( state->conn ), mysql_sqlstate( state->conn ), mysql_error( state->conn ));
+        }
+        pthread_mutex_lock( &state->lock );
+        state->errors++;
+        pthread_mutex_unlock( &state->lock );
+        if( attempt == STATE_RETRIES ) {
+            return( -1 );
+        }
+        usleep( (STATE_RETRY_MS << attempt) * 1000 );
+        state_disconnect( state );
+        state_connect( state );
+    }
+}
+
+
+/*
+ * format one VALUES tuple
+ */
+static int state_row( char *buf, KNXTELEGRAM *telegram )
+{
+    CEMIFRAME       *frame = &telegram->frame;
+    struct tm       tm;
+    uint8_t         eis;
+    double          value;
+    int             len;
+    int             raw_length;
+    int             idx;
+
+    localtime_r( &telegram->tv.tv_sec, &tm );
+    len = sprintf( buf, "(%u,'%04d-%02d-%02d %02d:%02d:%02d',%u,%u,'%c',%u,",
+                   ntohs( frame->daddr ),
+                   tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday, tm.tm_hour, tm.tm_min, tm.tm_sec,
+                   (unsigned int)telegram->tv.tv_usec / 1000, ntohs( frame->saddr ),
+                   knx_service( frame ), frame->length );
+    if( telegram_value( frame, &eis, &value ) == 0 && isfinite( value )) {
+        len += sprintf( buf + len, "%u,%.17g,", eis, value );
+    } else {
+        len += sprintf( buf + len, "%u,NULL,", eis );
+    }
+
+    raw_length = frame->length + 1;
+    if( raw_length > sizeof( CEMIFRAME ) - offsetof( CEMIFRAME, tpci )) {
+        raw_length = sizeof( CEMIFRAME ) - offsetof( CEMIFRAME, tpci );
+    }
+    len += sprintf( buf + len, "X'" );
+    for( idx = 0; idx < raw_length; idx++ ) {
+        len += sprintf( buf + len, "%02x", (&frame->tpci)[idx] );
+    }
+    len += sprintf( buf + len, "')" );
+
+    return( len );
+}
+
+
+/*
+ * write all addresses changed since the last flush
+ */
+static void state_flush( STATE_TABLE *state )
+{
+    unsigned int    count;
+    unsigned int    idx;
+    unsigned int    rows;
+    unsigned int    row;
+    uint16_t        daddr;
+    size_t          len;
+
+    // take the changed slots, capture continues while we write
+    pthread_mutex_lock( &state->lock );
+    count = state->ndirty;
+    for( idx = 0; idx < count; idx++ ) {
+        daddr = state->dirtylist[idx];
+        state->flushbuf[idx] = state->slots[daddr];
+        state->dirty[daddr] = 0;
+    }
+    state->ndirty = 0;
+    pthread_mutex_unlock( &state->lock );
+
+    for( idx = 0; idx < count; idx += rows ) {
+        rows = (count - idx < STATE_ROWS_PER_STATEMENT) ? count - idx : STATE_ROWS_PER_STATEMENT;
+        len = strlen( strcpy( state->query, upsert_head ));
+        for( row = 0; row < rows; row++ ) {
+            if( row > 0 ) {
+                state->query[len++] = ',';
+            }
+            len += state_row( state->query + len, &state->flushbuf[idx + row] );
+        }
+        strcpy( state->query + len, upsert_tail );
+        len += strlen( upsert_tail );
+
+        if( state_upsert( state, len ) != 0 ) {
+            // the slots hold the latest values, addresses changed meanwhile are already marked
+            fprintf( stderr, "State: %u addresses kept for the next flush\n", count - idx );
+            pthread_mutex_lock( &state->lock );
+            for( ; idx < count; idx++ ) {
+                daddr = ntohs( state->flushbuf[idx].frame.daddr );
+                if( state->dirty[daddr] == 0 ) {
+                    state->dirty[daddr] = 1;
+                    state->dirtylist[state->ndirty++] = daddr;
+                }
+            }
+            pthread_mutex_unlock( &state->lock );
+            return;
+        }
+        pthread_mutex_lock( &state->lock );
+        state->rows += rows;
+        state->statements++;
+        pthread_mutex_unlock( &state->lock );
+    }
+}
+
+
+/*
+ * flusher thread
+ */
+static void *state_thread( void *arg )
+{
+    STATE_TABLE     *state = arg;
+    struct timeval  now;
+    struct timespec deadline;
+    int             stop;
+
+    mysql_thread_init();
+
+    do {
+        gettimeofday( &now, NULL );
+        deadline.tv_sec = now.tv_sec + state->flush_ms / 1000;
+        deadline.tv_nsec = now.tv_usec * 1000 + (state->flush_ms % 1000) * 1000000;
+        if( deadline.tv_nsec >= 1000000000 ) {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000;
+        }
+        pthread_mutex_lock( &state->lock );
+        while( state->stop == 0 ) {
+            if( pthread_cond_timedwait( &state->wakeup, &state->lock, &deadline ) == ETIMEDOUT ) {
+                break;
+            }
+        }
+        stop = state->stop;
+        pthread_mutex_unlock( &state->lock );
+
+        state_flush( state );
+    } while( stop == 0 );
+
+    mysql_thread_end();
+    return( NULL );
+}
@@ -0,0 +1,42 @@
+/*
+ * state - current value per group address, kept in table knx_state
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#ifndef STATE_H_
+#define STATE_H_
+
+#include <stdio.h>
+
+#include "knxframe.h"
+#include "writer.h"
+
+#define STATE_DEFAULT_FLUSH_MS          1000
+#define STATE_ROWS_PER_STATEMENT        512
+
+typedef struct state_table STATE_TABLE;
+
+
+/*
+ * function declarations
+ */
+extern STATE_TABLE  *state_open( DBPARAMS *db, unsigned int flush_ms );
+extern void         state_update( STATE_TABLE *state, KNXTELEGRAM *telegram );
+extern void         state_stats( STATE_TABLE *state, FILE *fp );
+extern void         state_close( STATE_TABLE *state );
+
+#endif /*STATE_H_*/
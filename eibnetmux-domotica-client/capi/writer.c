@@ -0,0 +1,844 @@
+/*
+ * writer - parallel MySQL writer for captured telegrams
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+/*
+ * The pool opens one MySQL connection per writer, each with its own
+ * prepared INSERT statement and its own queue. Telegrams are sharded
+ * by destination address, so all telegrams for one group address are
+ * written by the same writer in the order they were received, while
+ * different addresses are inserted in parallel.
+ *
+ * Each writer collects up to batch_size rows, or whatever arrived
+ * within flush_ms, and writes them in a single transaction.
+ *
+ * With shedding enabled, a writer whose queue is filled beyond the
+ * watermark no longer queues everything: a telegram for a group address
+ * which is still queued replaces it (latest wins), and a sender which
+ * used up its token bucket is dropped. Below the watermark nothing is
+ * lost. Buckets are kept for all senders all the time, so a flooding
+ * device already has an empty bucket when the queue fills up.
+ *
+ * Telegrams to fast lane addresses go to an extra writer with a connection
+ * of its own, which writes whatever it gets at once, and are never shed.
+ * Telegrams with fast lane priority stay with the writer of their address,
+ * to keep its order, but are never shed either, and the writer writes
+ * its queue up to them at once instead of waiting for a full batch.
+ *
+ * A batch that fails is retried WRITER_RETRIES times on a new connection,
+ * with a growing pause; if it still fails its rows are counted as dropped.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <arpa/inet.h>
+#include <sys/time.h>
+
+#include <mysql.h>
+
+#include "writer.h"
+#include "eiscodec.h"
+
+#define WRITER_RAW_MAX      (sizeof( CEMIFRAME ) - offsetof( CEMIFRAME, tpci ))
+#define WRITER_ADDRESSES    65536
+#define WRITER_SHED_TOP     5
+#define WRITER_RETRIES      3
+#define WRITER_RETRY_MS     500                 // doubled with each retry
+
+/*
+ * one row as bound to the INSERT statement
+ */
+typedef struct {
+        MYSQL_TIME      dt;
+        uint16_t        msec;
+        uint16_t        saddr;
+        uint16_t        daddr;
+        uint8_t         ctrl;
+        uint8_t         ntwrk;
+        char            apci[1];
+        uint8_t         length;
+        uint8_t         eis;
+        double          value;
+        my_bool         value_null;
+        unsigned char   raw[WRITER_RAW_MAX];
+        unsigned long   raw_length;
+        unsigned long   apci_length;
+        uint8_t         seen;
+} ROWBUF;
+
+typedef struct {
+        pthread_t       thread;
+        int             id;
+        WRITER_POOL     *pool;
+        MYSQL           *conn;
+        MYSQL_STMT      *stmt;
+        MYSQL_BIND      param[12];
+        ROWBUF          row;
+        pthread_mutex_t lock;
+        pthread_cond_t  not_empty;
+        pthread_cond_t  not_full;
+        KNXTELEGRAM     *queue;
+        unsigned int    head;
+        unsigned int    count;
+        uint64_t        dequeued;               // telegrams taken from queue so far
+        uint64_t        *last_seq;              // per group address, 1 + queue sequence of latest telegram
+        int             stop;
+        int             running;
+        int             immediate;              // no batching, fast lane
+        uint64_t        urgent_seq;             // 1 + queue sequence of latest priority telegram
+        KNXTELEGRAM     *batch;
+        uint64_t        rows;
+        uint64_t        batches;
+        uint64_t        errors;
+        uint64_t        dropped;                // rows of batches which failed all retries
+        uint64_t        coalesced;
+        uint64_t        limited;
+        uint64_t        urgent;                 // priority telegrams
+} WRITER;
+
+typedef struct {
+        double          tokens;
+        double          last;                   // time of last refill
+} SOURCE_BUCKET;
+
+struct writer_pool {
+        DBPARAMS        db;
+        int             nwriters;
+        unsigned int    batch_size;
+        unsigned int    flush_ms;
+        unsigned int    queue_size;
+        WRITER          *writers;               // nwriters + fast lane writer
+        WRITER          *fast;                  // NULL if no fast lane
+        FASTLANE        *lane;
+        unsigned int    watermark;              // queued telegrams, 0 = shedding disabled
+        double          source_rate;
+        double          source_burst;
+        SOURCE_BUCKET   *bucket;                // per sender, used by the submitting thread only
+        uint32_t        *coalesced;             // per group address
+        uint32_t        *limited;               // per sender
+};
+
+static const char *create_stmt =
+    "CREATE TABLE IF NOT EXISTS knx_telegram ("
+    " id     BIGINT UNSIGNED NOT NULL AUTO_INCREMENT PRIMARY KEY,"
+    " dt     DATETIME NOT NULL,"
+    " msec   SMALLINT UNSIGNED NOT NULL,"
+    " saddr  SMALLINT UNSIGNED NOT NULL,"
+    " daddr  SMALLINT UNSIGNED NOT NULL,"
+    " ctrl   TINYINT UNSIGNED NOT NULL,"
+    " ntwrk  TINYINT UNSIGNED NOT NULL,"
+    " apci   CHAR(1) NOT NULL,"
+    " length TINYINT UNSIGNED NOT NULL,"
+    " eis    TINYINT UNSIGNED NOT NULL,"
+    " value  DOUBLE NULL,"
+    " raw    VARBINARY(17) NOT NULL,"
+    " seen   TINYINT UNSIGNED NOT NULL DEFAULT 0,"
+    " KEY daddr_dt (daddr, dt)"
+    ")";
+
+static const char *insert_stmt =
+    "INSERT INTO knx_telegram (dt,msec,saddr,daddr,ctrl,ntwrk,apci,length,eis,value,raw,seen)"
+    " VALUES(?,?,?,?,?,?,?,?,?,?,?,?)";
+
+
+/*
+ * local function declarations
+ */
+static void     *writer_thread( void *arg );
+static int      writer_setup( WRITER_POOL *pool, int idx );
+static int      writer_connect( WRITER *w );
+static void     writer_disconnect( WRITER *w );
+static void     writer_bind( WRITER *w );
+static int      writer_insert( WRITER *w, KNXTELEGRAM *batch, unsigned int count );
+static void     writer_flush( WRITER *w, KNXTELEGRAM *batch, unsigned int count );
+static void     writer_fill_row( ROWBUF *row, KNXTELEGRAM *telegram );
+static int      writer_source_token( WRITER_POOL *pool, KNXTELEGRAM *telegram );
+static void     writer_shed_top( FILE *fp, char *what, uint32_t *counters, int physical );
+
+
+/*
+ * open a pool of writers, each with its own database connection
+ */
+WRITER_POOL *writer_pool_open( DBPARAMS *db, int writers, unsigned int batch_size,
+                               unsigned int flush_ms, unsigned int queue_size )
+{
+    WRITER_POOL     *pool;
+    WRITER          *w;
+    int             idx;
+    int             err;
+
+    if( writers < 1 || writers > WRITER_MAX_WRITERS || batch_size < 1 || queue_size < batch_size ) {
+        fprintf( stderr, "Invalid writer configuration\n" );
+        return( NULL );
+    }
+
+    pool = calloc( 1, sizeof( WRITER_POOL ));
+    if( pool == NULL ) {
+        fprintf( stderr, "Out of memory: %s\n", strerror( errno ));
+        return( NULL );
+    }
+    pool->db = *db;
+    pool->nwriters = writers;
+    pool->batch_size = batch_size;
+    pool->flush_ms = flush_ms;
+    pool->queue_size = queue_size;
+    pool->writers = calloc( writers + 1, sizeof( WRITER ));
+    if( pool->writers == NULL ) {
+        fprintf( stderr, "Out of memory: %s\n", strerror( errno ));
+        free( pool );
+        return( NULL );
+    }
+
+    // connect all writers before starting any thread, so a bad configuration fails early
+    for( idx = 0; idx < writers; idx++ ) {
+        if( writer_setup( pool, idx ) != 0 ) {
+            break;
+        }
+    }
+    if( idx < writers ) {
+        w = &pool->writers[idx];
+        writer_disconnect( w );
+        free( w->queue );
+        free( w->batch );
+        pool->nwriters = idx;
+        writer_pool_close( pool );
+        return( NULL );
+    }
+
+    for( idx = 0; idx < writers; idx++ ) {
+        w = &pool->writers[idx];
+        if( (err = pthread_create( &w->thread, NULL, writer_thread, w )) != 0 ) {
+            fprintf( stderr, "Unable to start writer %d: %s\n", idx, strerror( err ));
+            exit( -5 );
+        }
+        w->running = 1;
+    }
+
+    return( pool );
+}
+
+
+/*
+ * allocate queue, connect and initialize writer idx
+ */
+static int writer_setup( WRITER_POOL *pool, int idx )
+{
+    WRITER          *w = &pool->writers[idx];
+
+    w->id = idx;
+    w->pool = pool;
+    w->queue = malloc( pool->queue_size * sizeof( KNXTELEGRAM ));
+    w->batch = malloc( pool->batch_size * sizeof( KNXTELEGRAM ));
+    if( w->queue == NULL || w->batch == NULL ) {
+        fprintf( stderr, "Out of memory: %s\n", strerror( errno ));
+        return( -1 );
+    }
+    if( writer_connect( w ) != 0 ) {
+        return( -1 );
+    }
+    pthread_mutex_init( &w->lock, NULL );
+    pthread_cond_init( &w->not_empty, NULL );
+    pthread_cond_init( &w->not_full, NULL );
+    return( 0 );
+}
+
+
+/*
+ * start the fast lane writer for telegrams matching lane
+ */
+int writer_pool_fastlane( WRITER_POOL *pool, FASTLANE *lane )
+{
+    WRITER          *w = &pool->writers[pool->nwriters];
+    int             err;
+
+    if( writer_setup( pool, pool->nwriters ) != 0 ) {
+        writer_disconnect( w );
+        free( w->queue );
+        free( w->batch );
+        memset( w, 0, sizeof( WRITER ));
+        return( -1 );
+    }
+    w->immediate = 1;
+    if( (err = pthread_create( &w->thread, NULL, writer_thread, w )) != 0 ) {
+        fprintf( stderr, "Unable to start fast lane writer: %s\n", strerror( err ));
+        exit( -5 );
+    }
+    w->running = 1;
+    pool->lane = lane;
+    pool->fast = w;
+    return( 0 );
+}
+
+
+/*
+ * enable load shedding above watermark percent of each writer's queue
+ *
+ * senders are limited to source_rate telegrams per second with bursts
+ * of source_burst while shedding
+ */
+int writer_pool_shedding( WRITER_POOL *pool, unsigned int watermark,
+                          unsigned int source_rate, unsigned int source_burst )
+{
+    int             idx;
+
+    if( watermark == 0 ) {
+        return( 0 );
+    }
+    if( watermark > 100 || source_rate == 0 || source_burst == 0 ) {
+        fprintf( stderr, "Invalid load shedding configuration\n" );
+        return( -1 );
+    }
+    pool->bucket = calloc( WRITER_ADDRESSES, sizeof( SOURCE_BUCKET ));
+    pool->coalesced = calloc( WRITER_ADDRESSES, sizeof( uint32_t ));
+    pool->limited = calloc( WRITER_ADDRESSES, sizeof( uint32_t ));
+    if( pool->bucket == NULL || pool->coalesced == NULL || pool->limited == NULL ) {
+        fprintf( stderr, "Out of memory: %s\n", strerror( errno ));
+        return( -1 );
+    }
+    for( idx = 0; idx < pool->nwriters; idx++ ) {
+        pool->writers[idx].last_seq = calloc( WRITER_ADDRESSES, sizeof( uint64_t ));
+        if( pool->writers[idx].last_seq == NULL ) {
+            fprintf( stderr, "Out of memory: %s\n", strerror( errno ));
+            return( -1 );
+        }
+    }
+    pool->source_rate = source_rate;
+    pool->source_burst = source_burst;
+    pool->watermark = (uint64_t)pool->queue_size * watermark / 100;
+    if( pool->watermark == 0 ) {
+        pool->watermark = 1;
+    }
+    return( 0 );
+}
+
+
+/*
+ * take a token from the sender's bucket, returns 0 if it is empty
+ */
+static int writer_source_token( WRITER_POOL *pool, KNXTELEGRAM *telegram )
+{
+    SOURCE_BUCKET   *bucket = &pool->bucket[ntohs( telegram->frame.saddr )];
+    double          now;
+
+    now = telegram->tv.tv_sec + telegram->tv.tv_usec / 1e6;
+    if( now > bucket->last ) {
+        bucket->tokens += (now - bucket->last) * pool->source_rate;
+        if( bucket->tokens > pool->source_burst ) {
+            bucket->tokens = pool->source_burst;
+        }
+        bucket->last = now;
+    }
+    if( bucket->tokens < 1 ) {
+        return( 0 );
+    }
+    bucket->tokens -= 1;
+    return( 1 );
+}
+
+
+/*
+ * queue telegram for its writer
+ *
+ * blocks while the writer's queue is full; above the shedding watermark
+ * the telegram may be merged into a queued one or dropped instead
+ * returns 1 if the telegram was shed, must be called from one thread only
+ */
+int writer_pool_submit( WRITER_POOL *pool, KNXTELEGRAM *telegram )
+{
+    WRITER          *w;
+    KNXTELEGRAM     *queued;
+    uint16_t        daddr;
+    uint64_t        seq;
+    int             token = 1;
+    int             urgent = 0;
+
+    daddr = ntohs( telegram->frame.daddr );
+    // by address only, all telegrams of one address go through the same writer in order
+    if( pool->fast != NULL && fastlane_address( pool->lane, &telegram->frame )) {
+        w = pool->fast;
+    } else {
+        w = &pool->writers[daddr % pool->nwriters];
+        urgent = (pool->fast != NULL && fastlane_priority( pool->lane, &telegram->frame ));
+    }
+    if( pool->watermark != 0 && urgent == 0 ) {
+        token = writer_source_token( pool, telegram );
+    }
+
+    pthread_mutex_lock( &w->lock );
+    if( pool->watermark != 0 && w != pool->fast && urgent == 0 && w->count >= pool->watermark ) {
+        seq = w->last_seq[daddr];
+        if( seq > w->dequeued ) {
+            queued = &w->queue[(seq - 1) % pool->queue_size];
+            if( queued->frame.daddr == telegram->frame.daddr && queued->frame.ntwrk == telegram->frame.ntwrk &&
+                knx_service( &queued->frame ) == knx_service( &telegram->frame )) {
+                *queued = *telegram;
+                w->coalesced++;
+                pool->coalesced[daddr]++;
+                pthread_mutex_unlock( &w->lock );
+                return( 1 );
+            }
+        }
+        if( token == 0 ) {
+            w->limited++;
+            pool->limited[ntohs( telegram->frame.saddr )]++;
+            pthread_mutex_unlock( &w->lock );
+            return( 1 );
+        }
+    }
+    while( w->count == pool->queue_size && w->stop == 0 ) {
+        pthread_cond_wait( &w->not_full, &w->lock );
+    }
+    if( w->stop != 0 ) {
+        pthread_mutex_unlock( &w->lock );
+        return( -1 );
+    }
+    w->queue[(w->head + w->count) % pool->queue_size] = *telegram;
+    if( w->last_seq != NULL ) {
+        w->last_seq[daddr] = w->dequeued + w->count + 1;
+    }
+    w->count++;
+    if( urgent ) {
+        w->urgent_seq = w->dequeued + w->count;
+        w->urgent++;
+    }
+    if( w->count == 1 || w->count == pool->batch_size || w->immediate || urgent ) {
+        pthread_cond_signal( &w->not_empty );
+    }
+    pthread_mutex_unlock( &w->lock );
+
+    return( 0 );
+}
+
+
+/*
+ * print per writer statistics
+ */
+void writer_pool_stats( WRITER_POOL *pool, FILE *fp )
+{
+    WRITER          *w;
+    int             idx;
+
+    for( idx = 0; idx < pool->nwriters + (pool->fast != NULL); idx++ ) {
+        w = &pool->writers[idx];
+        pthread_mutex_lock( &w->lock );
+        if( w == pool->fast ) {
+            fprintf( fp, "fast lane: " );
+        } else {
+            fprintf( fp, "writer %2d: ", idx );
+        }
+        fprintf( fp, "%llu rows in %llu batches, %llu errors, %llu rows dropped, %u queued",
+                 (unsigned long long)w->rows, (unsigned long long)w->batches,
+                 (unsigned long long)w->errors, (unsigned long long)w->dropped, w->count );
+        if( pool->watermark != 0 && w != pool->fast ) {
+            fprintf( fp, ", shed %llu coalesced %llu rate limited",
+                     (unsigned long long)w->coalesced, (unsigned long long)w->limited );
+        }
+        if( pool->fast != NULL && w != pool->fast && pool->lane->rank >= 0 ) {
+            fprintf( fp, ", %llu by priority", (unsigned long long)w->urgent );
+        }
+        fprintf( fp, "\n" );
+        pthread_mutex_unlock( &w->lock );
+    }
+    if( pool->watermark != 0 ) {
+        writer_shed_top( fp, "coalesced", pool->coalesced, 0 );
+        writer_shed_top( fp, "rate limited", pool->limited, 1 );
+    }
+}
+
+
+/*
+ * print addresses with most shed telegrams
+ */
+static void writer_shed_top( FILE *fp, char *what, uint32_t *counters, int physical )
+{
+    uint32_t        top[WRITER_SHED_TOP];
+    uint32_t        addr;
+    int             found = 0;
+    int             pos;
+
+    for( addr = 0; addr < WRITER_ADDRESSES; addr++ ) {
+        if( counters[addr] == 0 || (found == WRITER_SHED_TOP && counters[addr] <= counters[top[found -1]]) ) {
+            continue;
+        }
+        pos = (found < WRITER_SHED_TOP) ? found++ : found -1;
+        while( pos > 0 && counters[top[pos -1]] < counters[addr] ) {
+            top[pos] = top[pos -1];
+            pos--;
+        }
+        top[pos] = addr;
+    }
+    if( found == 0 ) {
+        return;
+    }
+    fprintf( fp, "most %s:", what );
+    for( pos = 0; pos < found; pos++ ) {
+        if( physical ) {
+            fprintf( fp, " %d.%d.%d (%u)", top[pos] >> 12, (top[pos] >> 8) & 0x0f, top[pos] & 0xff, counters[top[pos]] );
+        } else {
+            fprintf( fp, " %d/%d/%d (%u)", top[pos] >> 11, (top[pos] >> 8) & 0x07, top[pos] & 0xff, counters[top[pos]] );
+        }
+    }
+    fprintf( fp, "\n" );
+}
+
+
+/*
+ * stop all writers after their queues have been written, and free pool
+ */
+void writer_pool_close( WRITER_POOL *pool )
+{
+    WRITER          *w;
+    int             nwriters;
+    int             idx;
+
+    nwriters = pool->nwriters + (pool->fast != NULL);
+    for( idx = 0; idx < nwriters; idx++ ) {
+        w = &pool->writers[idx];
+        pthread_mutex_lock( &w->lock );
+        w->stop = 1;
+        pthread_cond_broadcast( &w->not_empty );
+        pthread_cond_broadcast( &w->not_full );
+        pthread_mutex_unlock( &w->lock );
+    }
+    for( idx = 0; idx < nwriters; idx++ ) {
+        w = &pool->writers[idx];
+        if( w->running != 0 ) {
+            pthread_join( w->thread, NULL );
+        }
+        writer_disconnect( w );
+        pthread_mutex_destroy( &w->lock );
+        pthread_cond_destroy( &w->not_empty );
+        pthread_cond_destroy( &w->not_full );
+        free( w->queue );
+        free( w->batch );
+        free( w->last_seq );
+    }
+    free( pool->writers );
+    free( pool->bucket );
+    free( pool->coalesced );
+    free( pool->limited );
+    free( pool );
+}
+
+
+/*
+ * open connection and prepare statement for one writer
+ */
+static int writer_connect( WRITER *w )
+{
+    DBPARAMS        *db = &w->pool->db;
+
+    w->conn = mysql_init( NULL );
+    if( w->conn == NULL ) {
+        fprintf( stderr, "Writer %d: mysql_init() failed (probably out of memory)\n", w->id );
+        return( -1 );
+    }
+    if( db->init_conn != NULL ) {
+        db->init_conn( w->conn );
+    }
+    if( mysql_real_connect( w->conn, db->host, db->user, db->password, db->db,
+                            db->port, db->socket, db->flags ) == NULL ) {
+        fprintf( stderr, "Writer %d: connect failed: Error %u (%s): %s\n", w->id,
+                 mysql_errno( w->conn ), mysql_sqlstate( w->conn ), mysql_error( w->conn ));
+        return( -1 );
+    }
+    if( w->id == 0 && mysql_query( w->conn, create_stmt ) != 0 ) {
+        fprintf( stderr, "Could not create table: Error %u (%s): %s\n",
+                 mysql_errno( w->conn ), mysql_sqlstate( w->conn ), mysql_error( w->conn ));
+        return( -1 );
+    }
+    mysql_autocommit( w->conn, 0 );
+
+    w->stmt = mysql_stmt_init( w->conn );
+    if( w->stmt == NULL ) {
+        fprintf( stderr, "Writer %d: could not initialize statement handler\n", w->id );
+        return( -1 );
+    }
+    if( mysql_stmt_prepare( w->stmt, insert_stmt, strlen( insert_stmt )) != 0 ) {
+        fprintf( stderr, "Writer %d: could not prepare INSERT statement: Error %u (%s): %s\n", w->id,
+                 mysql_stmt_errno( w->stmt ), mysql_stmt_sqlstate( w->stmt ), mysql_stmt_error( w->stmt ));
+        return( -1 );
+    }
+    writer_bind( w );
+    if( mysql_stmt_bind_param( w->stmt, w->param ) != 0 ) {
+        fprintf( stderr, "Writer %d: could not bind parameters for INSERT: %s\n", w->id,
+                 mysql_stmt_error( w->stmt ));
+        return( -1 );
+    }
+
+    return( 0 );
+}
+
+
+/*
+ * close statement and connection of one writer, if open
+ */
+static void writer_disconnect( WRITER *w )
+{
+    if( w->stmt != NULL ) {
+        mysql_stmt_close( w->stmt );
+        w->stmt = NULL;
+    }
+    if( w->conn != NULL ) {
+        mysql_close( w->conn );
+        w->conn = NULL;
+    }
+}
+
+
+/*
+ * bind the writer's row buffer to the statement parameters
+ */
+static void writer_bind( WRITER *w )
+{
+    MYSQL_BIND      *param = w->param;
+    ROWBUF          *row = &w->row;
+
+    memset( param, 0, sizeof( w->param ));
+
+    param[0].buffer_type = MYSQL_TYPE_DATETIME;
+    param[0].buffer = &row->dt;
+    param[1].buffer_type = MYSQL_TYPE_SHORT;
+    param[1].buffer = &row->msec;
+    param[1].is_unsigned = 1;
+    param[2].buffer_type = MYSQL_TYPE_SHORT;
+    param[2].buffer = &row->saddr;
+    param[2].is_unsigned = 1;
+    param[3].buffer_type = MYSQL_TYPE_SHORT;
+    param[3].buffer = &row->daddr;
+    param[3].is_unsigned = 1;
+    param[4].buffer_type = MYSQL_TYPE_TINY;
+    param[4].buffer = &row->ctrl;
+    param[4].is_unsigned = 1;
+    param[5].buffer_type = MYSQL_TYPE_TINY;
+    param[5].buffer = &row->ntwrk;
+    param[5].is_unsigned = 1;
+    param[6].buffer_type = MYSQL_TYPE_STRING;
+    param[6].buffer = row->apci;
+    param[6].buffer_length = sizeof( row->apci );
+    param[6].length = &row->apci_length;
+    param[7].buffer_type = MYSQL_TYPE_TINY;
+    param[7].buffer = &row->length;
+    param[7].is_unsigned = 1;
+    param[8].buffer_type = MYSQL_TYPE_TINY;
+    param[8].buffer = &row->eis;
+    param[8].is_unsigned = 1;
+    param[9].buffer_type = MYSQL_TYPE_DOUBLE;
+    param[9].buffer = &row->value;
+    param[9].is_null = &row->value_null;
+    param[10].buffer_type = MYSQL_TYPE_BLOB;
+    param[10].buffer = row->raw;
+    param[10].buffer_length = sizeof( row->raw );
+    param[10].length = &row->raw_length;
+    param[11].buffer_type = MYSQL_TYPE_TINY;
+    param[11].buffer = &row->seen;
+    param[11].is_unsigned = 1;
+
+    row->apci_length = 1;
+}
+
+
+/*
+ * fill row buffer from telegram
+ */
+static void writer_fill_row( ROWBUF *row, KNXTELEGRAM *telegram )
+{
+    CEMIFRAME       *frame = &telegram->frame;
+    struct tm       tm;
+
+    localtime_r( &telegram->tv.tv_sec, &tm );
+    row->dt.year = tm.tm_year + 1900;
+    row->dt.month = tm.tm_mon + 1;
+    row->dt.day = tm.tm_mday;
+    row->dt.hour = tm.tm_hour;
+    row->dt.minute = tm.tm_min;
+    row->dt.second = tm.tm_sec;
+    row->dt.second_part = 0;
+    row->dt.neg = 0;
+    row->msec = telegram->tv.tv_usec / 1000;
+
+    row->saddr = ntohs( frame->saddr );
+    row->daddr = ntohs( frame->daddr );
+    row->ctrl = frame->ctrl;
+    row->ntwrk = frame->ntwrk;
+    row->apci[0] = knx_service( frame );
+    row->length = frame->length;
+    row->raw_length = frame->length + 1;
+    if( row->raw_length > sizeof( row->raw )) {
+        row->raw_length = sizeof( row->raw );
+    }
+    memcpy( row->raw, &frame->tpci, row->raw_length );
+    row->seen = telegram->seen;
+
+    row->value_null = (telegram_value( frame, &row->eis, &row->value ) != 0);
+}
+
+
+/*
+ * decode value of a write or answer telegram
+ *
+ * the value is decoded with the most common EIS type for the frame length
+ * returns -1 if there is no value to decode
+ */
+int telegram_value( CEMIFRAME *frame, uint8_t *eis, double *value )
+{
+    *eis = 0;
+    if( knx_service( frame ) == 'R' ) {
+        return( -1 );
+    }
+    switch( frame->length ) {
+        case 1:     *eis = 1; break;
+        case 2:     *eis = 6; break;
+        case 3:     *eis = 5; break;
+        case 4:     *eis = 3; break;
+        case 5:     *eis = 9; break;
+        default:    return( -1 );
+    }
+    return( telegram_value_eis( frame, *eis, value ));
+}
+
+
+/*
+ * decode value of a write or answer telegram with a known EIS type
+ */
+int telegram_value_eis( CEMIFRAME *frame, uint8_t eis, double *value )
+{
+    if( knx_service( frame ) == 'R' ) {
+        return( -1 );
+    }
+    return( eis_decode( eis, frame, value ));
+}
+
+
+/*
+ * write a batch of telegrams in one transaction, returns -1 if it was rolled back
+ */
+static int writer_insert( WRITER *w, KNXTELEGRAM *batch, unsigned int count )
+{
+    unsigned int    idx;
+
+    for( idx = 0; idx < count; idx++ ) {
+        writer_fill_row( &w->row, &batch[idx] );
+        if( mysql_stmt_execute( w->stmt ) != 0 ) {
+            fprintf( stderr, "Writer %d: could not execute INSERT: Error %u (%s): %s\n", w->id,
+                     mysql_stmt_errno( w->stmt ), mysql_stmt_sqlstate( w->stmt ), mysql_stmt_error( w->stmt ));
+            mysql_rollback( w->conn );
+            return( -1 );
+        }
+    }
+    if( mysql_commit( w->conn ) != 0 ) {
+        fprintf( stderr, "Writer %d: commit failed: Error %u (%s): %s\n", w->id,
+                 mysql_errno( w->conn ), mysql_sqlstate( w->conn ), mysql_error( w->conn ));
+        mysql_rollback( w->conn );
+        return( -1 );
+    }
+    return( 0 );
+}
+
+
+/*
+ * write a batch, reconnecting and retrying if it fails
+ */
+static void writer_flush( WRITER *w, KNXTELEGRAM *batch, unsigned int count )
+{
+    int             attempt;
+
+    for( attempt = 0; ; attempt++ ) {
+        if( w->stmt != NULL && writer_insert( w, batch, count ) == 0 ) {
+            w->rows += count;
+            w->batches++;
+            return;
+        }
+        w->errors++;
+        if( attempt == WRITER_RETRIES ) {
+            break;
+        }
+        usleep( (WRITER_RETRY_MS << attempt) * 1000 );
+        writer_disconnect( w );
+        if( writer_connect( w ) != 0 ) {
+            writer_disconnect( w );
+        }
+    }
+    fprintf( stderr, "Writer %d: %u rows dropped after %d retries\n", w->id, count, WRITER_RETRIES );
+    w->dropped += count;
+}
+
+
+/*
+ * writer thread
+ *
+ * waits for a full batch or the flush interval, whatever comes first
+ */
+static void *writer_thread( void *arg )
+{
+    WRITER          *w = arg;
+    WRITER_POOL     *pool = w->pool;
+    struct timeval  now;
+    struct timespec deadline;
+    unsigned int    count;
+    unsigned int    idx;
+
+    mysql_thread_init();
+
+    pthread_mutex_lock( &w->lock );
+    for( ;; ) {
+        while( w->count == 0 && w->stop == 0 ) {
+            pthread_cond_wait( &w->not_empty, &w->lock );
+        }
+        if( w->count == 0 ) {
+            break;
+        }
+        gettimeofday( &now, NULL );
+        deadline.tv_sec = now.tv_sec + pool->flush_ms / 1000;
+        deadline.tv_nsec = now.tv_usec * 1000 + (pool->flush_ms % 1000) * 1000000;
+        if( deadline.tv_nsec >= 1000000000 ) {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000;
+        }
+        while( w->count < pool->batch_size && w->stop == 0 && w->immediate == 0 && w->urgent_seq <= w->dequeued ) {
+            if( pthread_cond_timedwait( &w->not_empty, &w->lock, &deadline ) == ETIMEDOUT ) {
+                break;
+            }
+        }
+
+        count = (w->count < pool->batch_size) ? w->count : pool->batch_size;
+        for( idx = 0; idx < count; idx++ ) {
+            w->batch[idx] = w->queue[(w->head + idx) % pool->queue_size];
+        }
+        w->head = (w->head + count) % pool->queue_size;
+        w->count -= count;
+        w->dequeued += count;
+        pthread_cond_broadcast( &w->not_full );
+        pthread_mutex_unlock( &w->lock );
+
+        writer_flush( w, w->batch, count );
+
+        pthread_mutex_lock( &w->lock );
+    }
+    pthread_mutex_unlock( &w->lock );
+
+    mysql_thread_end();
+    return( NULL );
+}
@@ -0,0 +1,75 @@
+/*
+ * writer - parallel MySQL writer for captured telegrams
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#ifndef WRITER_H_
+#define WRITER_H_
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include <mysql.h>
+
+#include "knxframe.h"
+#include "fastlane.h"
+
+/*
+ * defaults
+ */
+#define WRITER_DEFAULT_WRITERS          1
+#define WRITER_MAX_WRITERS              64
+#define WRITER_DEFAULT_BATCH            256
+#define WRITER_DEFAULT_FLUSH_MS         1000
+#define WRITER_DEFAULT_QUEUE            8192
+#define WRITER_DEFAULT_WATERMARK        75              // percent of queue, 0 = never shed
+#define WRITER_DEFAULT_SOURCE_RATE      20              // telegrams per second and source
+#define WRITER_DEFAULT_SOURCE_BURST     100
+
+
+/*
+ * MySQL connection parameters, one connection is opened per writer
+ */
+typedef struct {
+        char            *host;
+        char            *user;
+        char            *password;
+        char            *db;
+        unsigned int    port;
+        char            *socket;
+        unsigned long   flags;
+        void            (*init_conn)( MYSQL *conn );    // optional, called before connecting
+} DBPARAMS;
+
+typedef struct writer_pool WRITER_POOL;
+
+
+/*
+ * function declarations
+ */
+extern WRITER_POOL  *writer_pool_open( DBPARAMS *db, int writers, unsigned int batch_size,
+                                       unsigned int flush_ms, unsigned int queue_size );
+extern int          writer_pool_shedding( WRITER_POOL *pool, unsigned int watermark,
+                                          unsigned int source_rate, unsigned int source_burst );
+extern int          writer_pool_fastlane( WRITER_POOL *pool, FASTLANE *lane );
+extern int          writer_pool_submit( WRITER_POOL *pool, KNXTELEGRAM *telegram );
+extern void         writer_pool_stats( WRITER_POOL *pool, FILE *fp );
+extern void         writer_pool_close( WRITER_POOL *pool );
+extern int          telegram_value( CEMIFRAME *frame, uint8_t *eis, double *value );
+extern int          telegram_value_eis( CEMIFRAME *frame, uint8_t eis, double *value );
+
+#endif /*WRITER_H_*/
@@ -0,0 +1,657 @@
+/*
+ * eibbroker - share one eibnetmux monitor connection between local tools
+ *
+ * eibnetmux - eibnet/ip multiplexer
+ * Copyright (C) 2006-2008 Urs Zurbuchen <software@marmira.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+/*!
+ * \example eibbroker.c
+ *
+ * Holds a single EIBnetmux monitoring connection and distributes the
+ * telegrams to local subscribers over a unix domain socket.
+ *
+ * Each subscriber registers address ranges which are evaluated here, so
+ * it only receives what it asked for. Records are collected per subscriber
+ * and written with one system call per batch. A subscriber that does not
+ * keep up gets the latest telegram per group address only (with a count
+ * of the telegrams it replaced) and is disconnected if it stops reading
+ * altogether; it never holds up the others.
+ *
+ * Telegrams on the fast lane (-p) are passed on ahead of the others
+ * read in the same batch, as long as telegrams of one group address keep
+ * their order.
+ */
+
+/*!
+ * \cond DeveloperDocs
+ * \brief eibbroker - share one eibnetmux monitor connection
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "../config.h"
+#endif
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <signal.h>
+#include <libgen.h>
+#include <getopt.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <time.h>
+#include <pthread.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/time.h>
+
+#include <eibnetmux/enmx_lib.h>
+#include "mylib.h"
+#include "knxframe.h"
+#include "broker.h"
+#include "fastlane.h"
+
+/*
+ * broker limits
+ */
+#define MAX_SUBSCRIBERS             64
+#define OUTBUF_SIZE                 65536           // per subscriber, bytes
+#define PENDING_MAX                 4096            // coalesced addresses per subscriber
+#define STALL_SECONDS               30              // disconnect subscriber not reading for this long
+#define READ_BATCH                  256             // telegrams taken from the monitor thread at once
+
+#define SUB_HANDSHAKE               0
+#define SUB_ACTIVE                  1
+
+
+/*
+ * subscriber
+ */
+typedef struct {
+        int             fd;
+        int             state;
+        uint16_t        flags;
+        uint8_t         *filter;                // bitmap of wanted group addresses, NULL = all
+        unsigned char   inbuf[8 + BROKER_MAX_FILTERS * 4];
+        unsigned int    inlen;
+        unsigned char   *out;
+        unsigned int    outstart;
+        unsigned int    outend;
+        KNXTELEGRAM     *pending;               // coalesced while behind, oldest first
+        uint16_t        *pending_merged;
+        int32_t         *pending_idx;           // slot in pending per group address, -1 = none
+        unsigned int    phead;
+        unsigned int    ptail;
+        time_t          stalled_since;
+        uint64_t        sent;
+        uint64_t        merged;
+        uint64_t        dropped;
+} SUBSCRIBER;
+
+
+/*
+ * Global variables
+ */
+ENMX_HANDLE     sock_con = 0;
+unsigned char   conn_state = 0;
+static volatile sig_atomic_t stop_broker = 0;
+static int      monitor_pipe[2];
+static SUBSCRIBER subscribers[MAX_SUBSCRIBERS];
+static int      nsubscribers = 0;
+static int      quiet = 0;
+
+/*
+ * local function declarations
+ */
+static void     Usage( char *progname );
+static void     broker_shutdown( int arg );
+static void     *monitor_thread( void *arg );
+static void     subscriber_accept( int listen_fd );
+static void     subscriber_drop( int idx, char *reason );
+static int      subscriber_handshake( SUBSCRIBER *sub );
+static void     subscriber_queue( SUBSCRIBER *sub, KNXTELEGRAM *telegram );
+static int      subscriber_flush( SUBSCRIBER *sub );
+
+
+static void Usage( char *progname )
+{
+    fprintf( stderr, "Usage: %s [options] [hostname[:port]]\n"
+                     "where:\n"
+                     "  hostname[:port]                      defines eibnetmux server with default port of 4390\n"
+                     "\n"
+                     "options:\n"
+                     "  -s socket                            subscriber socket                      default: " BROKER_DEFAULT_SOCKET "\n"
+                     "  -u user                              name of user                           default: -\n"
+                     "  -p file                              fast lane addresses and priority       default: -\n"
+                     "  -q                                   no verbose output (default: no)\n"
+                     "\n", basename( progname ));
+}
+
+
+/*
+ * broker_shutdown
+ *
+ * catches SIGINT and SIGTERM and stops the broker loop
+ */
+static void broker_shutdown( int arg )
+{
+    stop_broker = 1;
+}
+
+
+int main( int argc, char **argv )
+{
+    struct sockaddr_un      addr;
+    struct pollfd           fds[MAX_SUBSCRIBERS + 2];
+    KNXTELEGRAM             batch[READ_BATCH];
+    uint8_t                 ahead[READ_BATCH];
+    pthread_t               thread;
+    ssize_t                 len;
+    int                     listen_fd;
+    int                     c;
+    int                     idx;
+    int                     sub;
+    int                     count;
+    int                     fast;
+    int                     err;
+    FASTLANE                *lane = NULL;
+    char                    *user = NULL;
+    char                    pwd[255];
+    char                    *target;
+    char                    *path = BROKER_DEFAULT_SOCKET;
+
+    opterr = 0;
+    while( ( c = getopt( argc, argv, "s:u:p:q" )) != -1 ) {
+        switch( c ) {
+            case 's':
+                path = strdup( optarg );
+                break;
+            case 'u':
+                user = strdup( optarg );
+                break;
+            case 'p':
+                lane = fastlane_load( optarg );
+                if( lane == NULL ) {
+                    exit( -1 );
+                }
+                break;
+            case 'q':
+                quiet = 1;
+                break;
+            default:
+                fprintf( stderr, "Invalid option: %c\n", c );
+                Usage( argv[0] );
+                exit( -1 );
+        }
+    }
+    if( optind == argc ) {
+        target = NULL;
+    } else if( optind + 1 == argc ) {
+        target = argv[optind];
+    } else {
+        Usage( argv[0] );
+        exit( -1 );
+    }
+
+    // catch signals for shutdown, subscribers going away must not kill us
+    signal( SIGINT, broker_shutdown );
+    signal( SIGTERM, broker_shutdown );
+    signal( SIGPIPE, SIG_IGN );
+
+    // request monitoring connection
+    enmx_init();
+    sock_con = enmx_open( target, "eibbroker" );
+    if( sock_con < 0 ) {
+        fprintf( stderr, "Connect to eibnetmux failed (%d): %s\n", sock_con, enmx_errormessage( sock_con ));
+        exit( -2 );
+    }
+
+    // authenticate
+    if( user != NULL ) {
+        if( getpassword( pwd ) != 0 ) {
+            fprintf( stderr, "Error reading password - cannot continue\n" );
+            exit( -6 );
+        }
+        if( enmx_auth( sock_con, user, pwd ) != 0 ) {
+            fprintf( stderr, "Authentication failure\n" );
+            exit( -3 );
+        }
+    }
+    conn_state = 1;
+    if( quiet == 0 ) {
+        printf( "Connection to eibnetmux '%s' established\n", enmx_gethost( sock_con ));
+    }
+
+    // subscriber socket
+    listen_fd = socket( AF_UNIX, SOCK_STREAM, 0 );
+    memset( &addr, 0, sizeof( addr ));
+    addr.sun_family = AF_UNIX;
+    strncpy( addr.sun_path, path, sizeof( addr.sun_path ) -1 );
+    unlink( path );
+    if( listen_fd < 0 || bind( listen_fd, (struct sockaddr *)&addr, sizeof( addr )) != 0 ||
+        listen( listen_fd, 16 ) != 0 ) {
+        fprintf( stderr, "Unable to listen on %s: %s\n", path, strerror( errno ));
+        enmx_close( sock_con );
+        exit( -5 );
+    }
+    fcntl( listen_fd, F_SETFL, O_NONBLOCK );
+
+    // enmx_monitor() blocks, it gets a thread of its own which passes telegrams through a pipe
+    err = (pipe( monitor_pipe ) != 0) ? errno : pthread_create( &thread, NULL, monitor_thread, NULL );
+    if( err != 0 ) {
+        fprintf( stderr, "Unable to start monitor: %s\n", strerror( err ));
+        enmx_close( sock_con );
+        exit( -5 );
+    }
+    if( quiet == 0 ) {
+        printf( "Accepting subscribers on %s\n", path );
+    }
+
+    while( stop_broker == 0 ) {
+        fds[0].fd = monitor_pipe[0];
+        fds[0].events = POLLIN;
+        fds[1].fd = listen_fd;
+        fds[1].events = (nsubscribers < MAX_SUBSCRIBERS) ? POLLIN : 0;
+        for( sub = 0; sub < nsubscribers; sub++ ) {
+            fds[sub + 2].fd = subscribers[sub].fd;
+            fds[sub + 2].events = POLLIN;
+            if( subscribers[sub].outend > subscribers[sub].outstart ) {
+                fds[sub + 2].events |= POLLOUT;
+            }
+        }
+        if( poll( fds, nsubscribers + 2, 1000 ) < 0 ) {
+            if( errno == EINTR ) {
+                continue;
+            }
+            fprintf( stderr, "poll failed: %s\n", strerror( errno ));
+            break;
+        }
+
+        // distribute telegrams, filters are evaluated here
+        if( fds[0].revents & (POLLIN | POLLHUP) ) {
+            len = read( monitor_pipe[0], batch, sizeof( batch ));
+            if( len <= 0 ) {
+                fprintf( stderr, "Monitor connection lost\n" );
+                break;
+            }
+            count = len / sizeof( KNXTELEGRAM );
+            for( idx = 0; idx < count && lane != NULL; idx++ ) {
+                ahead[idx] = fastlane_address( lane, &batch[idx].frame );
+                if( ahead[idx] == 0 && fastlane_priority( lane, &batch[idx].frame )) {
+                    // not past an earlier telegram to the same address
+                    ahead[idx] = 1;
+                    for( sub = 0; sub < idx && ahead[idx] != 0; sub++ ) {
+                        if( ahead[sub] == 0 && batch[sub].frame.daddr == batch[idx].frame.daddr &&
+                            batch[sub].frame.ntwrk == batch[idx].frame.ntwrk ) {
+                            ahead[idx] = 0;
+                        }
+                    }
+                }
+            }
+            for( fast = (lane != NULL); fast >= 0; fast-- ) {
+                for( idx = 0; idx < count; idx++ ) {
+                    if( lane != NULL && ahead[idx] != fast ) {
+                        continue;
+                    }
+                    for( sub = 0; sub < nsubscribers; sub++ ) {
+                        if( subscribers[sub].state == SUB_ACTIVE ) {
+                            subscriber_queue( &subscribers[sub], &batch[idx] );
+                        }
+                    }
+                }
+            }
+        }
+
+        // subscriber input and output, backwards as subscriber_drop() moves the last one
+        for( sub = nsubscribers -1; sub >= 0; sub-- ) {
+            if( fds[sub + 2].revents & (POLLIN | POLLHUP | POLLERR) ) {
+                if( subscriber_handshake( &subscribers[sub] ) != 0 ) {
+                    subscriber_drop( sub, "disconnected" );
+                    continue;
+                }
+            }
+            if( subscriber_flush( &subscribers[sub] ) != 0 ) {
+                subscriber_drop( sub, "stalled" );
+            }
+        }
+
+        if( fds[1].revents & POLLIN ) {
+            subscriber_accept( listen_fd );
+        }
+    }
+
+    fprintf( stderr, "Shutting down\n" );
+    while( nsubscribers > 0 ) {
+        subscriber_drop( nsubscribers -1, "broker shutdown" );
+    }
+    close( listen_fd );
+    unlink( path );
+    enmx_close( sock_con );
+    return( 0 );
+}
+
+
+/*
+ * monitor thread
+ *
+ * each telegram is written to the pipe on its own, writes below PIPE_BUF are atomic
+ */
+static void *monitor_thread( void *arg )
+{
+    uint16_t                value_size;
+    uint16_t                buflen;
+    unsigned char           *buf;
+    KNXTELEGRAM             telegram;
+    sigset_t                sigs;
+
+    // signals are for the main loop
+    sigemptyset( &sigs );
+    sigaddset( &sigs, SIGINT );
+    sigaddset( &sigs, SIGTERM );
+    pthread_sigmask( SIG_BLOCK, &sigs, NULL );
+
+    buf = malloc( 10 );
+    buflen = 10;
+    for( ;; ) {
+        buf = enmx_monitor( sock_con, 0xffff, buf, &buflen, &value_size );
+        if( buf == NULL ) {
+            switch( enmx_geterror( sock_con )) {
+                case ENMX_E_COMMUNICATION:
+                case ENMX_E_NO_CONNECTION:
+                case ENMX_E_WRONG_USAGE:
+                case ENMX_E_NO_MEMORY:
+                    fprintf( stderr, "Error on read: %s\n", enmx_errormessage( sock_con ));
+                    close( monitor_pipe[1] );
+                    return( NULL );
+                case ENMX_E_SERVER_ABORTED:
+                    fprintf( stderr, "EOF reached: %s\n", enmx_errormessage( sock_con ));
+                    close( monitor_pipe[1] );
+                    return( NULL );
+                case ENMX_E_INTERNAL:
+                    fprintf( stderr, "Bad status returned\n" );
+                    break;
+                case ENMX_E_TIMEOUT:
+                    break;
+            }
+            continue;
+        }
+        gettimeofday( &telegram.tv, NULL );
+        memset( &telegram.frame, 0, sizeof( CEMIFRAME ));
+        memcpy( &telegram.frame, buf, (value_size < sizeof( CEMIFRAME )) ? value_size : sizeof( CEMIFRAME ));
+        if( write( monitor_pipe[1], &telegram, sizeof( telegram )) != sizeof( telegram )) {
+            return( NULL );
+        }
+    }
+}
+
+
+/*
+ * accept new subscriber
+ */
+static void subscriber_accept( int listen_fd )
+{
+    SUBSCRIBER              *sub;
+    int                     fd;
+
+    fd = accept( listen_fd, NULL, NULL );
+    if( fd < 0 ) {
+        return;
+    }
+    fcntl( fd, F_SETFL, O_NONBLOCK );
+
+    sub = &subscribers[nsubscribers];
+    memset( sub, 0, sizeof( SUBSCRIBER ));
+    sub->fd = fd;
+    sub->state = SUB_HANDSHAKE;
+    sub->out = malloc( OUTBUF_SIZE );
+    if( sub->out == NULL ) {
+        close( fd );
+        return;
+    }
+    nsubscribers++;
+}
+
+
+/*
+ * remove subscriber
+ */
+static void subscriber_drop( int idx, char *reason )
+{
+    SUBSCRIBER              *sub = &subscribers[idx];
+
+    if( quiet == 0 && sub->state == SUB_ACTIVE ) {
+        fprintf( stderr, "Subscriber %d %s: %llu sent, %llu merged, %llu dropped\n", sub->fd, reason,
+                 (unsigned long long)sub->sent, (unsigned long long)sub->merged, (unsigned long long)sub->dropped );
+    }
+    close( sub->fd );
+    free( sub->filter );
+    free( sub->out );
+    free( sub->pending );
+    free( sub->pending_merged );
+    free( sub->pending_idx );
+
+    nsubscribers--;
+    if( idx != nsubscribers ) {
+        subscribers[idx] = subscribers[nsubscribers];
+    }
+}
+
+
+/*
+ * read subscription, anything a subscriber sends later is ignored
+ *
+ * returns -1 if the subscriber has gone or sent garbage
+ */
+static int subscriber_handshake( SUBSCRIBER *sub )
+{
+    unsigned char           scratch[256];
+    uint32_t                magic;
+    uint16_t                u16;
+    unsigned int            count;
+    unsigned int            first;
+    unsigned int            last;
+    unsigned int            addr;
+    unsigned int            idx;
+    ssize_t                 len;
+
+    if( sub->state == SUB_ACTIVE ) {
+        len = read( sub->fd, scratch, sizeof( scratch ));
+        return( (len == 0 || (len < 0 && errno != EAGAIN && errno != EINTR)) ? -1 : 0 );
+    }
+
+    len = read( sub->fd, sub->inbuf + sub->inlen, sizeof( sub->inbuf ) - sub->inlen );
+    if( len == 0 || (len < 0 && errno != EAGAIN && errno != EINTR) ) {
+        return( -1 );
+    }
+    if( len > 0 ) {
+        sub->inlen += len;
+    }
+    if( sub->inlen < 8 ) {
+        return( 0 );
+    }
+    memcpy( &magic, sub->inbuf, 4 );
+    memcpy( &u16, sub->inbuf + 6, 2 );
+    count = ntohs( u16 );
+    if( ntohl( magic ) != BROKER_MAGIC || count > BROKER_MAX_FILTERS ) {
+        return( -1 );
+    }
+    if( sub->inlen < 8 + count * 4 ) {
+        return( 0 );
+    }
+
+    memcpy( &u16, sub->inbuf + 4, 2 );
+    sub->flags = ntohs( u16 );
+    if( count > 0 ) {
+        sub->filter = calloc( 65536 / 8, 1 );
+        if( sub->filter == NULL ) {
+            return( -1 );
+        }
+        for( idx = 0; idx < count; idx++ ) {
+            memcpy( &u16, sub->inbuf + 8 + idx * 4, 2 );
+            first = ntohs( u16 );
+            memcpy( &u16, sub->inbuf + 10 + idx * 4, 2 );
+            last = ntohs( u16 );
+            for( addr = first; addr <= last; addr++ ) {
+                sub->filter[addr >> 3] |= 1 << (addr & 7);
+            }
+        }
+    }
+    sub->state = SUB_ACTIVE;
+    if( quiet == 0 ) {
+        fprintf( stderr, "Subscriber %d: %u address ranges\n", sub->fd, count );
+    }
+    return( 0 );
+}
+
+
+/*
+ * queue telegram for subscriber if it matches its filter
+ *
+ * while the subscriber is behind, telegrams for the same group address
+ * replace each other; frames to physical addresses are dropped then
+ */
+static void subscriber_queue( SUBSCRIBER *sub, KNXTELEGRAM *telegram )
+{
+    uint16_t                daddr;
+    int32_t                 slot;
+    unsigned int            idx;
+
+    daddr = ntohs( telegram->frame.daddr );
+    if( telegram->frame.ntwrk & EIB_DAF_GROUP ) {
+        if( sub->filter != NULL && !(sub->filter[daddr >> 3] & (1 << (daddr & 7))) ) {
+            return;
+        }
+    } else if( !(sub->flags & BROKER_F_PHYSICAL) ) {
+        return;
+    }
+
+    // keeping up: straight into the output buffer
+    if( sub->phead == sub->ptail && OUTBUF_SIZE - sub->outend >= BROKER_RECORD_MAX ) {
+        sub->outend += broker_encode( sub->out + sub->outend, telegram, 0 );
+        sub->sent++;
+        return;
+    }
+
+    // behind: coalesce per group address
+    if( !(telegram->frame.ntwrk & EIB_DAF_GROUP) ) {
+        sub->dropped++;
+        return;
+    }
+    if( sub->pending_idx == NULL ) {
+        sub->pending = malloc( PENDING_MAX * sizeof( KNXTELEGRAM ));
+        sub->pending_merged = malloc( PENDING_MAX * sizeof( uint16_t ));
+        sub->pending_idx = malloc( 65536 * sizeof( int32_t ));
+        if( sub->pending == NULL || sub->pending_merged == NULL || sub->pending_idx == NULL ) {
+            sub->dropped++;
+            return;
+        }
+        memset( sub->pending_idx, 0xff, 65536 * sizeof( int32_t ));
+    }
+    slot = sub->pending_idx[daddr];
+    if( slot >= 0 ) {
+        sub->pending[slot] = *telegram;
+        if( sub->pending_merged[slot] < UINT16_MAX ) {
+            sub->pending_merged[slot]++;
+        }
+        sub->merged++;
+        return;
+    }
+    if( sub->ptail == PENDING_MAX && sub->phead > 0 ) {
+        // compact
+        for( idx = sub->phead; idx < sub->ptail; idx++ ) {
+            sub->pending[idx - sub->phead] = sub->pending[idx];
+            sub->pending_merged[idx - sub->phead] = sub->pending_merged[idx];
+            sub->pending_idx[ntohs( sub->pending[idx].frame.daddr )] = idx - sub->phead;
+        }
+        sub->ptail -= sub->phead;
+        sub->phead = 0;
+    }
+    if( sub->ptail == PENDING_MAX ) {
+        sub->dropped++;
+        return;
+    }
+    sub->pending[sub->ptail] = *telegram;
+    sub->pending_merged[sub->ptail] = 0;
+    sub->pending_idx[daddr] = sub->ptail;
+    sub->ptail++;
+}
+
+
+/*
+ * write as much queued output as the subscriber takes, in one system call
+ *
+ * returns -1 if the subscriber has not taken anything for too long
+ */
+static int subscriber_flush( SUBSCRIBER *sub )
+{
+    KNXTELEGRAM             *telegram;
+    ssize_t                 len;
+
+    for( ;; ) {
+        // refill from the coalesced telegrams, oldest first
+        while( sub->phead < sub->ptail && OUTBUF_SIZE - sub->outend >= BROKER_RECORD_MAX ) {
+            telegram = &sub->pending[sub->phead];
+            sub->pending_idx[ntohs( telegram->frame.daddr )] = -1;
+            sub->outend += broker_encode( sub->out + sub->outend, telegram, sub->pending_merged[sub->phead] );
+            sub->sent++;
+            sub->phead++;
+        }
+        if( sub->phead == sub->ptail ) {
+            sub->phead = sub->ptail = 0;
+        }
+        if( sub->outend == sub->outstart ) {
+            sub->stalled_since = 0;
+            return( 0 );
+        }
+
+        len = write( sub->fd, sub->out + sub->outstart, sub->outend - sub->outstart );
+        if( len < 0 ) {
+            if( errno != EAGAIN && errno != EINTR ) {
+                return( -1 );
+            }
+            len = 0;
+        }
+        if( len > 0 ) {
+            sub->stalled_since = 0;
+        } else if( sub->stalled_since == 0 ) {
+            sub->stalled_since = time( NULL );
+        } else if( time( NULL ) - sub->stalled_since > STALL_SECONDS ) {
+            return( -1 );
+        }
+
+        sub->outstart += len;
+        if( sub->outstart < sub->outend ) {
+            // socket full, keep the rest for POLLOUT
+            if( sub->outstart > OUTBUF_SIZE / 2 ) {
+                memmove( sub->out, sub->out + sub->outstart, sub->outend - sub->outstart );
+                sub->outend -= sub->outstart;
+                sub->outstart = 0;
+            }
+            return( 0 );
+        }
+        sub->outstart = sub->outend = 0;
+        if( sub->phead == sub->ptail ) {
+            return( 0 );
+        }
+    }
+}
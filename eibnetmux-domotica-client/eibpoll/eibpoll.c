@@ -0,0 +1,660 @@
+/*
+ * eibpoll - read many group addresses with pipelined requests
+ *
+ * eibnetmux - eibnet/ip multiplexer
+ * Copyright (C) 2006-2008 Urs Zurbuchen <software@marmira.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+/*!
+ * \example eibpoll.c
+ *
+ * Refreshes a list of group addresses with a bounded number of group
+ * reads in flight.
+ *
+ * enmx_read() blocks until its answer arrives, so every read in flight
+ * runs in a worker process with a connection of its own. Answers are
+ * matched by group address, either from a worker or from a monitor
+ * process which sees answer telegrams on the bus (also answers to reads
+ * that already timed out). Timeouts and retries are kept in a timer
+ * wheel, so checking them costs the same for 10 or 10000 addresses.
+ */
+
+/*!
+ * \cond DeveloperDocs
+ * \brief eibpoll - pipelined group reads
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "../config.h"
+#endif
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <signal.h>
+#include <libgen.h>
+#include <getopt.h>
+#include <errno.h>
+#include <poll.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+
+#include <eibnetmux/enmx_lib.h>
+#include "mylib.h"
+#include "knxframe.h"
+#include "broker.h"
+
+/*
+ * poller limits
+ */
+#define DEFAULT_INFLIGHT            8
+#define MAX_INFLIGHT                64
+#define DEFAULT_TIMEOUT_MS          2000
+#define DEFAULT_RETRIES             2
+#define MAX_REQUESTS                65536
+#define WHEEL_SLOTS                 256             // power of two
+#define WHEEL_TICK_MS               10
+
+#define REQ_QUEUED                  0
+#define REQ_INFLIGHT                1
+#define REQ_DONE                    2
+#define REQ_FAILED                  3
+
+
+/*
+ * worker answer, also used for answers seen by the monitor
+ */
+typedef struct {
+        uint16_t        addr;                   // host byte order
+        uint8_t         status;                 // 0 = ok
+        uint8_t         length;
+        unsigned char   data[16];
+} READ_RESULT;
+
+/*
+ * one group address to refresh
+ */
+typedef struct request {
+        uint16_t        addr;
+        uint8_t         state;
+        uint8_t         attempts;
+        uint32_t        expires;                // wheel tick
+        struct request  *next;                  // wheel slot list
+        struct request  *prev;
+        struct timeval  sent;                   // first attempt
+        uint32_t        latency;                // ms, first attempt to answer
+        uint8_t         length;
+        unsigned char   data[16];
+} REQUEST;
+
+typedef struct {
+        pid_t           pid;
+        int             fd;
+        int             busy;
+        uint16_t        addr;
+} WORKER;
+
+
+/*
+ * Global variables
+ */
+ENMX_HANDLE     sock_con = 0;
+unsigned char   conn_state = 0;
+static volatile sig_atomic_t stop_poll = 0;
+static REQUEST  *requests;
+static int      nrequests = 0;
+static int32_t  *by_addr;                       // request index per group address, -1 = none
+static int      *queue;                         // ring of request indices waiting for a worker
+static unsigned int qhead = 0;
+static unsigned int qtail = 0;
+static REQUEST  *wheel[WHEEL_SLOTS];
+static uint32_t wheel_now = 0;
+static int      finished = 0;
+static int      quiet = 0;
+
+/*
+ * local function declarations
+ */
+static void     Usage( char *progname );
+static void     poll_shutdown( int arg );
+static int      load_addresses( char *file );
+static ENMX_HANDLE connect_eibnetmux( char *target, char *user, char *pwd, char *name );
+static pid_t    start_worker( WORKER *worker, char *target, char *user, char *pwd );
+static pid_t    start_monitor( int *fd, char *target, char *user, char *pwd, char *broker );
+static void     wheel_insert( REQUEST *req, uint32_t ticks );
+static void     wheel_remove( REQUEST *req );
+static void     request_answer( READ_RESULT *result );
+static void     request_retry( REQUEST *req, int retries );
+static char     *group_text( uint16_t grp_addr );
+
+
+static void Usage( char *progname )
+{
+    fprintf( stderr, "Usage: %s [options] [hostname[:port]]\n"
+                     "where:\n"
+                     "  hostname[:port]                      defines eibnetmux server with default port of 4390\n"
+                     "\n"
+                     "options:\n"
+                     "  -f file                              group addresses to read, one per line or first-last, - = stdin\n"
+                     "  -n inflight                          reads in flight (default %d, max %d)\n"
+                     "  -t ms                                timeout per read (default %d)\n"
+                     "  -r retries                           retries after timeout (default %d)\n"
+                     "  -b socket                            match answers from eibbroker instead of a monitor connection\n"
+                     "  -u user                              name of user\n"
+                     "  -q                                   no verbose output\n"
+                     "\n", basename( progname ), DEFAULT_INFLIGHT, MAX_INFLIGHT, DEFAULT_TIMEOUT_MS, DEFAULT_RETRIES );
+}
+
+
+static void poll_shutdown( int arg )
+{
+    stop_poll = 1;
+}
+
+
+/*
+ * read address list, returns number of addresses or -1
+ */
+static int load_addresses( char *file )
+{
+    FILE            *fp;
+    char            line[128];
+    char            *sep;
+    uint16_t        first;
+    uint16_t        last;
+    uint32_t        addr;
+
+    fp = (strcmp( file, "-" ) == 0) ? stdin : fopen( file, "r" );
+    if( fp == NULL ) {
+        fprintf( stderr, "Unable to open %s: %s\n", file, strerror( errno ));
+        return( -1 );
+    }
+    while( fgets( line, sizeof( line ), fp ) != NULL ) {
+        if( (sep = strpbrk( line, "#\r\n" )) != NULL ) {
+            *sep = '\0';
+        }
+        if( line[strspn( line, " \t" )] == '\0' ) {
+            continue;
+        }
+        if( (sep = strchr( line, '-' )) != NULL ) {
+            *sep++ = '\0';
+        }
+        if( knx_parse_group( line + strspn( line, " \t" ), &first ) != 0 ||
+            knx_parse_group( (sep != NULL) ? sep + strspn( sep, " \t" ) : line + strspn( line, " \t" ), &last ) != 0 ||
+            last < first ) {
+            fprintf( stderr, "Invalid group address: %s\n", line );
+            goto failed;
+        }
+        for( addr = first; addr <= last; addr++ ) {
+            if( by_addr[addr] >= 0 ) {
+                continue;
+            }
+            by_addr[addr] = nrequests;
+            requests[nrequests].addr = addr;
+            queue[qtail++ % MAX_REQUESTS] = nrequests;
+            nrequests++;
+        }
+    }
+    if( fp != stdin ) {
+        fclose( fp );
+    }
+    return( nrequests );
+
+failed:
+    if( fp != stdin ) {
+        fclose( fp );
+    }
+    return( -1 );
+}
+
+
+static ENMX_HANDLE connect_eibnetmux( char *target, char *user, char *pwd, char *name )
+{
+    ENMX_HANDLE     handle;
+
+    enmx_init();
+    handle = enmx_open( target, name );
+    if( handle < 0 ) {
+        fprintf( stderr, "Connect to eibnetmux failed (%d): %s\n", handle, enmx_errormessage( handle ));
+        exit( -2 );
+    }
+    if( user != NULL && enmx_auth( handle, user, pwd ) != 0 ) {
+        fprintf( stderr, "Authentication failure\n" );
+        exit( -3 );
+    }
+    return( handle );
+}
+
+
+/*
+ * worker process: one blocking enmx_read() at a time
+ */
+static pid_t start_worker( WORKER *worker, char *target, char *user, char *pwd )
+{
+    READ_RESULT     result;
+    unsigned char   *data;
+    uint16_t        len;
+    int             fds[2];
+
+    if( socketpair( AF_UNIX, SOCK_SEQPACKET, 0, fds ) != 0 ) {
+        return( -1 );
+    }
+    worker->pid = fork();
+    if( worker->pid != 0 ) {
+        close( fds[1] );
+        worker->fd = fds[0];
+        return( worker->pid );
+    }
+
+    close( fds[0] );
+    signal( SIGINT, SIG_IGN );
+    signal( SIGTERM, SIG_DFL );
+    sock_con = connect_eibnetmux( target, user, pwd, "eibpoll" );
+    while( read( fds[1], &result.addr, sizeof( result.addr )) == sizeof( result.addr )) {
+        len = 0;
+        data = enmx_read( sock_con, result.addr, &len );
+        result.status = (data == NULL);
+        result.length = (len < sizeof( result.data )) ? len : sizeof( result.data );
+        if( data != NULL ) {
+            memcpy( result.data, data, result.length );
+            free( data );
+        }
+        if( write( fds[1], &result, sizeof( result )) != sizeof( result )) {
+            break;
+        }
+    }
+    enmx_close( sock_con );
+    _exit( 0 );
+}
+
+
+/*
+ * monitor process: passes answer telegrams to group addresses on
+ */
+static pid_t start_monitor( int *fd, char *target, char *user, char *pwd, char *broker )
+{
+    BROKER_CLIENT   *client = NULL;
+    KNXTELEGRAM     telegram;
+    READ_RESULT     result;
+    CEMIFRAME       *frame;
+    unsigned char   *buf;
+    uint16_t        buflen;
+    uint16_t        value_size;
+    int             fds[2];
+    pid_t           pid;
+
+    if( socketpair( AF_UNIX, SOCK_SEQPACKET, 0, fds ) != 0 ) {
+        return( -1 );
+    }
+    pid = fork();
+    if( pid != 0 ) {
+        close( fds[1] );
+        *fd = fds[0];
+        return( pid );
+    }
+
+    close( fds[0] );
+    signal( SIGINT, SIG_IGN );
+    signal( SIGTERM, SIG_DFL );
+    if( broker != NULL ) {
+        client = broker_connect( broker, 0, NULL, 0 );
+        if( client == NULL ) {
+            _exit( -2 );
+        }
+    } else {
+        sock_con = connect_eibnetmux( target, user, pwd, "eibpoll" );
+    }
+    buflen = 10;
+    buf = malloc( buflen );
+    for( ;; ) {
+        if( client != NULL ) {
+            if( broker_next( client, &telegram, NULL ) != 0 ) {
+                break;
+            }
+            frame = &telegram.frame;
+        } else {
+            buf = enmx_monitor( sock_con, 0xffff, buf, &buflen, &value_size );
+            if( buf == NULL ) {
+                break;
+            }
+            frame = (CEMIFRAME *)buf;
+        }
+        if( !(frame->ntwrk & EIB_DAF_GROUP) || knx_service( frame ) != 'A' ) {
+            continue;
+        }
+        // same layout as enmx_read(): small values live in the apci byte
+        result.addr = ntohs( frame->daddr );
+        result.status = 0;
+        if( frame->length <= 1 ) {
+            result.length = 1;
+            result.data[0] = frame->apci & 0x3f;
+        } else {
+            result.length = (frame->length -1 < sizeof( result.data )) ? frame->length -1 : sizeof( result.data );
+            memcpy( result.data, frame->data, result.length );
+        }
+        if( write( fds[1], &result, sizeof( result )) != sizeof( result )) {
+            break;
+        }
+    }
+    _exit( 0 );
+}
+
+
+/*
+ * timer wheel
+ *
+ * requests are kept in the slot of their expiry tick, modulo WHEEL_SLOTS;
+ * a slot is only visited when its tick passes
+ */
+static void wheel_insert( REQUEST *req, uint32_t ticks )
+{
+    REQUEST         **slot;
+
+    req->expires = wheel_now + ticks;
+    slot = &wheel[req->expires & (WHEEL_SLOTS -1)];
+    req->prev = NULL;
+    req->next = *slot;
+    if( *slot != NULL ) {
+        (*slot)->prev = req;
+    }
+    *slot = req;
+}
+
+
+static void wheel_remove( REQUEST *req )
+{
+    if( req->prev != NULL ) {
+        req->prev->next = req->next;
+    } else {
+        wheel[req->expires & (WHEEL_SLOTS -1)] = req->next;
+    }
+    if( req->next != NULL ) {
+        req->next->prev = req->prev;
+    }
+    req->next = req->prev = NULL;
+}
+
+
+/*
+ * answer for a group address, from a worker or the monitor
+ */
+static void request_answer( READ_RESULT *result )
+{
+    REQUEST         *req;
+    struct timeval  now;
+
+    if( by_addr[result->addr] < 0 ) {
+        return;
+    }
+    req = &requests[by_addr[result->addr]];
+    if( req->state == REQ_DONE || result->status != 0 ) {
+        return;
+    }
+    if( req->state == REQ_INFLIGHT ) {
+        wheel_remove( req );
+    }
+    if( req->attempts > 0 ) {
+        gettimeofday( &now, NULL );
+        req->latency = (now.tv_sec - req->sent.tv_sec) * 1000 + (now.tv_usec - req->sent.tv_usec) / 1000;
+    }
+    if( req->state == REQ_FAILED ) {
+        finished--;                             // late answer after giving up
+    }
+    req->state = REQ_DONE;
+    req->length = result->length;
+    memcpy( req->data, result->data, result->length );
+    finished++;
+
+    printf( "%-9s : %s (%d attempts, %u ms)\n", group_text( req->addr ),
+            hexdump( req->data, req->length, 1 ), req->attempts, req->latency );
+}
+
+
+/*
+ * read timed out, queue it again or give up
+ */
+static void request_retry( REQUEST *req, int retries )
+{
+    if( req->attempts <= retries ) {
+        req->state = REQ_QUEUED;
+        queue[qtail++ % MAX_REQUESTS] = req - requests;
+        return;
+    }
+    req->state = REQ_FAILED;
+    finished++;
+    if( quiet == 0 ) {
+        fprintf( stderr, "%-9s : no answer after %d attempts\n", group_text( req->addr ), req->attempts );
+    }
+}
+
+
+/*
+ * Return representation of group address given in host byte order
+ */
+static char *group_text( uint16_t grp_addr )
+{
+    static char     textual[16];
+
+    sprintf( textual, "%d/%d/%d", (grp_addr & 0x7800) >> 11, (grp_addr & 0x0700) >> 8, grp_addr & 0x00ff );
+    return( textual );
+}
+
+
+int main( int argc, char **argv )
+{
+    WORKER                  workers[MAX_INFLIGHT];
+    struct pollfd           fds[MAX_INFLIGHT + 1];
+    READ_RESULT             result;
+    REQUEST                 *req;
+    REQUEST                 *expired;
+    struct timeval          start;
+    struct timeval          now;
+    uint32_t                elapsed;
+    pid_t                   monitor_pid;
+    int                     monitor_fd = -1;
+    int                     inflight = DEFAULT_INFLIGHT;
+    int                     timeout = DEFAULT_TIMEOUT_MS;
+    int                     retries = DEFAULT_RETRIES;
+    int                     answered = 0;
+    int                     c;
+    int                     idx;
+    char                    *file = NULL;
+    char                    *broker = NULL;
+    char                    *user = NULL;
+    char                    pwd[255];
+    char                    *target;
+
+    opterr = 0;
+    while( ( c = getopt( argc, argv, "f:n:t:r:b:u:q" )) != -1 ) {
+        switch( c ) {
+            case 'f':
+                file = strdup( optarg );
+                break;
+            case 'n':
+                inflight = atoi( optarg );
+                break;
+            case 't':
+                timeout = atoi( optarg );
+                break;
+            case 'r':
+                retries = atoi( optarg );
+                break;
+            case 'b':
+                broker = strdup( optarg );
+                break;
+            case 'u':
+                user = strdup( optarg );
+                break;
+            case 'q':
+                quiet = 1;
+                break;
+            default:
+                fprintf( stderr, "Invalid option: %c\n", c );
+                Usage( argv[0] );
+                exit( -1 );
+        }
+    }
+    if( optind == argc ) {
+        target = NULL;
+    } else if( optind + 1 == argc ) {
+        target = argv[optind];
+    } else {
+        Usage( argv[0] );
+        exit( -1 );
+    }
+    if( file == NULL || inflight < 1 || inflight > MAX_INFLIGHT || timeout < WHEEL_TICK_MS || retries < 0 ) {
+        Usage( argv[0] );
+        exit( -1 );
+    }
+
+    requests = calloc( MAX_REQUESTS, sizeof( REQUEST ));
+    by_addr = malloc( MAX_REQUESTS * sizeof( int32_t ));
+    queue = malloc( MAX_REQUESTS * sizeof( int ));
+    if( requests == NULL || by_addr == NULL || queue == NULL ) {
+        fprintf( stderr, "Out of memory\n" );
+        exit( -4 );
+    }
+    memset( by_addr, 0xff, MAX_REQUESTS * sizeof( int32_t ));
+    if( load_addresses( file ) <= 0 ) {
+        exit( -1 );
+    }
+    if( user != NULL && getpassword( pwd ) != 0 ) {
+        fprintf( stderr, "Error reading password - cannot continue\n" );
+        exit( -6 );
+    }
+
+    signal( SIGINT, poll_shutdown );
+    signal( SIGTERM, poll_shutdown );
+    signal( SIGPIPE, SIG_IGN );
+
+    // one connection per read in flight, plus the monitor
+    if( inflight > nrequests ) {
+        inflight = nrequests;
+    }
+    monitor_pid = start_monitor( &monitor_fd, target, user, pwd, broker );
+    if( monitor_pid < 0 ) {
+        fprintf( stderr, "Unable to start monitor: %s\n", strerror( errno ));
+        exit( -5 );
+    }
+    for( idx = 0; idx < inflight; idx++ ) {
+        if( start_worker( &workers[idx], target, user, pwd ) < 0 ) {
+            fprintf( stderr, "Unable to start workers: %s\n", strerror( errno ));
+            exit( -5 );
+        }
+        workers[idx].busy = 0;
+    }
+    if( quiet == 0 ) {
+        fprintf( stderr, "Reading %d group addresses, %d in flight\n", nrequests, inflight );
+    }
+
+    gettimeofday( &start, NULL );
+    while( stop_poll == 0 && finished < nrequests ) {
+        // hand queued reads to idle workers
+        for( idx = 0; idx < inflight && qhead != qtail; idx++ ) {
+            if( workers[idx].busy ) {
+                continue;
+            }
+            req = &requests[queue[qhead++ % MAX_REQUESTS]];
+            if( req->state != REQ_QUEUED ) {
+                idx--;
+                continue;
+            }
+            if( write( workers[idx].fd, &req->addr, sizeof( req->addr )) != sizeof( req->addr )) {
+                fprintf( stderr, "Worker %d lost\n", idx );
+                exit( -5 );
+            }
+            if( req->attempts++ == 0 ) {
+                gettimeofday( &req->sent, NULL );
+            }
+            req->state = REQ_INFLIGHT;
+            wheel_insert( req, (timeout + WHEEL_TICK_MS -1) / WHEEL_TICK_MS );
+            workers[idx].busy = 1;
+            workers[idx].addr = req->addr;
+        }
+
+        for( idx = 0; idx < inflight; idx++ ) {
+            fds[idx].fd = workers[idx].fd;
+            fds[idx].events = POLLIN;
+        }
+        fds[inflight].fd = monitor_fd;
+        fds[inflight].events = POLLIN;
+        if( poll( fds, inflight + 1, WHEEL_TICK_MS ) < 0 && errno != EINTR ) {
+            fprintf( stderr, "poll failed: %s\n", strerror( errno ));
+            break;
+        }
+
+        for( idx = 0; idx <= inflight; idx++ ) {
+            if( !(fds[idx].revents & (POLLIN | POLLHUP | POLLERR)) ) {
+                continue;
+            }
+            if( read( fds[idx].fd, &result, sizeof( result )) != sizeof( result )) {
+                fprintf( stderr, "%s lost\n", (idx < inflight) ? "Worker" : "Monitor" );
+                stop_poll = 1;
+                break;
+            }
+            if( idx < inflight ) {
+                // worker is free again, also if its read already timed out here
+                workers[idx].busy = 0;
+                if( result.status == 0 ) {
+                    answered++;
+                }
+            }
+            request_answer( &result );
+        }
+
+        // expire ticks that have passed
+        gettimeofday( &now, NULL );
+        elapsed = ((now.tv_sec - start.tv_sec) * 1000 + (now.tv_usec - start.tv_usec) / 1000) / WHEEL_TICK_MS;
+        while( wheel_now < elapsed ) {
+            wheel_now++;
+            req = wheel[wheel_now & (WHEEL_SLOTS -1)];
+            while( req != NULL ) {
+                expired = req;
+                req = req->next;
+                if( expired->expires == wheel_now ) {
+                    wheel_remove( expired );
+                    request_retry( expired, retries );
+                }
+            }
+        }
+    }
+
+    gettimeofday( &now, NULL );
+    elapsed = (now.tv_sec - start.tv_sec) * 1000 + (now.tv_usec - start.tv_usec) / 1000;
+    for( idx = 0; idx < inflight; idx++ ) {
+        close( workers[idx].fd );
+        kill( workers[idx].pid, SIGTERM );
+    }
+    close( monitor_fd );
+    kill( monitor_pid, SIGTERM );
+    while( wait( NULL ) > 0 );
+
+    if( quiet == 0 ) {
+        c = 0;
+        for( idx = 0; idx < nrequests; idx++ ) {
+            c += (requests[idx].state == REQ_DONE);
+        }
+        fprintf( stderr, "%d of %d group addresses answered in %u ms (%.1f reads/s, %d answered by workers)\n",
+                 c, nrequests, elapsed, (elapsed > 0) ? c * 1000.0 / elapsed : 0.0, answered );
+    }
+    return( 0 );
+}
@@ -26,6 +26,13 @@
  * Demonstrates usage of the EIBnetmux monitoring function.
  * 
  * It produces a trace of requests seen on the KNX bus.
+ *
+ * With --stats it prints a periodic table of the busiest senders and
+ * destinations and the estimated bus load instead.
+ *
+ * With --latency reads are matched to their answers and the answer time
+ * of the responding devices is reported, with the stats and at the end,
+ * also when stopped with SIGINT or SIGTERM.
  */
 
 /*!
@@ -44,21 +51,78 @@
 #include <signal.h>
 #include <libgen.h>
 #include <getopt.h>
+#include <unistd.h>
 #include <errno.h>
 #include <time.h>
 #include <math.h>
+#include <poll.h>
+#include <pthread.h>
 #include <arpa/inet.h>
 #include <sys/time.h>
 
 #include <eibnetmux/enmx_lib.h>
 //#include "../mylib/mylib.h"
 #include "mylib.h"
+#include "knxframe.h"
+#include "eiscodec.h"
+#include "broker.h"
+#include "readtrack.h"
+#include "capfile.h"
+#include "capmerge.h"
+#include "knxip.h"
+
+
+/*
+ * KNX TP1 timing, in bit times at 9600 bit/s
+ *
+ * each character takes 13 bit times (start, 8 data, parity, stop and 2 idle),
+ * a frame is preceded by 50 bit times idle and followed by an acknowledge
+ * character after 15 bit times; a frame has 8 characters plus the data
+ */
+#define TP1_BITRATE             9600
+#define TP1_CHAR_BITS           13
+#define TP1_FRAME_BITS( len )   (50 + TP1_CHAR_BITS * (8 + (len)) + 15 + TP1_CHAR_BITS)
+
+#define STATS_DEFAULT_INTERVAL  5
+#define STATS_DEFAULT_TOP       10
+#define STATS_MAX_TOP           64
+#define STATS_HISTORY           20              // intervals of repeat ratio shown
+#define REPEAT_WINDOW_MS        1000            // repetition follows its original within
+
+
 /*
- * EIB constants
+ * traffic counters, flat arrays indexed by address in host byte order
  */
-#define EIB_DAF_GROUP                   0x80
-#define A_RESPONSE_VALUE_REQ            0x0040
-#define A_WRITE_VALUE_REQ               0x0080
+typedef struct {
+        uint32_t        source[65536];
+        uint32_t        group[65536];           // destination group address
+        uint32_t        physical[65536];        // destination physical address
+        uint64_t        service[3];             // W, A, R
+        uint64_t        bits;                   // TP1 bit times
+        uint64_t        frames;
+        uint32_t        repeated[65536];        // repeated frames per source
+        uint32_t        line_frames[256];       // per source line, area.line
+        uint32_t        line_repeated[256];
+        uint64_t        repeats;
+        uint64_t        duplicates;             // repetitions of a frame seen before
+} TRAFFIC;
+
+/*
+ * last original frame of each source, to tell a duplicate from a repetition
+ * whose original got lost, and repeat ratio of the past intervals
+ */
+typedef struct {
+        uint32_t        hash[65536];
+        uint32_t        ms[65536];
+        float           ratio[STATS_HISTORY];   // ring, percent
+        int             intervals;
+} REPEATS;
+
+typedef struct {
+        uint32_t        count;
+        uint16_t        addr;
+        uint8_t         group;
+} TALKER;
 
 
 /*
@@ -67,34 +131,28 @@
 ENMX_HANDLE     sock_con = 0;
 unsigned char   conn_state = 0;
 
+static volatile sig_atomic_t stop_trace = 0;
+static int      monitor_pipe[2];
+
 /*
  * local function declarations
  */
 static void     Usage( char *progname );
+static void     trace_shutdown( int arg );
+static void     *trace_monitor( void *arg );
 static char     *knx_physical( uint16_t phy_addr );
 static char     *knx_group( uint16_t grp_addr );
-
-
-/*
- * EIB request frame
- */
-typedef struct __attribute__((packed)) {
-        uint8_t  code;
-        uint8_t  zero;
-        uint8_t  ctrl;
-        uint8_t  ntwrk;
-        uint16_t saddr;
-        uint16_t daddr;
-        uint8_t  length;
-        uint8_t  tpci;
-        uint8_t  apci;
-        uint8_t  data[16];
-} CEMIFRAME;
+static int      repeat_check( REPEATS *repeats, CEMIFRAME *cemiframe, struct timeval *tv );
+static void     stats_count( TRAFFIC *traffic, CEMIFRAME *cemiframe, int repeat );
+static int      stats_top( uint32_t *counters, uint32_t size, int group, TALKER *top, int n );
+static void     stats_print( TRAFFIC *interval, TRAFFIC *total, double seconds, int n );
+static void     repeats_print( TRAFFIC *traffic, REPEATS *repeats, int n );
 
 
 static void Usage( char *progname )
 {
     fprintf( stderr, "Usage: %s [options] [hostname[:port]]\n"
+                     "       %s [options] -r file [file ...]\n"
                      "where:\n"
                      "  hostname[:port]                      defines eibnetmux server with default port of 4390\n"
                      "\n"
@@ -102,18 +160,308 @@ static void Usage( char *progname )
                      "  -u user                              name of user                           default: -\n"
                      "  -c count                             stop after count number of requests    default: endless\n"
                      "  -q                                   no verbose output (default: no)\n"
-                     "\n", basename( progname ));
+                     "  -b socket                            receive from eibbroker instead of eibnetmux\n"
+                     "  -k, --knxip[=group[:port]]           receive KNXnet/IP routing multicast instead (default: %s)\n"
+                     "  -i address                           address of the interface to join the routing group on\n"
+                     "  -r file [file ...]                   read capture files instead, merged in time order, '-' for stdin\n"
+                     "  -w file                              write telegrams to capture file instead of printing, '-' for stdout\n"
+                     "  -s, --stats[=seconds]                print top talkers, bus load and repeated frames every interval (default: %d)\n"
+                     "  -n count                             number of top talkers shown                default: %d\n"
+                     "  -l, --latency[=ms]                   match reads to answers, timeout            default: %d\n"
+                     "\n", basename( progname ), basename( progname ), KNXIP_DEFAULT_GROUP, STATS_DEFAULT_INTERVAL, STATS_DEFAULT_TOP,
+                     READTRACK_DEFAULT_TIMEOUT );
 }
 
 
-int main( int argc, char **argv )
+/*
+ * trace_shutdown
+ *
+ * catches SIGINT and SIGTERM and stops the trace loop, so that the
+ * statistics and the latency report are still printed
+ */
+static void trace_shutdown( int arg )
+{
+    stop_trace = 1;
+}
+
+
+/*
+ * monitor thread
+ *
+ * enmx_monitor() blocks until the next telegram, so it runs here and
+ * passes telegrams through a pipe the trace loop can wait on with a
+ * timeout; closes the pipe on a fatal error
+ */
+static void *trace_monitor( void *arg )
 {
     uint16_t                value_size;
-    struct timeval          tv;
-    struct tm               *ltime;
     uint16_t                buflen;
     unsigned char           *buf;
+    KNXTELEGRAM             telegram;
+    sigset_t                sigs;
+
+    // signals are for the trace loop
+    sigemptyset( &sigs );
+    sigaddset( &sigs, SIGINT );
+    sigaddset( &sigs, SIGTERM );
+    pthread_sigmask( SIG_BLOCK, &sigs, NULL );
+
+    buf = malloc( 10 );
+    buflen = 10;
+    for( ;; ) {
+        buf = enmx_monitor( sock_con, 0xffff, buf, &buflen, &value_size );
+        if( buf == NULL ) {
+            switch( enmx_geterror( sock_con )) {
+                case ENMX_E_COMMUNICATION:
+                case ENMX_E_NO_CONNECTION:
+                case ENMX_E_WRONG_USAGE:
+                case ENMX_E_NO_MEMORY:
+                    fprintf( stderr, "Error on write: %s\n", enmx_errormessage( sock_con ));
+                    close( monitor_pipe[1] );
+                    return( NULL );
+                case ENMX_E_INTERNAL:
+                    fprintf( stderr, "Bad status returned\n" );
+                    break;
+                case ENMX_E_SERVER_ABORTED:
+                    fprintf( stderr, "EOF reached: %s\n", enmx_errormessage( sock_con ));
+                    close( monitor_pipe[1] );
+                    return( NULL );
+                case ENMX_E_TIMEOUT:
+                    fprintf( stderr, "No value received\n" );
+                    break;
+            }
+            continue;
+        }
+        gettimeofday( &telegram.tv, NULL );
+        memset( &telegram.frame, 0, sizeof( CEMIFRAME ));
+        memcpy( &telegram.frame, buf, (value_size < sizeof( CEMIFRAME )) ? value_size : sizeof( CEMIFRAME ));
+        telegram.seen = 0;
+        if( write( monitor_pipe[1], &telegram, sizeof( telegram )) != sizeof( telegram )) {
+            return( NULL );
+        }
+    }
+}
+
+
+/*
+ * classify frame: 0 = original, 1 = repetition of a frame seen before,
+ * 2 = repetition whose original was not seen
+ */
+static int repeat_check( REPEATS *repeats, CEMIFRAME *cemiframe, struct timeval *tv )
+{
+    uint16_t        saddr = ntohs( cemiframe->saddr );
+    uint32_t        ms = tv->tv_sec * 1000 + tv->tv_usec / 1000;
+    uint32_t        hash = 2166136261u;
+    unsigned char   *byte = &cemiframe->tpci;
+    int             len = (cemiframe->length < 16) ? cemiframe->length + 1 : 17;
+
+    // FNV-1a over destination and payload
+    hash = (hash ^ cemiframe->daddr) * 16777619u;
+    while( len-- > 0 ) {
+        hash = (hash ^ *byte++) * 16777619u;
+    }
+    if( !knx_repeated( cemiframe )) {
+        repeats->hash[saddr] = hash;
+        repeats->ms[saddr] = ms;
+        return( 0 );
+    }
+    if( repeats->hash[saddr] == hash && ms - repeats->ms[saddr] <= REPEAT_WINDOW_MS ) {
+        return( 1 );
+    }
+    return( 2 );
+}
+
+
+/*
+ * count one frame, a handful of increments
+ */
+static void stats_count( TRAFFIC *traffic, CEMIFRAME *cemiframe, int repeat )
+{
+    uint16_t        daddr = ntohs( cemiframe->daddr );
+    uint16_t        saddr = ntohs( cemiframe->saddr );
+
+    traffic->source[saddr]++;
+    traffic->line_frames[saddr >> 8]++;
+    if( repeat ) {
+        traffic->repeated[saddr]++;
+        traffic->line_repeated[saddr >> 8]++;
+        traffic->repeats++;
+        traffic->duplicates += (repeat == 1);
+    }
+    if( cemiframe->ntwrk & EIB_DAF_GROUP ) {
+        traffic->group[daddr]++;
+    } else {
+        traffic->physical[daddr]++;
+    }
+    switch( knx_service( cemiframe )) {
+        case 'W':   traffic->service[0]++; break;
+        case 'A':   traffic->service[1]++; break;
+        default:    traffic->service[2]++; break;
+    }
+    traffic->bits += TP1_FRAME_BITS( cemiframe->length );
+    traffic->frames++;
+}
+
+
+/*
+ * select the n highest counters into top, descending, returns number found
+ */
+static int stats_top( uint32_t *counters, uint32_t size, int group, TALKER *top, int n )
+{
+    uint32_t        addr;
+    int             found = 0;
+    int             pos;
+
+    for( addr = 0; addr < size; addr++ ) {
+        if( counters[addr] == 0 || (found == n && counters[addr] <= top[n -1].count) ) {
+            continue;
+        }
+        pos = (found < n) ? found++ : n -1;
+        while( pos > 0 && top[pos -1].count < counters[addr] ) {
+            top[pos] = top[pos -1];
+            pos--;
+        }
+        top[pos].count = counters[addr];
+        top[pos].addr = addr;
+        top[pos].group = group;
+    }
+    return( found );
+}
+
+
+/*
+ * print interval table: service counts, bus load, top senders and destinations
+ */
+static void stats_print( TRAFFIC *interval, TRAFFIC *total, double seconds, int n )
+{
+    TALKER          senders[STATS_MAX_TOP];
+    TALKER          groups[STATS_MAX_TOP];
+    TALKER          physicals[STATS_MAX_TOP];
+    TALKER          *dest;
+    int             nsenders;
+    int             ngroups;
+    int             nphysicals;
+    int             row;
+    uint16_t        addr;
+
+    nsenders = stats_top( interval->source, 65536, 0, senders, n );
+    ngroups = stats_top( interval->group, 65536, 1, groups, n );
+    nphysicals = stats_top( interval->physical, 65536, 0, physicals, n );
+
+    if( isatty( STDOUT_FILENO )) {
+        printf( "\033[H\033[2J" );
+    }
+    printf( "%.1f s: %llu frames (%.1f/s), W %llu  A %llu  R %llu, bus load %.1f%%   total: %llu frames\n",
+            seconds, (unsigned long long)interval->frames, interval->frames / seconds,
+            (unsigned long long)interval->service[0], (unsigned long long)interval->service[1],
+            (unsigned long long)interval->service[2],
+            100.0 * interval->bits / (seconds * TP1_BITRATE), (unsigned long long)total->frames );
+    printf( "\n%-14s %8s %6s    %-14s %8s %6s\n", "source", "frames", "%", "destination", "frames", "%" );
+    for( row = 0; row < n && (row < nsenders || ngroups + nphysicals > 0); row++ ) {
+        if( row < nsenders ) {
+            addr = htons( senders[row].addr );
+            printf( "%-14s %8u %5.1f%%    ", knx_physical( addr ), senders[row].count,
+                    100.0 * senders[row].count / interval->frames );
+        } else {
+            printf( "%-14s %8s %6s    ", "", "", "" );
+        }
+        // merge group and physical destinations, highest first
+        if( ngroups > 0 && (nphysicals == 0 || groups[0].count >= physicals[0].count) ) {
+            dest = &groups[0];
+        } else if( nphysicals > 0 ) {
+            dest = &physicals[0];
+        } else {
+            printf( "\n" );
+            continue;
+        }
+        addr = htons( dest->addr );
+        printf( "%-14s %8u %5.1f%%\n", dest->group ? knx_group( addr ) : knx_physical( addr ), dest->count,
+                100.0 * dest->count / interval->frames );
+        if( dest == &groups[0] ) {
+            memmove( groups, groups + 1, --ngroups * sizeof( TALKER ));
+        } else {
+            memmove( physicals, physicals + 1, --nphysicals * sizeof( TALKER ));
+        }
+    }
+    fflush( stdout );
+}
+
+
+/*
+ * print repeated frames: totals, top sources and lines, ratio history
+ */
+static void repeats_print( TRAFFIC *traffic, REPEATS *repeats, int n )
+{
+    TALKER          sources[STATS_MAX_TOP];
+    TALKER          lines[STATS_MAX_TOP];
+    int             nsources;
+    int             nlines;
+    int             row;
+    int             idx;
+    uint16_t        addr;
+
+    printf( "\nrepeated %llu (%.2f%%): %llu duplicates of frames seen, %llu with original lost\n",
+            (unsigned long long)traffic->repeats,
+            (traffic->frames > 0) ? 100.0 * traffic->repeats / traffic->frames : 0.0,
+            (unsigned long long)traffic->duplicates,
+            (unsigned long long)(traffic->repeats - traffic->duplicates) );
+    if( repeats->intervals > 0 ) {
+        printf( "repeat ratio %%, oldest first:" );
+        idx = (repeats->intervals > STATS_HISTORY) ? repeats->intervals - STATS_HISTORY : 0;
+        for( ; idx < repeats->intervals; idx++ ) {
+            printf( " %.1f", repeats->ratio[idx % STATS_HISTORY] );
+        }
+        printf( "\n" );
+    }
+    if( traffic->repeats == 0 ) {
+        fflush( stdout );
+        return;
+    }
+
+    nsources = stats_top( traffic->repeated, 65536, 0, sources, n );
+    nlines = stats_top( traffic->line_repeated, 256, 0, lines, n );
+    printf( "\n%-14s %8s %6s    %-14s %8s %6s\n", "source", "repeats", "ratio", "line", "repeats", "ratio" );
+    for( row = 0; row < nsources || row < nlines; row++ ) {
+        if( row < nsources ) {
+            addr = htons( sources[row].addr );
+            printf( "%-14s %8u %5.1f%%    ", knx_physical( addr ), sources[row].count,
+                    100.0 * sources[row].count / traffic->source[sources[row].addr] );
+        } else {
+            printf( "%-14s %8s %6s    ", "", "", "" );
+        }
+        if( row < nlines ) {
+            printf( "%2d.%-11d %8u %5.1f%%", lines[row].addr >> 4, lines[row].addr & 0x0f, lines[row].count,
+                    100.0 * lines[row].count / traffic->line_frames[lines[row].addr] );
+        }
+        printf( "\n" );
+    }
+    fflush( stdout );
+}
+
+
+int main( int argc, char **argv )
+{
+    struct timeval          tv;
+    struct tm               *ltime;
     CEMIFRAME               *cemiframe;
+    KNXTELEGRAM             telegram;
+    BROKER_CLIENT           *broker = NULL;
+    char                    *broker_path = NULL;
+    static BROKER_VIEW      views[BROKER_VIEWS];
+    int                     view_next = 0;
+    int                     view_count = 0;
+    KNXIP_ROUTER            *knxip = NULL;
+    char                    *knxip_group = NULL;
+    char                    *knxip_if = NULL;
+    int                     knxip_mode = 0;
+    CAPMERGE                *capture = NULL;
+    char                    *capture_path = NULL;
+    CAPFILE                 *output = NULL;
+    char                    *output_path = NULL;
+    pthread_t               monitor;
+    struct pollfd           pfd;
+    struct sigaction        sa;
+    int                     result;
     int                     enmx_version;
     int                     c;
     int                     quiet = 0;
@@ -124,15 +472,49 @@ int main( int argc, char **argv )
     char                    pwd[255];
     char                    *target;
     char                    *eis_types;
-    int                     type;
     int                     seconds;
-    unsigned char           value[20];
-    uint32_t                *p_int = 0;
-    double                  *p_real;
+    time_t                  date;
+    uint8_t                 character;
+    TRAFFIC                 *stats = NULL;      // interval and total counters
+    REPEATS                 *repeats = NULL;
+    int                     repeat;
+    struct timeval          stats_start;
+    struct timeval          stats_first;
+    double                  elapsed;
+    int                     stats_interval = 0;
+    int                     top = STATS_DEFAULT_TOP;
+    READTRACK               *track = NULL;
+    int                     latency;
+    static struct option    long_options[] = {
+        { "stats", optional_argument, NULL, 's' },
+        { "latency", optional_argument, NULL, 'l' },
+        { "knxip", optional_argument, NULL, 'k' },
+        { NULL, 0, NULL, 0 }
+    };
     
     opterr = 0;
-    while( ( c = getopt( argc, argv, "c:u:q" )) != -1 ) {
+    while( ( c = getopt_long( argc, argv, "c:u:qb:k::i:r:w:s::n:l::", long_options, NULL )) != -1 ) {
         switch( c ) {
+            case 's':
+                stats_interval = (optarg != NULL) ? atoi( optarg ) : STATS_DEFAULT_INTERVAL;
+                if( stats_interval <= 0 ) {
+                    Usage( argv[0] );
+                    exit( -1 );
+                }
+                break;
+            case 'l':
+                track = readtrack_open( (optarg != NULL) ? atoi( optarg ) : READTRACK_DEFAULT_TIMEOUT );
+                if( track == NULL ) {
+                    exit( -5 );
+                }
+                break;
+            case 'n':
+                top = atoi( optarg );
+                if( top < 1 || top > STATS_MAX_TOP ) {
+                    Usage( argv[0] );
+                    exit( -1 );
+                }
+                break;
             case 'c':
                 total = atoi( optarg );
                 break;
@@ -142,15 +524,35 @@ int main( int argc, char **argv )
             case 'q':
                 quiet = 1;
                 break;
+            case 'b':
+                broker_path = strdup( optarg );
+                break;
+            case 'k':
+                knxip_mode = 1;
+                knxip_group = (optarg != NULL) ? strdup( optarg ) : NULL;
+                break;
+            case 'i':
+                knxip_if = strdup( optarg );
+                break;
+            case 'r':
+                capture_path = strdup( optarg );
+                break;
+            case 'w':
+                output_path = strdup( optarg );
+                break;
             default:
                 fprintf( stderr, "Invalid option: %c\n", c );
                 Usage( argv[0] );
                 exit( -1 );
         }
     }
-    if( optind == argc ) {
+    if( capture_path != NULL ) {
+        // further arguments are capture files too, the -r one first
+        argv[--optind] = capture_path;
+        target = NULL;
+    } else if( optind == argc ) {
         target = NULL;
-    } else if( optind + 1 == argc ) {
+    } else if( optind + 1 == argc && broker_path == NULL && knxip_mode == 0 ) {
         target = argv[optind];
     } else {
         Usage( argv[0] );
@@ -158,19 +560,56 @@ int main( int argc, char **argv )
     }
     
     // catch signals for shutdown
-    signal( SIGINT, Shutdown );
-    signal( SIGTERM, Shutdown );
+    // no SA_RESTART, a pending poll() must return
+    memset( &sa, 0, sizeof( sa ));
+    sa.sa_handler = trace_shutdown;
+    sigemptyset( &sa.sa_mask );
+    sigaction( SIGINT, &sa, NULL );
+    sigaction( SIGTERM, &sa, NULL );
     
-    // request monitoring connection
+    if( output_path != NULL ) {
+        output = capfile_create( output_path );
+        if( output == NULL ) {
+            exit( -2 );
+        }
+        if( strcmp( output_path, "-" ) == 0 ) {
+            quiet = 1;
+        }
+    }
+
+    // request monitoring connection, or share the one of eibbroker
     enmx_version = enmx_init();
-    sock_con = enmx_open( target, "eibtrace" );
-    if( sock_con < 0 ) {
-        fprintf( stderr, "Connect to eibnetmux failed (%d): %s\n", sock_con, enmx_errormessage( sock_con ));
-        exit( -2 );
+    if( capture_path != NULL ) {
+        capture = capmerge_open( &argv[optind], argc - optind, 0 );
+        if( capture == NULL ) {
+            exit( -2 );
+        }
+    } else if( broker_path != NULL ) {
+        broker = broker_connect( broker_path, BROKER_F_PHYSICAL, NULL, 0 );
+        if( broker == NULL || broker_nonblock( broker ) != 0 ) {
+            exit( -2 );
+        }
+        if( quiet == 0 ) {
+            printf( "Connection to eibbroker '%s' established\n", broker_path );
+        }
+    } else if( knxip_mode != 0 ) {
+        knxip = knxip_open( knxip_group, knxip_if );
+        if( knxip == NULL ) {
+            exit( -2 );
+        }
+        if( quiet == 0 ) {
+            printf( "Joined KNXnet/IP routing group %s\n", (knxip_group != NULL) ? knxip_group : KNXIP_DEFAULT_GROUP );
+        }
+    } else {
+        sock_con = enmx_open( target, "eibtrace" );
+        if( sock_con < 0 ) {
+            fprintf( stderr, "Connect to eibnetmux failed (%d): %s\n", sock_con, enmx_errormessage( sock_con ));
+            exit( -2 );
+        }
     }
     
     // authenticate
-    if( user != NULL ) {
+    if( user != NULL && broker == NULL && capture == NULL && knxip == NULL ) {
         if( getpassword( pwd ) != 0 ) {
             fprintf( stderr, "Error reading password - cannot continue\n" );
             exit( -6 );
@@ -180,43 +619,117 @@ int main( int argc, char **argv )
             exit( -3 );
         }
     }
-    if( quiet == 0 ) {
-        printf( "Connection to eibnetmux '%s' established\n", enmx_gethost( sock_con ));
+    if( broker == NULL && capture == NULL && knxip == NULL ) {
+        if( quiet == 0 ) {
+            printf( "Connection to eibnetmux '%s' established\n", enmx_gethost( sock_con ));
+        }
+        result = (pipe( monitor_pipe ) != 0) ? errno : pthread_create( &monitor, NULL, trace_monitor, NULL );
+        if( result != 0 ) {
+            fprintf( stderr, "Unable to start monitor: %s\n", strerror( result ));
+            exit( -5 );
+        }
     }
     
-    buf = malloc( 10 );
-    buflen = 10;
+    if( stats_interval > 0 ) {
+        stats = calloc( 2, sizeof( TRAFFIC ));
+        repeats = calloc( 1, sizeof( REPEATS ));
+        if( stats == NULL || repeats == NULL ) {
+            fprintf( stderr, "Out of memory\n" );
+            exit( -5 );
+        }
+        gettimeofday( &stats_start, NULL );
+        stats_first = stats_start;
+    }
+
     if( total != -1 ) {
         spaces = floor( log10( total )) +1;
     }
-    while( total == -1 || count < total ) {
-        buf = enmx_monitor( sock_con, 0xffff, buf, &buflen, &value_size );
-        if( buf == NULL ) {
-            switch( enmx_geterror( sock_con )) {
-                case ENMX_E_COMMUNICATION:
-                case ENMX_E_NO_CONNECTION:
-                case ENMX_E_WRONG_USAGE:
-                case ENMX_E_NO_MEMORY:
-                    fprintf( stderr, "Error on write: %s\n", enmx_errormessage( sock_con ));
-                    enmx_close( sock_con );
+    while( stop_trace == 0 && (total == -1 || count < total) ) {
+        if( capture != NULL ) {
+            result = capmerge_next( capture, &telegram, NULL );
+            if( result <= 0 ) {
+                break;
+            }
+            cemiframe = &telegram.frame;
+            tv = telegram.tv;
+        } else if( broker != NULL ) {
+            // frames are used in place, as long as the views of one read last,
+            // waking up now and then for the stats interval
+            if( view_next == view_count ) {
+                view_next = view_count = 0;
+                if( broker_poll( broker, 1000 ) < 0 || (view_count = broker_views( broker, views, BROKER_VIEWS )) < 0 ) {
+                    fprintf( stderr, "Connection to eibbroker lost\n" );
                     exit( -4 );
-                    break;
-                case ENMX_E_INTERNAL:
-                    fprintf( stderr, "Bad status returned\n" );
-                    break;
-                case ENMX_E_SERVER_ABORTED:
-                    fprintf( stderr, "EOF reached: %s\n", enmx_errormessage( sock_con ));
+                }
+            }
+            cemiframe = NULL;
+            if( view_next < view_count ) {
+                cemiframe = (CEMIFRAME *) views[view_next].frame;
+                tv = views[view_next].tv;
+                if( track != NULL || output != NULL ) {
+                    broker_view_telegram( &views[view_next], &telegram );
+                }
+                view_next++;
+            }
+        } else if( knxip != NULL ) {
+            result = knxip_next( knxip, &telegram, 1000 );
+            if( result < 0 ) {
+                fprintf( stderr, "Receive from KNXnet/IP routing group failed: %s\n", strerror( errno ));
+                exit( -4 );
+            }
+            cemiframe = NULL;
+            if( result > 0 ) {
+                cemiframe = &telegram.frame;
+                tv = telegram.tv;
+            }
+        } else {
+            // from the monitor thread, waking up now and then for the stats interval
+            pfd.fd = monitor_pipe[0];
+            pfd.events = POLLIN;
+            cemiframe = NULL;
+            if( poll( &pfd, 1, 1000 ) > 0 ) {
+                if( read( monitor_pipe[0], &telegram, sizeof( telegram )) != sizeof( telegram )) {
+                    // the monitor thread reported why
                     enmx_close( sock_con );
                     exit( -4 );
-                    break;
-                case ENMX_E_TIMEOUT:
-                    fprintf( stderr, "No value received\n" );
-                    break;
+                }
+                cemiframe = &telegram.frame;
+                tv = telegram.tv;
+            }
+        }
+        if( cemiframe == NULL ) {
+            // quiet line, the stats interval still ends on time
+            if( stop_trace != 0 || stats == NULL || capture != NULL ) {
+                continue;
             }
+            gettimeofday( &tv, NULL );
+            if( track != NULL ) {
+                // reads without answer are counted as such in the next report
+                readtrack_expire( track, &tv );
+            }
+        } else if( output != NULL ) {
+            count++;
+            if( capfile_write( output, &telegram ) != 0 ) {
+                fprintf( stderr, "Unable to write capture file %s: %s\n", output_path, strerror( errno ));
+                exit( -4 );
+            }
+        } else if( stats != NULL ) {
+            if( capture != NULL && count == 0 ) {
+                stats_start = stats_first = tv;     // intervals in capture time
+            }
+            count++;
+            if( track != NULL ) {
+                readtrack_telegram( track, &telegram );
+            }
+            repeat = repeat_check( repeats, cemiframe, &tv );
+            stats_count( &stats[0], cemiframe, repeat );
+            stats_count( &stats[1], cemiframe, repeat );
         } else {
             count++;
-            cemiframe = (CEMIFRAME *) buf;
-            gettimeofday( &tv, NULL );
+            latency = -1;
+            if( track != NULL ) {
+                latency = readtrack_telegram( track, &telegram );
+            }
             ltime = localtime( &tv.tv_sec );
             if( total != -1 ) {
                 printf( "%*d: ", spaces, count );
@@ -235,59 +748,45 @@ int main( int argc, char **argv )
             printf( "%8s", (cemiframe->ntwrk & EIB_DAF_GROUP) ? knx_group( cemiframe->daddr ) : knx_physical( cemiframe->daddr ));
             if( cemiframe->apci & (A_WRITE_VALUE_REQ | A_RESPONSE_VALUE_REQ) ) {
                 printf( " : " );
-                p_int = (uint32_t *)value;
-                p_real = (double *)value;
                 switch( cemiframe->length ) {
                     case 1:     // EIS 1, 2, 7, 8
-                        type = enmx_frame2value( 1, cemiframe, value );
-                        printf( "%s | ", (*p_int == 0) ? "off" : "on" );
-                        type = enmx_frame2value( 2, cemiframe, value );
-                        printf( "%d | ", *p_int );
-                        type = enmx_frame2value( 7, cemiframe, value );
-                        printf( "%d | ", *p_int );
-                        type = enmx_frame2value( 8, cemiframe, value );
-                        printf( "%d", *p_int );
+                        printf( "%s | ", eis1_decode( cemiframe ) ? "on" : "off" );
+                        printf( "%d | ", eis2_decode( cemiframe ));
+                        printf( "%d | ", eis7_decode( cemiframe ));
+                        printf( "%d", eis8_decode( cemiframe ));
                         eis_types = "1, 2, 7, 8";
                         break;
                     case 2:     // 6, 13, 14
-                        type = enmx_frame2value( 6, cemiframe, value );
-                        printf( "%d%% | %d", *p_int * 100 / 255, *p_int );
-                        type = enmx_frame2value( 13, cemiframe, value );
-                        if( *p_int >=  0x20 && *p_int < 0x7f ) {
-                            printf( " | %c", *p_int );
+                        printf( "%d%% | %d", eis6_decode( cemiframe ) * 100 / 255, eis6_decode( cemiframe ));
+                        character = eis13_decode( cemiframe );
+                        if( character >=  0x20 && character < 0x7f ) {
+                            printf( " | %c", character );
                             eis_types = "6, 14, 13";
                         } else {
                             eis_types = "6, 14";
                         }
                         break;
                     case 3:     // 5, 10
-                        type = enmx_frame2value( 5, cemiframe, value );
-                        printf( "%.2f | ", *p_real );
-                        type = enmx_frame2value( 10, cemiframe, value );
-                        printf( "%d", *p_int );
+                        printf( "%.2f | ", eis5_decode( cemiframe ));
+                        printf( "%d", eis10_decode( cemiframe ));
                         eis_types = "5, 10";
                         break;
                     case 4:     // 3, 4
-                        type = enmx_frame2value( 3, cemiframe, value );
-                        seconds = *p_int;
+                        seconds = eis3_decode( cemiframe );
                         ltime->tm_hour = seconds / 3600;
                         seconds %= 3600;
                         ltime->tm_min = seconds / 60;
                         seconds %= 60;
                         ltime->tm_sec = seconds;
                         printf( "%02d:%02d:%02d | ", ltime->tm_hour, ltime->tm_min, ltime->tm_sec );
-                        type = enmx_frame2value( 4, cemiframe, value );
-                        ltime = localtime( (time_t *)p_int );
+                        date = eis4_decode( cemiframe );
+                        ltime = localtime( &date );
                         printf( "%04d/%02d/%02d", ltime->tm_year + 1900, ltime->tm_mon +1, ltime->tm_mday );
                         eis_types = "3, 4";
                         break;
                     case 5:     // 9, 11, 12
-                        type = enmx_frame2value( 11, cemiframe, value );
-                        printf( "%d | ", *p_int );
-                        type = enmx_frame2value( 9, cemiframe, value );
-                        printf( "%.2f", *p_real );
-                        type = enmx_frame2value( 12, cemiframe, value );
-                        // printf( "12: <->" );
+                        printf( "%u | ", eis11_decode( cemiframe ));
+                        printf( "%.2f", eis9_decode( cemiframe ));
                         eis_types = "9, 11, 12";
                         break;
                     default:    // 15
@@ -302,8 +801,68 @@ int main( int argc, char **argv )
                 }
                 printf( " - eis types: %s)", eis_types );
             }
+            if( latency >= 0 ) {
+                printf( " [answer after %d ms]", latency );
+            }
             printf( "\n" );
         }
+        if( stats != NULL && output == NULL ) {
+            elapsed = (tv.tv_sec - stats_start.tv_sec) + (tv.tv_usec - stats_start.tv_usec) / 1e6;
+            if( elapsed >= stats_interval ) {
+                repeats->ratio[repeats->intervals++ % STATS_HISTORY] =
+                    (stats[0].frames > 0) ? 100.0 * stats[0].repeats / stats[0].frames : 0.0;
+                stats_print( &stats[0], &stats[1], elapsed, top );
+                repeats_print( &stats[0], repeats, top );
+                if( track != NULL ) {
+                    printf( "\n" );
+                    readtrack_report( track, stdout, top );
+                }
+                memset( &stats[0], 0, sizeof( TRAFFIC ));
+                stats_start = tv;
+            }
+        }
+    }
+    if( stop_trace != 0 ) {
+        fprintf( stderr, "Signal received - shutting down\n" );
+    }
+    if( stats != NULL ) {
+        if( capture == NULL ) {
+            gettimeofday( &tv, NULL );
+        }
+        elapsed = (tv.tv_sec - stats_first.tv_sec) + (tv.tv_usec - stats_first.tv_usec) / 1e6;
+        stats_print( &stats[1], &stats[1], (elapsed > 0) ? elapsed : 1, top );
+        repeats_print( &stats[1], repeats, top );
+    }
+    if( track != NULL ) {
+        if( capture == NULL ) {
+            gettimeofday( &tv, NULL );
+        }
+        readtrack_expire( track, &tv );
+        printf( "\n" );
+        readtrack_report( track, stdout, top );
+    }
+    if( capture != NULL ) {
+        capmerge_close( capture );
+    }
+    if( broker != NULL ) {
+        broker_close( broker );
+    }
+    if( broker == NULL && capture == NULL && knxip == NULL ) {
+        // enmx_monitor() may be waiting, stop the thread before closing its connection
+        pthread_cancel( monitor );
+        pthread_join( monitor, NULL );
+        enmx_close( sock_con );
+        close( monitor_pipe[0] );
+    }
+    if( knxip != NULL ) {
+        if( quiet == 0 ) {
+            knxip_stats( knxip, stderr );
+        }
+        knxip_close( knxip );
+    }
+    if( output != NULL && capfile_close( output ) != 0 ) {
+        fprintf( stderr, "Unable to write capture file %s: %s\n", output_path, strerror( errno ));
+        exit( -4 );
     }
     return( 0 );
 }
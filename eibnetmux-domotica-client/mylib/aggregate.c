@@ -0,0 +1,495 @@
+/*
+ * aggregate - min/max/sum/count per group address over an archive
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+#include <pthread.h>
+
+#include "aggregate.h"
+#include "dptdecode.h"
+
+
+/*
+ * running values of one group address, empty is +inf/-inf/0/0
+ */
+typedef struct {
+        double          min;
+        double          max;
+        double          sum;
+        uint64_t        count;
+} AGG_SLOT;
+
+typedef struct {
+        ARCHIVE         *ar;
+        const AGG_QUERY *query;
+        AGG_RESULT      *result;
+        void            (*decode)( const uint32_t *data, double *value, size_t n );
+        uint8_t         length;                 // column value of a payload of the datapoint type
+        uint32_t        ngroups;
+        uint16_t        min_group;
+        uint16_t        max_group;
+        uint16_t        probe[AGG_BLOOM_PROBES];
+        uint32_t        probes;                 // 0 = range only
+        uint32_t        next;                   // segment to take
+        int             failed;                 // out of memory, workers stop
+        pthread_mutex_t lock;                   // result
+} AGG_JOB;
+
+typedef struct {
+        AGG_JOB         *job;
+        pthread_t       thread;
+        AGG_SLOT        *slot;                  // 65536
+        uint64_t        touched[65536 / 64];
+        int64_t         bucket;                 // slots belong to, -1 = none
+        AGG_CELL        *run;                   // touched slots on flush
+        double          value[AGG_BLOCK];
+        uint8_t         keep[AGG_BLOCK];
+        uint16_t        sel[AGG_BLOCK];
+        uint64_t        segments;
+        uint64_t        skipped;
+        uint64_t        rows;
+        uint64_t        values;
+} AGG_WORKER;
+
+
+/*
+ * local function declarations
+ */
+static int64_t  agg_bucket( const AGG_QUERY *query, int64_t sec );
+static int      agg_skip( AGG_JOB *job, const ARCHIVE_SEGMENT *seg );
+static int      agg_merge( AGG_BUCKET *bucket, AGG_CELL *run, uint32_t n );
+static void     agg_flush( AGG_WORKER *w );
+static void     agg_segment( AGG_WORKER *w, uint32_t segment );
+static void     *agg_worker( void *arg );
+
+
+/*
+ * bucket holding sec, -1 if outside all
+ */
+static int64_t agg_bucket( const AGG_QUERY *query, int64_t sec )
+{
+    uint32_t        lo = 0;
+    uint32_t        hi = query->buckets;
+    uint32_t        mid;
+
+    if( sec < query->bounds[0] || sec >= query->bounds[query->buckets] ) {
+        return( -1 );
+    }
+    while( hi - lo > 1 ) {
+        mid = lo + (hi - lo) / 2;
+        if( sec < query->bounds[mid] ) {
+            hi = mid;
+        } else {
+            lo = mid;
+        }
+    }
+    return( lo );
+}
+
+
+/*
+ * statistics show segment has nothing for the query
+ */
+static int agg_skip( AGG_JOB *job, const ARCHIVE_SEGMENT *seg )
+{
+    const AGG_QUERY *query = job->query;
+    uint32_t        idx;
+
+    if( seg->rows == 0 || seg->groups == 0 || seg->writes + seg->answers == 0 ) {
+        return( 1 );
+    }
+    if( seg->last_sec < query->bounds[0] || seg->first_sec >= query->bounds[query->buckets] ) {
+        return( 1 );
+    }
+    if( query->groups == NULL ) {
+        return( 0 );
+    }
+    if( job->ngroups == 0 || seg->max_group < job->min_group || seg->min_group > job->max_group ) {
+        return( 1 );
+    }
+    if( job->probes == 0 ) {
+        return( 0 );
+    }
+    for( idx = 0; idx < job->probes; idx++ ) {
+        if( archive_may_contain( seg, job->probe[idx] )) {
+            return( 0 );
+        }
+    }
+    return( 1 );
+}
+
+
+/*
+ * add a run of cells sorted by group to bucket, with the result lock held
+ *
+ * returns -1 if out of memory, the bucket is left as it was
+ */
+static int agg_merge( AGG_BUCKET *bucket, AGG_CELL *run, uint32_t n )
+{
+    AGG_CELL        *cell;
+    AGG_CELL        *old = bucket->cell;
+    uint32_t        a = 0;
+    uint32_t        b = 0;
+    uint32_t        count = 0;
+
+    if( n == 0 ) {
+        return( 0 );
+    }
+    cell = malloc( (bucket->cells + n) * sizeof( AGG_CELL ));
+    if( cell == NULL ) {
+        fprintf( stderr, "Out of memory: %s\n", strerror( errno ));
+        return( -1 );
+    }
+    while( a < bucket->cells || b < n ) {
+        if( b == n || (a < bucket->cells && old[a].group < run[b].group) ) {
+            cell[count++] = old[a++];
+        } else if( a == bucket->cells || run[b].group < old[a].group ) {
+            cell[count++] = run[b++];
+        } else {
+            cell[count] = old[a++];
+            cell[count].count += run[b].count;
+            cell[count].sum += run[b].sum;
+            if( run[b].min < cell[count].min ) {
+                cell[count].min = run[b].min;
+            }
+            if( run[b].max > cell[count].max ) {
+                cell[count].max = run[b].max;
+            }
+            count++;
+            b++;
+        }
+    }
+    free( old );
+    bucket->cell = cell;
+    bucket->cells = count;
+    return( 0 );
+}
+
+
+/*
+ * hand the slots to the result and empty them
+ */
+static void agg_flush( AGG_WORKER *w )
+{
+    AGG_SLOT        *slot;
+    uint64_t        bits;
+    uint32_t        n = 0;
+    uint32_t        word;
+    uint32_t        group;
+
+    if( w->bucket < 0 ) {
+        return;
+    }
+    for( word = 0; word < 65536 / 64; word++ ) {
+        for( bits = w->touched[word]; bits != 0; bits &= bits - 1 ) {
+            group = word * 64 + __builtin_ctzll( bits );
+            slot = &w->slot[group];
+            w->run[n].group = group;
+            w->run[n].count = slot->count;
+            w->run[n].min = slot->min;
+            w->run[n].max = slot->max;
+            w->run[n].sum = slot->sum;
+            n++;
+            slot->min = INFINITY;
+            slot->max = -INFINITY;
+            slot->sum = 0;
+            slot->count = 0;
+        }
+        w->touched[word] = 0;
+    }
+    pthread_mutex_lock( &w->job->lock );
+    if( agg_merge( &w->job->result->bucket[w->bucket], w->run, n ) != 0 ) {
+        __atomic_store_n( &w->job->failed, 1, __ATOMIC_RELAXED );
+    }
+    pthread_mutex_unlock( &w->job->lock );
+    w->bucket = -1;
+}
+
+
+/*
+ * sum up one segment
+ *
+ * rows are filtered a block at a time: a branch free pass over the
+ * columns the compiler can vectorize, then the rows kept are added to
+ * the slot of their address
+ */
+static void agg_segment( AGG_WORKER *w, uint32_t segment )
+{
+    AGG_JOB         *job = w->job;
+    const AGG_QUERY *query = job->query;
+    const uint8_t   *groups = query->groups;
+    const ARCHIVE_SEGMENT *seg;
+    ARCHIVE_COLUMNS cols;
+    AGG_SLOT        *slot;
+    const double    *value;
+    const uint32_t  *sec;
+    const uint16_t  *daddr;
+    const uint8_t   *ntwrk;
+    const uint8_t   *apci;
+    const uint8_t   *length;
+    uint8_t         need;
+    uint64_t        lo;
+    uint64_t        hi;
+    int64_t         first;
+    int64_t         last;
+    int64_t         bucket;
+    uint32_t        start;
+    uint32_t        rows;
+    uint32_t        count;
+    uint32_t        n;
+    uint32_t        idx;
+    uint16_t        group;
+    double          v;
+
+    if( archive_columns( job->ar, segment, &cols ) != 0 ) {
+        return;
+    }
+    seg = cols.segment;
+    if( agg_skip( job, seg )) {
+        w->skipped++;
+        return;
+    }
+    w->segments++;
+    w->rows += seg->rows;
+
+    // query time range in seconds since first_sec
+    lo = (query->bounds[0] > seg->first_sec) ? query->bounds[0] - seg->first_sec : 0;
+    hi = query->bounds[query->buckets] - seg->first_sec;
+    first = agg_bucket( query, seg->first_sec );
+    last = agg_bucket( query, seg->last_sec );
+    if( first >= 0 && first == last && w->bucket != first ) {
+        agg_flush( w );
+        w->bucket = first;
+    }
+    need = job->length;
+
+    rows = seg->rows;
+    for( start = 0; start < rows; start += n ) {
+        n = (rows - start < AGG_BLOCK) ? rows - start : AGG_BLOCK;
+        if( job->decode != NULL ) {
+            job->decode( cols.data + start, w->value, n );
+            value = w->value;
+        } else {
+            value = cols.value + start;
+        }
+        sec = cols.sec + start;
+        daddr = cols.daddr + start;
+        ntwrk = cols.ntwrk + start;
+        apci = cols.apci + start;
+        length = cols.length + start;
+
+        for( idx = 0; idx < n; idx++ ) {
+            w->keep[idx] = ((ntwrk[idx] & EIB_DAF_GROUP) != 0) & ((apci[idx] & (A_WRITE_VALUE_REQ | A_RESPONSE_VALUE_REQ)) != 0) &
+                           (sec[idx] >= lo) & (sec[idx] < hi) & ((need == 0) | (length[idx] == need)) & (value[idx] == value[idx]);
+        }
+        count = 0;
+        if( groups == NULL ) {
+            for( idx = 0; idx < n; idx++ ) {
+                w->sel[count] = idx;
+                count += w->keep[idx];
+            }
+        } else {
+            for( idx = 0; idx < n; idx++ ) {
+                w->sel[count] = idx;
+                count += w->keep[idx] & (groups[daddr[idx]] != 0);
+            }
+        }
+        w->values += count;
+
+        for( idx = 0; idx < count; idx++ ) {
+            if( first != last || first < 0 ) {
+                bucket = agg_bucket( query, seg->first_sec + sec[w->sel[idx]] );
+                if( bucket != w->bucket ) {
+                    agg_flush( w );
+                    w->bucket = bucket;
+                }
+            }
+            group = daddr[w->sel[idx]];
+            v = value[w->sel[idx]];
+            slot = &w->slot[group];
+            slot->min = (v < slot->min) ? v : slot->min;
+            slot->max = (v > slot->max) ? v : slot->max;
+            slot->sum += v;
+            slot->count++;
+            w->touched[group >> 6] |= 1ull << (group & 63);
+        }
+    }
+}
+
+
+static void *agg_worker( void *arg )
+{
+    AGG_WORKER      *w = arg;
+    uint32_t        segment;
+
+    while( !__atomic_load_n( &w->job->failed, __ATOMIC_RELAXED ) &&
+           (segment = __atomic_fetch_add( &w->job->next, 1, __ATOMIC_RELAXED )) < w->job->ar->segments ) {
+        agg_segment( w, segment );
+    }
+    agg_flush( w );
+    return( NULL );
+}
+
+
+/*
+ * run query over archive, returns NULL if it cannot be answered
+ */
+AGG_RESULT *agg_run( ARCHIVE *ar, const AGG_QUERY *query )
+{
+    AGG_JOB         job;
+    AGG_WORKER      *worker;
+    AGG_WORKER      *w;
+    AGG_RESULT      *result;
+    int             threads;
+    int             started;
+    uint32_t        addr;
+    int             idx;
+    int             err;
+
+    memset( &job, 0, sizeof( job ));
+    switch( query->dpt ) {
+        case 0:     job.decode = NULL;              job.length = 0;     break;
+        case 5:     job.decode = dpt5_to_double;    job.length = 2;     break;
+        case 6:     job.decode = dpt6_to_double;    job.length = 2;     break;
+        case 7:     job.decode = dpt7_to_double;    job.length = 3;     break;
+        case 8:     job.decode = dpt8_to_double;    job.length = 3;     break;
+        case 9:     job.decode = dpt9_to_double;    job.length = 3;     break;
+        default:
+            fprintf( stderr, "Datapoint type %d cannot be aggregated\n", query->dpt );
+            return( NULL );
+    }
+    if( query->dpt == 0 && ar->version < 2 ) {
+        fprintf( stderr, "Archive has no value column, a datapoint type is needed\n" );
+        return( NULL );
+    }
+    if( query->buckets == 0 ) {
+        fprintf( stderr, "No time range to aggregate\n" );
+        return( NULL );
+    }
+
+    result = calloc( 1, sizeof( AGG_RESULT ));
+    if( result != NULL ) {
+        result->bucket = calloc( query->buckets, sizeof( AGG_BUCKET ));
+    }
+    if( result == NULL || result->bucket == NULL ) {
+        fprintf( stderr, "Out of memory: %s\n", strerror( errno ));
+        free( result );
+        return( NULL );
+    }
+    result->buckets = query->buckets;
+
+    job.ar = ar;
+    job.query = query;
+    job.result = result;
+    if( query->groups != NULL ) {
+        job.min_group = 0xffff;
+        for( addr = 0; addr < 65536; addr++ ) {
+            if( query->groups[addr] ) {
+                if( job.ngroups < AGG_BLOOM_PROBES ) {
+                    job.probe[job.ngroups] = addr;
+                }
+                job.ngroups++;
+                if( addr < job.min_group ) {
+                    job.min_group = addr;
+                }
+                job.max_group = addr;
+            }
+        }
+        job.probes = (job.ngroups <= AGG_BLOOM_PROBES) ? job.ngroups : 0;
+    }
+
+    threads = query->threads;
+    if( threads < 1 ) {
+        threads = 1;
+    } else if( threads > AGG_MAX_THREADS ) {
+        threads = AGG_MAX_THREADS;
+    }
+    worker = calloc( threads, sizeof( AGG_WORKER ));
+    if( worker == NULL ) {
+        fprintf( stderr, "Out of memory: %s\n", strerror( errno ));
+        agg_free( result );
+        return( NULL );
+    }
+    pthread_mutex_init( &job.lock, NULL );
+    for( idx = 0; idx < threads; idx++ ) {
+        w = &worker[idx];
+        w->job = &job;
+        w->bucket = -1;
+        w->slot = malloc( 65536 * sizeof( AGG_SLOT ));
+        w->run = malloc( 65536 * sizeof( AGG_CELL ));
+        if( w->slot == NULL || w->run == NULL ) {
+            fprintf( stderr, "Out of memory: %s\n", strerror( errno ));
+            break;
+        }
+        for( addr = 0; addr < 65536; addr++ ) {
+            w->slot[addr].min = INFINITY;
+            w->slot[addr].max = -INFINITY;
+            w->slot[addr].sum = 0;
+            w->slot[addr].count = 0;
+        }
+        if( (err = pthread_create( &w->thread, NULL, agg_worker, w )) != 0 ) {
+            fprintf( stderr, "Unable to start aggregation thread: %s\n", strerror( err ));
+            break;
+        }
+    }
+    // a thread short, the ones running stop at their next segment
+    started = idx;
+    if( started < threads ) {
+        __atomic_store_n( &job.failed, 1, __ATOMIC_RELAXED );
+    }
+    for( idx = 0; idx < started; idx++ ) {
+        w = &worker[idx];
+        pthread_join( w->thread, NULL );
+        result->segments += w->segments;
+        result->skipped += w->skipped;
+        result->rows += w->rows;
+        result->values += w->values;
+    }
+    for( idx = 0; idx < threads; idx++ ) {
+        free( worker[idx].slot );
+        free( worker[idx].run );
+    }
+    free( worker );
+    pthread_mutex_destroy( &job.lock );
+    if( job.failed ) {
+        agg_free( result );
+        return( NULL );
+    }
+    return( result );
+}
+
+
+void agg_free( AGG_RESULT *result )
+{
+    uint32_t        idx;
+
+    for( idx = 0; idx < result->buckets; idx++ ) {
+        free( result->bucket[idx].cell );
+    }
+    free( result->bucket );
+    free( result );
+}
@@ -0,0 +1,84 @@
+/*
+ * aggregate - min/max/sum/count per group address over an archive
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#ifndef AGGREGATE_H_
+#define AGGREGATE_H_
+
+#include <stdint.h>
+
+#include "archive.h"
+
+/*
+ * Values of write and answer telegrams to group addresses are summed up
+ * per address in time buckets bounds[i] to bounds[i + 1], which need not
+ * be of equal length (local days, months). Segments whose statistics
+ * rule out the time range or the addresses are not read at all.
+ *
+ * Values come from the value column, or are decoded from the data
+ * column as the given datapoint type when dpt is set, which also works
+ * for version 1 archives.
+ *
+ * Threads take whole segments and sum up in a table with a slot per
+ * group address for the bucket at hand. The table is merged into the
+ * result when a thread moves on to another bucket, which may be in the
+ * next segment, and once more when the thread runs out of segments. Sums
+ * depend on the order that work is merged in, in the last bits.
+ */
+#define AGG_BLOCK               1024            // rows filtered at a time
+#define AGG_MAX_THREADS         64
+#define AGG_BLOOM_PROBES        64              // more addresses are checked by range only
+
+typedef struct {
+        const int64_t   *bounds;                // buckets + 1 times, ascending
+        uint32_t        buckets;
+        const uint8_t   *groups;                // 65536 flags, NULL = all
+        int             dpt;                    // 0 = value column, 5, 6, 7, 8 or 9
+        int             threads;
+} AGG_QUERY;
+
+typedef struct {
+        uint16_t        group;
+        uint32_t        count;
+        double          min;
+        double          max;
+        double          sum;
+} AGG_CELL;
+
+typedef struct {
+        AGG_CELL        *cell;                  // by group address
+        uint32_t        cells;
+} AGG_BUCKET;
+
+typedef struct {
+        AGG_BUCKET      *bucket;                // one per query bucket
+        uint32_t        buckets;
+        uint64_t        segments;               // read
+        uint64_t        skipped;                // by statistics
+        uint64_t        rows;                   // of segments read
+        uint64_t        values;                 // summed up
+} AGG_RESULT;
+
+
+/*
+ * function declarations
+ */
+extern AGG_RESULT   *agg_run( ARCHIVE *ar, const AGG_QUERY *query );
+extern void         agg_free( AGG_RESULT *result );
+
+#endif /*AGGREGATE_H_*/
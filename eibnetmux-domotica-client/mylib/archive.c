@@ -0,0 +1,472 @@
+/*
+ * archive - columnar telegram archive
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <math.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <arpa/inet.h>
+
+#include "archive.h"
+
+#define ARCHIVE_BUFFER      (1 << 20)
+#define ARCHIVE_ALIGN(n)    (((n) + 7) & ~(size_t)7)
+
+typedef char archive_header_check[(sizeof( ARCHIVE_HEADER ) == 16 && sizeof( ARCHIVE_SEGMENT ) == 96) ? 1 : -1];
+
+/*
+ * local function declarations
+ */
+static size_t   archive_row_size( uint16_t version );
+static size_t   archive_segment_size( uint16_t version, uint32_t rows, uint32_t blob );
+static int      archive_flush( ARCHIVE *ar );
+static ARCHIVE  *archive_map( const char *path, int writable );
+
+
+/*
+ * bytes of the arrays per row
+ */
+static size_t archive_row_size( uint16_t version )
+{
+    return( 3 * 4 + 2 * 2 + 5 + ((version >= 2) ? 8 + 1 : 0) );
+}
+
+
+/*
+ * bytes taken by a segment
+ */
+static size_t archive_segment_size( uint16_t version, uint32_t rows, uint32_t blob )
+{
+    return( ARCHIVE_ALIGN( sizeof( ARCHIVE_SEGMENT ) + (size_t)rows * archive_row_size( version ) + blob ));
+}
+
+
+/*
+ * write segment being filled, returns -1 on a write error
+ */
+static int archive_flush( ARCHIVE *ar )
+{
+    ARCHIVE_SEGMENT *seg = &ar->stats;
+    uint32_t        sec[1024];
+    uint32_t        rows = seg->rows;
+    uint32_t        row;
+    uint32_t        n;
+    size_t          size;
+    static const uint8_t    pad[8];
+
+    if( rows == 0 ) {
+        return( 0 );
+    }
+    size = archive_segment_size( ARCHIVE_VERSION, rows, seg->blob );
+    seg->magic = ARCHIVE_SEGMENT_MAGIC;
+    seg->size = size;
+    size -= sizeof( ARCHIVE_SEGMENT ) + (size_t)rows * archive_row_size( ARCHIVE_VERSION ) + seg->blob;
+
+    if( fwrite( seg, sizeof( ARCHIVE_SEGMENT ), 1, ar->fp ) != 1 ||
+        fwrite( ar->value, 8, rows, ar->fp ) != rows ) {
+        ar->error = 1;
+        return( -1 );
+    }
+    for( row = 0; row < rows; row += n ) {
+        for( n = 0; n < 1024 && row + n < rows; n++ ) {
+            sec[n] = ar->sec[row + n] - seg->first_sec;
+        }
+        if( fwrite( sec, 4, n, ar->fp ) != n ) {
+            ar->error = 1;
+            return( -1 );
+        }
+    }
+    if( fwrite( ar->usec, 4, rows, ar->fp ) != rows ||
+        fwrite( ar->data, 4, rows, ar->fp ) != rows ||
+        fwrite( ar->saddr, 2, rows, ar->fp ) != rows ||
+        fwrite( ar->daddr, 2, rows, ar->fp ) != rows ||
+        fwrite( ar->ctrl, 1, rows, ar->fp ) != rows ||
+        fwrite( ar->ntwrk, 1, rows, ar->fp ) != rows ||
+        fwrite( ar->tpci, 1, rows, ar->fp ) != rows ||
+        fwrite( ar->apci, 1, rows, ar->fp ) != rows ||
+        fwrite( ar->length, 1, rows, ar->fp ) != rows ||
+        fwrite( ar->eis, 1, rows, ar->fp ) != rows ||
+        fwrite( ar->blob, 1, seg->blob, ar->fp ) != seg->blob ||
+        fwrite( pad, 1, size, ar->fp ) != size ) {
+        ar->error = 1;
+        return( -1 );
+    }
+    ar->segments++;
+    memset( seg, 0, sizeof( ARCHIVE_SEGMENT ));
+    return( 0 );
+}
+
+
+/*
+ * create archive, segments of rows telegrams (0 = default)
+ *
+ * values are decoded with decode, if not NULL
+ */
+ARCHIVE *archive_create( const char *path, uint32_t rows, ARCHIVE_DECODE decode )
+{
+    ARCHIVE         *ar;
+    ARCHIVE_HEADER  header;
+
+    if( rows == 0 || rows > ARCHIVE_MAX_ROWS ) {
+        rows = ARCHIVE_DEFAULT_ROWS;
+    }
+    ar = calloc( 1, sizeof( ARCHIVE ));
+    if( ar == NULL ) {
+        fprintf( stderr, "Out of memory: %s\n", strerror( errno ));
+        return( NULL );
+    }
+    ar->max_rows = rows;
+    ar->decode = decode;
+    ar->version = ARCHIVE_VERSION;
+    ar->value = malloc( rows * sizeof( double ));
+    ar->sec = malloc( rows * sizeof( int64_t ));
+    ar->usec = malloc( rows * 4 );
+    ar->data = malloc( rows * 4 );
+    ar->saddr = malloc( rows * 2 );
+    ar->daddr = malloc( rows * 2 );
+    ar->ctrl = malloc( rows * 6 );
+    ar->blob_size = 4096;
+    ar->blob = malloc( ar->blob_size );
+    if( ar->value == NULL || ar->sec == NULL || ar->usec == NULL || ar->data == NULL || ar->saddr == NULL ||
+        ar->daddr == NULL || ar->ctrl == NULL || ar->blob == NULL ) {
+        fprintf( stderr, "Out of memory: %s\n", strerror( errno ));
+        archive_close( ar );
+        return( NULL );
+    }
+    ar->ntwrk = ar->ctrl + rows;
+    ar->tpci = ar->ntwrk + rows;
+    ar->apci = ar->tpci + rows;
+    ar->length = ar->apci + rows;
+    ar->eis = ar->length + rows;
+
+    ar->fp = (strcmp( path, "-" ) == 0) ? stdout : fopen( path, "w" );
+    if( ar->fp == NULL ) {
+        fprintf( stderr, "Unable to create archive %s: %s\n", path, strerror( errno ));
+        archive_close( ar );
+        return( NULL );
+    }
+    setvbuf( ar->fp, NULL, _IOFBF, ARCHIVE_BUFFER );
+    memset( &header, 0, sizeof( header ));
+    header.magic = ARCHIVE_MAGIC;
+    header.version = ARCHIVE_VERSION;
+    header.header_size = sizeof( header );
+    if( fwrite( &header, sizeof( header ), 1, ar->fp ) != 1 ) {
+        fprintf( stderr, "Unable to write archive %s: %s\n", path, strerror( errno ));
+        archive_close( ar );
+        return( NULL );
+    }
+    return( ar );
+}
+
+
+/*
+ * add telegram, returns -1 on a write error
+ */
+int archive_append( ARCHIVE *ar, KNXTELEGRAM *telegram )
+{
+    ARCHIVE_SEGMENT *seg = &ar->stats;
+    CEMIFRAME       *frame = &telegram->frame;
+    uint32_t        row = seg->rows;
+    uint32_t        data = 0;
+    uint16_t        daddr = ntohs( frame->daddr );
+    unsigned int    bytes;
+    unsigned int    idx;
+    unsigned int    bit;
+
+    if( row == 0 ) {
+        seg->first_sec = seg->last_sec = telegram->tv.tv_sec;
+        seg->min_group = 0xffff;
+    } else if( telegram->tv.tv_sec < seg->first_sec ) {
+        seg->first_sec = telegram->tv.tv_sec;
+    } else if( telegram->tv.tv_sec > seg->last_sec ) {
+        seg->last_sec = telegram->tv.tv_sec;
+    }
+
+    bytes = (frame->length > 0) ? frame->length - 1 : 0;
+    if( bytes > sizeof( frame->data )) {
+        bytes = sizeof( frame->data );
+    }
+    if( bytes == 0 ) {
+        data = frame->apci & 0x3f;
+    }
+    for( idx = 0; idx < bytes && idx < ARCHIVE_DATA_BYTES; idx++ ) {
+        data = (data << 8) | frame->data[idx];
+    }
+    if( bytes > ARCHIVE_DATA_BYTES ) {
+        if( seg->blob + bytes > ar->blob_size ) {
+            ar->blob_size *= 2;
+            ar->blob = realloc( ar->blob, ar->blob_size );
+            if( ar->blob == NULL ) {
+                fprintf( stderr, "Out of memory: %s\n", strerror( errno ));
+                exit( -9 );
+            }
+        }
+        memcpy( ar->blob + seg->blob, frame->data + ARCHIVE_DATA_BYTES, bytes - ARCHIVE_DATA_BYTES );
+        seg->blob += bytes - ARCHIVE_DATA_BYTES;
+    }
+
+    ar->sec[row] = telegram->tv.tv_sec;
+    ar->usec[row] = telegram->tv.tv_usec;
+    ar->data[row] = data;
+    ar->saddr[row] = ntohs( frame->saddr );
+    ar->daddr[row] = daddr;
+    ar->ctrl[row] = frame->ctrl;
+    ar->ntwrk[row] = frame->ntwrk;
+    ar->tpci[row] = frame->tpci;
+    ar->apci[row] = frame->apci;
+    ar->length[row] = bytes + 1;
+    if( ar->decode == NULL || ar->decode( frame, &ar->eis[row], &ar->value[row] ) != 0 ) {
+        ar->eis[row] = 0;
+        ar->value[row] = NAN;
+    }
+
+    if( frame->ntwrk & EIB_DAF_GROUP ) {
+        seg->groups++;
+        if( daddr < seg->min_group ) {
+            seg->min_group = daddr;
+        }
+        if( daddr > seg->max_group ) {
+            seg->max_group = daddr;
+        }
+        bit = archive_bloom_bit( daddr );
+        seg->bloom[bit >> 3] |= 1 << (bit & 7);
+    }
+    switch( knx_service( frame )) {
+        case 'W':   seg->writes++;      break;
+        case 'A':   seg->answers++;     break;
+        default:    seg->reads++;       break;
+    }
+    ar->records++;
+    if( ++seg->rows == ar->max_rows ) {
+        return( archive_flush( ar ));
+    }
+    return( 0 );
+}
+
+
+/*
+ * map archive and index its segments
+ */
+static ARCHIVE *archive_map( const char *path, int writable )
+{
+    ARCHIVE         *ar;
+    ARCHIVE_HEADER  *header;
+    ARCHIVE_SEGMENT *seg;
+    struct stat     st;
+    size_t          pos;
+    uint32_t        allocated = 0;
+    int             fd;
+
+    ar = calloc( 1, sizeof( ARCHIVE ));
+    if( ar == NULL ) {
+        fprintf( stderr, "Out of memory: %s\n", strerror( errno ));
+        return( NULL );
+    }
+    fd = open( path, writable ? O_RDWR : O_RDONLY );
+    if( fd < 0 || fstat( fd, &st ) != 0 ) {
+        fprintf( stderr, "Unable to open archive %s: %s\n", path, strerror( errno ));
+        if( fd >= 0 ) {
+            close( fd );
+        }
+        free( ar );
+        return( NULL );
+    }
+    ar->size = st.st_size;
+    ar->map = (ar->size > 0) ? mmap( NULL, ar->size, writable ? PROT_READ | PROT_WRITE : PROT_READ,
+                                     MAP_SHARED, fd, 0 ) : MAP_FAILED;
+    close( fd );
+    header = (ARCHIVE_HEADER *)ar->map;
+    if( ar->map == MAP_FAILED || ar->size < sizeof( ARCHIVE_HEADER ) || header->magic != ARCHIVE_MAGIC ||
+        header->version < 1 || header->version > ARCHIVE_VERSION || header->header_size < sizeof( ARCHIVE_HEADER ) ||
+        header->header_size > ar->size ) {
+        fprintf( stderr, "%s is not an archive\n", path );
+        if( ar->map != MAP_FAILED ) {
+            munmap( ar->map, ar->size );
+        }
+        free( ar );
+        return( NULL );
+    }
+    ar->version = header->version;
+
+    for( pos = header->header_size; pos + sizeof( ARCHIVE_SEGMENT ) <= ar->size; pos += seg->size ) {
+        seg = (ARCHIVE_SEGMENT *)(ar->map + pos);
+        if( seg->magic != ARCHIVE_SEGMENT_MAGIC || seg->rows == 0 || seg->rows > ARCHIVE_MAX_ROWS ||
+            seg->size != archive_segment_size( ar->version, seg->rows, seg->blob ) || pos + seg->size > ar->size ) {
+            break;
+        }
+        if( ar->segments == allocated ) {
+            allocated = (allocated == 0) ? 256 : allocated * 2;
+            ar->offset = realloc( ar->offset, allocated * sizeof( uint32_t ));
+            if( ar->offset == NULL ) {
+                fprintf( stderr, "Out of memory: %s\n", strerror( errno ));
+                exit( -9 );
+            }
+        }
+        ar->offset[ar->segments++] = pos;
+        ar->records += seg->rows;
+    }
+    if( pos != ar->size ) {
+        fprintf( stderr, "Archive %s is damaged after %u segments\n", path, ar->segments );
+    }
+    return( ar );
+}
+
+
+/*
+ * map archive for reading
+ */
+ARCHIVE *archive_open( const char *path )
+{
+    return( archive_map( path, 0 ));
+}
+
+
+/*
+ * map archive for changing values in place
+ */
+ARCHIVE *archive_update( const char *path )
+{
+    return( archive_map( path, 1 ));
+}
+
+
+/*
+ * write values changed in place to disk, returns -1 on failure
+ */
+int archive_sync( ARCHIVE *ar )
+{
+    if( ar->map == NULL || msync( ar->map, ar->size, MS_SYNC ) != 0 ) {
+        return( -1 );
+    }
+    return( 0 );
+}
+
+
+/*
+ * locate the arrays of a segment
+ */
+int archive_columns( ARCHIVE *ar, uint32_t segment, ARCHIVE_COLUMNS *cols )
+{
+    unsigned char   *p;
+    uint32_t        rows;
+
+    if( ar->map == NULL || segment >= ar->segments ) {
+        return( -1 );
+    }
+    p = ar->map + ar->offset[segment];
+    cols->segment = (const ARCHIVE_SEGMENT *)p;
+    rows = cols->segment->rows;
+    p += sizeof( ARCHIVE_SEGMENT );
+    cols->value = NULL;
+    cols->eis = NULL;
+    if( ar->version >= 2 ) {
+        cols->value = (double *)p;          p += rows * 8;
+    }
+    cols->sec = (const uint32_t *)p;        p += rows * 4;
+    cols->usec = (const uint32_t *)p;       p += rows * 4;
+    cols->data = (const uint32_t *)p;       p += rows * 4;
+    cols->saddr = (const uint16_t *)p;      p += rows * 2;
+    cols->daddr = (const uint16_t *)p;      p += rows * 2;
+    cols->ctrl = p;                         p += rows;
+    cols->ntwrk = p;                        p += rows;
+    cols->tpci = p;                         p += rows;
+    cols->apci = p;                         p += rows;
+    cols->length = p;                       p += rows;
+    if( ar->version >= 2 ) {
+        cols->eis = (uint8_t *)p;           p += rows;
+    }
+    cols->blob = p;
+    return( 0 );
+}
+
+
+/*
+ * rebuild telegram of a row
+ *
+ * rows must be visited in order, blob_pos starts at 0 for every segment
+ */
+void archive_telegram( ARCHIVE_COLUMNS *cols, uint32_t row, uint32_t *blob_pos, KNXTELEGRAM *telegram )
+{
+    CEMIFRAME       *frame = &telegram->frame;
+    unsigned int    bytes = cols->length[row] - 1;
+    unsigned int    idx;
+
+    memset( telegram, 0, sizeof( KNXTELEGRAM ));
+    telegram->tv.tv_sec = cols->segment->first_sec + cols->sec[row];
+    telegram->tv.tv_usec = cols->usec[row];
+    frame->code = 0x29;
+    frame->ctrl = cols->ctrl[row];
+    frame->ntwrk = cols->ntwrk[row];
+    frame->saddr = htons( cols->saddr[row] );
+    frame->daddr = htons( cols->daddr[row] );
+    frame->length = cols->length[row];
+    frame->tpci = cols->tpci[row];
+    frame->apci = cols->apci[row];
+    for( idx = 0; idx < bytes && idx < ARCHIVE_DATA_BYTES; idx++ ) {
+        frame->data[idx] = cols->data[row] >> (8 * (((bytes < ARCHIVE_DATA_BYTES) ? bytes : ARCHIVE_DATA_BYTES) - 1 - idx));
+    }
+    if( bytes > ARCHIVE_DATA_BYTES ) {
+        memcpy( frame->data + ARCHIVE_DATA_BYTES, cols->blob + *blob_pos, bytes - ARCHIVE_DATA_BYTES );
+        *blob_pos += bytes - ARCHIVE_DATA_BYTES;
+    }
+}
+
+
+/*
+ * write last segment when creating, unmap when reading
+ *
+ * returns -1 if not everything could be written
+ */
+int archive_close( ARCHIVE *ar )
+{
+    int             result = 0;
+
+    if( ar->fp != NULL ) {
+        if( archive_flush( ar ) != 0 || fflush( ar->fp ) != 0 || ar->error ) {
+            result = -1;
+        }
+        if( ar->fp != stdout && fclose( ar->fp ) != 0 ) {
+            result = -1;
+        }
+    }
+    if( ar->map != NULL ) {
+        munmap( ar->map, ar->size );
+    }
+    free( ar->value );
+    free( ar->sec );
+    free( ar->usec );
+    free( ar->data );
+    free( ar->saddr );
+    free( ar->daddr );
+    free( ar->ctrl );
+    free( ar->blob );
+    free( ar->offset );
+    free( ar );
+    return( result );
+}
@@ -0,0 +1,167 @@
+/*
+ * archive - columnar telegram archive
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#ifndef ARCHIVE_H_
+#define ARCHIVE_H_
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include "knxframe.h"
+
+/*
+ * An archive is a file header followed by segments of up to a few ten
+ * thousand telegrams. A segment starts with statistics which allow a
+ * scan to skip it (time range, group address range and bloom filter,
+ * service counts), followed by one array per field:
+ *
+ *   double  value[rows]        decoded value, NaN if none (version 2)
+ *   uint32  sec[rows]          seconds since first_sec
+ *   uint32  usec[rows]
+ *   uint32  data[rows]         data bytes after apci, big endian, right aligned;
+ *                              the 6 bit value of apci for short frames
+ *   uint16  saddr[rows]
+ *   uint16  daddr[rows]
+ *   uint8   ctrl[rows], ntwrk[rows], tpci[rows], apci[rows], length[rows]
+ *   uint8   eis[rows]          type value was decoded with, 0 = none (version 2)
+ *   uint8   blob[]             data bytes beyond the first 4, in row order
+ *
+ * padded to 8 bytes. Arrays are in host byte order, addresses included.
+ * Version 1 archives, without value and eis, can still be read.
+ */
+#define ARCHIVE_MAGIC           0x4b4e5841          // "KNXA"
+#define ARCHIVE_SEGMENT_MAGIC   0x4b4e5847          // "KNXG"
+#define ARCHIVE_VERSION         2
+#define ARCHIVE_DEFAULT_ROWS    65536
+#define ARCHIVE_MAX_ROWS        1048576
+#define ARCHIVE_DATA_BYTES      4                   // data bytes kept in column data
+
+typedef struct {
+        uint32_t        magic;
+        uint16_t        version;
+        uint16_t        header_size;
+        uint32_t        reserved[2];
+} ARCHIVE_HEADER;
+
+typedef struct {
+        uint32_t        magic;
+        uint32_t        rows;
+        uint32_t        size;                   // bytes, this header included
+        uint32_t        blob;                   // bytes in blob
+        int64_t         first_sec;
+        int64_t         last_sec;
+        uint16_t        min_group;              // range of group addresses, if groups > 0
+        uint16_t        max_group;
+        uint32_t        groups;                 // rows sent to a group address
+        uint32_t        writes;
+        uint32_t        answers;
+        uint32_t        reads;
+        uint32_t        reserved[3];
+        uint8_t         bloom[32];              // group addresses present
+} ARCHIVE_SEGMENT;
+
+/*
+ * decodes the value of a frame, returns -1 if it has none
+ */
+typedef int (*ARCHIVE_DECODE)( CEMIFRAME *frame, uint8_t *eis, double *value );
+
+/*
+ * the arrays of one segment, pointing into the mapped file
+ */
+typedef struct {
+        const ARCHIVE_SEGMENT   *segment;
+        double                  *value;         // NULL in version 1, writable after archive_update()
+        uint8_t                 *eis;
+        const uint32_t          *sec;
+        const uint32_t          *usec;
+        const uint32_t          *data;
+        const uint16_t          *saddr;
+        const uint16_t          *daddr;
+        const uint8_t           *ctrl;
+        const uint8_t           *ntwrk;
+        const uint8_t           *tpci;
+        const uint8_t           *apci;
+        const uint8_t           *length;
+        const uint8_t           *blob;
+} ARCHIVE_COLUMNS;
+
+typedef struct {
+        // writing
+        FILE            *fp;
+        uint32_t        max_rows;
+        ARCHIVE_DECODE  decode;                 // NULL = no values
+        ARCHIVE_SEGMENT stats;                  // of the segment being filled
+        double          *value;
+        uint8_t         *eis;
+        int64_t         *sec;
+        uint32_t        *usec;
+        uint32_t        *data;
+        uint16_t        *saddr;
+        uint16_t        *daddr;
+        uint8_t         *ctrl;
+        uint8_t         *ntwrk;
+        uint8_t         *tpci;
+        uint8_t         *apci;
+        uint8_t         *length;
+        uint8_t         *blob;
+        uint32_t        blob_size;
+        int             error;
+        // reading
+        unsigned char   *map;
+        size_t          size;
+        uint32_t        *offset;                // of every segment
+        // both
+        uint16_t        version;
+        uint32_t        segments;
+        uint64_t        records;
+} ARCHIVE;
+
+
+/*
+ * function declarations
+ */
+extern ARCHIVE      *archive_create( const char *path, uint32_t rows, ARCHIVE_DECODE decode );
+extern int          archive_append( ARCHIVE *ar, KNXTELEGRAM *telegram );
+extern ARCHIVE      *archive_open( const char *path );
+extern ARCHIVE      *archive_update( const char *path );
+extern int          archive_columns( ARCHIVE *ar, uint32_t segment, ARCHIVE_COLUMNS *cols );
+extern int          archive_sync( ARCHIVE *ar );
+extern void         archive_telegram( ARCHIVE_COLUMNS *cols, uint32_t row, uint32_t *blob_pos, KNXTELEGRAM *telegram );
+extern int          archive_close( ARCHIVE *ar );
+
+/*
+ * bloom filter bit of a group address
+ */
+static inline unsigned int archive_bloom_bit( uint16_t grp_addr )
+{
+    return( (uint16_t)(grp_addr * 40503u) >> 8 );
+}
+
+/*
+ * segment may hold telegrams to group address, false means it certainly does not
+ */
+static inline int archive_may_contain( const ARCHIVE_SEGMENT *seg, uint16_t grp_addr )
+{
+    unsigned int    bit = archive_bloom_bit( grp_addr );
+
+    return( seg->groups > 0 && grp_addr >= seg->min_group && grp_addr <= seg->max_group &&
+            (seg->bloom[bit >> 3] & (1 << (bit & 7))) );
+}
+
+#endif /*ARCHIVE_H_*/
@@ -0,0 +1,332 @@
+/*
+ * broker - local distribution of monitored telegrams
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <arpa/inet.h>
+
+#include "broker.h"
+
+
+/*
+ * encode telegram as broker record, returns record size
+ */
+int broker_encode( unsigned char *buf, KNXTELEGRAM *telegram, uint16_t merged )
+{
+    uint32_t        u32;
+    uint16_t        u16;
+    int             framelen;
+
+    framelen = offsetof( CEMIFRAME, apci ) + telegram->frame.length;
+    if( framelen > sizeof( CEMIFRAME )) {
+        framelen = sizeof( CEMIFRAME );
+    }
+
+    u16 = htons( BROKER_RECORD_HEADER - 2 + framelen );
+    memcpy( buf, &u16, 2 );
+    u32 = htonl( telegram->tv.tv_sec );
+    memcpy( buf + 2, &u32, 4 );
+    u32 = htonl( telegram->tv.tv_usec );
+    memcpy( buf + 6, &u32, 4 );
+    u16 = htons( merged );
+    memcpy( buf + 10, &u16, 2 );
+    memcpy( buf + BROKER_RECORD_HEADER, &telegram->frame, framelen );
+
+    return( BROKER_RECORD_HEADER + framelen );
+}
+
+
+/*
+ * connect to broker and subscribe
+ */
+BROKER_CLIENT *broker_connect( const char *path, uint16_t flags, BROKER_FILTER *filters, int count )
+{
+    BROKER_CLIENT       *client;
+    struct sockaddr_un  addr;
+    unsigned char       *request;
+    uint32_t            u32;
+    uint16_t            u16;
+    int                 len;
+    int                 idx;
+
+    if( count < 0 || count > BROKER_MAX_FILTERS ) {
+        fprintf( stderr, "Too many address filters\n" );
+        return( NULL );
+    }
+    client = calloc( 1, sizeof( BROKER_CLIENT ));
+    request = malloc( 8 + count * 4 );
+    if( client == NULL || request == NULL ) {
+        fprintf( stderr, "Out of memory: %s\n", strerror( errno ));
+        free( client );
+        free( request );
+        return( NULL );
+    }
+
+    memset( &addr, 0, sizeof( addr ));
+    addr.sun_family = AF_UNIX;
+    strncpy( addr.sun_path, path, sizeof( addr.sun_path ) -1 );
+    client->fd = socket( AF_UNIX, SOCK_STREAM, 0 );
+    if( client->fd < 0 || connect( client->fd, (struct sockaddr *)&addr, sizeof( addr )) != 0 ) {
+        fprintf( stderr, "Connect to broker %s failed: %s\n", path, strerror( errno ));
+        goto failed;
+    }
+
+    u32 = htonl( BROKER_MAGIC );
+    memcpy( request, &u32, 4 );
+    u16 = htons( flags );
+    memcpy( request + 4, &u16, 2 );
+    u16 = htons( count );
+    memcpy( request + 6, &u16, 2 );
+    len = 8;
+    for( idx = 0; idx < count; idx++ ) {
+        u16 = htons( filters[idx].first );
+        memcpy( request + len, &u16, 2 );
+        u16 = htons( filters[idx].last );
+        memcpy( request + len + 2, &u16, 2 );
+        len += 4;
+    }
+    if( write( client->fd, request, len ) != len ) {
+        fprintf( stderr, "Subscription to broker failed: %s\n", strerror( errno ));
+        goto failed;
+    }
+    free( request );
+    return( client );
+
+failed:
+    if( client->fd >= 0 ) {
+        close( client->fd );
+    }
+    free( client );
+    free( request );
+    return( NULL );
+}
+
+
+/*
+ * return next telegram, blocks until one is available
+ *
+ * records are read in large chunks, most calls are served from the buffer
+ * returns -1 if the broker closed the connection
+ */
+int broker_next( BROKER_CLIENT *client, KNXTELEGRAM *telegram, uint16_t *merged )
+{
+    unsigned char   *rec;
+    uint32_t        u32;
+    uint16_t        u16;
+    unsigned int    reclen;
+    int             framelen;
+    ssize_t         len;
+
+    for( ;; ) {
+        if( client->end - client->start >= 2 ) {
+            memcpy( &u16, client->buf + client->start, 2 );
+            reclen = ntohs( u16 ) + 2;
+            if( reclen < BROKER_RECORD_HEADER || reclen > BROKER_RECORD_MAX ) {
+                fprintf( stderr, "Invalid record from broker\n" );
+                return( -1 );
+            }
+            if( client->end - client->start >= reclen ) {
+                break;
+            }
+        }
+        if( client->start > 0 ) {
+            memmove( client->buf, client->buf + client->start, client->end - client->start );
+            client->end -= client->start;
+            client->start = 0;
+        }
+        len = read( client->fd, client->buf + client->end, BROKER_BUFFER - client->end );
+        if( len <= 0 ) {
+            return( -1 );
+        }
+        client->end += len;
+    }
+
+    rec = client->buf + client->start;
+    memcpy( &u32, rec + 2, 4 );
+    telegram->tv.tv_sec = ntohl( u32 );
+    memcpy( &u32, rec + 6, 4 );
+    telegram->tv.tv_usec = ntohl( u32 );
+    if( merged != NULL ) {
+        memcpy( &u16, rec + 10, 2 );
+        *merged = ntohs( u16 );
+    }
+    framelen = reclen - BROKER_RECORD_HEADER;
+    memset( &telegram->frame, 0, sizeof( CEMIFRAME ));
+    memcpy( &telegram->frame, rec + BROKER_RECORD_HEADER, framelen );
+    telegram->seen = 0;
+    client->start += reclen;
+
+    return( 0 );
+}
+
+
+/*
+ * switch the connection to non-blocking reads for broker_fill()
+ */
+int broker_nonblock( BROKER_CLIENT *client )
+{
+    int             flags;
+
+    flags = fcntl( client->fd, F_GETFL );
+    if( flags < 0 || fcntl( client->fd, F_SETFL, flags | O_NONBLOCK ) != 0 ) {
+        fprintf( stderr, "Unable to make broker connection non-blocking: %s\n", strerror( errno ));
+        return( -1 );
+    }
+    return( 0 );
+}
+
+
+/*
+ * socket to wait on with poll() or epoll
+ */
+int broker_fd( BROKER_CLIENT *client )
+{
+    return( client->fd );
+}
+
+
+/*
+ * read whatever the broker has sent so far with a single read()
+ *
+ * an incomplete record is moved to the front first, so all records stay
+ * contiguous; this invalidates views handed out before
+ * returns bytes read, 0 if nothing was waiting or the buffer is full,
+ * -1 if the broker closed the connection
+ */
+int broker_fill( BROKER_CLIENT *client )
+{
+    ssize_t         len;
+
+    if( client->start == client->end ) {
+        client->start = client->end = 0;
+    } else if( client->start > 0 && BROKER_BUFFER - client->end < BROKER_RECORD_MAX ) {
+        memmove( client->buf, client->buf + client->start, client->end - client->start );
+        client->end -= client->start;
+        client->start = 0;
+    }
+    if( client->end == BROKER_BUFFER ) {
+        return( 0 );
+    }
+    len = read( client->fd, client->buf + client->end, BROKER_BUFFER - client->end );
+    if( len < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) ) {
+        return( 0 );
+    }
+    if( len <= 0 ) {
+        return( -1 );
+    }
+    client->end += len;
+    return( len );
+}
+
+
+/*
+ * wait up to timeout_ms for the broker, then broker_fill()
+ *
+ * for clients without an event loop of their own
+ */
+int broker_poll( BROKER_CLIENT *client, int timeout_ms )
+{
+    struct pollfd   pfd;
+    int             result;
+
+    pfd.fd = client->fd;
+    pfd.events = POLLIN;
+    result = poll( &pfd, 1, timeout_ms );
+    if( result < 0 ) {
+        return( (errno == EINTR) ? 0 : -1 );
+    }
+    if( result == 0 ) {
+        return( 0 );
+    }
+    return( broker_fill( client ));
+}
+
+
+/*
+ * hand out up to max complete records in the buffer without copying them
+ *
+ * returns number of views, -1 on an invalid record
+ */
+int broker_views( BROKER_CLIENT *client, BROKER_VIEW *views, int max )
+{
+    unsigned char   *rec;
+    uint32_t        u32;
+    uint16_t        u16;
+    unsigned int    reclen;
+    int             count = 0;
+
+    while( count < max && client->end - client->start >= 2 ) {
+        rec = client->buf + client->start;
+        memcpy( &u16, rec, 2 );
+        reclen = ntohs( u16 ) + 2;
+        if( reclen < BROKER_RECORD_HEADER || reclen > BROKER_RECORD_MAX ) {
+            fprintf( stderr, "Invalid record from broker\n" );
+            return( -1 );
+        }
+        if( client->end - client->start < reclen ) {
+            break;
+        }
+        memcpy( &u32, rec + 2, 4 );
+        views[count].tv.tv_sec = ntohl( u32 );
+        memcpy( &u32, rec + 6, 4 );
+        views[count].tv.tv_usec = ntohl( u32 );
+        memcpy( &u16, rec + 10, 2 );
+        views[count].merged = ntohs( u16 );
+        views[count].framelen = reclen - BROKER_RECORD_HEADER;
+        views[count].frame = (const CEMIFRAME *)(rec + BROKER_RECORD_HEADER);
+        client->start += reclen;
+        count++;
+    }
+    return( count );
+}
+
+
+/*
+ * copy a view into a telegram that outlives the buffer
+ */
+void broker_view_telegram( const BROKER_VIEW *view, KNXTELEGRAM *telegram )
+{
+    telegram->tv = view->tv;
+    memset( &telegram->frame, 0, sizeof( CEMIFRAME ));
+    memcpy( &telegram->frame, view->frame, view->framelen );
+    telegram->seen = 0;
+}
+
+
+/*
+ * disconnect from broker
+ */
+void broker_close( BROKER_CLIENT *client )
+{
+    close( client->fd );
+    free( client );
+}
@@ -0,0 +1,95 @@
+/*
+ * broker - local distribution of monitored telegrams
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#ifndef BROKER_H_
+#define BROKER_H_
+
+#include <stdint.h>
+#include <sys/time.h>
+
+#include "knxframe.h"
+
+/*
+ * eibbroker holds the only monitor connection to eibnetmux and passes
+ * telegrams on to local subscribers over a unix domain stream socket.
+ *
+ * A subscriber starts with a subscription:
+ *   uint32  magic             BROKER_MAGIC
+ *   uint16  flags             BROKER_F_*
+ *   uint16  count             number of address ranges, 0 = all group addresses
+ *   count * { uint16 first, uint16 last }
+ * after which the broker sends records:
+ *   uint16  length            of the rest of the record
+ *   uint32  tv_sec, tv_usec   receive time
+ *   uint16  merged            telegrams replaced by this one while the subscriber was behind
+ *   CEMIFRAME                 as received, length - 10 bytes
+ * All integers are in network byte order, addresses in a CEMIFRAME stay as on the bus.
+ *
+ * broker_next() blocks for each telegram. Event loops instead make the
+ * socket non-blocking, wait for broker_fd() themselves, pull whatever has
+ * arrived with broker_fill() and take all complete records at once with
+ * broker_views(). A view points into the client buffer and stays valid
+ * until the next broker_fill() or broker_next(); only the first
+ * offsetof( CEMIFRAME, apci ) + frame->length bytes of its frame are set.
+ */
+#define BROKER_DEFAULT_SOCKET   "/tmp/eibbroker.sock"
+#define BROKER_MAGIC            0x4b4e5842          // "KNXB"
+#define BROKER_MAX_FILTERS      1024
+#define BROKER_RECORD_HEADER    12
+#define BROKER_RECORD_MAX       (BROKER_RECORD_HEADER + sizeof( CEMIFRAME ))
+#define BROKER_BUFFER           16384
+#define BROKER_VIEWS            (BROKER_BUFFER / BROKER_RECORD_HEADER)
+
+#define BROKER_F_PHYSICAL       0x0001              // include frames to physical addresses
+
+typedef struct {
+        uint16_t        first;
+        uint16_t        last;
+} BROKER_FILTER;
+
+typedef struct {
+        int             fd;
+        unsigned int    start;
+        unsigned int    end;
+        unsigned char   buf[BROKER_BUFFER + sizeof( CEMIFRAME )];  // slack keeps views at the end readable
+} BROKER_CLIENT;
+
+typedef struct {
+        struct timeval  tv;
+        uint16_t        merged;
+        uint16_t        framelen;
+        const CEMIFRAME *frame;
+} BROKER_VIEW;
+
+
+/*
+ * function declarations
+ */
+extern BROKER_CLIENT    *broker_connect( const char *path, uint16_t flags, BROKER_FILTER *filters, int count );
+extern int              broker_next( BROKER_CLIENT *client, KNXTELEGRAM *telegram, uint16_t *merged );
+extern int              broker_nonblock( BROKER_CLIENT *client );
+extern int              broker_fd( BROKER_CLIENT *client );
+extern int              broker_fill( BROKER_CLIENT *client );
+extern int              broker_poll( BROKER_CLIENT *client, int timeout_ms );
+extern int              broker_views( BROKER_CLIENT *client, BROKER_VIEW *views, int max );
+extern void             broker_view_telegram( const BROKER_VIEW *view, KNXTELEGRAM *telegram );
+extern void             broker_close( BROKER_CLIENT *client );
+extern int              broker_encode( unsigned char *buf, KNXTELEGRAM *telegram, uint16_t merged );
+
+#endif /*BROKER_H_*/
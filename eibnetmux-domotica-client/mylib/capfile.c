@@ -0,0 +1,283 @@
+/*
+ * capfile - capture files of raw telegrams
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+#include <errno.h>
+#include <arpa/inet.h>
+
+#include "capfile.h"
+
+#define CAPFILE_BUFFER      65536
+
+/*
+ * local function declarations
+ */
+static CAPFILE  *capfile_new( const char *path, const char *mode );
+
+
+/*
+ * format file header, returns its size
+ */
+int capfile_header( unsigned char *buf )
+{
+    uint32_t        u32;
+    uint16_t        u16;
+
+    u32 = htonl( CAPFILE_MAGIC );
+    memcpy( buf, &u32, 4 );
+    u16 = htons( CAPFILE_VERSION );
+    memcpy( buf + 4, &u16, 2 );
+    u16 = htons( CAPFILE_HEADER );
+    memcpy( buf + 6, &u16, 2 );
+    memset( buf + 8, 0, 4 );
+    return( CAPFILE_HEADER );
+}
+
+
+/*
+ * verify file header, returns offset of the first record or -1
+ */
+int capfile_check( const unsigned char *buf, size_t len )
+{
+    uint32_t        u32;
+    uint16_t        u16;
+
+    if( len < CAPFILE_HEADER ) {
+        return( -1 );
+    }
+    memcpy( &u32, buf, 4 );
+    if( ntohl( u32 ) != CAPFILE_MAGIC ) {
+        return( -1 );
+    }
+    memcpy( &u16, buf + 4, 2 );
+    if( ntohs( u16 ) != CAPFILE_VERSION ) {
+        return( -1 );
+    }
+    memcpy( &u16, buf + 6, 2 );
+    if( ntohs( u16 ) < CAPFILE_HEADER || ntohs( u16 ) > len ) {
+        return( -1 );
+    }
+    return( ntohs( u16 ));
+}
+
+
+/*
+ * encode telegram as record, returns record size
+ */
+int capfile_encode( unsigned char *buf, KNXTELEGRAM *telegram )
+{
+    uint32_t        u32;
+    uint16_t        u16;
+    int             framelen;
+
+    framelen = offsetof( CEMIFRAME, apci ) + telegram->frame.length;
+    if( framelen > sizeof( CEMIFRAME )) {
+        framelen = sizeof( CEMIFRAME );
+    }
+    u16 = htons( CAPFILE_RECORD_HEADER - 2 + framelen );
+    memcpy( buf, &u16, 2 );
+    u32 = htonl( telegram->tv.tv_sec );
+    memcpy( buf + 2, &u32, 4 );
+    u32 = htonl( telegram->tv.tv_usec );
+    memcpy( buf + 6, &u32, 4 );
+    memcpy( buf + CAPFILE_RECORD_HEADER, &telegram->frame, framelen );
+
+    return( CAPFILE_RECORD_HEADER + framelen );
+}
+
+
+/*
+ * decode record at buf with len bytes available
+ *
+ * returns record size, 0 if the record is incomplete, -1 if it is invalid
+ */
+int capfile_decode( const unsigned char *buf, size_t len, KNXTELEGRAM *telegram )
+{
+    uint32_t        u32;
+    uint16_t        u16;
+    unsigned int    reclen;
+
+    if( len < 2 ) {
+        return( 0 );
+    }
+    memcpy( &u16, buf, 2 );
+    reclen = ntohs( u16 ) + 2;
+    if( reclen < CAPFILE_RECORD_HEADER || reclen > CAPFILE_RECORD_MAX ) {
+        return( -1 );
+    }
+    if( len < reclen ) {
+        return( 0 );
+    }
+    memcpy( &u32, buf + 2, 4 );
+    telegram->tv.tv_sec = ntohl( u32 );
+    memcpy( &u32, buf + 6, 4 );
+    telegram->tv.tv_usec = ntohl( u32 );
+    memset( &telegram->frame, 0, sizeof( CEMIFRAME ));
+    memcpy( &telegram->frame, buf + CAPFILE_RECORD_HEADER, reclen - CAPFILE_RECORD_HEADER );
+    telegram->seen = 0;
+    return( reclen );
+}
+
+
+static CAPFILE *capfile_new( const char *path, const char *mode )
+{
+    CAPFILE         *cf;
+
+    cf = calloc( 1, sizeof( CAPFILE ));
+    if( cf != NULL ) {
+        cf->buf = malloc( CAPFILE_BUFFER );
+    }
+    if( cf == NULL || cf->buf == NULL ) {
+        fprintf( stderr, "Out of memory: %s\n", strerror( errno ));
+        if( cf != NULL ) {
+            free( cf );
+        }
+        return( NULL );
+    }
+    if( strcmp( path, "-" ) == 0 ) {
+        cf->fp = (*mode == 'w') ? stdout : stdin;
+        return( cf );
+    }
+    cf->fp = fopen( path, mode );
+    if( cf->fp == NULL ) {
+        fprintf( stderr, "Unable to open capture file %s: %s\n", path, strerror( errno ));
+        free( cf->buf );
+        free( cf );
+        return( NULL );
+    }
+    setvbuf( cf->fp, cf->buf, _IOFBF, CAPFILE_BUFFER );
+    return( cf );
+}
+
+
+/*
+ * create capture file, '-' is stdout
+ */
+CAPFILE *capfile_create( const char *path )
+{
+    CAPFILE         *cf;
+    unsigned char   header[CAPFILE_HEADER];
+
+    cf = capfile_new( path, "w" );
+    if( cf == NULL ) {
+        return( NULL );
+    }
+    cf->writing = 1;
+    capfile_header( header );
+    if( fwrite( header, CAPFILE_HEADER, 1, cf->fp ) != 1 ) {
+        fprintf( stderr, "Unable to write capture file %s: %s\n", path, strerror( errno ));
+        capfile_close( cf );
+        return( NULL );
+    }
+    return( cf );
+}
+
+
+/*
+ * open capture file for reading, '-' is stdin
+ */
+CAPFILE *capfile_open( const char *path )
+{
+    CAPFILE         *cf;
+    unsigned char   header[CAPFILE_HEADER];
+    int             offset;
+
+    cf = capfile_new( path, "r" );
+    if( cf == NULL ) {
+        return( NULL );
+    }
+    if( fread( header, CAPFILE_HEADER, 1, cf->fp ) != 1 ||
+        (offset = capfile_check( header, 65535 )) < 0 ) {
+        fprintf( stderr, "%s is not a capture file\n", path );
+        capfile_close( cf );
+        return( NULL );
+    }
+    // skip header fields of later minor versions
+    while( offset-- > CAPFILE_HEADER ) {
+        fgetc( cf->fp );
+    }
+    return( cf );
+}
+
+
+int capfile_write( CAPFILE *cf, KNXTELEGRAM *telegram )
+{
+    unsigned char   record[CAPFILE_RECORD_MAX];
+    int             len;
+
+    len = capfile_encode( record, telegram );
+    if( fwrite( record, len, 1, cf->fp ) != 1 ) {
+        return( -1 );
+    }
+    cf->records++;
+    return( 0 );
+}
+
+
+/*
+ * read next record, returns 1, 0 at end of file or -1 on a damaged file
+ */
+int capfile_read( CAPFILE *cf, KNXTELEGRAM *telegram )
+{
+    unsigned char   record[CAPFILE_RECORD_MAX];
+    uint16_t        u16;
+    unsigned int    reclen;
+
+    if( fread( record, 2, 1, cf->fp ) != 1 ) {
+        return( 0 );
+    }
+    memcpy( &u16, record, 2 );
+    reclen = ntohs( u16 ) + 2;
+    if( reclen < CAPFILE_RECORD_HEADER || reclen > CAPFILE_RECORD_MAX ||
+        fread( record + 2, reclen - 2, 1, cf->fp ) != 1 ) {
+        return( -1 );
+    }
+    capfile_decode( record, reclen, telegram );
+    cf->records++;
+    return( 1 );
+}
+
+
+/*
+ * close file, returns -1 if not everything could be written
+ */
+int capfile_close( CAPFILE *cf )
+{
+    int             result = 0;
+
+    if( cf->writing && fflush( cf->fp ) != 0 ) {
+        result = -1;
+    }
+    if( cf->fp != stdin && cf->fp != stdout ) {
+        if( fclose( cf->fp ) != 0 ) {
+            result = -1;
+        }
+    }
+    free( cf->buf );
+    free( cf );
+    return( result );
+}
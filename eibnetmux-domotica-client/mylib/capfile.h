@@ -0,0 +1,68 @@
+/*
+ * capfile - capture files of raw telegrams
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#ifndef CAPFILE_H_
+#define CAPFILE_H_
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include "knxframe.h"
+
+/*
+ * A capture file starts with a header:
+ *   uint32  magic             CAPFILE_MAGIC
+ *   uint16  version           CAPFILE_VERSION
+ *   uint16  header size       of this header, records start after it
+ *   uint32  reserved          0
+ * followed by records in receive order:
+ *   uint16  length            of the rest of the record
+ *   uint32  tv_sec, tv_usec   receive time
+ *   CEMIFRAME                 as received, length - 8 bytes
+ * All integers are in network byte order, addresses in a CEMIFRAME stay as
+ * on the bus. Records are the broker records without the merged count.
+ */
+#define CAPFILE_MAGIC           0x4b4e5843          // "KNXC"
+#define CAPFILE_VERSION         1
+#define CAPFILE_HEADER          12
+#define CAPFILE_RECORD_HEADER   10
+#define CAPFILE_RECORD_MAX      (CAPFILE_RECORD_HEADER + sizeof( CEMIFRAME ))
+
+typedef struct {
+        FILE            *fp;
+        char            *buf;                   // stdio buffer
+        int             writing;
+        uint64_t        records;
+} CAPFILE;
+
+
+/*
+ * function declarations
+ */
+extern CAPFILE      *capfile_create( const char *path );
+extern CAPFILE      *capfile_open( const char *path );
+extern int          capfile_write( CAPFILE *cf, KNXTELEGRAM *telegram );
+extern int          capfile_read( CAPFILE *cf, KNXTELEGRAM *telegram );
+extern int          capfile_close( CAPFILE *cf );
+extern int          capfile_header( unsigned char *buf );
+extern int          capfile_check( const unsigned char *buf, size_t len );
+extern int          capfile_encode( unsigned char *buf, KNXTELEGRAM *telegram );
+extern int          capfile_decode( const unsigned char *buf, size_t len, KNXTELEGRAM *telegram );
+
+#endif /*CAPFILE_H_*/
@@ -0,0 +1,806 @@
+/*
+ * caplog - continuous capture to rotating capture files
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE                             // fallocate()
+#endif
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+
+// io_uring is used through its system calls, liburing is not needed
+#if defined( __linux__ ) && defined( __has_include )
+#if __has_include( <linux/io_uring.h> )
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#endif
+#endif
+#if defined( __NR_io_uring_setup ) && defined( IORING_FEAT_SINGLE_MMAP )
+#define CAPLOG_HAVE_URING
+#endif
+
+#include "caplog.h"
+#include "capfile.h"
+
+#define SEG_FREE            -1                  // segment fd when no file is open
+#define SEG_OPENING         -2
+#define TAG_SYNC            0x10000             // completion of a sync, else of a write to buffer n
+#define RING_ENTRIES        64
+
+typedef struct {
+        unsigned char   *data;
+        uint32_t        used;
+        int             busy;                   // being written
+        int             segment;
+        struct iovec    iov;
+} CAPLOG_BUFFER;
+
+typedef struct {
+        int             fd;                     // SEG_FREE, SEG_OPENING or the open file
+        char            part[PATH_MAX];         // name while being written
+        time_t          start;
+        uint64_t        offset;                 // bytes queued
+        unsigned int    inflight;               // writes and syncs not completed
+        int             dirty;                  // written since last sync
+        int             retired;                // 1 = waiting for its writes, 2 = handed to the thread
+} CAPLOG_SEGMENT;
+
+#ifdef CAPLOG_HAVE_URING
+typedef struct {
+        int             fd;
+        void            *sq_map;
+        size_t          sq_size;
+        void            *cq_map;
+        size_t          cq_size;
+        struct io_uring_sqe *sqes;
+        size_t          sqes_size;
+        unsigned int    *sq_head;
+        unsigned int    *sq_tail;
+        unsigned int    *sq_mask;
+        unsigned int    *sq_array;
+        unsigned int    *cq_head;
+        unsigned int    *cq_tail;
+        unsigned int    *cq_mask;
+        struct io_uring_cqe *cqes;
+        int             fixed;                  // buffers registered
+} CAPLOG_RING;
+#endif
+
+struct caplog {
+        char            *dir;
+        int             method;
+        uint64_t        segment_bytes;
+        unsigned int    segment_seconds;
+        unsigned char   *memory;
+        CAPLOG_BUFFER   buffer[CAPLOG_BUFFERS];
+        int             current;                // buffer being filled, -1 = none
+        struct timeval  synced;
+        CAPLOG_SEGMENT  segment[CAPLOG_SEGMENTS];
+        int             active;                 // segment written, -1 = none
+        unsigned int    inflight;
+        pthread_t       thread;
+        pthread_mutex_t lock;
+        pthread_cond_t  wakeup;
+        int             stop;
+        int             spare;                  // segment prepared by the thread, -1 = none
+        int             closing[CAPLOG_SEGMENTS];
+        int             nclosing;
+        unsigned int    sequence;
+#ifdef CAPLOG_HAVE_URING
+        CAPLOG_RING     ring;
+#endif
+        uint64_t        records;
+        uint64_t        bytes;
+        uint64_t        dropped;
+        uint64_t        errors;
+        uint64_t        segments;
+        uint64_t        syncs;
+};
+
+/*
+ * local function declarations
+ */
+static int      caplog_prepare( CAPLOG *log );
+static void     caplog_finish( CAPLOG *log, int slot );
+static void     *caplog_thread( void *arg );
+static void     caplog_retire( CAPLOG *log );
+static int      caplog_rotate( CAPLOG *log, time_t now );
+static int      caplog_buffer( CAPLOG *log );
+static void     caplog_submit( CAPLOG *log );
+static void     caplog_sync( CAPLOG *log, struct timeval *now );
+#ifdef CAPLOG_HAVE_URING
+static int      caplog_ring_open( CAPLOG *log );
+static void     caplog_ring_close( CAPLOG *log );
+static int      caplog_queue( CAPLOG *log, int fd, CAPLOG_BUFFER *buf, uint64_t offset, uint64_t tag );
+static void     caplog_reap( CAPLOG *log, int wait );
+#endif
+
+
+/*
+ * open and preallocate the next segment as spare
+ *
+ * returns -1 if no file could be created
+ */
+static int caplog_prepare( CAPLOG *log )
+{
+    CAPLOG_SEGMENT  *seg = NULL;
+    int             slot;
+    int             fd;
+
+    pthread_mutex_lock( &log->lock );
+    for( slot = 0; slot < CAPLOG_SEGMENTS; slot++ ) {
+        if( log->segment[slot].fd == SEG_FREE ) {
+            seg = &log->segment[slot];
+            seg->fd = SEG_OPENING;
+            break;
+        }
+    }
+    pthread_mutex_unlock( &log->lock );
+    if( seg == NULL ) {
+        return( -1 );
+    }
+
+    snprintf( seg->part, sizeof( seg->part ), "%s/.knxcap-%d-%u.part", log->dir, (int)getpid(), log->sequence++ );
+    fd = open( seg->part, O_WRONLY | O_CREAT | O_TRUNC, 0644 );
+    if( fd < 0 ) {
+        fprintf( stderr, "Unable to create capture file %s: %s\n", seg->part, strerror( errno ));
+        pthread_mutex_lock( &log->lock );
+        seg->fd = SEG_FREE;
+        pthread_mutex_unlock( &log->lock );
+        return( -1 );
+    }
+    // not all file systems can, the file then grows as written
+    fallocate( fd, FALLOC_FL_KEEP_SIZE, 0, log->segment_bytes + CAPLOG_BUFFER_SIZE );
+
+    pthread_mutex_lock( &log->lock );
+    seg->start = 0;
+    seg->offset = 0;
+    seg->inflight = 0;
+    seg->dirty = 0;
+    seg->retired = 0;
+    seg->fd = fd;
+    log->spare = slot;
+    pthread_mutex_unlock( &log->lock );
+    return( 0 );
+}
+
+
+/*
+ * sync, close and rename a segment all writes of which completed, remove it if empty
+ */
+static void caplog_finish( CAPLOG *log, int slot )
+{
+    CAPLOG_SEGMENT  *seg = &log->segment[slot];
+    struct tm       tm;
+    char            name[32];
+    char            path[PATH_MAX];
+    int             n;
+
+    // give back what was preallocated but not used
+    if( ftruncate( seg->fd, seg->offset ) != 0 || fdatasync( seg->fd ) != 0 ) {
+        fprintf( stderr, "Unable to sync capture file %s: %s\n", seg->part, strerror( errno ));
+    }
+    close( seg->fd );
+    if( seg->offset == 0 ) {
+        unlink( seg->part );
+        pthread_mutex_lock( &log->lock );
+        seg->fd = SEG_FREE;
+        pthread_mutex_unlock( &log->lock );
+        return;
+    }
+
+    localtime_r( &seg->start, &tm );
+    strftime( name, sizeof( name ), "knxcap-%Y%m%d-%H%M%S", &tm );
+    snprintf( path, sizeof( path ), "%s/%s.cap", log->dir, name );
+    for( n = 2; access( path, F_OK ) == 0 && n < 100; n++ ) {
+        snprintf( path, sizeof( path ), "%s/%s-%d.cap", log->dir, name, n );
+    }
+    if( rename( seg->part, path ) != 0 ) {
+        fprintf( stderr, "Unable to rename capture file %s: %s\n", seg->part, strerror( errno ));
+    }
+
+    pthread_mutex_lock( &log->lock );
+    seg->fd = SEG_FREE;
+    pthread_mutex_unlock( &log->lock );
+}
+
+
+/*
+ * keeps a spare segment ready and closes retired ones
+ */
+static void *caplog_thread( void *arg )
+{
+    CAPLOG          *log = arg;
+    struct timespec deadline;
+    int             slot;
+    int             failed = 0;
+
+    pthread_mutex_lock( &log->lock );
+    for( ;; ) {
+        if( log->nclosing > 0 ) {
+            slot = log->closing[--log->nclosing];
+            pthread_mutex_unlock( &log->lock );
+            caplog_finish( log, slot );
+            pthread_mutex_lock( &log->lock );
+        } else if( log->stop ) {
+            break;
+        } else if( log->spare < 0 && !failed ) {
+            pthread_mutex_unlock( &log->lock );
+            failed = (caplog_prepare( log ) != 0);
+            pthread_mutex_lock( &log->lock );
+        } else if( failed ) {
+            // retry creating a file once a second
+            clock_gettime( CLOCK_REALTIME, &deadline );
+            deadline.tv_sec++;
+            pthread_cond_timedwait( &log->wakeup, &log->lock, &deadline );
+            failed = 0;
+        } else {
+            pthread_cond_wait( &log->wakeup, &log->lock );
+        }
+    }
+    pthread_mutex_unlock( &log->lock );
+    return( NULL );
+}
+
+
+/*
+ * hand retired segments without pending writes to the thread
+ */
+static void caplog_retire( CAPLOG *log )
+{
+    CAPLOG_SEGMENT  *seg;
+    int             slot;
+
+    for( slot = 0; slot < CAPLOG_SEGMENTS; slot++ ) {
+        seg = &log->segment[slot];
+        if( seg->retired == 1 && seg->inflight == 0 ) {
+            seg->retired = 2;
+            pthread_mutex_lock( &log->lock );
+            log->closing[log->nclosing++] = slot;
+            pthread_cond_signal( &log->wakeup );
+            pthread_mutex_unlock( &log->lock );
+        }
+    }
+}
+
+
+/*
+ * continue in the spare segment, returns -1 if it is not ready yet
+ */
+static int caplog_rotate( CAPLOG *log, time_t now )
+{
+    int             spare;
+
+    pthread_mutex_lock( &log->lock );
+    spare = log->spare;
+    log->spare = -1;
+    pthread_cond_signal( &log->wakeup );
+    pthread_mutex_unlock( &log->lock );
+    if( spare < 0 ) {
+        return( -1 );
+    }
+    if( log->active >= 0 ) {
+        caplog_submit( log );
+        log->segment[log->active].retired = 1;
+        caplog_retire( log );
+    }
+    log->active = spare;
+    log->segment[spare].start = now;
+    log->segments++;
+    return( 0 );
+}
+
+
+/*
+ * get an empty buffer as current, starting with the file header for a new segment
+ *
+ * returns -1 if all buffers are being written
+ */
+static int caplog_buffer( CAPLOG *log )
+{
+    CAPLOG_BUFFER   *buf;
+    int             idx;
+
+    for( idx = 0; idx < CAPLOG_BUFFERS; idx++ ) {
+        if( !log->buffer[idx].busy ) {
+            break;
+        }
+    }
+#ifdef CAPLOG_HAVE_URING
+    if( idx == CAPLOG_BUFFERS && log->method == CAPLOG_URING ) {
+        caplog_reap( log, 0 );
+        for( idx = 0; idx < CAPLOG_BUFFERS; idx++ ) {
+            if( !log->buffer[idx].busy ) {
+                break;
+            }
+        }
+    }
+#endif
+    if( idx == CAPLOG_BUFFERS ) {
+        return( -1 );
+    }
+    buf = &log->buffer[idx];
+    buf->busy = 1;
+    buf->used = 0;
+    if( log->segment[log->active].offset == 0 ) {
+        buf->used = capfile_header( buf->data );
+    }
+    log->current = idx;
+    return( 0 );
+}
+
+
+/*
+ * write current buffer to the active segment
+ */
+static void caplog_submit( CAPLOG *log )
+{
+    CAPLOG_BUFFER   *buf;
+    CAPLOG_SEGMENT  *seg;
+    ssize_t         written;
+    uint32_t        done = 0;
+
+    if( log->current < 0 ) {
+        return;
+    }
+    buf = &log->buffer[log->current];
+    seg = &log->segment[log->active];
+    buf->segment = log->active;
+    log->current = -1;
+
+#ifdef CAPLOG_HAVE_URING
+    if( log->method == CAPLOG_URING ) {
+        if( caplog_queue( log, seg->fd, buf, seg->offset, buf - log->buffer ) == 0 ) {
+            seg->offset += buf->used;
+            seg->inflight++;
+            seg->dirty = 1;
+            log->bytes += buf->used;
+        } else {
+            log->errors++;
+            buf->busy = 0;
+        }
+        return;
+    }
+#endif
+    while( done < buf->used ) {
+        written = pwrite( seg->fd, buf->data + done, buf->used - done, seg->offset + done );
+        if( written <= 0 ) {
+            if( written < 0 && errno == EINTR ) {
+                continue;
+            }
+            log->errors++;
+            break;
+        }
+        done += written;
+    }
+    seg->offset += done;
+    seg->dirty = 1;
+    log->bytes += done;
+    buf->busy = 0;
+}
+
+
+/*
+ * write what was collected and have the active segment synced
+ */
+static void caplog_sync( CAPLOG *log, struct timeval *now )
+{
+    CAPLOG_SEGMENT  *seg;
+
+    log->synced = *now;
+    if( log->active < 0 ) {
+        return;
+    }
+    caplog_submit( log );
+    seg = &log->segment[log->active];
+    if( !seg->dirty ) {
+        return;
+    }
+    seg->dirty = 0;
+#ifdef CAPLOG_HAVE_URING
+    if( log->method == CAPLOG_URING ) {
+        if( caplog_queue( log, seg->fd, NULL, 0, TAG_SYNC | log->active ) == 0 ) {
+            seg->inflight++;
+        } else {
+            log->errors++;
+        }
+        return;
+    }
+#endif
+    if( fdatasync( seg->fd ) == 0 ) {
+        log->syncs++;
+    } else {
+        log->errors++;
+    }
+}
+
+
+#ifdef CAPLOG_HAVE_URING
+/*
+ * set up submission and completion rings, register the buffers
+ */
+static int caplog_ring_open( CAPLOG *log )
+{
+    CAPLOG_RING     *ring = &log->ring;
+    struct io_uring_params params;
+    struct iovec    iov[CAPLOG_BUFFERS];
+    int             idx;
+
+    memset( &params, 0, sizeof( params ));
+    ring->fd = syscall( __NR_io_uring_setup, RING_ENTRIES, &params );
+    if( ring->fd < 0 ) {
+        return( -1 );
+    }
+    ring->sq_size = params.sq_off.array + params.sq_entries * sizeof( unsigned int );
+    ring->cq_size = params.cq_off.cqes + params.cq_entries * sizeof( struct io_uring_cqe );
+    if( params.features & IORING_FEAT_SINGLE_MMAP ) {
+        if( ring->cq_size > ring->sq_size ) {
+            ring->sq_size = ring->cq_size;
+        }
+        ring->cq_size = ring->sq_size;
+    }
+    ring->sq_map = mmap( NULL, ring->sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                         ring->fd, IORING_OFF_SQ_RING );
+    if( params.features & IORING_FEAT_SINGLE_MMAP ) {
+        ring->cq_map = ring->sq_map;
+    } else {
+        ring->cq_map = mmap( NULL, ring->cq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                             ring->fd, IORING_OFF_CQ_RING );
+    }
+    ring->sqes_size = params.sq_entries * sizeof( struct io_uring_sqe );
+    ring->sqes = mmap( NULL, ring->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                       ring->fd, IORING_OFF_SQES );
+    if( ring->sq_map == MAP_FAILED || ring->cq_map == MAP_FAILED || ring->sqes == MAP_FAILED ) {
+        caplog_ring_close( log );
+        return( -1 );
+    }
+    ring->sq_head = (unsigned int *)((char *)ring->sq_map + params.sq_off.head);
+    ring->sq_tail = (unsigned int *)((char *)ring->sq_map + params.sq_off.tail);
+    ring->sq_mask = (unsigned int *)((char *)ring->sq_map + params.sq_off.ring_mask);
+    ring->sq_array = (unsigned int *)((char *)ring->sq_map + params.sq_off.array);
+    ring->cq_head = (unsigned int *)((char *)ring->cq_map + params.cq_off.head);
+    ring->cq_tail = (unsigned int *)((char *)ring->cq_map + params.cq_off.tail);
+    ring->cq_mask = (unsigned int *)((char *)ring->cq_map + params.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe *)((char *)ring->cq_map + params.cq_off.cqes);
+
+    // fixed buffers save pinning the pages on every write; plain writes otherwise
+    for( idx = 0; idx < CAPLOG_BUFFERS; idx++ ) {
+        iov[idx] = log->buffer[idx].iov;
+    }
+    ring->fixed = (syscall( __NR_io_uring_register, ring->fd, IORING_REGISTER_BUFFERS, iov, CAPLOG_BUFFERS ) == 0);
+    return( 0 );
+}
+
+
+static void caplog_ring_close( CAPLOG *log )
+{
+    CAPLOG_RING     *ring = &log->ring;
+
+    if( ring->sqes != NULL && ring->sqes != MAP_FAILED ) {
+        munmap( ring->sqes, ring->sqes_size );
+    }
+    if( ring->cq_map != NULL && ring->cq_map != MAP_FAILED && ring->cq_map != ring->sq_map ) {
+        munmap( ring->cq_map, ring->cq_size );
+    }
+    if( ring->sq_map != NULL && ring->sq_map != MAP_FAILED ) {
+        munmap( ring->sq_map, ring->sq_size );
+    }
+    close( ring->fd );
+}
+
+
+/*
+ * queue write of buf at offset, or a data sync of all earlier writes if buf is NULL
+ *
+ * returns -1 if the kernel did not take it
+ */
+static int caplog_queue( CAPLOG *log, int fd, CAPLOG_BUFFER *buf, uint64_t offset, uint64_t tag )
+{
+    CAPLOG_RING     *ring = &log->ring;
+    struct io_uring_sqe *sqe;
+    unsigned int    tail = *ring->sq_tail;
+    unsigned int    idx = tail & *ring->sq_mask;
+    int             rc;
+
+    sqe = &ring->sqes[idx];
+    memset( sqe, 0, sizeof( *sqe ));
+    sqe->fd = fd;
+    sqe->user_data = tag;
+    if( buf == NULL ) {
+        // io_uring does not order requests, the sync must wait for the writes queued before it
+        sqe->opcode = IORING_OP_FSYNC;
+        sqe->fsync_flags = IORING_FSYNC_DATASYNC;
+        sqe->flags = IOSQE_IO_DRAIN;
+    } else if( ring->fixed ) {
+        sqe->opcode = IORING_OP_WRITE_FIXED;
+        sqe->addr = (uintptr_t)buf->data;
+        sqe->len = buf->used;
+        sqe->off = offset;
+        sqe->buf_index = buf - log->buffer;
+    } else {
+        buf->iov.iov_len = buf->used;
+        sqe->opcode = IORING_OP_WRITEV;
+        sqe->addr = (uintptr_t)&buf->iov;
+        sqe->len = 1;
+        sqe->off = offset;
+    }
+    ring->sq_array[idx] = idx;
+    __atomic_store_n( ring->sq_tail, tail + 1, __ATOMIC_RELEASE );
+
+    do {
+        rc = syscall( __NR_io_uring_enter, ring->fd,
+                      tail + 1 - __atomic_load_n( ring->sq_head, __ATOMIC_ACQUIRE ), 0, 0, NULL, 0 );
+    } while( rc < 0 && errno == EINTR );
+    if( rc < 0 && errno != EAGAIN && errno != EBUSY ) {
+        // not submitted: take it back
+        __atomic_store_n( ring->sq_tail, tail, __ATOMIC_RELEASE );
+        return( -1 );
+    }
+    log->inflight++;
+    return( 0 );
+}
+
+
+/*
+ * collect completed writes and syncs, wait for one if wait is set
+ */
+static void caplog_reap( CAPLOG *log, int wait )
+{
+    CAPLOG_RING     *ring = &log->ring;
+    struct io_uring_cqe *cqe;
+    CAPLOG_BUFFER   *buf;
+    CAPLOG_SEGMENT  *seg;
+    unsigned int    head;
+
+    if( wait && log->inflight > 0 ) {
+        syscall( __NR_io_uring_enter, ring->fd, 0, 1, IORING_ENTER_GETEVENTS, NULL, 0 );
+    }
+    head = *ring->cq_head;
+    if( head == __atomic_load_n( ring->cq_tail, __ATOMIC_ACQUIRE )) {
+        return;
+    }
+    while( head != __atomic_load_n( ring->cq_tail, __ATOMIC_ACQUIRE )) {
+        cqe = &ring->cqes[head & *ring->cq_mask];
+        if( cqe->user_data & TAG_SYNC ) {
+            seg = &log->segment[cqe->user_data & (TAG_SYNC - 1)];
+            if( cqe->res < 0 ) {
+                log->errors++;
+            } else {
+                log->syncs++;
+            }
+        } else {
+            buf = &log->buffer[cqe->user_data];
+            seg = &log->segment[buf->segment];
+            if( cqe->res != buf->used ) {
+                log->errors++;
+            }
+            buf->busy = 0;
+        }
+        seg->inflight--;
+        log->inflight--;
+        head++;
+    }
+    __atomic_store_n( ring->cq_head, head, __ATOMIC_RELEASE );
+    caplog_retire( log );
+}
+#endif
+
+
+/*
+ * start capturing to segments in dir
+ *
+ * method CAPLOG_URING falls back to CAPLOG_WRITE if io_uring is not available
+ */
+CAPLOG *caplog_open( const char *dir, uint64_t segment_bytes, unsigned int segment_seconds, int method )
+{
+    CAPLOG          *log;
+    int             idx;
+    int             err;
+
+    log = calloc( 1, sizeof( CAPLOG ));
+    if( log == NULL || posix_memalign( (void **)&log->memory, 4096, CAPLOG_BUFFERS * CAPLOG_BUFFER_SIZE ) != 0 ||
+        (log->dir = strdup( dir )) == NULL ) {
+        fprintf( stderr, "Out of memory: %s\n", strerror( errno ));
+        if( log != NULL ) {
+            free( log->memory );
+            free( log );
+        }
+        return( NULL );
+    }
+    for( idx = 0; idx < CAPLOG_BUFFERS; idx++ ) {
+        log->buffer[idx].data = log->memory + idx * CAPLOG_BUFFER_SIZE;
+        log->buffer[idx].iov.iov_base = log->buffer[idx].data;
+        log->buffer[idx].iov.iov_len = CAPLOG_BUFFER_SIZE;
+    }
+    for( idx = 0; idx < CAPLOG_SEGMENTS; idx++ ) {
+        log->segment[idx].fd = SEG_FREE;
+    }
+    log->segment_bytes = segment_bytes;
+    log->segment_seconds = segment_seconds;
+    log->current = -1;
+    log->active = -1;
+    log->spare = -1;
+    pthread_mutex_init( &log->lock, NULL );
+    pthread_cond_init( &log->wakeup, NULL );
+
+    log->method = CAPLOG_WRITE;
+#ifdef CAPLOG_HAVE_URING
+    if( method == CAPLOG_URING ) {
+        if( caplog_ring_open( log ) == 0 ) {
+            log->method = CAPLOG_URING;
+        } else {
+            fprintf( stderr, "io_uring not available (%s), writing capture files with write()\n", strerror( errno ));
+        }
+    }
+#else
+    if( method == CAPLOG_URING ) {
+        fprintf( stderr, "Built without io_uring, writing capture files with write()\n" );
+    }
+#endif
+
+    gettimeofday( &log->synced, NULL );
+    if( caplog_prepare( log ) != 0 ) {
+        caplog_close( log );
+        return( NULL );
+    }
+    // the thread waits while there is a spare, nothing to undo but the spare if it fails
+    if( (err = pthread_create( &log->thread, NULL, caplog_thread, log )) != 0 ) {
+        fprintf( stderr, "Unable to start capture file thread: %s\n", strerror( err ));
+        log->thread = 0;
+        caplog_close( log );
+        return( NULL );
+    }
+    caplog_rotate( log, log->synced.tv_sec );
+    return( log );
+}
+
+
+/*
+ * add telegram, returns -1 if it had to be dropped
+ */
+int caplog_append( CAPLOG *log, KNXTELEGRAM *telegram )
+{
+    CAPLOG_SEGMENT  *seg;
+    CAPLOG_BUFFER   *buf;
+    uint64_t        size;
+
+#ifdef CAPLOG_HAVE_URING
+    if( log->method == CAPLOG_URING && log->inflight > 0 ) {
+        caplog_reap( log, 0 );
+    }
+#endif
+    if( log->active < 0 && caplog_rotate( log, telegram->tv.tv_sec ) != 0 ) {
+        log->dropped++;
+        return( -1 );
+    }
+    seg = &log->segment[log->active];
+    size = seg->offset + ((log->current >= 0) ? log->buffer[log->current].used : 0);
+    if( size >= log->segment_bytes || telegram->tv.tv_sec - seg->start >= log->segment_seconds ) {
+        caplog_rotate( log, telegram->tv.tv_sec );      // keeps on in this one if no spare yet
+    }
+    if( log->current >= 0 && log->buffer[log->current].used + CAPFILE_RECORD_MAX > CAPLOG_BUFFER_SIZE ) {
+        caplog_submit( log );
+    }
+    if( log->current < 0 && caplog_buffer( log ) != 0 ) {
+        log->dropped++;
+        return( -1 );
+    }
+    buf = &log->buffer[log->current];
+    buf->used += capfile_encode( buf->data + buf->used, telegram );
+    log->records++;
+
+    if( (telegram->tv.tv_sec - log->synced.tv_sec) * 1000 + (telegram->tv.tv_usec - log->synced.tv_usec) / 1000 >= CAPLOG_SYNC_MS ) {
+        caplog_sync( log, &telegram->tv );
+    }
+    return( 0 );
+}
+
+
+/*
+ * called when no telegrams arrive, writes, syncs and rotates by time
+ */
+void caplog_tick( CAPLOG *log, struct timeval *now )
+{
+#ifdef CAPLOG_HAVE_URING
+    if( log->method == CAPLOG_URING && log->inflight > 0 ) {
+        caplog_reap( log, 0 );
+    }
+#endif
+    if( log->active >= 0 && now->tv_sec - log->segment[log->active].start >= log->segment_seconds ) {
+        caplog_rotate( log, now->tv_sec );
+    }
+    if( (now->tv_sec - log->synced.tv_sec) * 1000 + (now->tv_usec - log->synced.tv_usec) / 1000 >= CAPLOG_SYNC_MS ) {
+        caplog_sync( log, now );
+    }
+}
+
+
+int caplog_method( CAPLOG *log )
+{
+    return( log->method );
+}
+
+
+void caplog_stats( CAPLOG *log, FILE *fp )
+{
+    fprintf( fp, "Capture files (%s): %llu telegrams, %llu bytes in %llu segments, %llu syncs, "
+                 "%llu dropped, %llu errors\n",
+             (log->method == CAPLOG_URING) ? "io_uring" : "write",
+             (unsigned long long)log->records, (unsigned long long)log->bytes,
+             (unsigned long long)log->segments, (unsigned long long)log->syncs,
+             (unsigned long long)log->dropped, (unsigned long long)log->errors );
+}
+
+
+/*
+ * write everything, close the last segment and remove the spare
+ */
+void caplog_close( CAPLOG *log )
+{
+    int             slot;
+
+    if( log->active >= 0 ) {
+        caplog_submit( log );
+        log->segment[log->active].retired = 1;
+        log->active = -1;
+    }
+#ifdef CAPLOG_HAVE_URING
+    while( log->method == CAPLOG_URING && log->inflight > 0 ) {
+        caplog_reap( log, 1 );
+    }
+#endif
+    if( log->thread != 0 ) {
+        caplog_retire( log );
+        pthread_mutex_lock( &log->lock );
+        log->stop = 1;
+        pthread_cond_signal( &log->wakeup );
+        pthread_mutex_unlock( &log->lock );
+        pthread_join( log->thread, NULL );
+    }
+    slot = log->spare;
+    if( slot >= 0 ) {
+        close( log->segment[slot].fd );
+        unlink( log->segment[slot].part );
+    }
+#ifdef CAPLOG_HAVE_URING
+    if( log->method == CAPLOG_URING ) {
+        caplog_ring_close( log );
+    }
+#endif
+    pthread_mutex_destroy( &log->lock );
+    pthread_cond_destroy( &log->wakeup );
+    free( log->memory );
+    free( log->dir );
+    free( log );
+}
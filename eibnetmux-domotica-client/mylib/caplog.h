@@ -0,0 +1,67 @@
+/*
+ * caplog - continuous capture to rotating capture files
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#ifndef CAPLOG_H_
+#define CAPLOG_H_
+
+#include <stdio.h>
+#include <stdint.h>
+#include <sys/time.h>
+
+#include "knxframe.h"
+
+/*
+ * Telegrams are collected in buffers of CAPLOG_BUFFER_SIZE bytes which
+ * are written when full, and at least every CAPLOG_SYNC_MS together with
+ * a data sync of the file.
+ *
+ * With CAPLOG_URING writes and syncs are queued to an io_uring and the
+ * capture thread only collects their completions; when all buffers are
+ * still being written, telegrams are dropped and counted rather than
+ * waited for. CAPLOG_WRITE uses write() and fdatasync() in the calling
+ * thread, and is used when io_uring is not available.
+ *
+ * A segment file is preallocated to its maximum size and written under
+ * a hidden name; a helper thread prepares the next one in advance and
+ * syncs, closes and renames the previous one to knxcap-<start>.cap.
+ */
+#define CAPLOG_DEFAULT_SEGMENT_MB       64
+#define CAPLOG_DEFAULT_SEGMENT_MINUTES  60
+#define CAPLOG_SYNC_MS                  1000
+#define CAPLOG_BUFFERS                  32
+#define CAPLOG_BUFFER_SIZE              65536
+#define CAPLOG_SEGMENTS                 4           // active, spare and closing
+
+#define CAPLOG_WRITE                    0           // methods
+#define CAPLOG_URING                    1
+
+typedef struct caplog CAPLOG;
+
+
+/*
+ * function declarations
+ */
+extern CAPLOG       *caplog_open( const char *dir, uint64_t segment_bytes, unsigned int segment_seconds, int method );
+extern int          caplog_append( CAPLOG *log, KNXTELEGRAM *telegram );
+extern void         caplog_tick( CAPLOG *log, struct timeval *now );
+extern int          caplog_method( CAPLOG *log );
+extern void         caplog_stats( CAPLOG *log, FILE *fp );
+extern void         caplog_close( CAPLOG *log );
+
+#endif /*CAPLOG_H_*/
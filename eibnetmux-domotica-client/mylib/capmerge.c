@@ -0,0 +1,280 @@
+/*
+ * capmerge - time ordered merge of capture files
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "capmerge.h"
+
+
+/*
+ * local function declarations
+ */
+static int      capmerge_map( CAPMERGE *merge, CAPMERGE_INPUT *in );
+static int      capmerge_advance( CAPMERGE *merge, CAPMERGE_INPUT *in );
+static int      capmerge_before( CAPMERGE *merge, int a, int b );
+static void     capmerge_down( CAPMERGE *merge, int pos );
+
+
+/*
+ * map the window starting at the page of the next record
+ */
+static int capmerge_map( CAPMERGE *merge, CAPMERGE_INPUT *in )
+{
+    if( in->map != NULL ) {
+        munmap( in->map, in->map_len );
+        in->map = NULL;
+    }
+    in->map_offset = in->pos & ~(uint64_t)(merge->page - 1);
+    in->map_len = (in->size - in->map_offset < merge->window) ? in->size - in->map_offset : merge->window;
+    in->map = mmap( NULL, in->map_len, PROT_READ, MAP_PRIVATE, in->fd, in->map_offset );
+    if( in->map == MAP_FAILED ) {
+        in->map = NULL;
+        fprintf( stderr, "Unable to map capture file %s: %s\n", in->path, strerror( errno ));
+        return( -1 );
+    }
+    madvise( in->map, in->map_len, MADV_SEQUENTIAL );
+    if( in->map_offset + in->map_len < in->size ) {
+        posix_fadvise( in->fd, in->map_offset + in->map_len, merge->window, POSIX_FADV_WILLNEED );
+    }
+    return( 0 );
+}
+
+
+/*
+ * decode next telegram of input, returns 1, 0 at end or -1 if damaged
+ */
+static int capmerge_advance( CAPMERGE *merge, CAPMERGE_INPUT *in )
+{
+    uint64_t        end;
+    int             len;
+
+    if( in->cf != NULL ) {
+        len = capfile_read( in->cf, &in->telegram );
+    } else if( in->pos >= in->size ) {
+        len = 0;
+    } else {
+        end = in->map_offset + in->map_len;
+        if( in->pos + CAPFILE_RECORD_MAX > end && end < in->size && capmerge_map( merge, in ) != 0 ) {
+            return( -1 );
+        }
+        len = capfile_decode( in->map + (in->pos - in->map_offset), in->map_offset + in->map_len - in->pos,
+                              &in->telegram );
+        if( len == 0 ) {
+            len = -1;                           // record cut off at end of file
+        } else if( len > 0 ) {
+            in->pos += len;
+        }
+    }
+    if( len < 0 ) {
+        fprintf( stderr, "Capture file %s is damaged after %llu records\n",
+                 in->path, (unsigned long long)in->records );
+        merge->damaged = 1;
+        return( -1 );
+    }
+    if( len > 0 ) {
+        in->records++;
+        return( 1 );
+    }
+    return( 0 );
+}
+
+
+/*
+ * input a has an earlier telegram than input b
+ */
+static int capmerge_before( CAPMERGE *merge, int a, int b )
+{
+    struct timeval  *ta = &merge->input[a].telegram.tv;
+    struct timeval  *tb = &merge->input[b].telegram.tv;
+
+    if( ta->tv_sec != tb->tv_sec ) {
+        return( ta->tv_sec < tb->tv_sec );
+    }
+    if( ta->tv_usec != tb->tv_usec ) {
+        return( ta->tv_usec < tb->tv_usec );
+    }
+    return( a < b );
+}
+
+
+static void capmerge_down( CAPMERGE *merge, int pos )
+{
+    int             *heap = merge->heap;
+    int             child;
+    int             tmp;
+
+    for( ;; ) {
+        child = 2 * pos + 1;
+        if( child >= merge->heap_size ) {
+            break;
+        }
+        if( child + 1 < merge->heap_size && capmerge_before( merge, heap[child + 1], heap[child] )) {
+            child++;
+        }
+        if( !capmerge_before( merge, heap[child], heap[pos] )) {
+            break;
+        }
+        tmp = heap[pos];
+        heap[pos] = heap[child];
+        heap[child] = tmp;
+        pos = child;
+    }
+}
+
+
+/*
+ * open n capture files for merging, window 0 for the default
+ */
+CAPMERGE *capmerge_open( char **paths, int n, size_t window )
+{
+    CAPMERGE        *merge;
+    CAPMERGE_INPUT  *in;
+    struct stat     st;
+    int             header;
+    int             idx;
+
+    merge = calloc( 1, sizeof( CAPMERGE ));
+    if( merge != NULL ) {
+        merge->input = calloc( n, sizeof( CAPMERGE_INPUT ));
+        merge->heap = calloc( n, sizeof( int ));
+    }
+    if( merge == NULL || merge->input == NULL || merge->heap == NULL ) {
+        fprintf( stderr, "Out of memory: %s\n", strerror( errno ));
+        if( merge != NULL ) {
+            free( merge->input );
+            free( merge->heap );
+            free( merge );
+        }
+        return( NULL );
+    }
+    merge->inputs = n;
+    merge->page = sysconf( _SC_PAGESIZE );
+    merge->window = (window > 0) ? window : CAPMERGE_DEFAULT_WINDOW;
+    if( merge->window < 2 * merge->page + CAPFILE_RECORD_MAX ) {
+        merge->window = 2 * merge->page + CAPFILE_RECORD_MAX;
+    }
+    for( idx = 0; idx < n; idx++ ) {
+        merge->input[idx].fd = -1;
+    }
+
+    for( idx = 0; idx < n; idx++ ) {
+        in = &merge->input[idx];
+        in->path = paths[idx];
+        if( strcmp( paths[idx], "-" ) != 0 ) {
+            in->fd = open( paths[idx], O_RDONLY );
+            if( in->fd < 0 ) {
+                fprintf( stderr, "Unable to open capture file %s: %s\n", paths[idx], strerror( errno ));
+                capmerge_close( merge );
+                return( NULL );
+            }
+        }
+        if( in->fd < 0 || fstat( in->fd, &st ) != 0 || !S_ISREG( st.st_mode )) {
+            in->cf = capfile_open( paths[idx] );
+            if( in->cf == NULL ) {
+                capmerge_close( merge );
+                return( NULL );
+            }
+        } else {
+            in->size = st.st_size;
+            header = -1;
+            if( in->size > 0 && capmerge_map( merge, in ) == 0 ) {
+                header = capfile_check( in->map, in->map_len );
+            }
+            if( header < 0 ) {
+                fprintf( stderr, "%s is not a capture file\n", paths[idx] );
+                capmerge_close( merge );
+                return( NULL );
+            }
+            in->pos = header;
+        }
+        if( capmerge_advance( merge, in ) == 1 ) {
+            merge->heap[merge->heap_size++] = idx;
+        }
+    }
+    for( idx = merge->heap_size / 2 - 1; idx >= 0; idx-- ) {
+        capmerge_down( merge, idx );
+    }
+    return( merge );
+}
+
+
+/*
+ * earliest telegram of all inputs, returns 1 or 0 when all are done
+ *
+ * source is set to the index of the input, if not NULL; a damaged input
+ * is reported and merging goes on without it
+ */
+int capmerge_next( CAPMERGE *merge, KNXTELEGRAM *telegram, int *source )
+{
+    int             idx;
+
+    if( merge->heap_size == 0 ) {
+        return( 0 );
+    }
+    idx = merge->heap[0];
+    *telegram = merge->input[idx].telegram;
+    if( source != NULL ) {
+        *source = idx;
+    }
+    if( capmerge_advance( merge, &merge->input[idx] ) != 1 ) {
+        merge->heap[0] = merge->heap[--merge->heap_size];
+    }
+    capmerge_down( merge, 0 );
+    return( 1 );
+}
+
+
+/*
+ * returns -1 if an input was damaged
+ */
+int capmerge_close( CAPMERGE *merge )
+{
+    CAPMERGE_INPUT  *in;
+    int             rc = merge->damaged ? -1 : 0;
+    int             idx;
+
+    for( idx = 0; idx < merge->inputs; idx++ ) {
+        in = &merge->input[idx];
+        if( in->map != NULL ) {
+            munmap( in->map, in->map_len );
+        }
+        if( in->fd >= 0 ) {
+            close( in->fd );
+        }
+        if( in->cf != NULL ) {
+            capfile_close( in->cf );
+        }
+    }
+    free( merge->heap );
+    free( merge->input );
+    free( merge );
+    return( rc );
+}
@@ -0,0 +1,72 @@
+/*
+ * capmerge - time ordered merge of capture files
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#ifndef CAPMERGE_H_
+#define CAPMERGE_H_
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include "knxframe.h"
+#include "capfile.h"
+
+/*
+ * Every input is read through a window of the file mapped at a time,
+ * the next window is announced to the kernel for readahead while the
+ * current one is decoded. Memory used is a window per input, whatever
+ * the size of the files.
+ *
+ * Telegrams come out in order of receive time, with equal times in the
+ * order of the inputs. Inputs that cannot be mapped (stdin, pipes) are
+ * read with stdio.
+ */
+#define CAPMERGE_DEFAULT_WINDOW 8388608         // bytes mapped per input
+
+typedef struct {
+        const char      *path;
+        int             fd;
+        CAPFILE         *cf;                    // not mapped
+        uint64_t        size;
+        uint64_t        pos;                    // of next record in file
+        unsigned char   *map;
+        uint64_t        map_offset;
+        size_t          map_len;
+        KNXTELEGRAM     telegram;               // next one of this input
+        uint64_t        records;
+} CAPMERGE_INPUT;
+
+typedef struct {
+        CAPMERGE_INPUT  *input;
+        int             inputs;
+        int             *heap;                  // inputs with a telegram, earliest first
+        int             heap_size;
+        size_t          window;
+        size_t          page;
+        int             damaged;
+} CAPMERGE;
+
+
+/*
+ * function declarations
+ */
+extern CAPMERGE     *capmerge_open( char **paths, int n, size_t window );
+extern int          capmerge_next( CAPMERGE *merge, KNXTELEGRAM *telegram, int *source );
+extern int          capmerge_close( CAPMERGE *merge );
+
+#endif /*CAPMERGE_H_*/
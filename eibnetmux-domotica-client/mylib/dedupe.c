@@ -0,0 +1,250 @@
+/*
+ * dedupe - store telegrams forwarded by couplers only once
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "dedupe.h"
+
+#define SLOT_MASK           (DEDUPE_SLOTS -1)
+
+/*
+ * local function declarations
+ */
+static uint32_t     dedupe_key( CEMIFRAME *frame );
+static int          dedupe_same( CEMIFRAME *a, CEMIFRAME *b );
+static DEDUPE_ENTRY *dedupe_find( DEDUPE_BUCKET *bucket, uint32_t key, CEMIFRAME *frame, uint32_t *slot );
+static void         dedupe_release( DEDUPE *dd, DEDUPE_BUCKET *bucket );
+static void         dedupe_advance( DEDUPE *dd, uint32_t slice );
+
+
+/*
+ * FNV-1a over source, destination and payload; control field and
+ * routing counter differ between the copies and are left out
+ */
+static uint32_t dedupe_key( CEMIFRAME *frame )
+{
+    unsigned char   *byte = &frame->tpci;
+    uint32_t        key = 2166136261u;
+    int             len = (frame->length < 16) ? frame->length + 1 : 17;
+
+    key = (key ^ frame->saddr) * 16777619u;
+    key = (key ^ frame->daddr) * 16777619u;
+    key = (key ^ (frame->ntwrk & EIB_DAF_GROUP)) * 16777619u;
+    while( len-- > 0 ) {
+        key = (key ^ *byte++) * 16777619u;
+    }
+    return( key );
+}
+
+
+static int dedupe_same( CEMIFRAME *a, CEMIFRAME *b )
+{
+    int             len = (a->length < 16) ? a->length + 1 : 17;
+
+    return( a->saddr == b->saddr && a->daddr == b->daddr && a->length == b->length &&
+            ((a->ntwrk ^ b->ntwrk) & EIB_DAF_GROUP) == 0 && memcmp( &a->tpci, &b->tpci, len ) == 0 );
+}
+
+
+/*
+ * look up frame in one slice
+ *
+ * returns the entry, or NULL with *slot set to the free slot it would take
+ */
+static DEDUPE_ENTRY *dedupe_find( DEDUPE_BUCKET *bucket, uint32_t key, CEMIFRAME *frame, uint32_t *slot )
+{
+    DEDUPE_ENTRY    *entry;
+    uint32_t        idx;
+    uint32_t        value;
+
+    for( idx = key & SLOT_MASK; ; idx = (idx + 1) & SLOT_MASK ) {
+        value = bucket->slot[idx];
+        if( (value >> 16) != bucket->generation || (value & 0xffff) == 0 ) {
+            *slot = idx;
+            return( NULL );
+        }
+        entry = &bucket->entry[(value & 0xffff) - 1];
+        if( entry->key == key && dedupe_same( &entry->telegram.frame, frame )) {
+            return( entry );
+        }
+    }
+}
+
+
+/*
+ * emit a slice in arrival order and clear it
+ */
+static void dedupe_release( DEDUPE *dd, DEDUPE_BUCKET *bucket )
+{
+    unsigned int    idx;
+
+    for( idx = 0; idx < bucket->count; idx++ ) {
+        dd->copies[__builtin_popcount( bucket->entry[idx].telegram.seen ) - 1]++;
+        dd->emit( dd->arg, &bucket->entry[idx].telegram );
+    }
+    bucket->count = 0;
+    if( ++bucket->generation == 0 ) {
+        // stale slots could match again after wrapping
+        memset( bucket->slot, 0, sizeof( bucket->slot ));
+        bucket->generation = 1;
+    }
+}
+
+
+/*
+ * move time forward to slice, releasing slices that left the window
+ */
+static void dedupe_advance( DEDUPE *dd, uint32_t slice )
+{
+    DEDUPE_BUCKET   *bucket;
+    int             idx;
+
+    if( (int32_t)(slice - dd->current) <= 0 ) {
+        return;
+    }
+    // oldest first
+    for( idx = 1; idx <= DEDUPE_BUCKETS; idx++ ) {
+        bucket = &dd->bucket[(dd->current + idx) % DEDUPE_BUCKETS];
+        if( bucket->count > 0 && (int32_t)(slice - bucket->slice) >= DEDUPE_BUCKETS -1 ) {
+            dedupe_release( dd, bucket );
+        }
+    }
+    dd->current = slice;
+    dd->bucket[slice % DEDUPE_BUCKETS].slice = slice;
+}
+
+
+DEDUPE *dedupe_open( uint32_t window, DEDUPE_EMIT emit, void *arg )
+{
+    DEDUPE          *dd;
+    struct timeval  now;
+    int             idx;
+
+    dd = calloc( 1, sizeof( DEDUPE ));
+    if( dd == NULL ) {
+        fprintf( stderr, "Out of memory: %s\n", strerror( errno ));
+        return( NULL );
+    }
+    dd->span = (window < DEDUPE_BUCKETS -1) ? 1 : window / (DEDUPE_BUCKETS -1);
+    dd->emit = emit;
+    dd->arg = arg;
+    gettimeofday( &now, NULL );
+    dd->current = (now.tv_sec * 1000 + now.tv_usec / 1000) / dd->span;
+    for( idx = 0; idx < DEDUPE_BUCKETS; idx++ ) {
+        dd->bucket[idx].generation = 1;
+    }
+    dd->bucket[dd->current % DEDUPE_BUCKETS].slice = dd->current;
+    return( dd );
+}
+
+
+/*
+ * merge telegram into an earlier copy or hold it back
+ *
+ * returns 1 if it was a copy
+ */
+int dedupe_telegram( DEDUPE *dd, KNXTELEGRAM *telegram )
+{
+    CEMIFRAME       *frame = &telegram->frame;
+    DEDUPE_BUCKET   *bucket;
+    DEDUPE_ENTRY    *entry;
+    uint32_t        key;
+    uint32_t        slot;
+    uint8_t         hops = 1 << ((frame->ntwrk >> 4) & 0x07);
+    int             idx;
+
+    dedupe_expire( dd, &telegram->tv );
+    dd->telegrams++;
+    key = dedupe_key( frame );
+    for( idx = 0; idx < DEDUPE_BUCKETS; idx++ ) {
+        bucket = &dd->bucket[idx];
+        if( bucket->count > 0 && (entry = dedupe_find( bucket, key, frame, &slot )) != NULL ) {
+            entry->telegram.seen |= hops;
+            dd->duplicates++;
+            return( 1 );
+        }
+    }
+
+    bucket = &dd->bucket[dd->current % DEDUPE_BUCKETS];
+    if( bucket->count == DEDUPE_BUCKET_SIZE ) {
+        dd->untracked++;
+        telegram->seen = hops;
+        dd->emit( dd->arg, telegram );
+        return( 0 );
+    }
+    dedupe_find( bucket, key, frame, &slot );
+    entry = &bucket->entry[bucket->count++];
+    entry->telegram = *telegram;
+    entry->telegram.seen = hops;
+    entry->key = key;
+    bucket->slot[slot] = (uint32_t)bucket->generation << 16 | bucket->count;
+    return( 0 );
+}
+
+
+/*
+ * release what is older than the window, also to be called while the bus is quiet
+ */
+void dedupe_expire( DEDUPE *dd, struct timeval *now )
+{
+    dedupe_advance( dd, (now->tv_sec * 1000 + now->tv_usec / 1000) / dd->span );
+}
+
+
+/*
+ * release everything held, oldest first
+ */
+void dedupe_flush( DEDUPE *dd )
+{
+    int             idx;
+
+    for( idx = 1; idx <= DEDUPE_BUCKETS; idx++ ) {
+        dedupe_release( dd, &dd->bucket[(dd->current + idx) % DEDUPE_BUCKETS] );
+    }
+}
+
+
+void dedupe_stats( DEDUPE *dd, FILE *fp )
+{
+    int             idx;
+
+    fprintf( fp, "Dedupe: %llu telegrams, %llu copies merged, %llu not tracked\n",
+             (unsigned long long)dd->telegrams, (unsigned long long)dd->duplicates,
+             (unsigned long long)dd->untracked );
+    for( idx = 0; idx < 8; idx++ ) {
+        if( dd->copies[idx] != 0 ) {
+            fprintf( fp, "  seen on %d line%s: %llu\n", idx + 1, (idx > 0) ? "s" : "",
+                     (unsigned long long)dd->copies[idx] );
+        }
+    }
+}
+
+
+void dedupe_close( DEDUPE *dd )
+{
+    free( dd );
+}
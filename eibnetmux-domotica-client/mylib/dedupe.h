@@ -0,0 +1,84 @@
+/*
+ * dedupe - store telegrams forwarded by couplers only once
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#ifndef DEDUPE_H_
+#define DEDUPE_H_
+
+#include <stdio.h>
+#include <stdint.h>
+#include <sys/time.h>
+
+#include "knxframe.h"
+
+/*
+ * A telegram passed on by line and area couplers is seen once per line,
+ * each copy with the routing counter decremented. Copies with the same
+ * source, destination and payload inside the window are merged into the
+ * first one, which is held back until the window has passed and then
+ * emitted with the routing counters of all copies in telegram->seen.
+ *
+ * Time is cut into DEDUPE_BUCKETS slices of window / (DEDUPE_BUCKETS - 1),
+ * each slice with a hash set of its own. A slice leaving the window is
+ * emitted in arrival order and cleared by bumping its generation, so
+ * expiry never scans the hash slots.
+ */
+#define DEDUPE_DEFAULT_WINDOW   100             // ms
+#define DEDUPE_BUCKETS          4               // time slices
+#define DEDUPE_BUCKET_SIZE      4096            // telegrams per slice
+#define DEDUPE_SLOTS            8192            // hash slots per slice, power of two
+
+typedef struct {
+        KNXTELEGRAM     telegram;               // first copy
+        uint32_t        key;
+} DEDUPE_ENTRY;
+
+typedef struct {
+        uint32_t        slice;
+        uint16_t        generation;
+        unsigned int    count;
+        uint32_t        slot[DEDUPE_SLOTS];     // generation << 16 | entry + 1
+        DEDUPE_ENTRY    entry[DEDUPE_BUCKET_SIZE];
+} DEDUPE_BUCKET;
+
+typedef void (*DEDUPE_EMIT)( void *arg, KNXTELEGRAM *telegram );
+
+typedef struct {
+        uint32_t        span;                   // ms per slice
+        uint32_t        current;                // latest slice
+        DEDUPE_EMIT     emit;
+        void            *arg;
+        uint64_t        telegrams;
+        uint64_t        duplicates;
+        uint64_t        untracked;              // slice full, passed on at once
+        uint64_t        copies[8];              // emitted telegrams by number of routing counters seen
+        DEDUPE_BUCKET   bucket[DEDUPE_BUCKETS];
+} DEDUPE;
+
+
+/*
+ * function declarations
+ */
+extern DEDUPE   *dedupe_open( uint32_t window, DEDUPE_EMIT emit, void *arg );
+extern int      dedupe_telegram( DEDUPE *dd, KNXTELEGRAM *telegram );
+extern void     dedupe_expire( DEDUPE *dd, struct timeval *now );
+extern void     dedupe_flush( DEDUPE *dd );
+extern void     dedupe_stats( DEDUPE *dd, FILE *fp );
+extern void     dedupe_close( DEDUPE *dd );
+
+#endif /*DEDUPE_H_*/
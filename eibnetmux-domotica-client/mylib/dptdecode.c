@@ -0,0 +1,180 @@
+/*
+ * dptdecode - batch decoding of datapoint values
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdint.h>
+#include <stddef.h>
+#if defined( __SSE2__ ) || defined( __AVX2__ )
+#include <immintrin.h>
+#endif
+
+#include "dptdecode.h"
+
+
+/*
+ * local function declarations
+ */
+static inline void  dpt_int_to_double( const uint32_t *data, double *value, size_t n, int bits, int sign );
+
+
+/*
+ * DPT 9 to double
+ *
+ * the mantissa is sign extended from bit 15 into bit 11 as
+ * (raw & 0x7ff) - ((raw & 0x8000) >> 4)
+ */
+void dpt9_to_double( const uint32_t *data, double *value, size_t n )
+{
+    size_t          idx = 0;
+
+#if defined( __AVX2__ )
+    const __m256i   m11 = _mm256_set1_epi32( 0x07ff );
+    const __m256i   sgn = _mm256_set1_epi32( 0x8000 );
+    const __m256i   e4 = _mm256_set1_epi32( 0x0f );
+    const __m256d   scale = _mm256_set1_pd( 0.01 );
+    __m256i         x;
+    __m256i         mant;
+
+    for( ; idx + 8 <= n; idx += 8 ) {
+        x = _mm256_loadu_si256( (const __m256i *)(data + idx) );
+        mant = _mm256_sub_epi32( _mm256_and_si256( x, m11 ), _mm256_srli_epi32( _mm256_and_si256( x, sgn ), 4 ));
+        mant = _mm256_sllv_epi32( mant, _mm256_and_si256( _mm256_srli_epi32( x, 11 ), e4 ));
+        _mm256_storeu_pd( value + idx, _mm256_mul_pd( _mm256_cvtepi32_pd( _mm256_castsi256_si128( mant )), scale ));
+        _mm256_storeu_pd( value + idx + 4, _mm256_mul_pd( _mm256_cvtepi32_pd( _mm256_extracti128_si256( mant, 1 )), scale ));
+    }
+#elif defined( __SSE2__ )
+    const __m128i   m11 = _mm_set1_epi32( 0x07ff );
+    const __m128i   sgn = _mm_set1_epi32( 0x8000 );
+    const __m128i   e4 = _mm_set1_epi32( 0x0f );
+    const __m128i   bias = _mm_set1_epi32( 127 );
+    const __m128d   scale = _mm_set1_pd( 0.01 );
+    __m128i         x;
+    __m128i         mant;
+    __m128          pow2;
+    __m128          f;
+
+    // no variable shift: 2^E built as float, mant * 2^E has 12 significant bits and is exact
+    for( ; idx + 4 <= n; idx += 4 ) {
+        x = _mm_loadu_si128( (const __m128i *)(data + idx) );
+        mant = _mm_sub_epi32( _mm_and_si128( x, m11 ), _mm_srli_epi32( _mm_and_si128( x, sgn ), 4 ));
+        pow2 = _mm_castsi128_ps( _mm_slli_epi32( _mm_add_epi32( _mm_and_si128( _mm_srli_epi32( x, 11 ), e4 ), bias ), 23 ));
+        f = _mm_mul_ps( _mm_cvtepi32_ps( mant ), pow2 );
+        _mm_storeu_pd( value + idx, _mm_mul_pd( _mm_cvtps_pd( f ), scale ));
+        _mm_storeu_pd( value + idx + 2, _mm_mul_pd( _mm_cvtps_pd( _mm_movehl_ps( f, f )), scale ));
+    }
+#endif
+    for( ; idx < n; idx++ ) {
+        value[idx] = dpt9_value( data[idx] );
+    }
+}
+
+
+/*
+ * DPT 9 to float, rounded once from the double value
+ */
+void dpt9_to_float( const uint32_t *data, float *value, size_t n )
+{
+    double          block[64];
+    size_t          idx;
+    size_t          count;
+    size_t          k;
+
+    for( idx = 0; idx < n; idx += count ) {
+        count = (n - idx < 64) ? n - idx : 64;
+        dpt9_to_double( data + idx, block, count );
+        for( k = 0; k < count; k++ ) {
+            value[idx + k] = (float)block[k];
+        }
+    }
+}
+
+
+/*
+ * integers of bits width, sign extended if sign is set
+ */
+static inline void dpt_int_to_double( const uint32_t *data, double *value, size_t n, int bits, int sign )
+{
+    size_t          idx = 0;
+    int             shift = 32 - bits;
+
+#if defined( __AVX2__ )
+    __m256i         x;
+
+    for( ; idx + 8 <= n; idx += 8 ) {
+        x = _mm256_slli_epi32( _mm256_loadu_si256( (const __m256i *)(data + idx) ), shift );
+        x = sign ? _mm256_srai_epi32( x, shift ) : _mm256_srli_epi32( x, shift );
+        _mm256_storeu_pd( value + idx, _mm256_cvtepi32_pd( _mm256_castsi256_si128( x )));
+        _mm256_storeu_pd( value + idx + 4, _mm256_cvtepi32_pd( _mm256_extracti128_si256( x, 1 )));
+    }
+#elif defined( __SSE2__ )
+    __m128i         x;
+
+    for( ; idx + 4 <= n; idx += 4 ) {
+        x = _mm_slli_epi32( _mm_loadu_si128( (const __m128i *)(data + idx) ), shift );
+        x = sign ? _mm_srai_epi32( x, shift ) : _mm_srli_epi32( x, shift );
+        _mm_storeu_pd( value + idx, _mm_cvtepi32_pd( x ));
+        _mm_storeu_pd( value + idx + 2, _mm_cvtepi32_pd( _mm_shuffle_epi32( x, 0x4e )));
+    }
+#endif
+    for( ; idx < n; idx++ ) {
+        value[idx] = sign ? (double)((int32_t)(data[idx] << shift) >> shift) : (double)((data[idx] << shift) >> shift);
+    }
+}
+
+
+void dpt5_to_double( const uint32_t *data, double *value, size_t n )
+{
+    dpt_int_to_double( data, value, n, 8, 0 );
+}
+
+
+void dpt6_to_double( const uint32_t *data, double *value, size_t n )
+{
+    dpt_int_to_double( data, value, n, 8, 1 );
+}
+
+
+void dpt7_to_double( const uint32_t *data, double *value, size_t n )
+{
+    dpt_int_to_double( data, value, n, 16, 0 );
+}
+
+
+void dpt8_to_double( const uint32_t *data, double *value, size_t n )
+{
+    dpt_int_to_double( data, value, n, 16, 1 );
+}
+
+
+/*
+ * instruction set the batch functions were built for
+ */
+const char *dpt_kernel( void )
+{
+#if defined( __AVX2__ )
+    return( "avx2" );
+#elif defined( __SSE2__ )
+    return( "sse2" );
+#else
+    return( "scalar" );
+#endif
+}
@@ -0,0 +1,84 @@
+/*
+ * dptdecode - batch decoding of datapoint values
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#ifndef DPTDECODE_H_
+#define DPTDECODE_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+ * Input is a column of payloads as kept in the data column of an
+ * archive: the data bytes after apci, big endian, right aligned. Bits
+ * above the datapoint are ignored.
+ *
+ *   DPT 9       2 byte float (EIS 5)    MEEEEMMM MMMMMMMM, 0.01 * M * 2^E
+ *   DPT 5       unsigned 8 bit
+ *   DPT 6       signed 8 bit
+ *   DPT 7       unsigned 16 bit
+ *   DPT 8       signed 16 bit
+ *
+ * The batch functions use AVX2 or SSE2 when the compiler targets them
+ * and give the same bits as the single value functions below for every
+ * input.
+ */
+
+/*
+ * function declarations
+ */
+extern void         dpt9_to_double( const uint32_t *data, double *value, size_t n );
+extern void         dpt9_to_float( const uint32_t *data, float *value, size_t n );
+extern void         dpt5_to_double( const uint32_t *data, double *value, size_t n );
+extern void         dpt6_to_double( const uint32_t *data, double *value, size_t n );
+extern void         dpt7_to_double( const uint32_t *data, double *value, size_t n );
+extern void         dpt8_to_double( const uint32_t *data, double *value, size_t n );
+extern const char   *dpt_kernel( void );
+
+/*
+ * single values
+ */
+static inline double dpt9_value( uint32_t raw )
+{
+    int32_t         mant = (int32_t)(raw & 0x07ff) - (int32_t)((raw & 0x8000) >> 4);
+
+    // mant * 2^E is exact, so is scaling it afterwards in one rounding
+    return( (double)(mant * (1 << ((raw >> 11) & 0x0f))) * 0.01 );
+}
+
+static inline double dpt5_value( uint32_t raw )
+{
+    return( (double)(raw & 0xff) );
+}
+
+static inline double dpt6_value( uint32_t raw )
+{
+    return( (double)(int8_t)(raw & 0xff) );
+}
+
+static inline double dpt7_value( uint32_t raw )
+{
+    return( (double)(raw & 0xffff) );
+}
+
+static inline double dpt8_value( uint32_t raw )
+{
+    return( (double)(int16_t)(raw & 0xffff) );
+}
+
+#endif /*DPTDECODE_H_*/
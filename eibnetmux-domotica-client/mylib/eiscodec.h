@@ -0,0 +1,378 @@
+/*
+ * eiscodec - typed decoding and encoding of EIS values
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#ifndef EISCODEC_H_
+#define EISCODEC_H_
+
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#include "knxframe.h"
+#include "dptdecode.h"
+
+/*
+ * Every EIS type has a frame length and a decode and encode function
+ * with the C type of its value, all inline:
+ *
+ *   EIS  length  value                                  DPT
+ *    1     1     uint8_t   switch, 0 or 1                1
+ *    2     1     uint8_t   dimming control, 4 bits       3
+ *    3     4     uint32_t  seconds since midnight        10
+ *    4     4     time_t    local midnight of date        11
+ *    5     3     double    2 byte float                  9
+ *    6     2     uint8_t   0..255                        5
+ *    7     1     uint8_t   drive up/down, 0 or 1         1
+ *    8     1     uint8_t   priority control, 2 bits      2
+ *    9     5     double    4 byte IEEE float             14
+ *   10     3     uint16_t  16 bit counter                7
+ *   11     5     uint32_t  32 bit counter                12
+ *   13     2     uint8_t   ASCII character               4
+ *   14     2     uint8_t   8 bit counter                 5
+ *   15    15     char[15]  string, 14 characters         16
+ *
+ * EIS 12 (access control) has no codec. Length is the frame length,
+ * counting the apci byte. Encoding writes what enmx_write() sends: the
+ * 6 bit value of short frames in data[0], else 0 followed by the
+ * payload. The return value is the length.
+ *
+ * eis_decode() and eis_encode() take the type at run time and go
+ * through a double. With a constant type the switch folds away.
+ */
+#define EIS1_LENGTH             1
+#define EIS2_LENGTH             1
+#define EIS3_LENGTH             4
+#define EIS4_LENGTH             4
+#define EIS5_LENGTH             3
+#define EIS6_LENGTH             2
+#define EIS7_LENGTH             1
+#define EIS8_LENGTH             1
+#define EIS9_LENGTH             5
+#define EIS10_LENGTH            3
+#define EIS11_LENGTH            5
+#define EIS13_LENGTH            2
+#define EIS14_LENGTH            2
+#define EIS15_LENGTH            15
+#define EIS_MAX_LENGTH          EIS15_LENGTH
+
+typedef char eis_codec_check[(sizeof( ((CEMIFRAME *)0)->data ) >= EIS_MAX_LENGTH - 1 &&
+                              sizeof( float ) == 4 && sizeof( uint32_t ) == 4) ? 1 : -1];
+
+
+/*
+ * payload bytes after the apci byte, big endian
+ */
+static inline uint32_t eis_payload( const CEMIFRAME *frame, int bytes )
+{
+    uint32_t        raw = 0;
+    int             idx;
+
+    for( idx = 0; idx < bytes; idx++ ) {
+        raw = (raw << 8) | frame->data[idx];
+    }
+    return( raw );
+}
+
+static inline void eis_put( uint8_t *data, uint32_t raw, int bytes )
+{
+    data[0] = 0;
+    for( ; bytes > 0; bytes-- ) {
+        data[bytes] = raw;
+        raw >>= 8;
+    }
+}
+
+
+/*
+ * decoding
+ */
+static inline uint8_t eis1_decode( const CEMIFRAME *frame )
+{
+    return( frame->apci & 0x01 );
+}
+
+static inline uint8_t eis2_decode( const CEMIFRAME *frame )
+{
+    return( frame->apci & 0x0f );
+}
+
+static inline uint32_t eis3_decode( const CEMIFRAME *frame )
+{
+    return( (frame->data[0] & 0x1f) * 3600 + (frame->data[1] & 0x3f) * 60 + (frame->data[2] & 0x3f) );
+}
+
+static inline time_t eis4_decode( const CEMIFRAME *frame )
+{
+    struct tm       tm;
+
+    memset( &tm, 0, sizeof( tm ));
+    tm.tm_mday = frame->data[0] & 0x1f;
+    tm.tm_mon = (frame->data[1] & 0x0f) - 1;
+    tm.tm_year = frame->data[2] & 0x7f;
+    if( tm.tm_year < 90 ) {
+        tm.tm_year += 100;
+    }
+    tm.tm_isdst = -1;
+    return( mktime( &tm ));
+}
+
+static inline double eis5_decode( const CEMIFRAME *frame )
+{
+    return( dpt9_value( eis_payload( frame, 2 )));
+}
+
+static inline uint8_t eis6_decode( const CEMIFRAME *frame )
+{
+    return( frame->data[0] );
+}
+
+static inline uint8_t eis7_decode( const CEMIFRAME *frame )
+{
+    return( frame->apci & 0x01 );
+}
+
+static inline uint8_t eis8_decode( const CEMIFRAME *frame )
+{
+    return( frame->apci & 0x03 );
+}
+
+static inline double eis9_decode( const CEMIFRAME *frame )
+{
+    uint32_t        raw = eis_payload( frame, 4 );
+    float           f;
+
+    memcpy( &f, &raw, sizeof( f ));
+    return( f );
+}
+
+static inline uint16_t eis10_decode( const CEMIFRAME *frame )
+{
+    return( eis_payload( frame, 2 ));
+}
+
+static inline uint32_t eis11_decode( const CEMIFRAME *frame )
+{
+    return( eis_payload( frame, 4 ));
+}
+
+static inline uint8_t eis13_decode( const CEMIFRAME *frame )
+{
+    return( frame->data[0] );
+}
+
+static inline uint8_t eis14_decode( const CEMIFRAME *frame )
+{
+    return( frame->data[0] );
+}
+
+static inline void eis15_decode( const CEMIFRAME *frame, char *text )
+{
+    memcpy( text, frame->data, EIS15_LENGTH - 1 );
+    text[EIS15_LENGTH - 1] = '\0';
+}
+
+
+/*
+ * encoding
+ */
+static inline int eis1_encode( uint8_t value, uint8_t *data )
+{
+    data[0] = (value != 0);
+    return( EIS1_LENGTH );
+}
+
+static inline int eis2_encode( uint8_t value, uint8_t *data )
+{
+    data[0] = value & 0x0f;
+    return( EIS2_LENGTH );
+}
+
+static inline int eis3_encode( uint32_t value, uint8_t *data )
+{
+    value %= 86400;
+    eis_put( data, ((value / 3600) << 16) | ((value / 60 % 60) << 8) | (value % 60), 3 );
+    return( EIS3_LENGTH );
+}
+
+static inline int eis4_encode( time_t value, uint8_t *data )
+{
+    struct tm       tm;
+
+    localtime_r( &value, &tm );
+    eis_put( data, (tm.tm_mday << 16) | ((tm.tm_mon + 1) << 8) | (tm.tm_year % 100), 3 );
+    return( EIS4_LENGTH );
+}
+
+/*
+ * smallest exponent the mantissa fits with, -1 if out of range
+ */
+static inline int eis5_encode( double value, uint8_t *data )
+{
+    double          mant = value * 100;
+    int32_t         m;
+    int             exp = 0;
+
+    if( !(value >= -671088.64 && value <= 670760.96) ) {
+        return( -1 );
+    }
+    while( mant < -2048 || mant > 2047 ) {
+        mant /= 2;
+        exp++;
+    }
+    m = (mant < 0) ? (int32_t)(mant - 0.5) : (int32_t)(mant + 0.5);
+    if( m > 2047 || m < -2048 ) {
+        m /= 2;
+        exp++;
+    }
+    eis_put( data, ((m < 0) ? 0x8000 : 0) | (exp << 11) | (m & 0x07ff), 2 );
+    return( EIS5_LENGTH );
+}
+
+static inline int eis6_encode( uint8_t value, uint8_t *data )
+{
+    eis_put( data, value, 1 );
+    return( EIS6_LENGTH );
+}
+
+static inline int eis7_encode( uint8_t value, uint8_t *data )
+{
+    data[0] = (value != 0);
+    return( EIS7_LENGTH );
+}
+
+static inline int eis8_encode( uint8_t value, uint8_t *data )
+{
+    data[0] = value & 0x03;
+    return( EIS8_LENGTH );
+}
+
+static inline int eis9_encode( double value, uint8_t *data )
+{
+    float           f = value;
+    uint32_t        raw;
+
+    memcpy( &raw, &f, sizeof( raw ));
+    eis_put( data, raw, 4 );
+    return( EIS9_LENGTH );
+}
+
+static inline int eis10_encode( uint16_t value, uint8_t *data )
+{
+    eis_put( data, value, 2 );
+    return( EIS10_LENGTH );
+}
+
+static inline int eis11_encode( uint32_t value, uint8_t *data )
+{
+    eis_put( data, value, 4 );
+    return( EIS11_LENGTH );
+}
+
+static inline int eis13_encode( uint8_t value, uint8_t *data )
+{
+    eis_put( data, value, 1 );
+    return( EIS13_LENGTH );
+}
+
+static inline int eis14_encode( uint8_t value, uint8_t *data )
+{
+    eis_put( data, value, 1 );
+    return( EIS14_LENGTH );
+}
+
+static inline int eis15_encode( const char *text, uint8_t *data )
+{
+    data[0] = 0;
+    strncpy( (char *)data + 1, text, EIS15_LENGTH - 1 );
+    return( EIS15_LENGTH );
+}
+
+
+/*
+ * frame length of EIS type, 0 if it has no codec
+ */
+static inline int eis_length( int eis )
+{
+    switch( eis ) {
+        case 1:     return( EIS1_LENGTH );
+        case 2:     return( EIS2_LENGTH );
+        case 3:     return( EIS3_LENGTH );
+        case 4:     return( EIS4_LENGTH );
+        case 5:     return( EIS5_LENGTH );
+        case 6:     return( EIS6_LENGTH );
+        case 7:     return( EIS7_LENGTH );
+        case 8:     return( EIS8_LENGTH );
+        case 9:     return( EIS9_LENGTH );
+        case 10:    return( EIS10_LENGTH );
+        case 11:    return( EIS11_LENGTH );
+        case 13:    return( EIS13_LENGTH );
+        case 14:    return( EIS14_LENGTH );
+        case 15:    return( EIS15_LENGTH );
+    }
+    return( 0 );
+}
+
+/*
+ * numeric value of frame as EIS type, -1 for strings and unknown types
+ */
+static inline int eis_decode( int eis, const CEMIFRAME *frame, double *value )
+{
+    switch( eis ) {
+        case 1:     *value = eis1_decode( frame );      break;
+        case 2:     *value = eis2_decode( frame );      break;
+        case 3:     *value = eis3_decode( frame );      break;
+        case 4:     *value = eis4_decode( frame );      break;
+        case 5:     *value = eis5_decode( frame );      break;
+        case 6:     *value = eis6_decode( frame );      break;
+        case 7:     *value = eis7_decode( frame );      break;
+        case 8:     *value = eis8_decode( frame );      break;
+        case 9:     *value = eis9_decode( frame );      break;
+        case 10:    *value = eis10_decode( frame );     break;
+        case 11:    *value = eis11_decode( frame );     break;
+        case 13:    *value = eis13_decode( frame );     break;
+        case 14:    *value = eis14_decode( frame );     break;
+        default:    return( -1 );
+    }
+    return( 0 );
+}
+
+/*
+ * encode numeric value as EIS type, returns length or -1
+ */
+static inline int eis_encode( int eis, double value, uint8_t *data )
+{
+    switch( eis ) {
+        case 1:     return( eis1_encode( value != 0, data ));
+        case 2:     return( eis2_encode( (uint32_t)value, data ));
+        case 3:     return( eis3_encode( (uint32_t)value, data ));
+        case 4:     return( eis4_encode( (time_t)value, data ));
+        case 5:     return( eis5_encode( value, data ));
+        case 6:     return( eis6_encode( (uint32_t)value, data ));
+        case 7:     return( eis7_encode( value != 0, data ));
+        case 8:     return( eis8_encode( (uint32_t)value, data ));
+        case 9:     return( eis9_encode( value, data ));
+        case 10:    return( eis10_encode( (uint32_t)value, data ));
+        case 11:    return( eis11_encode( (uint32_t)value, data ));
+        case 13:    return( eis13_encode( (uint32_t)value, data ));
+        case 14:    return( eis14_encode( (uint32_t)value, data ));
+    }
+    return( -1 );
+}
+
+#endif /*EISCODEC_H_*/
@@ -0,0 +1,111 @@
+/*
+ * fastlane - telegrams which must not wait behind normal traffic
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "fastlane.h"
+
+
+/*
+ * load fast lane definition
+ */
+FASTLANE *fastlane_load( const char *file )
+{
+    FASTLANE        *lane;
+    FILE            *fp;
+    char            line[128];
+    char            word[32];
+    char            *text;
+    char            *sep;
+    uint16_t        first;
+    uint16_t        last;
+    uint32_t        addr;
+    int             lineno = 0;
+
+    fp = fopen( file, "r" );
+    if( fp == NULL ) {
+        fprintf( stderr, "Unable to open fast lane file %s: %s\n", file, strerror( errno ));
+        return( NULL );
+    }
+    lane = calloc( 1, sizeof( FASTLANE ));
+    if( lane == NULL ) {
+        fprintf( stderr, "Out of memory: %s\n", strerror( errno ));
+        fclose( fp );
+        return( NULL );
+    }
+    lane->rank = -1;
+
+    while( fgets( line, sizeof( line ), fp ) != NULL ) {
+        lineno++;
+        if( (sep = strpbrk( line, "#\r\n" )) != NULL ) {
+            *sep = '\0';
+        }
+        text = line + strspn( line, " \t" );
+        if( *text == '\0' ) {
+            continue;
+        }
+        if( sscanf( text, "priority %31s", word ) == 1 ) {
+            if( strcmp( word, "system" ) == 0 ) {
+                lane->rank = 0;
+            } else if( strcmp( word, "urgent" ) == 0 ) {
+                lane->rank = 1;
+            } else if( strcmp( word, "normal" ) == 0 ) {
+                lane->rank = 2;
+            } else if( strcmp( word, "low" ) == 0 ) {
+                lane->rank = 3;
+            } else {
+                fprintf( stderr, "Fast lane line %d: unknown priority '%s'\n", lineno, word );
+                goto failed;
+            }
+            continue;
+        }
+        if( (sep = strchr( text, '-' )) != NULL ) {
+            *sep++ = '\0';
+        }
+        if( knx_parse_group( text, &first ) != 0 ||
+            knx_parse_group( (sep != NULL) ? sep : text, &last ) != 0 || last < first ) {
+            fprintf( stderr, "Fast lane line %d: invalid group address\n", lineno );
+            goto failed;
+        }
+        for( addr = first; addr <= last; addr++ ) {
+            lane->group[addr >> 3] |= 1 << (addr & 7);
+        }
+    }
+    fclose( fp );
+    return( lane );
+
+failed:
+    fclose( fp );
+    free( lane );
+    return( NULL );
+}
+
+
+void fastlane_close( FASTLANE *lane )
+{
+    free( lane );
+}
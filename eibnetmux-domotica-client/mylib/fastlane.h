@@ -0,0 +1,76 @@
+/*
+ * fastlane - telegrams which must not wait behind normal traffic
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#ifndef FASTLANE_H_
+#define FASTLANE_H_
+
+#include <stdint.h>
+#include <arpa/inet.h>
+
+#include "knxframe.h"
+
+/*
+ * A fast lane file lists group addresses or ranges (first-last), one per
+ * line, and optionally a KNX priority (system, urgent, normal or low):
+ *
+ *   7/0/0-7/0/255          # alarms
+ *   1/1/10
+ *   priority urgent        # also frames sent with system or urgent priority
+ *
+ * Matching is a bit test plus a look at the control field. Telegrams of
+ * one address must stay in order: the writer pool sends the listed
+ * addresses to the fast lane writer and has the writer of its address
+ * write a priority frame at once; eibbroker moves a frame ahead by its
+ * priority only if nothing for the same address is left behind.
+ */
+typedef struct {
+        uint8_t         group[8192];            // bitmap of group addresses
+        int             rank;                   // knx_priority_rank() at or below is fast, -1 = not used
+} FASTLANE;
+
+
+/*
+ * function declarations
+ */
+extern FASTLANE     *fastlane_load( const char *file );
+extern void         fastlane_close( FASTLANE *lane );
+
+/*
+ * is the telegram sent to a fast lane address
+ */
+static inline int fastlane_address( const FASTLANE *lane, const CEMIFRAME *frame )
+{
+    uint16_t        daddr;
+
+    if( !(frame->ntwrk & EIB_DAF_GROUP) ) {
+        return( 0 );
+    }
+    daddr = ntohs( frame->daddr );
+    return( (lane->group[daddr >> 3] >> (daddr & 7)) & 1 );
+}
+
+/*
+ * is the telegram sent with fast lane priority
+ */
+static inline int fastlane_priority( const FASTLANE *lane, const CEMIFRAME *frame )
+{
+    return( lane->rank >= 0 && knx_priority_rank( frame ) <= lane->rank );
+}
+
+#endif /*FASTLANE_H_*/
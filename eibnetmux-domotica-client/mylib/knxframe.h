@@ -0,0 +1,148 @@
+/*
+ * KNX frame definitions shared by the samples
+ *
+ * eibnetmux - eibnet/ip multiplexer
+ * Copyright (C) 2006-2008 Urs Zurbuchen <software@marmira.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#ifndef KNXFRAME_H_
+#define KNXFRAME_H_
+
+#include <stdio.h>
+#include <stdint.h>
+#include <sys/time.h>
+
+/*
+ * EIB constants
+ */
+#define EIB_DAF_GROUP                   0x80
+#define A_RESPONSE_VALUE_REQ            0x0040
+#define A_WRITE_VALUE_REQ               0x0080
+
+/*
+ * priority bits of the cEMI control field, (ctrl >> 2) & 3
+ */
+#define KNX_PRIO_SYSTEM                 0
+#define KNX_PRIO_NORMAL                 1
+#define KNX_PRIO_URGENT                 2
+#define KNX_PRIO_LOW                    3
+
+/*
+ * repeat bit of the cEMI control field, cleared when the frame is a repetition
+ */
+#define KNX_CTRL_NOT_REPEATED           0x20
+
+
+/*
+ * EIB request frame
+ *
+ * as returned by enmx_monitor(); addresses are in network byte order
+ */
+typedef struct __attribute__((packed)) {
+        uint8_t  code;
+        uint8_t  zero;
+        uint8_t  ctrl;
+        uint8_t  ntwrk;
+        uint16_t saddr;
+        uint16_t daddr;
+        uint8_t  length;
+        uint8_t  tpci;
+        uint8_t  apci;
+        uint8_t  data[16];
+} CEMIFRAME;
+
+
+/*
+ * Telegram as passed along the capture pipeline:
+ * the frame as received together with its receive time
+ */
+typedef struct {
+        struct timeval  tv;
+        CEMIFRAME       frame;
+        uint8_t         seen;                   // routing counters of merged copies, bit per value, 0 = unknown
+} KNXTELEGRAM;
+
+
+/*
+ * Service of a frame: 'W'rite, 'A'nswer or 'R'ead
+ */
+static inline char knx_service( const CEMIFRAME *frame )
+{
+    if( frame->apci & A_WRITE_VALUE_REQ ) {
+        return( 'W' );
+    } else if( frame->apci & A_RESPONSE_VALUE_REQ ) {
+        return( 'A' );
+    }
+    return( 'R' );
+}
+
+
+/*
+ * Priority of a frame as urgency rank: 0 = system, 1 = urgent, 2 = normal, 3 = low
+ */
+static inline int knx_priority_rank( const CEMIFRAME *frame )
+{
+    static const uint8_t    rank[4] = { 0, 2, 1, 3 };
+
+    return( rank[(frame->ctrl >> 2) & 0x03] );
+}
+
+
+/*
+ * Frame is a repetition sent because the original was not acknowledged
+ */
+static inline int knx_repeated( const CEMIFRAME *frame )
+{
+    return( (frame->ctrl & KNX_CTRL_NOT_REPEATED) == 0 );
+}
+
+
+/*
+ * Parse group address given as main/middle/sub, main/sub or plain number
+ *
+ * returns -1 if text is not a valid group address
+ */
+static inline int knx_parse_group( const char *text, uint16_t *grp_addr )
+{
+    unsigned int    top;
+    unsigned int    sub;
+    unsigned int    group;
+    char            tail;
+
+    if( sscanf( text, "%u/%u/%u %c", &top, &sub, &group, &tail ) == 3 ) {
+        if( top > 31 || sub > 7 || group > 255 ) {
+            return( -1 );
+        }
+        *grp_addr = (top << 11) | (sub << 8) | group;
+    } else if( sscanf( text, "%u/%u %c", &top, &group, &tail ) == 2 ) {
+        if( top > 31 || group > 2047 ) {
+            return( -1 );
+        }
+        *grp_addr = (top << 11) | group;
+    } else if( sscanf( text, "%u %c", &group, &tail ) == 1 ) {
+        if( group > 65535 ) {
+            return( -1 );
+        }
+        *grp_addr = group;
+    } else {
+        return( -1 );
+    }
+    return( 0 );
+}
+
+#endif /*KNXFRAME_H_*/
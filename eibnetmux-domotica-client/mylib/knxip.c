@@ -0,0 +1,354 @@
+/*
+ * knxip - KNXnet/IP routing multicast receiver
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE                             // recvmmsg()
+#endif
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "knxip.h"
+
+#define KNXIP_CEMI_FIXED    9                   // ctrl1 up to and including apci
+
+struct knxip_router {
+        int             fd;
+        struct mmsghdr  msg[KNXIP_BATCH];
+        struct iovec    iov[KNXIP_BATCH];
+        unsigned char   buf[KNXIP_BATCH][KNXIP_PACKET_MAX];
+        unsigned char   control[KNXIP_BATCH][CMSG_SPACE( sizeof( struct timeval ))];
+        int             received;               // packets of last recvmmsg()
+        int             next;                   // next of them to parse
+        uint64_t        packets;
+        uint64_t        batches;
+        uint64_t        frames;
+        uint64_t        invalid;
+        uint64_t        lost;                   // as reported by routers
+        uint64_t        busy;
+};
+
+
+/*
+ * local function declarations
+ */
+static int      knxip_receive( KNXIP_ROUTER *router, int timeout_ms );
+static void     knxip_stamp( struct msghdr *hdr, struct timeval *tv );
+
+
+/*
+ * parse address[:port], missing parts are the KNXnet/IP routing defaults
+ */
+int knxip_address( const char *text, struct sockaddr_in *sin )
+{
+    char            host[64];
+    char            *sep;
+
+    memset( sin, 0, sizeof( struct sockaddr_in ));
+    sin->sin_family = AF_INET;
+    sin->sin_port = htons( KNXIP_DEFAULT_PORT );
+    snprintf( host, sizeof( host ), "%s", (text != NULL && *text != '\0') ? text : KNXIP_DEFAULT_GROUP );
+    if( (sep = strchr( host, ':' )) != NULL ) {
+        *sep++ = '\0';
+        if( atoi( sep ) < 1 || atoi( sep ) > 65535 ) {
+            return( -1 );
+        }
+        sin->sin_port = htons( atoi( sep ));
+    }
+    if( *host == '\0' ) {
+        strcpy( host, KNXIP_DEFAULT_GROUP );
+    }
+    if( inet_pton( AF_INET, host, &sin->sin_addr ) != 1 ) {
+        return( -1 );
+    }
+    return( 0 );
+}
+
+
+/*
+ * join routing group as group[:port] on interface with address ifaddr,
+ * NULL for the defaults
+ */
+KNXIP_ROUTER *knxip_open( const char *group, const char *ifaddr )
+{
+    KNXIP_ROUTER        *router;
+    struct sockaddr_in  addr;
+    struct ip_mreq      mreq;
+    int                 on = 1;
+    int                 rcvbuf = KNXIP_RCVBUF;
+    int                 idx;
+
+    if( knxip_address( group, &addr ) != 0 || !IN_MULTICAST( ntohl( addr.sin_addr.s_addr ))) {
+        fprintf( stderr, "Invalid KNXnet/IP routing group %s\n", group );
+        return( NULL );
+    }
+    memset( &mreq, 0, sizeof( mreq ));
+    mreq.imr_multiaddr = addr.sin_addr;
+    mreq.imr_interface.s_addr = htonl( INADDR_ANY );
+    if( ifaddr != NULL && inet_pton( AF_INET, ifaddr, &mreq.imr_interface ) != 1 ) {
+        fprintf( stderr, "Invalid interface address %s\n", ifaddr );
+        return( NULL );
+    }
+
+    router = calloc( 1, sizeof( KNXIP_ROUTER ));
+    if( router == NULL ) {
+        fprintf( stderr, "Out of memory\n" );
+        exit( -5 );
+    }
+    // bound to the group, so that other groups on the port are not received
+    router->fd = socket( AF_INET, SOCK_DGRAM, 0 );
+    if( router->fd < 0 ||
+        setsockopt( router->fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof( on )) != 0 ||
+        setsockopt( router->fd, SOL_SOCKET, SO_TIMESTAMP, &on, sizeof( on )) != 0 ||
+        bind( router->fd, (struct sockaddr *)&addr, sizeof( addr )) != 0 ||
+        setsockopt( router->fd, IPPROTO_IP, IP_ADD_MEMBERSHIP, &mreq, sizeof( mreq )) != 0 ) {
+        fprintf( stderr, "Unable to join KNXnet/IP routing group %s:%d: %s\n",
+                 inet_ntoa( addr.sin_addr ), ntohs( addr.sin_port ), strerror( errno ));
+        knxip_close( router );
+        return( NULL );
+    }
+    // room for bursts while the capture loop is busy, best effort
+    setsockopt( router->fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof( rcvbuf ));
+
+    for( idx = 0; idx < KNXIP_BATCH; idx++ ) {
+        router->iov[idx].iov_base = router->buf[idx];
+        router->iov[idx].iov_len = KNXIP_PACKET_MAX;
+        router->msg[idx].msg_hdr.msg_iov = &router->iov[idx];
+        router->msg[idx].msg_hdr.msg_iovlen = 1;
+    }
+    return( router );
+}
+
+
+/*
+ * fill the batch with whatever is waiting, after waiting up to timeout_ms
+ * for the first packet
+ *
+ * returns packets received, 0 on timeout or signal, -1 on error
+ */
+static int knxip_receive( KNXIP_ROUTER *router, int timeout_ms )
+{
+    struct pollfd   pfd;
+    int             idx;
+    int             n;
+
+    pfd.fd = router->fd;
+    pfd.events = POLLIN;
+    n = poll( &pfd, 1, timeout_ms );
+    if( n <= 0 ) {
+        return( (n < 0 && errno != EINTR) ? -1 : 0 );
+    }
+    for( idx = 0; idx < KNXIP_BATCH; idx++ ) {
+        router->msg[idx].msg_hdr.msg_name = NULL;
+        router->msg[idx].msg_hdr.msg_namelen = 0;
+        router->msg[idx].msg_hdr.msg_control = router->control[idx];
+        router->msg[idx].msg_hdr.msg_controllen = sizeof( router->control[idx] );
+        router->msg[idx].msg_hdr.msg_flags = 0;
+    }
+    n = recvmmsg( router->fd, router->msg, KNXIP_BATCH, MSG_DONTWAIT, NULL );
+    if( n < 0 ) {
+        return( (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) ? 0 : -1 );
+    }
+    router->received = n;
+    router->next = 0;
+    router->packets += n;
+    router->batches++;
+    return( n );
+}
+
+
+/*
+ * kernel receive time of a packet, now if there is none
+ */
+static void knxip_stamp( struct msghdr *hdr, struct timeval *tv )
+{
+    struct cmsghdr  *cmsg;
+
+    for( cmsg = CMSG_FIRSTHDR( hdr ); cmsg != NULL; cmsg = CMSG_NXTHDR( hdr, cmsg )) {
+        if( cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_TIMESTAMP ) {
+            memcpy( tv, CMSG_DATA( cmsg ), sizeof( struct timeval ));
+            return;
+        }
+    }
+    gettimeofday( tv, NULL );
+}
+
+
+/*
+ * return next telegram, waiting up to timeout_ms for one, -1 = forever
+ *
+ * returns 1 with a telegram, 0 on timeout or signal, -1 on socket errors
+ */
+int knxip_next( KNXIP_ROUTER *router, KNXTELEGRAM *telegram, int timeout_ms )
+{
+    struct mmsghdr  *msg;
+    unsigned char   *buf;
+    uint16_t        service;
+    int             idx;
+    int             rc;
+
+    for( ;; ) {
+        while( router->next < router->received ) {
+            idx = router->next++;
+            msg = &router->msg[idx];
+            buf = router->buf[idx];
+            if( msg->msg_len < KNXIP_HEADER || buf[0] != KNXIP_HEADER || buf[1] != KNXIP_VERSION ) {
+                router->invalid++;
+                continue;
+            }
+            service = (buf[2] << 8) | buf[3];
+            if( service == KNXIP_ROUTING_LOST_MESSAGE ) {
+                if( msg->msg_len >= KNXIP_HEADER + 4 ) {
+                    router->lost += (buf[KNXIP_HEADER + 2] << 8) | buf[KNXIP_HEADER + 3];
+                }
+                continue;
+            }
+            if( service == KNXIP_ROUTING_BUSY ) {
+                router->busy++;
+                continue;
+            }
+            if( knxip_parse( buf, msg->msg_len, &telegram->frame ) != 0 ) {
+                router->invalid++;
+                continue;
+            }
+            knxip_stamp( &msg->msg_hdr, &telegram->tv );
+            telegram->seen = 0;
+            router->frames++;
+            return( 1 );
+        }
+        rc = knxip_receive( router, timeout_ms );
+        if( rc <= 0 ) {
+            return( rc );
+        }
+    }
+}
+
+
+int knxip_fd( KNXIP_ROUTER *router )
+{
+    return( router->fd );
+}
+
+
+void knxip_stats( KNXIP_ROUTER *router, FILE *fp )
+{
+    fprintf( fp, "knxip: %llu packets in %llu reads, %llu frames, %llu invalid, "
+                 "%llu lost and %llu busy reported by routers\n",
+             (unsigned long long)router->packets, (unsigned long long)router->batches,
+             (unsigned long long)router->frames, (unsigned long long)router->invalid,
+             (unsigned long long)router->lost, (unsigned long long)router->busy );
+}
+
+
+void knxip_close( KNXIP_ROUTER *router )
+{
+    if( router->fd >= 0 ) {
+        close( router->fd );
+    }
+    free( router );
+}
+
+
+/*
+ * parse a routing indication with a data frame
+ *
+ * frames with more data than a CEMIFRAME holds are rejected, downstream
+ * code trusts frame->length
+ * returns 0, or -1 if it is something else, damaged or too long
+ */
+int knxip_parse( const unsigned char *buf, size_t len, CEMIFRAME *frame )
+{
+    const unsigned char *cemi;
+    size_t          total;
+    size_t          avail;
+    size_t          framelen;
+
+    if( len < KNXIP_HEADER || buf[0] != KNXIP_HEADER || buf[1] != KNXIP_VERSION ||
+        ((buf[2] << 8) | buf[3]) != KNXIP_ROUTING_INDICATION ) {
+        return( -1 );
+    }
+    total = (buf[4] << 8) | buf[5];
+    if( total > len || total < KNXIP_HEADER + 2 ) {
+        return( -1 );
+    }
+    cemi = buf + KNXIP_HEADER;
+    if( cemi[0] != CEMI_L_DATA_IND && cemi[0] != CEMI_L_DATA_REQ ) {
+        return( -1 );
+    }
+    // skip additional info
+    avail = total - KNXIP_HEADER;
+    if( (size_t)(2 + cemi[1] + KNXIP_CEMI_FIXED) > avail ) {
+        return( -1 );
+    }
+    avail -= 2 + cemi[1];
+    // npdu length counts apci and data
+    if( cemi[2 + cemi[1] + 6] > 1 + sizeof( frame->data )) {
+        return( -1 );
+    }
+    framelen = cemi[2 + cemi[1] + 6] + KNXIP_CEMI_FIXED - 1;
+    if( framelen > avail ) {
+        return( -1 );
+    }
+
+    memset( frame, 0, sizeof( CEMIFRAME ));
+    frame->code = cemi[0];
+    memcpy( &frame->ctrl, cemi + 2 + cemi[1], framelen );
+    return( 0 );
+}
+
+
+/*
+ * encode frame as routing indication, returns packet size
+ */
+int knxip_encode( unsigned char *buf, const CEMIFRAME *frame )
+{
+    int             framelen;
+    int             total;
+
+    framelen = KNXIP_CEMI_FIXED - 1 + frame->length;
+    if( framelen > (int)(sizeof( CEMIFRAME ) - offsetof( CEMIFRAME, ctrl ))) {
+        framelen = sizeof( CEMIFRAME ) - offsetof( CEMIFRAME, ctrl );
+    }
+    total = KNXIP_HEADER + 2 + framelen;
+    buf[0] = KNXIP_HEADER;
+    buf[1] = KNXIP_VERSION;
+    buf[2] = KNXIP_ROUTING_INDICATION >> 8;
+    buf[3] = KNXIP_ROUTING_INDICATION & 0xff;
+    buf[4] = total >> 8;
+    buf[5] = total & 0xff;
+    buf[6] = CEMI_L_DATA_IND;
+    buf[7] = 0;
+    memcpy( buf + 8, &frame->ctrl, framelen );
+    buf[8 + 6] = framelen - KNXIP_CEMI_FIXED + 1;
+    return( total );
+}
@@ -0,0 +1,75 @@
+/*
+ * knxip - KNXnet/IP routing multicast receiver
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#ifndef KNXIP_H_
+#define KNXIP_H_
+
+#include <stdio.h>
+#include <stdint.h>
+#include <netinet/in.h>
+
+#include "knxframe.h"
+
+/*
+ * KNXnet/IP routers send every telegram of their line to a multicast
+ * group as a routing indication:
+ *   uint8   header size       6
+ *   uint8   version           0x10
+ *   uint16  service           KNXIP_ROUTING_INDICATION
+ *   uint16  total length      of the packet
+ *   cEMI                      message code, additional info length and
+ *                             info, ctrl1, ctrl2, source, destination,
+ *                             npdu length, tpci, apci, data
+ * in network byte order. The cEMI message is the CEMIFRAME eibnetmux
+ * hands out once the additional info is left out; frames with more than
+ * 16 data bytes do not fit and are dropped as invalid.
+ *
+ * The receiver joins the group and reads up to KNXIP_BATCH packets per
+ * recvmmsg() call, each with its kernel receive time.
+ */
+#define KNXIP_DEFAULT_GROUP             "224.0.23.12"
+#define KNXIP_DEFAULT_PORT              3671
+#define KNXIP_HEADER                    6
+#define KNXIP_VERSION                   0x10
+#define KNXIP_ROUTING_INDICATION        0x0530
+#define KNXIP_ROUTING_LOST_MESSAGE      0x0531
+#define KNXIP_ROUTING_BUSY              0x0532
+#define KNXIP_PACKET_MAX                512
+#define KNXIP_BATCH                     64
+#define KNXIP_RCVBUF                    (1 << 20)
+
+#define CEMI_L_DATA_REQ                 0x11
+#define CEMI_L_DATA_IND                 0x29
+
+typedef struct knxip_router KNXIP_ROUTER;
+
+
+/*
+ * function declarations
+ */
+extern KNXIP_ROUTER *knxip_open( const char *group, const char *ifaddr );
+extern int          knxip_next( KNXIP_ROUTER *router, KNXTELEGRAM *telegram, int timeout_ms );
+extern int          knxip_fd( KNXIP_ROUTER *router );
+extern void         knxip_stats( KNXIP_ROUTER *router, FILE *fp );
+extern void         knxip_close( KNXIP_ROUTER *router );
+extern int          knxip_parse( const unsigned char *buf, size_t len, CEMIFRAME *frame );
+extern int          knxip_encode( unsigned char *buf, const CEMIFRAME *frame );
+extern int          knxip_address( const char *text, struct sockaddr_in *sin );
+
+#endif /*KNXIP_H_*/
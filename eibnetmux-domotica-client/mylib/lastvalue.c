@@ -0,0 +1,385 @@
+/*
+ * lastvalue - last value per group address in shared memory
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <limits.h>
+#include <time.h>
+#include <sched.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <arpa/inet.h>
+
+#include "lastvalue.h"
+
+// a slot must stay one cache line, readers depend on the layout
+typedef char lv_slot_size_check[(sizeof( LV_SLOT ) == 64 && sizeof( LV_HEADER ) == 64) ? 1 : -1];
+typedef char lv_snap_size_check[(sizeof( LV_SNAP_RECORD ) == 48 && sizeof( LV_SNAP_HEADER ) == 32) ? 1 : -1];
+
+
+/*
+ * map shared memory object
+ */
+static LV_TABLE *lv_map( const char *name, int writable )
+{
+    LV_TABLE        *table;
+    int             fd;
+    void            *base;
+
+    table = calloc( 1, sizeof( LV_TABLE ));
+    if( table == NULL ) {
+        return( NULL );
+    }
+    table->size = sizeof( LV_HEADER ) + LV_SLOTS * sizeof( LV_SLOT );
+    table->writable = writable;
+    table->name = strdup( name );
+
+    if( writable ) {
+        fd = shm_open( name, O_RDWR | O_CREAT, 0644 );
+        if( fd >= 0 && ftruncate( fd, table->size ) != 0 ) {
+            close( fd );
+            fd = -1;
+        }
+    } else {
+        fd = shm_open( name, O_RDONLY, 0 );
+    }
+    if( fd < 0 ) {
+        fprintf( stderr, "Unable to open shared memory %s: %s\n", name, strerror( errno ));
+        free( table->name );
+        free( table );
+        return( NULL );
+    }
+    base = mmap( NULL, table->size, writable ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, fd, 0 );
+    close( fd );
+    if( base == MAP_FAILED ) {
+        fprintf( stderr, "Unable to map shared memory %s: %s\n", name, strerror( errno ));
+        free( table->name );
+        free( table );
+        return( NULL );
+    }
+    table->header = base;
+    table->slot = (LV_SLOT *)((char *)base + sizeof( LV_HEADER ));
+
+    return( table );
+}
+
+
+/*
+ * create (or take over) the table, called by the capture process
+ *
+ * values of a previous run are kept, the layout is reset if it does not match;
+ * a slot left odd by a writer which died while updating it is cleared
+ */
+LV_TABLE *lv_create( const char *name )
+{
+    LV_TABLE        *table;
+    LV_HEADER       *header;
+    LV_SLOT         *slot;
+    uint32_t        addr;
+
+    table = lv_map( name, 1 );
+    if( table == NULL ) {
+        return( NULL );
+    }
+    header = table->header;
+    if( header->magic != LV_MAGIC || header->version != LV_VERSION ||
+        header->slots != LV_SLOTS || header->slot_size != sizeof( LV_SLOT )) {
+        memset( table->slot, 0, LV_SLOTS * sizeof( LV_SLOT ));
+        header->version = LV_VERSION;
+        header->slots = LV_SLOTS;
+        header->slot_size = sizeof( LV_SLOT );
+        header->updates = 0;
+        __atomic_store_n( &header->magic, LV_MAGIC, __ATOMIC_RELEASE );
+        return( table );
+    }
+    for( addr = 0; addr < LV_SLOTS; addr++ ) {
+        slot = &table->slot[addr];
+        if( slot->seq & 1 ) {
+            memset( (char *)slot + sizeof( slot->seq ), 0, sizeof( LV_SLOT ) - sizeof( slot->seq ));
+            __atomic_store_n( &slot->seq, 0, __ATOMIC_RELEASE );
+        }
+    }
+    return( table );
+}
+
+
+/*
+ * open existing table for reading
+ */
+LV_TABLE *lv_open( const char *name )
+{
+    LV_TABLE        *table;
+    LV_HEADER       *header;
+
+    table = lv_map( name, 0 );
+    if( table == NULL ) {
+        return( NULL );
+    }
+    header = table->header;
+    if( __atomic_load_n( &header->magic, __ATOMIC_ACQUIRE ) != LV_MAGIC || header->version != LV_VERSION ||
+        header->slots != LV_SLOTS || header->slot_size != sizeof( LV_SLOT )) {
+        fprintf( stderr, "Shared memory %s is not a last value table\n", name );
+        lv_close( table );
+        return( NULL );
+    }
+    return( table );
+}
+
+
+/*
+ * publish telegram as last value of its group address
+ *
+ * single writer only
+ */
+void lv_publish( LV_TABLE *table, KNXTELEGRAM *telegram, uint8_t eis, double value )
+{
+    CEMIFRAME       *frame = &telegram->frame;
+    LV_SLOT         *slot;
+    uint32_t        seq;
+    int             raw_length;
+
+    if( !(frame->ntwrk & EIB_DAF_GROUP) || knx_service( frame ) == 'R' ) {
+        return;
+    }
+    slot = &table->slot[ntohs( frame->daddr )];
+
+    seq = slot->seq;
+    __atomic_store_n( &slot->seq, seq + 1, __ATOMIC_RELAXED );
+    __atomic_thread_fence( __ATOMIC_RELEASE );
+
+    slot->saddr = ntohs( frame->saddr );
+    slot->service = knx_service( frame );
+    slot->eis = eis;
+    slot->tv_sec = telegram->tv.tv_sec;
+    slot->tv_usec = telegram->tv.tv_usec;
+    slot->length = frame->length;
+    raw_length = frame->length + 1;
+    if( raw_length > sizeof( slot->raw )) {
+        raw_length = sizeof( slot->raw );
+    }
+    memcpy( slot->raw, &frame->tpci, raw_length );
+    slot->value = value;
+
+    __atomic_store_n( &slot->seq, seq + 2, __ATOMIC_RELEASE );
+    table->header->updates++;
+}
+
+
+/*
+ * read consistent copy of a slot
+ *
+ * gives up after LV_READ_TRIES attempts, a writer may have died mid-update
+ * returns -1 if the address has never been seen, -2 if no copy could be taken
+ */
+int lv_read( LV_TABLE *table, uint16_t grp_addr, LV_SLOT *result )
+{
+    LV_SLOT         *slot = &table->slot[grp_addr];
+    uint32_t        seq;
+    int             tries;
+
+    for( tries = 0; tries < LV_READ_TRIES; tries++ ) {
+        seq = __atomic_load_n( &slot->seq, __ATOMIC_ACQUIRE );
+        if( seq & 1 ) {
+            sched_yield();
+            continue;
+        }
+        memcpy( result, slot, sizeof( LV_SLOT ));
+        __atomic_thread_fence( __ATOMIC_ACQUIRE );
+        if( __atomic_load_n( &slot->seq, __ATOMIC_RELAXED ) == seq ) {
+            result->seq = seq;
+            return( (seq == 0) ? -1 : 0 );
+        }
+    }
+    return( -2 );
+}
+
+
+/*
+ * write snapshot of all addresses seen
+ *
+ * may run next to the writer, every slot is a consistent copy; a slot
+ * which stays locked is left out rather than holding up the snapshot
+ * returns number of addresses saved or -1
+ */
+int lv_save( LV_TABLE *table, const char *path )
+{
+    LV_SNAP_HEADER  header;
+    LV_SNAP_RECORD  record;
+    LV_SLOT         slot;
+    FILE            *fp;
+    char            tmp[PATH_MAX];
+    uint32_t        addr;
+    int             skipped = 0;
+    int             result = 0;
+
+    snprintf( tmp, sizeof( tmp ), "%s.tmp", path );
+    fp = fopen( tmp, "w" );
+    if( fp == NULL ) {
+        fprintf( stderr, "Unable to create snapshot %s: %s\n", tmp, strerror( errno ));
+        return( -1 );
+    }
+    memset( &header, 0, sizeof( header ));
+    fwrite( &header, sizeof( header ), 1, fp );        // records counted below
+
+    memset( &record, 0, sizeof( record ));
+    for( addr = 0; addr < LV_SLOTS; addr++ ) {
+        switch( lv_read( table, addr, &slot )) {
+            case 0:
+                break;
+            case -2:
+                skipped++;
+                continue;
+            default:
+                continue;
+        }
+        record.tv_sec = slot.tv_sec;
+        record.value = slot.value;
+        record.tv_usec = slot.tv_usec;
+        record.daddr = addr;
+        record.saddr = slot.saddr;
+        record.service = slot.service;
+        record.eis = slot.eis;
+        record.length = slot.length;
+        memcpy( record.raw, slot.raw, sizeof( record.raw ));
+        if( fwrite( &record, sizeof( record ), 1, fp ) != 1 ) {
+            result = -1;
+            break;
+        }
+        header.records++;
+    }
+
+    header.magic = LV_SNAP_MAGIC;
+    header.version = LV_SNAP_VERSION;
+    header.record_size = sizeof( LV_SNAP_RECORD );
+    header.saved = time( NULL );
+    header.updates = table->header->updates;
+    if( result != 0 || fseek( fp, 0, SEEK_SET ) != 0 || fwrite( &header, sizeof( header ), 1, fp ) != 1 ||
+        fflush( fp ) != 0 || fsync( fileno( fp )) != 0 ) {
+        result = -1;
+    }
+    if( fclose( fp ) != 0 || result != 0 || rename( tmp, path ) != 0 ) {
+        fprintf( stderr, "Unable to write snapshot %s: %s\n", path, strerror( errno ));
+        unlink( tmp );
+        return( -1 );
+    }
+    if( skipped != 0 ) {
+        fprintf( stderr, "Snapshot %s: %d addresses left out, their slots stayed locked\n", path, skipped );
+    }
+    return( header.records );
+}
+
+
+/*
+ * load snapshot into the table, single writer only
+ *
+ * a slot is only replaced by an older value if it was never written,
+ * values of a previous run still in shared memory are at least as new;
+ * a slot locked by a dead writer is left alone
+ * returns number of addresses restored or -1
+ */
+int lv_restore( LV_TABLE *table, const char *path )
+{
+    LV_SNAP_HEADER  *header;
+    LV_SNAP_RECORD  *record;
+    LV_SLOT         *slot;
+    struct stat     st;
+    void            *base;
+    uint32_t        seq;
+    uint32_t        n;
+    int             fd;
+    int             restored = 0;
+
+    fd = open( path, O_RDONLY );
+    if( fd < 0 ) {
+        if( errno != ENOENT ) {
+            fprintf( stderr, "Unable to open snapshot %s: %s\n", path, strerror( errno ));
+        }
+        return( -1 );
+    }
+    if( fstat( fd, &st ) != 0 || st.st_size < sizeof( LV_SNAP_HEADER )) {
+        fprintf( stderr, "Snapshot %s is not valid\n", path );
+        close( fd );
+        return( -1 );
+    }
+    base = mmap( NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0 );
+    close( fd );
+    if( base == MAP_FAILED ) {
+        fprintf( stderr, "Unable to map snapshot %s: %s\n", path, strerror( errno ));
+        return( -1 );
+    }
+    header = base;
+    if( header->magic != LV_SNAP_MAGIC || header->version != LV_SNAP_VERSION ||
+        header->record_size != sizeof( LV_SNAP_RECORD ) || header->records > LV_SLOTS ||
+        st.st_size != sizeof( LV_SNAP_HEADER ) + (off_t)header->records * sizeof( LV_SNAP_RECORD )) {
+        fprintf( stderr, "Snapshot %s is not valid\n", path );
+        munmap( base, st.st_size );
+        return( -1 );
+    }
+    madvise( base, st.st_size, MADV_SEQUENTIAL );
+
+    record = (LV_SNAP_RECORD *)(header + 1);
+    for( n = 0; n < header->records; n++, record++ ) {
+        slot = &table->slot[record->daddr];
+        if( slot->seq & 1 ) {
+            continue;
+        }
+        if( slot->seq != 0 && (slot->tv_sec > record->tv_sec ||
+            (slot->tv_sec == record->tv_sec && slot->tv_usec >= record->tv_usec)) ) {
+            continue;
+        }
+        seq = slot->seq;
+        __atomic_store_n( &slot->seq, seq + 1, __ATOMIC_RELAXED );
+        __atomic_thread_fence( __ATOMIC_RELEASE );
+        slot->saddr = record->saddr;
+        slot->service = record->service;
+        slot->eis = record->eis;
+        slot->tv_sec = record->tv_sec;
+        slot->tv_usec = record->tv_usec;
+        slot->length = record->length;
+        memcpy( slot->raw, record->raw, sizeof( slot->raw ));
+        slot->value = record->value;
+        __atomic_store_n( &slot->seq, seq + 2, __ATOMIC_RELEASE );
+        restored++;
+    }
+    munmap( base, st.st_size );
+    return( restored );
+}
+
+
+/*
+ * unmap table
+ *
+ * the shared memory object stays, readers keep the last values after
+ * the capture process ended
+ */
+void lv_close( LV_TABLE *table )
+{
+    munmap( table->header, table->size );
+    free( table->name );
+    free( table );
+}
@@ -0,0 +1,119 @@
+/*
+ * lastvalue - last value per group address in shared memory
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#ifndef LASTVALUE_H_
+#define LASTVALUE_H_
+
+#include <stdint.h>
+
+#include "knxframe.h"
+
+/*
+ * The capture process publishes the last write or answer seen for every
+ * group address in a POSIX shared memory object (/dev/shm/<name>).
+ * Each slot is protected by a sequence lock: the single writer makes the
+ * sequence odd while updating, readers retry until they copied a slot
+ * with the same even sequence before and after. Readers never block the
+ * writer and a read is a plain memory copy, no system call. A reader gives
+ * up on a slot that stays odd for LV_READ_TRIES attempts.
+ */
+#define LV_DEFAULT_NAME         "/knx_lastvalue"
+#define LV_MAGIC                0x4b4e5856          // "KNXV"
+#define LV_VERSION              1
+#define LV_SLOTS                65536
+#define LV_READ_TRIES           1000                // yielding while a slot is odd
+
+/*
+ * one slot, a cache line each
+ */
+typedef struct {
+        uint32_t        seq;                    // odd while being written, 0 = never written
+        uint16_t        saddr;                  // sender, host byte order
+        uint8_t         service;                // 'W' or 'A'
+        uint8_t         eis;                    // EIS type value was decoded with, 0 = none
+        int64_t         tv_sec;                 // receive time
+        int32_t         tv_usec;
+        uint8_t         length;                 // frame length
+        uint8_t         raw[17];                // tpci, apci and data as on the bus
+        double          value;                  // decoded value
+        uint8_t         pad[16];
+} LV_SLOT;
+
+typedef struct {
+        uint32_t        magic;
+        uint32_t        version;
+        uint32_t        slots;
+        uint32_t        slot_size;
+        uint64_t        updates;
+        uint8_t         pad[40];
+} LV_HEADER;
+
+/*
+ * Snapshot file, to start warm after a restart or reboot: a header and
+ * one record per address seen, in address order. The file is written
+ * under a temporary name and renamed, it is either complete or absent.
+ * Records are in host layout, a snapshot is restored on the same machine.
+ */
+#define LV_SNAP_MAGIC           0x4b4e5853          // "KNXS"
+#define LV_SNAP_VERSION         1
+
+typedef struct {
+        uint32_t        magic;
+        uint16_t        version;
+        uint16_t        record_size;
+        uint32_t        records;
+        uint32_t        reserved;
+        int64_t         saved;                  // time of snapshot
+        uint64_t        updates;
+} LV_SNAP_HEADER;
+
+typedef struct {
+        int64_t         tv_sec;
+        double          value;
+        int32_t         tv_usec;
+        uint16_t        daddr;
+        uint16_t        saddr;
+        uint8_t         service;
+        uint8_t         eis;
+        uint8_t         length;
+        uint8_t         raw[17];
+        uint8_t         pad[4];
+} LV_SNAP_RECORD;
+
+typedef struct {
+        LV_HEADER       *header;
+        LV_SLOT         *slot;
+        size_t          size;
+        int             writable;
+        char            *name;
+} LV_TABLE;
+
+
+/*
+ * function declarations
+ */
+extern LV_TABLE     *lv_create( const char *name );
+extern LV_TABLE     *lv_open( const char *name );
+extern void         lv_publish( LV_TABLE *table, KNXTELEGRAM *telegram, uint8_t eis, double value );
+extern int          lv_read( LV_TABLE *table, uint16_t grp_addr, LV_SLOT *result );
+extern int          lv_save( LV_TABLE *table, const char *path );
+extern int          lv_restore( LV_TABLE *table, const char *path );
+extern void         lv_close( LV_TABLE *table );
+
+#endif /*LASTVALUE_H_*/
@@ -0,0 +1,324 @@
+/*
+ * readtrack - match group reads to their answers
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <arpa/inet.h>
+
+#include "readtrack.h"
+
+#define SLOT_MASK           (READTRACK_SLOTS -1)
+#define SLOT_LIMIT          (READTRACK_SLOTS * 3 / 4)
+
+/*
+ * device as collected for the report
+ */
+typedef struct {
+        uint16_t        addr;
+        uint32_t        average;
+        READTRACK_DEVICE *stats;
+} DEVICE_REPORT;
+
+/*
+ * local function declarations
+ */
+static unsigned int     slot_hash( uint16_t grp_addr );
+static int              slot_find( READTRACK *track, uint16_t grp_addr );
+static void             slot_delete( READTRACK *track, int idx );
+static READTRACK_DEVICE *device_stats( READTRACK *track, uint16_t phy_addr );
+static void             read_unanswered( READTRACK *track, uint16_t grp_addr );
+static uint32_t         elapsed_ms( struct timeval *from, struct timeval *to );
+static int              report_compare( const void *a, const void *b );
+
+
+static unsigned int slot_hash( uint16_t grp_addr )
+{
+    return( ((uint32_t)grp_addr * 2654435761u) >> 22 & SLOT_MASK );
+}
+
+
+/*
+ * returns slot of grp_addr, or -1 - free slot where it would go
+ */
+static int slot_find( READTRACK *track, uint16_t grp_addr )
+{
+    unsigned int    idx;
+
+    for( idx = slot_hash( grp_addr ); track->slot[idx].used; idx = (idx + 1) & SLOT_MASK ) {
+        if( track->slot[idx].grp_addr == grp_addr ) {
+            return( idx );
+        }
+    }
+    return( -1 - idx );
+}
+
+
+/*
+ * remove slot, moving later entries of the probe sequence up
+ */
+static void slot_delete( READTRACK *track, int idx )
+{
+    unsigned int    hole = idx;
+    unsigned int    next = idx;
+    unsigned int    home;
+
+    for( ;; ) {
+        next = (next + 1) & SLOT_MASK;
+        if( !track->slot[next].used ) {
+            break;
+        }
+        home = slot_hash( track->slot[next].grp_addr );
+        // entry stays if its home lies cyclically in (hole, next]
+        if( (hole <= next) ? (hole < home && home <= next) : (hole < home || home <= next) ) {
+            continue;
+        }
+        track->slot[hole] = track->slot[next];
+        hole = next;
+    }
+    track->slot[hole].used = 0;
+    track->outstanding--;
+}
+
+
+static READTRACK_DEVICE *device_stats( READTRACK *track, uint16_t phy_addr )
+{
+    if( track->device[phy_addr] == NULL ) {
+        track->device[phy_addr] = calloc( 1, sizeof( READTRACK_DEVICE ));
+    }
+    return( track->device[phy_addr] );
+}
+
+
+/*
+ * read timed out, charge it to the device answering that address before
+ */
+static void read_unanswered( READTRACK *track, uint16_t grp_addr )
+{
+    READTRACK_DEVICE    *device;
+
+    track->unanswered++;
+    if( track->has_responder[grp_addr >> 3] & (1 << (grp_addr & 7)) ) {
+        device = device_stats( track, track->responder[grp_addr] );
+        if( device != NULL ) {
+            device->unanswered++;
+        }
+    }
+}
+
+
+static uint32_t elapsed_ms( struct timeval *from, struct timeval *to )
+{
+    int64_t         ms;
+
+    ms = (int64_t)(to->tv_sec - from->tv_sec) * 1000 + (to->tv_usec - from->tv_usec) / 1000;
+    return( (ms < 0) ? 0 : (ms > UINT32_MAX) ? UINT32_MAX : ms );
+}
+
+
+READTRACK *readtrack_open( uint32_t timeout )
+{
+    READTRACK       *track;
+
+    track = calloc( 1, sizeof( READTRACK ));
+    if( track == NULL ) {
+        fprintf( stderr, "Out of memory: %s\n", strerror( errno ));
+        return( NULL );
+    }
+    track->timeout = timeout;
+    return( track );
+}
+
+
+/*
+ * follow one telegram
+ *
+ * returns latency in ms if it answered an outstanding read, otherwise -1
+ */
+int readtrack_telegram( READTRACK *track, KNXTELEGRAM *telegram )
+{
+    CEMIFRAME           *frame = &telegram->frame;
+    READTRACK_DEVICE    *device;
+    uint16_t            grp_addr;
+    uint16_t            saddr;
+    uint32_t            latency;
+    int                 bucket;
+    int                 idx;
+
+    if( !(frame->ntwrk & EIB_DAF_GROUP) ) {
+        return( -1 );
+    }
+    if( elapsed_ms( &track->last_sweep, &telegram->tv ) >= 1000 ) {
+        readtrack_expire( track, &telegram->tv );
+    }
+    grp_addr = ntohs( frame->daddr );
+
+    switch( knx_service( frame )) {
+        case 'R':
+            track->reads++;
+            idx = slot_find( track, grp_addr );
+            if( idx >= 0 ) {
+                track->repeated++;              // the first read counts
+            } else if( track->outstanding >= SLOT_LIMIT ) {
+                track->overflow++;
+            } else {
+                idx = -1 - idx;
+                track->slot[idx].grp_addr = grp_addr;
+                track->slot[idx].used = 1;
+                track->slot[idx].tv = telegram->tv;
+                track->outstanding++;
+            }
+            return( -1 );
+
+        case 'A':
+            idx = slot_find( track, grp_addr );
+            if( idx < 0 ) {
+                track->unsolicited++;
+                return( -1 );
+            }
+            latency = elapsed_ms( &track->slot[idx].tv, &telegram->tv );
+            slot_delete( track, idx );
+            if( latency > track->timeout ) {
+                read_unanswered( track, grp_addr );
+                return( -1 );
+            }
+            saddr = ntohs( frame->saddr );
+            track->answered++;
+            track->responder[grp_addr] = saddr;
+            track->has_responder[grp_addr >> 3] |= 1 << (grp_addr & 7);
+            device = device_stats( track, saddr );
+            if( device != NULL ) {
+                for( bucket = 0; bucket < READTRACK_BUCKETS -1 && (latency >> bucket) != 0; bucket++ );
+                device->latency[bucket]++;
+                device->answered++;
+                device->latency_sum += latency;
+                if( latency > device->latency_max ) {
+                    device->latency_max = latency;
+                }
+            }
+            return( latency );
+    }
+    return( -1 );
+}
+
+
+/*
+ * drop reads older than the timeout
+ */
+void readtrack_expire( READTRACK *track, struct timeval *now )
+{
+    unsigned int    idx = 0;
+
+    track->last_sweep = *now;
+    while( idx < READTRACK_SLOTS && track->outstanding > 0 ) {
+        if( track->slot[idx].used && elapsed_ms( &track->slot[idx].tv, now ) > track->timeout ) {
+            read_unanswered( track, track->slot[idx].grp_addr );
+            slot_delete( track, idx );
+            continue;                           // an entry may have moved into idx
+        }
+        idx++;
+    }
+}
+
+
+/*
+ * slowest first
+ */
+static int report_compare( const void *a, const void *b )
+{
+    const DEVICE_REPORT *da = a;
+    const DEVICE_REPORT *db = b;
+
+    if( da->average != db->average ) {
+        return( (da->average < db->average) ? 1 : -1 );
+    }
+    return( (int)db->stats->unanswered - (int)da->stats->unanswered );
+}
+
+
+/*
+ * print totals and the top slowest or least answering devices
+ */
+void readtrack_report( READTRACK *track, FILE *fp, int top )
+{
+    DEVICE_REPORT   *devices;
+    READTRACK_DEVICE *stats;
+    uint32_t        addr;
+    int             count = 0;
+    int             idx;
+    int             bucket;
+
+    fprintf( fp, "reads %llu (%llu repeated, %llu untracked), answered %llu, no answer %llu, %d waiting, %llu unsolicited answers\n",
+             (unsigned long long)track->reads, (unsigned long long)track->repeated,
+             (unsigned long long)track->overflow, (unsigned long long)track->answered,
+             (unsigned long long)track->unanswered, track->outstanding,
+             (unsigned long long)track->unsolicited );
+
+    devices = malloc( 65536 * sizeof( DEVICE_REPORT ));
+    if( devices == NULL ) {
+        return;
+    }
+    for( addr = 0; addr < 65536; addr++ ) {
+        if( (stats = track->device[addr]) == NULL ) {
+            continue;
+        }
+        devices[count].addr = addr;
+        devices[count].stats = stats;
+        // a device that never answers sorts first
+        devices[count].average = (stats->answered > 0) ? stats->latency_sum / stats->answered : UINT32_MAX;
+        count++;
+    }
+    qsort( devices, count, sizeof( DEVICE_REPORT ), report_compare );
+    if( count > 0 ) {
+        fprintf( fp, "device     latency per bucket: < 1, 2, 4 .. 2048 ms, 2048 ms and above\n" );
+    }
+
+    for( idx = 0; idx < count && idx < top; idx++ ) {
+        stats = devices[idx].stats;
+        fprintf( fp, "%2d.%d.%-3d  %6u answers", devices[idx].addr >> 12, (devices[idx].addr >> 8) & 0x0f,
+                 devices[idx].addr & 0xff, stats->answered );
+        if( stats->answered > 0 ) {
+            fprintf( fp, ", avg %5u ms, max %5u ms", devices[idx].average, stats->latency_max );
+        }
+        fprintf( fp, ", no answer %u (%.1f%%) |", stats->unanswered,
+                 100.0 * stats->unanswered / (stats->answered + stats->unanswered) );
+        for( bucket = 0; bucket < READTRACK_BUCKETS; bucket++ ) {
+            fprintf( fp, " %u", stats->latency[bucket] );
+        }
+        fprintf( fp, "\n" );
+    }
+    free( devices );
+}
+
+
+void readtrack_close( READTRACK *track )
+{
+    uint32_t        addr;
+
+    for( addr = 0; addr < 65536; addr++ ) {
+        free( track->device[addr] );
+    }
+    free( track );
+}
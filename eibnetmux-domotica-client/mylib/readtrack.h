@@ -0,0 +1,80 @@
+/*
+ * readtrack - match group reads to their answers
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#ifndef READTRACK_H_
+#define READTRACK_H_
+
+#include <stdio.h>
+#include <stdint.h>
+#include <sys/time.h>
+
+#include "knxframe.h"
+
+/*
+ * Each read is remembered in a small open addressing table keyed by group
+ * address (linear probing, deletion by backward shift) until the next
+ * answer for that address arrives or it times out. Latency is kept per
+ * answering device in log2 millisecond buckets. A read without answer is
+ * charged to the device which answered that group address before.
+ */
+#define READTRACK_DEFAULT_TIMEOUT   2000            // ms
+#define READTRACK_SLOTS             1024            // outstanding reads, power of two
+#define READTRACK_BUCKETS           13              // < 1, < 2, < 4 .. < 2048 ms and above
+
+typedef struct {
+        uint16_t        grp_addr;
+        uint16_t        used;
+        struct timeval  tv;                     // time of read
+} READTRACK_SLOT;
+
+typedef struct {
+        uint32_t        answered;
+        uint32_t        unanswered;
+        uint64_t        latency_sum;            // ms
+        uint32_t        latency_max;
+        uint32_t        latency[READTRACK_BUCKETS];
+} READTRACK_DEVICE;
+
+typedef struct {
+        READTRACK_SLOT  slot[READTRACK_SLOTS];
+        int             outstanding;
+        uint32_t        timeout;                // ms
+        READTRACK_DEVICE *device[65536];        // by physical address, allocated on first answer
+        uint16_t        responder[65536];       // last device answering a group address
+        uint8_t         has_responder[8192];
+        uint64_t        reads;
+        uint64_t        repeated;               // read for an address already waiting
+        uint64_t        answered;
+        uint64_t        unanswered;
+        uint64_t        unsolicited;            // answers nobody waited for
+        uint64_t        overflow;               // table full
+        struct timeval  last_sweep;
+} READTRACK;
+
+
+/*
+ * function declarations
+ */
+extern READTRACK    *readtrack_open( uint32_t timeout );
+extern int          readtrack_telegram( READTRACK *track, KNXTELEGRAM *telegram );
+extern void         readtrack_expire( READTRACK *track, struct timeval *now );
+extern void         readtrack_report( READTRACK *track, FILE *fp, int top );
+extern void         readtrack_close( READTRACK *track );
+
+#endif /*READTRACK_H_*/
@@ -0,0 +1,222 @@
+/*
+ * recorder - flight recorder of the most recent telegrams
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <limits.h>
+
+#include "recorder.h"
+#include "capfile.h"
+
+/*
+ * local function declarations
+ */
+static int      recorder_dump( RECORDER *rec, int reasons );
+static void     *recorder_thread( void *arg );
+
+
+/*
+ * write the ring to a new capture file, returns -1 on failure
+ */
+static int recorder_dump( RECORDER *rec, int reasons )
+{
+    RECORDER_SLOT   *slot;
+    KNXTELEGRAM     telegram;
+    CAPFILE         *cf;
+    char            name[64];
+    char            path[PATH_MAX];
+    char            tmp[PATH_MAX];
+    struct tm       tm;
+    time_t          now;
+    uint64_t        head;
+    uint64_t        pos;
+    uint64_t        seq;
+    uint64_t        lost = 0;
+    uint64_t        records;
+
+    time( &now );
+    localtime_r( &now, &tm );
+    strftime( name, sizeof( name ), "knxrec-%Y%m%d-%H%M%S", &tm );
+    snprintf( path, sizeof( path ), "%s/%s-%s%s%s.cap", rec->dir, name,
+              (reasons & RECORDER_SIGNAL) ? "s" : "", (reasons & RECORDER_RULE) ? "r" : "",
+              (reasons & RECORDER_WATCHDOG) ? "w" : "" );
+    snprintf( tmp, sizeof( tmp ), "%s/.%s.tmp", rec->dir, name );
+
+    cf = capfile_create( tmp );
+    if( cf == NULL ) {
+        return( -1 );
+    }
+    head = __atomic_load_n( &rec->head, __ATOMIC_ACQUIRE );
+    for( pos = (head > rec->mask) ? head - rec->mask - 1 : 0; pos < head; pos++ ) {
+        slot = &rec->slot[pos & rec->mask];
+        seq = __atomic_load_n( &slot->seq, __ATOMIC_ACQUIRE );
+        if( seq != 2 * pos + 2 ) {
+            lost++;
+            continue;
+        }
+        telegram = slot->telegram;
+        __atomic_thread_fence( __ATOMIC_ACQUIRE );
+        if( __atomic_load_n( &slot->seq, __ATOMIC_RELAXED ) != seq ) {
+            lost++;
+            continue;
+        }
+        if( capfile_write( cf, &telegram ) != 0 ) {
+            break;
+        }
+    }
+    records = cf->records;
+    rec->overwritten += lost;
+    if( capfile_close( cf ) != 0 || pos < head || rename( tmp, path ) != 0 ) {
+        fprintf( stderr, "Flight recorder: could not write %s: %s\n", path, strerror( errno ));
+        unlink( tmp );
+        return( -1 );
+    }
+    rec->dumped += records;
+    fprintf( stderr, "Flight recorder: %llu telegrams written to %s\n", (unsigned long long)records, path );
+    return( 0 );
+}
+
+
+/*
+ * dump thread, waits for triggers
+ */
+static void *recorder_thread( void *arg )
+{
+    RECORDER        *rec = arg;
+    struct timespec deadline;
+    int             reasons;
+
+    for( ;; ) {
+        while( sem_wait( &rec->trigger ) != 0 && errno == EINTR );
+        reasons = __atomic_load_n( &rec->reasons, __ATOMIC_ACQUIRE );
+        if( reasons == 0 ) {
+            break;                              // woken by recorder_close()
+        }
+        // wait for the holdoff to pass, unless shutting down
+        deadline.tv_sec = rec->last_dump + RECORDER_HOLDOFF;
+        deadline.tv_nsec = 0;
+        while( rec->stop == 0 && rec->last_dump != 0 && time( NULL ) < deadline.tv_sec ) {
+            if( sem_timedwait( &rec->trigger, &deadline ) != 0 && errno == ETIMEDOUT ) {
+                break;
+            }
+        }
+        // triggers posted meanwhile are served by this dump
+        while( sem_trywait( &rec->trigger ) == 0 );
+        reasons = __atomic_exchange_n( &rec->reasons, 0, __ATOMIC_ACQ_REL );
+        if( recorder_dump( rec, reasons ) != 0 ) {
+            rec->failed++;
+        } else {
+            rec->dumps++;
+        }
+        time( &rec->last_dump );
+        if( rec->stop ) {
+            break;
+        }
+    }
+    return( NULL );
+}
+
+
+/*
+ * allocate ring of size telegrams, rounded up to a power of two, dumps go to dir
+ */
+RECORDER *recorder_open( uint32_t size, const char *dir )
+{
+    RECORDER        *rec;
+    uint32_t        slots = 1;
+    int             err;
+
+    while( slots < size && slots < 0x80000000u ) {
+        slots <<= 1;
+    }
+    rec = calloc( 1, sizeof( RECORDER ));
+    if( rec != NULL ) {
+        rec->slot = calloc( slots, sizeof( RECORDER_SLOT ));
+        rec->dir = strdup( dir );
+    }
+    if( rec == NULL || rec->slot == NULL || rec->dir == NULL ) {
+        fprintf( stderr, "Out of memory: %s\n", strerror( errno ));
+        if( rec != NULL ) {
+            free( rec->slot );
+            free( rec->dir );
+            free( rec );
+        }
+        return( NULL );
+    }
+    rec->mask = slots - 1;
+    if( access( dir, W_OK ) != 0 ) {
+        fprintf( stderr, "Flight recorder: cannot write to %s: %s\n", dir, strerror( errno ));
+        recorder_close( rec );
+        return( NULL );
+    }
+    sem_init( &rec->trigger, 0, 0 );
+    if( (err = pthread_create( &rec->thread, NULL, recorder_thread, rec )) != 0 ) {
+        fprintf( stderr, "Unable to start flight recorder: %s\n", strerror( err ));
+        rec->thread = 0;
+        sem_destroy( &rec->trigger );
+        recorder_close( rec );
+        return( NULL );
+    }
+    return( rec );
+}
+
+
+/*
+ * request a dump, async signal safe
+ */
+void recorder_trigger( RECORDER *rec, int reason )
+{
+    __atomic_fetch_or( &rec->reasons, reason, __ATOMIC_RELEASE );
+    sem_post( &rec->trigger );
+}
+
+
+void recorder_stats( RECORDER *rec, FILE *fp )
+{
+    fprintf( fp, "Flight recorder: %u slots, %llu telegrams recorded, %llu dumps with %llu telegrams, "
+                 "%llu overwritten while dumping, %llu failed\n",
+             rec->mask + 1, (unsigned long long)rec->head, (unsigned long long)rec->dumps,
+             (unsigned long long)rec->dumped, (unsigned long long)rec->overwritten,
+             (unsigned long long)rec->failed );
+}
+
+
+/*
+ * stop dump thread, a dump in progress is completed first
+ */
+void recorder_close( RECORDER *rec )
+{
+    if( rec->thread != 0 ) {
+        rec->stop = 1;
+        sem_post( &rec->trigger );
+        pthread_join( rec->thread, NULL );
+        sem_destroy( &rec->trigger );
+    }
+    free( rec->slot );
+    free( rec->dir );
+    free( rec );
+}
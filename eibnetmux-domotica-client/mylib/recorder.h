@@ -0,0 +1,95 @@
+/*
+ * recorder - flight recorder of the most recent telegrams
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#ifndef RECORDER_H_
+#define RECORDER_H_
+
+#include <stdio.h>
+#include <stdint.h>
+#include <time.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <signal.h>
+
+#include "knxframe.h"
+
+/*
+ * The capture thread stores every telegram in a ring without taking a
+ * lock: each slot carries a sequence number which is odd while the slot
+ * is written and 2 * (position + 1) once it is complete. A dump thread
+ * copies the ring, skipping slots overwritten meanwhile, into a capture
+ * file, which is written under a temporary name and renamed when
+ * complete. recorder_trigger() only posts a semaphore and is safe to call
+ * from a signal handler. Triggers within RECORDER_HOLDOFF seconds of a
+ * dump are served by one dump at the end of the holdoff, which then also
+ * shows what followed the event.
+ */
+#define RECORDER_DEFAULT_SIZE   65536           // telegrams, power of two
+#define RECORDER_HOLDOFF        10              // s
+
+#define RECORDER_SIGNAL         0x01            // trigger reasons
+#define RECORDER_RULE           0x02
+#define RECORDER_WATCHDOG       0x04
+
+typedef struct {
+        uint64_t        seq;
+        KNXTELEGRAM     telegram;
+} RECORDER_SLOT;
+
+typedef struct {
+        RECORDER_SLOT   *slot;
+        uint32_t        mask;
+        uint64_t        head;                   // telegrams recorded
+        char            *dir;
+        pthread_t       thread;
+        sem_t           trigger;
+        volatile sig_atomic_t reasons;
+        volatile sig_atomic_t stop;
+        time_t          last_dump;
+        uint64_t        dumps;
+        uint64_t        dumped;
+        uint64_t        overwritten;            // slots lost while dumping
+        uint64_t        failed;
+} RECORDER;
+
+
+/*
+ * function declarations
+ */
+extern RECORDER     *recorder_open( uint32_t size, const char *dir );
+extern void         recorder_trigger( RECORDER *rec, int reason );
+extern void         recorder_stats( RECORDER *rec, FILE *fp );
+extern void         recorder_close( RECORDER *rec );
+
+/*
+ * record telegram, capture thread only
+ */
+static inline void recorder_record( RECORDER *rec, KNXTELEGRAM *telegram )
+{
+    uint64_t        head = rec->head;
+    RECORDER_SLOT   *slot = &rec->slot[head & rec->mask];
+
+    __atomic_store_n( &slot->seq, 2 * head + 1, __ATOMIC_RELAXED );
+    __atomic_thread_fence( __ATOMIC_RELEASE );
+    slot->telegram = *telegram;
+    __atomic_store_n( &slot->seq, 2 * head + 2, __ATOMIC_RELEASE );
+    __atomic_store_n( &rec->head, head + 1, __ATOMIC_RELEASE );
+}
+
+#endif /*RECORDER_H_*/
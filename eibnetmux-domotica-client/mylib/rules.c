@@ -0,0 +1,356 @@
+/*
+ * rules - react to telegrams with group writes
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <arpa/inet.h>
+#include <sys/time.h>
+
+#include "rules.h"
+#include "eiscodec.h"
+
+#define RULES_ADDRESSES         65536
+
+/*
+ * EIS types usable in rules: plain numbers, no time, date or string
+ */
+#define RULES_EIS_USABLE( eis ) ((eis) != 3 && (eis) != 4 && (eis) != 15 && eis_length( eis ) != 0)
+
+/*
+ * local function declarations
+ */
+static int      rules_parse( RULE *rule, char *line, int lineno );
+static int      rules_compare( const void *a, const void *b );
+static int      rules_match( RULE *rule, double value );
+
+
+/*
+ * parse one rule, returns 1 for a rule, 0 for an empty line, -1 on error
+ */
+static int rules_parse( RULE *rule, char *line, int lineno )
+{
+    char            source[32];
+    char            condition[4];
+    char            threshold[32];
+    char            target[32];
+    char            value[32];
+    char            *end;
+    unsigned int    source_eis;
+    unsigned int    target_eis;
+    double          real_value;
+    int             fields;
+    int             len;
+
+    if( (end = strchr( line, '#' )) != NULL ) {
+        *end = '\0';
+    }
+    fields = sscanf( line, "%31s %u %3s %31s %31s %u %31s",
+                     source, &source_eis, condition, threshold, target, &target_eis, value );
+    if( fields <= 0 ) {
+        return( 0 );
+    }
+    if( fields != 7 ) {
+        fprintf( stderr, "Rule on line %d: expected 7 fields\n", lineno );
+        return( -1 );
+    }
+
+    memset( rule, 0, sizeof( RULE ));
+    rule->line = lineno;
+    if( knx_parse_group( source, &rule->source ) != 0 || knx_parse_group( target, &rule->target ) != 0 ) {
+        fprintf( stderr, "Rule on line %d: invalid group address\n", lineno );
+        return( -1 );
+    }
+    if( !RULES_EIS_USABLE( source_eis ) || !RULES_EIS_USABLE( target_eis )) {
+        fprintf( stderr, "Rule on line %d: unsupported EIS type\n", lineno );
+        return( -1 );
+    }
+    rule->source_eis = source_eis;
+
+    if( strcmp( condition, "any" ) == 0 ) {
+        rule->condition = RULE_ANY;
+    } else if( strcmp( condition, "<" ) == 0 ) {
+        rule->condition = RULE_LT;
+    } else if( strcmp( condition, "<=" ) == 0 ) {
+        rule->condition = RULE_LE;
+    } else if( strcmp( condition, ">" ) == 0 ) {
+        rule->condition = RULE_GT;
+    } else if( strcmp( condition, ">=" ) == 0 ) {
+        rule->condition = RULE_GE;
+    } else if( strcmp( condition, "==" ) == 0 ) {
+        rule->condition = RULE_EQ;
+    } else if( strcmp( condition, "!=" ) == 0 ) {
+        rule->condition = RULE_NE;
+    } else {
+        fprintf( stderr, "Rule on line %d: unknown condition '%s'\n", lineno, condition );
+        return( -1 );
+    }
+    if( rule->condition != RULE_ANY ) {
+        rule->threshold = strtod( threshold, &end );
+        if( *end != '\0' ) {
+            fprintf( stderr, "Rule on line %d: invalid threshold '%s'\n", lineno, threshold );
+            return( -1 );
+        }
+    }
+
+    // encode target value once, firing only sends the bytes
+    real_value = strtod( value, &end );
+    if( *end != '\0' ) {
+        fprintf( stderr, "Rule on line %d: invalid value '%s'\n", lineno, value );
+        return( -1 );
+    }
+    len = eis_encode( target_eis, real_value, rule->data );
+    if( len <= 0 || len > sizeof( rule->data )) {
+        fprintf( stderr, "Rule on line %d: cannot encode value '%s' as EIS %u\n", lineno, value, target_eis );
+        return( -1 );
+    }
+    rule->length = len;
+
+    return( 1 );
+}
+
+
+/*
+ * order by source address, keep file order for the same address
+ */
+static int rules_compare( const void *a, const void *b )
+{
+    const RULE      *ra = a;
+    const RULE      *rb = b;
+
+    if( ra->source != rb->source ) {
+        return( ra->source - rb->source );
+    }
+    return( ra->line - rb->line );
+}
+
+
+/*
+ * load and compile rule file
+ */
+RULESET *rules_load( const char *file )
+{
+    RULESET         *rules;
+    FILE            *fp;
+    char            line[256];
+    int             lineno = 0;
+    int             result;
+    int             idx;
+    uint32_t        addr;
+
+    fp = fopen( file, "r" );
+    if( fp == NULL ) {
+        fprintf( stderr, "Unable to open rule file %s: %s\n", file, strerror( errno ));
+        return( NULL );
+    }
+    rules = calloc( 1, sizeof( RULESET ));
+    if( rules != NULL ) {
+        rules->rule = calloc( RULES_MAX, sizeof( RULE ));
+        rules->first = calloc( RULES_ADDRESSES + 1, sizeof( uint32_t ));
+        rules->handle = -1;
+    }
+    if( rules == NULL || rules->rule == NULL || rules->first == NULL ) {
+        fprintf( stderr, "Out of memory: %s\n", strerror( errno ));
+        fclose( fp );
+        rules_close( rules );
+        return( NULL );
+    }
+
+    while( fgets( line, sizeof( line ), fp ) != NULL ) {
+        lineno++;
+        if( rules->count == RULES_MAX ) {
+            fprintf( stderr, "Rule file %s: more than %d rules\n", file, RULES_MAX );
+            goto failed;
+        }
+        result = rules_parse( &rules->rule[rules->count], line, lineno );
+        if( result < 0 ) {
+            goto failed;
+        }
+        rules->count += result;
+    }
+    fclose( fp );
+
+    // rules of address a are rule[first[a]] .. rule[first[a+1] -1]
+    qsort( rules->rule, rules->count, sizeof( RULE ), rules_compare );
+    idx = 0;
+    for( addr = 0; addr <= RULES_ADDRESSES; addr++ ) {
+        while( idx < rules->count && rules->rule[idx].source < addr ) {
+            idx++;
+        }
+        rules->first[addr] = idx;
+    }
+    return( rules );
+
+failed:
+    fclose( fp );
+    rules_close( rules );
+    return( NULL );
+}
+
+
+/*
+ * open the connection the rules write on
+ *
+ * separate from the monitor connection, which is busy in enmx_monitor()
+ */
+int rules_connect( RULESET *rules, char *target, char *user, char *password )
+{
+    rules->handle = enmx_open( target, "eibrules" );
+    if( rules->handle < 0 ) {
+        fprintf( stderr, "Rules: connect to eibnetmux failed (%d): %s\n", rules->handle, enmx_errormessage( rules->handle ));
+        return( -1 );
+    }
+    if( user != NULL && enmx_auth( rules->handle, user, password ) != 0 ) {
+        fprintf( stderr, "Rules: authentication failure\n" );
+        enmx_close( rules->handle );
+        rules->handle = -1;
+        return( -1 );
+    }
+    return( 0 );
+}
+
+
+/*
+ * evaluate condition, returns 1 if the rule fires
+ */
+static int rules_match( RULE *rule, double value )
+{
+    int             state;
+
+    switch( rule->condition ) {
+        case RULE_LT:   state = (value <  rule->threshold); break;
+        case RULE_LE:   state = (value <= rule->threshold); break;
+        case RULE_GT:   state = (value >  rule->threshold); break;
+        case RULE_GE:   state = (value >= rule->threshold); break;
+        case RULE_EQ:   state = (value == rule->threshold); break;
+        case RULE_NE:   state = (value != rule->threshold); break;
+        default:        return( 1 );
+    }
+    if( state == rule->active ) {
+        return( 0 );
+    }
+    rule->active = state;
+    return( state );
+}
+
+
+/*
+ * run the rules of a telegram's destination, returns number of writes
+ */
+int rules_process( RULESET *rules, KNXTELEGRAM *telegram )
+{
+    CEMIFRAME       *frame = &telegram->frame;
+    RULE            *rule;
+    RULE            *last;
+    double          value = 0;
+    uint8_t         decoded = 0;
+    struct timeval  now;
+    int64_t         elapsed;
+    uint32_t        usec;
+    int             bucket;
+    int             writes = 0;
+    uint16_t        daddr;
+
+    if( !(frame->ntwrk & EIB_DAF_GROUP) || knx_service( frame ) == 'R' ) {
+        return( 0 );
+    }
+    daddr = ntohs( frame->daddr );
+    rule = &rules->rule[rules->first[daddr]];
+    last = &rules->rule[rules->first[daddr + 1]];
+
+    for( ; rule < last; rule++ ) {
+        rules->evaluated++;
+        if( frame->length != eis_length( rule->source_eis )) {
+            continue;
+        }
+        if( rule->condition != RULE_ANY && decoded != rule->source_eis ) {
+            eis_decode( rule->source_eis, frame, &value );
+            decoded = rule->source_eis;
+        }
+        if( rules_match( rule, value ) == 0 ) {
+            continue;
+        }
+        if( enmx_write( rules->handle, rule->target, rule->length, rule->data ) != 0 ) {
+            fprintf( stderr, "Rule on line %d: write failed: %s\n", rule->line, enmx_errormessage( rules->handle ));
+            rules->failed++;
+            continue;
+        }
+        rule->fired++;
+        rules->fired++;
+        writes++;
+
+        // reaction time from reception of the trigger to completed write
+        gettimeofday( &now, NULL );
+        elapsed = (int64_t)(now.tv_sec - telegram->tv.tv_sec) * 1000000 + (now.tv_usec - telegram->tv.tv_usec);
+        usec = (elapsed < 0) ? 0 : (elapsed > UINT32_MAX) ? UINT32_MAX : elapsed;
+        for( bucket = 0; bucket < RULES_LATENCY_BUCKETS -1 && (usec >> bucket) > 1; bucket++ );
+        rules->latency[bucket]++;
+        rules->latency_sum += usec;
+        if( usec > rules->latency_max ) {
+            rules->latency_max = usec;
+        }
+    }
+    return( writes );
+}
+
+
+/*
+ * print rule statistics and reaction time histogram
+ */
+void rules_stats( RULESET *rules, FILE *fp )
+{
+    int             bucket;
+
+    fprintf( fp, "Rules: %d loaded, %llu evaluated, %llu fired, %llu failed\n", rules->count,
+             (unsigned long long)rules->evaluated, (unsigned long long)rules->fired,
+             (unsigned long long)rules->failed );
+    if( rules->fired == 0 ) {
+        return;
+    }
+    fprintf( fp, "Rules: reaction time avg %llu us, max %u us\n",
+             (unsigned long long)(rules->latency_sum / rules->fired), rules->latency_max );
+    for( bucket = 0; bucket < RULES_LATENCY_BUCKETS; bucket++ ) {
+        if( rules->latency[bucket] != 0 ) {
+            fprintf( fp, "  < %8u us: %llu\n", 2u << bucket, (unsigned long long)rules->latency[bucket] );
+        }
+    }
+}
+
+
+/*
+ * close write connection and free rules
+ */
+void rules_close( RULESET *rules )
+{
+    if( rules == NULL ) {
+        return;
+    }
+    if( rules->handle >= 0 ) {
+        enmx_close( rules->handle );
+    }
+    free( rules->first );
+    free( rules->rule );
+    free( rules );
+}
@@ -0,0 +1,92 @@
+/*
+ * rules - react to telegrams with group writes
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#ifndef RULES_H_
+#define RULES_H_
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include <eibnetmux/enmx_lib.h>
+#include "knxframe.h"
+
+/*
+ * A rule file has one rule per line:
+ *
+ *   # source  eis  condition  threshold  target  eis  value
+ *   3/0/1     5    >          25         3/1/0   1    1
+ *   1/2/3     1    any        -          1/2/4   1    0
+ *
+ * Conditions are <, <=, >, >=, ==, != and any. A comparison fires when it
+ * becomes true (edge triggered), any fires on every write or answer.
+ * Rules are compiled into one contiguous array sorted by source address
+ * with a start index per group address, so finding the rules of a
+ * telegram is a single array lookup. The target value is encoded when
+ * loading, the action is a plain enmx_write() on a dedicated connection.
+ */
+#define RULES_MAX               4096
+#define RULES_LATENCY_BUCKETS   24              // log2 microseconds
+
+enum rule_condition {
+    RULE_ANY = 0,
+    RULE_LT,
+    RULE_LE,
+    RULE_GT,
+    RULE_GE,
+    RULE_EQ,
+    RULE_NE
+};
+
+typedef struct {
+        uint16_t        source;                 // host byte order
+        uint8_t         source_eis;
+        uint8_t         condition;
+        double          threshold;
+        uint16_t        target;
+        uint8_t         active;                 // condition currently true
+        uint8_t         length;                 // of encoded target value
+        unsigned char   data[16];
+        uint32_t        fired;
+        int             line;
+} RULE;
+
+typedef struct {
+        RULE            *rule;
+        int             count;
+        uint32_t        *first;                 // per group address + 1, start index into rule
+        ENMX_HANDLE     handle;
+        uint64_t        evaluated;
+        uint64_t        fired;
+        uint64_t        failed;
+        uint64_t        latency_sum;            // microseconds, receive to write done
+        uint32_t        latency_max;
+        uint64_t        latency[RULES_LATENCY_BUCKETS];
+} RULESET;
+
+
+/*
+ * function declarations
+ */
+extern RULESET      *rules_load( const char *file );
+extern int          rules_connect( RULESET *rules, char *target, char *user, char *password );
+extern int          rules_process( RULESET *rules, KNXTELEGRAM *telegram );
+extern void         rules_stats( RULESET *rules, FILE *fp );
+extern void         rules_close( RULESET *rules );
+
+#endif /*RULES_H_*/
@@ -0,0 +1,414 @@
+/*
+ * sink - storage backends behind a common interface
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <arpa/inet.h>
+#include <sys/time.h>
+
+#include "sink.h"
+#include "capfile.h"
+
+struct sink {
+        const SINK_OPS  *ops;
+        void            *handle;
+        unsigned int    batch_size;
+        unsigned int    flush_ms;
+        unsigned int    queue_size;             // 0 = append in submitting thread
+        pthread_t       thread;
+        int             running;
+        pthread_mutex_t lock;
+        pthread_cond_t  not_empty;
+        pthread_cond_t  not_full;
+        KNXTELEGRAM     *queue;
+        unsigned int    head;
+        unsigned int    count;
+        int             stop;
+        KNXTELEGRAM     *batch;
+        uint64_t        rows;
+        uint64_t        batches;
+        uint64_t        errors;
+        uint64_t        dropped;
+};
+
+/*
+ * text sink, one line per telegram
+ */
+typedef struct {
+        FILE            *fp;
+        time_t          sec;                    // of stamp
+        char            stamp[24];
+} TEXT_SINK;
+
+
+/*
+ * local function declarations
+ */
+static void     *sink_thread( void *arg );
+static int      capfile_sink_append( void *handle, KNXTELEGRAM *batch, unsigned int count );
+static int      capfile_sink_flush( void *handle );
+static void     capfile_sink_close( void *handle );
+static int      text_sink_append( void *handle, KNXTELEGRAM *batch, unsigned int count );
+static int      text_sink_flush( void *handle );
+static void     text_sink_close( void *handle );
+
+const SINK_OPS sink_capfile_ops = {
+    "capfile", capfile_sink_append, capfile_sink_flush, NULL, capfile_sink_close
+};
+
+const SINK_OPS sink_text_ops = {
+    "text", text_sink_append, text_sink_flush, NULL, text_sink_close
+};
+
+
+/*
+ * start a sink on an opened backend handle, which it owns from now on
+ *
+ * returns NULL if handle is NULL, so that the backend open function can
+ * be passed directly
+ */
+SINK *sink_open( const SINK_OPS *ops, void *handle, unsigned int batch_size,
+                 unsigned int flush_ms, unsigned int queue_size )
+{
+    SINK            *sink;
+    int             err;
+
+    if( handle == NULL ) {
+        return( NULL );
+    }
+    if( batch_size == 0 || (queue_size != 0 && queue_size < batch_size) ) {
+        fprintf( stderr, "Sink %s: queue must hold at least one batch\n", ops->name );
+        ops->close( handle );
+        return( NULL );
+    }
+    sink = calloc( 1, sizeof( SINK ));
+    if( sink == NULL ) {
+        fprintf( stderr, "Out of memory\n" );
+        exit( -5 );
+    }
+    sink->ops = ops;
+    sink->handle = handle;
+    sink->batch_size = batch_size;
+    sink->flush_ms = flush_ms;
+    sink->queue_size = queue_size;
+    pthread_mutex_init( &sink->lock, NULL );
+    pthread_cond_init( &sink->not_empty, NULL );
+    pthread_cond_init( &sink->not_full, NULL );
+    if( queue_size == 0 ) {
+        return( sink );
+    }
+
+    sink->queue = malloc( queue_size * sizeof( KNXTELEGRAM ));
+    sink->batch = malloc( batch_size * sizeof( KNXTELEGRAM ));
+    if( sink->queue == NULL || sink->batch == NULL ) {
+        fprintf( stderr, "Out of memory\n" );
+        exit( -5 );
+    }
+    if( (err = pthread_create( &sink->thread, NULL, sink_thread, sink )) != 0 ) {
+        fprintf( stderr, "Sink %s: unable to start thread: %s\n", ops->name, strerror( err ));
+        sink_close( sink );
+        return( NULL );
+    }
+    sink->running = 1;
+    return( sink );
+}
+
+
+/*
+ * queue telegram, returns 1 if it was dropped because the queue is full
+ * and wait is 0, -1 if the sink is closing or the append failed
+ *
+ * must be called from one thread only
+ */
+int sink_submit( SINK *sink, KNXTELEGRAM *telegram, int wait )
+{
+    if( sink->queue_size == 0 ) {
+        if( sink->ops->append( sink->handle, telegram, 1 ) != 0 ) {
+            sink->errors++;
+            return( -1 );
+        }
+        sink->rows++;
+        return( 0 );
+    }
+
+    pthread_mutex_lock( &sink->lock );
+    while( sink->count == sink->queue_size && sink->stop == 0 ) {
+        if( wait == 0 ) {
+            sink->dropped++;
+            pthread_mutex_unlock( &sink->lock );
+            return( 1 );
+        }
+        pthread_cond_wait( &sink->not_full, &sink->lock );
+    }
+    if( sink->stop != 0 ) {
+        pthread_mutex_unlock( &sink->lock );
+        return( -1 );
+    }
+    sink->queue[(sink->head + sink->count) % sink->queue_size] = *telegram;
+    sink->count++;
+    if( sink->count == 1 || sink->count == sink->batch_size ) {
+        pthread_cond_signal( &sink->not_empty );
+    }
+    pthread_mutex_unlock( &sink->lock );
+    return( 0 );
+}
+
+
+const char *sink_name( SINK *sink )
+{
+    return( sink->ops->name );
+}
+
+
+void sink_stats( SINK *sink, FILE *fp )
+{
+    pthread_mutex_lock( &sink->lock );
+    fprintf( fp, "sink %s: %llu rows", sink->ops->name, (unsigned long long)sink->rows );
+    if( sink->queue_size != 0 ) {
+        fprintf( fp, " in %llu batches, %llu dropped, %u queued",
+                 (unsigned long long)sink->batches, (unsigned long long)sink->dropped, sink->count );
+    }
+    fprintf( fp, ", %llu errors\n", (unsigned long long)sink->errors );
+    pthread_mutex_unlock( &sink->lock );
+    if( sink->ops->stats != NULL ) {
+        sink->ops->stats( sink->handle, fp );
+    }
+}
+
+
+/*
+ * append what is queued, then close backend and free sink
+ */
+void sink_close( SINK *sink )
+{
+    pthread_mutex_lock( &sink->lock );
+    sink->stop = 1;
+    pthread_cond_broadcast( &sink->not_empty );
+    pthread_cond_broadcast( &sink->not_full );
+    pthread_mutex_unlock( &sink->lock );
+    if( sink->running != 0 ) {
+        pthread_join( sink->thread, NULL );
+    }
+    sink->ops->close( sink->handle );
+    pthread_mutex_destroy( &sink->lock );
+    pthread_cond_destroy( &sink->not_empty );
+    pthread_cond_destroy( &sink->not_full );
+    free( sink->queue );
+    free( sink->batch );
+    free( sink );
+}
+
+
+/*
+ * sink thread
+ *
+ * waits for a full batch or the flush interval, whatever comes first,
+ * and flushes the backend when nothing more is queued
+ */
+static void *sink_thread( void *arg )
+{
+    SINK            *sink = arg;
+    struct timeval  now;
+    struct timespec deadline;
+    unsigned int    count;
+    unsigned int    idx;
+    int             rc;
+
+    pthread_mutex_lock( &sink->lock );
+    for( ;; ) {
+        while( sink->count == 0 && sink->stop == 0 ) {
+            pthread_cond_wait( &sink->not_empty, &sink->lock );
+        }
+        if( sink->count == 0 ) {
+            break;
+        }
+        gettimeofday( &now, NULL );
+        deadline.tv_sec = now.tv_sec + sink->flush_ms / 1000;
+        deadline.tv_nsec = now.tv_usec * 1000 + (sink->flush_ms % 1000) * 1000000;
+        if( deadline.tv_nsec >= 1000000000 ) {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000;
+        }
+        while( sink->count < sink->batch_size && sink->stop == 0 ) {
+            if( pthread_cond_timedwait( &sink->not_empty, &sink->lock, &deadline ) == ETIMEDOUT ) {
+                break;
+            }
+        }
+
+        count = (sink->count < sink->batch_size) ? sink->count : sink->batch_size;
+        for( idx = 0; idx < count; idx++ ) {
+            sink->batch[idx] = sink->queue[(sink->head + idx) % sink->queue_size];
+        }
+        sink->head = (sink->head + count) % sink->queue_size;
+        sink->count -= count;
+        pthread_cond_broadcast( &sink->not_full );
+        pthread_mutex_unlock( &sink->lock );
+
+        rc = sink->ops->append( sink->handle, sink->batch, count );
+
+        pthread_mutex_lock( &sink->lock );
+        if( rc == 0 ) {
+            sink->rows += count;
+            sink->batches++;
+        } else {
+            sink->errors++;
+        }
+        if( sink->count == 0 && sink->ops->flush != NULL ) {
+            pthread_mutex_unlock( &sink->lock );
+            rc = sink->ops->flush( sink->handle );
+            pthread_mutex_lock( &sink->lock );
+            if( rc != 0 ) {
+                sink->errors++;
+            }
+        }
+    }
+    pthread_mutex_unlock( &sink->lock );
+    return( NULL );
+}
+
+
+/*
+ * capture file sink, '-' is stdout
+ */
+void *sink_capfile_open( const char *path )
+{
+    return( capfile_create( path ));
+}
+
+
+static int capfile_sink_append( void *handle, KNXTELEGRAM *batch, unsigned int count )
+{
+    unsigned int    idx;
+
+    for( idx = 0; idx < count; idx++ ) {
+        if( capfile_write( handle, &batch[idx] ) != 0 ) {
+            return( -1 );
+        }
+    }
+    return( 0 );
+}
+
+
+static int capfile_sink_flush( void *handle )
+{
+    CAPFILE         *cf = handle;
+
+    return( (fflush( cf->fp ) == 0) ? 0 : -1 );
+}
+
+
+static void capfile_sink_close( void *handle )
+{
+    capfile_close( handle );
+}
+
+
+/*
+ * text sink, lines like
+ *
+ *   2026-10-19 14:03:07.412  1.1.12  1/2/3  W  0c 1a
+ *
+ * with the payload after the apci byte in hex; the file is not closed
+ */
+void *sink_text_open( FILE *fp )
+{
+    TEXT_SINK       *text;
+
+    if( fp == NULL ) {
+        fprintf( stderr, "Text sink: no file\n" );
+        return( NULL );
+    }
+    text = calloc( 1, sizeof( TEXT_SINK ));
+    if( text == NULL ) {
+        fprintf( stderr, "Out of memory\n" );
+        exit( -5 );
+    }
+    text->fp = fp;
+    text->sec = -1;
+    return( text );
+}
+
+
+static int text_sink_append( void *handle, KNXTELEGRAM *batch, unsigned int count )
+{
+    TEXT_SINK       *text = handle;
+    CEMIFRAME       *frame;
+    struct tm       tm;
+    uint16_t        saddr;
+    uint16_t        daddr;
+    unsigned int    idx;
+    int             len;
+    int             k;
+
+    for( idx = 0; idx < count; idx++ ) {
+        frame = &batch[idx].frame;
+        if( batch[idx].tv.tv_sec != text->sec ) {
+            text->sec = batch[idx].tv.tv_sec;
+            localtime_r( &text->sec, &tm );
+            strftime( text->stamp, sizeof( text->stamp ), "%Y-%m-%d %H:%M:%S", &tm );
+        }
+        saddr = ntohs( frame->saddr );
+        daddr = ntohs( frame->daddr );
+        fprintf( text->fp, "%s.%03d  %d.%d.%d  ", text->stamp, (int)(batch[idx].tv.tv_usec / 1000),
+                 saddr >> 12, (saddr >> 8) & 0x0f, saddr & 0xff );
+        if( frame->ntwrk & EIB_DAF_GROUP ) {
+            fprintf( text->fp, "%d/%d/%d", daddr >> 11, (daddr >> 8) & 0x07, daddr & 0xff );
+        } else {
+            fprintf( text->fp, "%d.%d.%d", daddr >> 12, (daddr >> 8) & 0x0f, daddr & 0xff );
+        }
+        fprintf( text->fp, "  %c ", knx_service( frame ));
+        len = frame->length - 1;
+        if( len > (int)sizeof( frame->data )) {
+            len = sizeof( frame->data );
+        }
+        for( k = 0; k < len; k++ ) {
+            fprintf( text->fp, " %02x", frame->data[k] );
+        }
+        if( fputc( '\n', text->fp ) == EOF ) {
+            return( -1 );
+        }
+    }
+    return( 0 );
+}
+
+
+static int text_sink_flush( void *handle )
+{
+    TEXT_SINK       *text = handle;
+
+    return( (fflush( text->fp ) == 0) ? 0 : -1 );
+}
+
+
+static void text_sink_close( void *handle )
+{
+    TEXT_SINK       *text = handle;
+
+    fflush( text->fp );
+    free( text );
+}
@@ -0,0 +1,78 @@
+/*
+ * sink - storage backends behind a common interface
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#ifndef SINK_H_
+#define SINK_H_
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include "knxframe.h"
+
+/*
+ * A backend provides SINK_OPS and a handle for one destination:
+ *   append    store count telegrams, 0 or -1 if the batch was lost
+ *   flush     make appended telegrams durable or visible, optional
+ *   stats     print backend statistics, optional
+ *   close     flush and free the handle
+ *
+ * sink_open() puts a queue and a thread of its own in front of the
+ * backend, which appends up to batch_size telegrams, or whatever
+ * arrived within flush_ms, at a time and flushes whenever the queue
+ * runs empty. Several sinks run side by side without waiting for each
+ * other: a full queue blocks the submitter only if asked to, otherwise
+ * the telegram is dropped and counted. With queue_size 0 telegrams are
+ * appended one at a time in the submitting thread, for backends which
+ * queue themselves.
+ *
+ * The capture file and text sinks are built in, the database sinks are
+ * in capi/sinkdb.h.
+ */
+#define SINK_DEFAULT_BATCH      256
+#define SINK_DEFAULT_FLUSH_MS   1000
+#define SINK_DEFAULT_QUEUE      8192
+#define SINK_MAX                8               // sinks per program
+
+typedef struct {
+        const char      *name;
+        int             (*append)( void *handle, KNXTELEGRAM *batch, unsigned int count );
+        int             (*flush)( void *handle );
+        void            (*stats)( void *handle, FILE *fp );
+        void            (*close)( void *handle );
+} SINK_OPS;
+
+typedef struct sink SINK;
+
+extern const SINK_OPS   sink_capfile_ops;
+extern const SINK_OPS   sink_text_ops;
+
+
+/*
+ * function declarations
+ */
+extern SINK         *sink_open( const SINK_OPS *ops, void *handle, unsigned int batch_size,
+                                unsigned int flush_ms, unsigned int queue_size );
+extern int          sink_submit( SINK *sink, KNXTELEGRAM *telegram, int wait );
+extern const char   *sink_name( SINK *sink );
+extern void         sink_stats( SINK *sink, FILE *fp );
+extern void         sink_close( SINK *sink );
+extern void         *sink_capfile_open( const char *path );
+extern void         *sink_text_open( FILE *fp );
+
+#endif /*SINK_H_*/
@@ -0,0 +1,187 @@
+/*
+ * timerwheel - hierarchical timing wheel for a fixed set of timers
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "timerwheel.h"
+
+#define SLOT_MASK           (WHEEL_SLOTS -1)
+
+/*
+ * local function declarations
+ */
+static void     wheel_link( TIMER_WHEEL *wheel, uint32_t id );
+static void     wheel_unlink( TIMER_WHEEL *wheel, uint32_t id );
+static void     wheel_cascade( TIMER_WHEEL *wheel, int level );
+
+
+/*
+ * put timer into the slot its distance from now falls into
+ */
+static void wheel_link( TIMER_WHEEL *wheel, uint32_t id )
+{
+    WHEEL_TIMER     *timer = &wheel->timer[id];
+    uint32_t        delta = timer->expires - wheel->now;
+    int             level;
+    int             slot;
+
+    for( level = 0; level < WHEEL_LEVELS -1 && delta >= (1u << ((level + 1) * WHEEL_BITS)); level++ );
+    slot = level * WHEEL_SLOTS + ((timer->expires >> (level * WHEEL_BITS)) & SLOT_MASK);
+
+    timer->slot = slot;
+    timer->prev = -1;
+    timer->next = wheel->head[slot];
+    if( timer->next >= 0 ) {
+        wheel->timer[timer->next].prev = id;
+    }
+    wheel->head[slot] = id;
+}
+
+
+static void wheel_unlink( TIMER_WHEEL *wheel, uint32_t id )
+{
+    WHEEL_TIMER     *timer = &wheel->timer[id];
+
+    if( timer->prev >= 0 ) {
+        wheel->timer[timer->prev].next = timer->next;
+    } else {
+        wheel->head[timer->slot] = timer->next;
+    }
+    if( timer->next >= 0 ) {
+        wheel->timer[timer->next].prev = timer->prev;
+    }
+    timer->slot = -1;
+}
+
+
+/*
+ * redistribute the current slot of level over the levels below
+ */
+static void wheel_cascade( TIMER_WHEEL *wheel, int level )
+{
+    int             slot = level * WHEEL_SLOTS + ((wheel->now >> (level * WHEEL_BITS)) & SLOT_MASK);
+    int32_t         id = wheel->head[slot];
+    int32_t         next;
+
+    wheel->head[slot] = -1;
+    for( ; id >= 0; id = next ) {
+        next = wheel->timer[id].next;
+        wheel_link( wheel, id );
+    }
+}
+
+
+TIMER_WHEEL *wheel_open( uint32_t count, uint32_t now )
+{
+    TIMER_WHEEL     *wheel;
+    uint32_t        id;
+    int             slot;
+
+    wheel = calloc( 1, sizeof( TIMER_WHEEL ));
+    if( wheel != NULL ) {
+        wheel->timer = malloc( count * sizeof( WHEEL_TIMER ));
+    }
+    if( wheel == NULL || wheel->timer == NULL ) {
+        fprintf( stderr, "Out of memory: %s\n", strerror( errno ));
+        free( wheel );
+        return( NULL );
+    }
+    wheel->now = now;
+    wheel->count = count;
+    for( id = 0; id < count; id++ ) {
+        wheel->timer[id].slot = -1;
+    }
+    for( slot = 0; slot < WHEEL_LEVELS * WHEEL_SLOTS; slot++ ) {
+        wheel->head[slot] = -1;
+    }
+    return( wheel );
+}
+
+
+/*
+ * (re)arm timer id to expire at tick expires
+ *
+ * a time already passed expires on the next tick
+ */
+void wheel_arm( TIMER_WHEEL *wheel, uint32_t id, uint32_t expires )
+{
+    if( wheel->timer[id].slot >= 0 ) {
+        wheel_unlink( wheel, id );
+    }
+    if( (int32_t)(expires - wheel->now) <= 0 ) {
+        expires = wheel->now + 1;
+    } else if( expires - wheel->now >= WHEEL_RANGE ) {
+        expires = wheel->now + WHEEL_RANGE -1;
+    }
+    wheel->timer[id].expires = expires;
+    wheel_link( wheel, id );
+}
+
+
+void wheel_cancel( TIMER_WHEEL *wheel, uint32_t id )
+{
+    if( wheel->timer[id].slot >= 0 ) {
+        wheel_unlink( wheel, id );
+    }
+}
+
+
+/*
+ * advance to tick now, calling expired for every timer run out on the way
+ *
+ * the callback may re-arm or cancel any timer
+ */
+void wheel_advance( TIMER_WHEEL *wheel, uint32_t now, WHEEL_EXPIRED expired, void *arg )
+{
+    int32_t         id;
+    int             level;
+    int             slot;
+
+    while( (int32_t)(now - wheel->now) > 0 ) {
+        wheel->now++;
+        for( level = 1; level < WHEEL_LEVELS; level++ ) {
+            if( (wheel->now & ((1u << (level * WHEEL_BITS)) -1)) != 0 ) {
+                break;
+            }
+            wheel_cascade( wheel, level );
+        }
+        slot = wheel->now & SLOT_MASK;
+        while( (id = wheel->head[slot]) >= 0 ) {
+            wheel_unlink( wheel, id );
+            expired( arg, id );
+        }
+    }
+}
+
+
+void wheel_close( TIMER_WHEEL *wheel )
+{
+    if( wheel != NULL ) {
+        free( wheel->timer );
+        free( wheel );
+    }
+}
@@ -0,0 +1,72 @@
+/*
+ * timerwheel - hierarchical timing wheel for a fixed set of timers
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#ifndef TIMERWHEEL_H_
+#define TIMERWHEEL_H_
+
+#include <stdint.h>
+
+/*
+ * Timers are numbered 0 .. count-1 and linked into doubly linked slot
+ * lists by index, so arming, re-arming and cancelling are O(1). Level 0
+ * has one slot per tick, each higher level covers 64 times the range of
+ * the one below. Its slots are cascaded down when the lower level wraps,
+ * so advancing by one tick costs O(1) amortized, never a scan of all
+ * timers. Four levels cover 2^24 ticks, later timers are clamped.
+ */
+#define WHEEL_LEVELS            4
+#define WHEEL_BITS              6
+#define WHEEL_SLOTS             (1 << WHEEL_BITS)
+#define WHEEL_RANGE             (1u << (WHEEL_LEVELS * WHEEL_BITS))
+
+typedef struct {
+        uint32_t        expires;                // tick
+        int32_t         next;                   // -1 = end of list
+        int32_t         prev;                   // -1 = head of slot
+        int32_t         slot;                   // level * WHEEL_SLOTS + slot, -1 = not armed
+} WHEEL_TIMER;
+
+typedef struct {
+        uint32_t        now;                    // current tick
+        uint32_t        count;
+        WHEEL_TIMER     *timer;
+        int32_t         head[WHEEL_LEVELS * WHEEL_SLOTS];
+} TIMER_WHEEL;
+
+typedef void (*WHEEL_EXPIRED)( void *arg, uint32_t id );
+
+
+/*
+ * function declarations
+ */
+extern TIMER_WHEEL  *wheel_open( uint32_t count, uint32_t now );
+extern void         wheel_arm( TIMER_WHEEL *wheel, uint32_t id, uint32_t expires );
+extern void         wheel_cancel( TIMER_WHEEL *wheel, uint32_t id );
+extern void         wheel_advance( TIMER_WHEEL *wheel, uint32_t now, WHEEL_EXPIRED expired, void *arg );
+extern void         wheel_close( TIMER_WHEEL *wheel );
+
+/*
+ * is timer id armed
+ */
+static inline int wheel_armed( const TIMER_WHEEL *wheel, uint32_t id )
+{
+    return( wheel->timer[id].slot >= 0 );
+}
+
+#endif /*TIMERWHEEL_H_*/